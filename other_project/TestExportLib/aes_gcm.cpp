@@ -0,0 +1,834 @@
+#include "pch.h"
+#include "encode.h"
+#include "encode_internal.h"
+#include <string.h>
+#include <windows.h>
+#include <intrin.h>
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+
+// AES-256-GCM 加密引擎
+// 密钥: SHA-256(域分隔串 + 组合密钥)
+// 引擎参数: 96位随机数（写在文件头中）
+// 尾部数据: 128位认证标签（写在CRC32校验和之前）
+// 支持 AES-NI + PCLMULQDQ 的CPU上使用硬件指令（8个计数器块流水线 + 4块聚合GHASH），否则使用可移植实现
+
+#define AES_BLOCK_SIZE 16                  // AES分组大小
+#define AES_256_ROUNDS 14                  // AES-256轮数
+#define AES_256_KEY_SIZE 32                // AES-256密钥大小
+#define GCM_NONCE_SIZE 12                  // 随机数大小
+#define GCM_TAG_SIZE 16                    // 认证标签大小
+#define GCM_PARALLEL_BLOCKS 8              // AES-NI 流水线一次处理的计数器块数
+#define GCM_HASH_POWERS 4                  // 聚合GHASH使用的 H 的幂次数
+#define GCM_MAX_DATA_LENGTH ((1ULL << 36) - 32)    // 单个数据流的明文上限（约64GB，NIST SP 800-38D）
+
+static const char g_aesGcmKeyDomain[] = "ENCODE-AES-256-GCM";   // 密钥派生域分隔串
+
+// ========== SHA-256（密钥派生） ==========
+
+static const unsigned int g_sha256K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+struct Sha256State {
+	unsigned int hash[8];
+	unsigned char block[64];
+	size_t blockLength;                    // block 中已缓存的字节数
+	unsigned long long totalLength;        // 已输入的总字节数
+};
+
+static inline unsigned int RotateRight32(unsigned int value, int bits) {
+	return (value >> bits) | (value << (32 - bits));
+}
+
+static void Sha256Compress(Sha256State* state, const unsigned char* block) {
+	unsigned int w[64];
+	for (int i = 0; i < 16; i++) {
+		w[i] = ((unsigned int)block[i * 4] << 24) | ((unsigned int)block[i * 4 + 1] << 16) | ((unsigned int)block[i * 4 + 2] << 8) | block[i * 4 + 3];
+	}
+	for (int i = 16; i < 64; i++) {
+		unsigned int s0 = RotateRight32(w[i - 15], 7) ^ RotateRight32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		unsigned int s1 = RotateRight32(w[i - 2], 17) ^ RotateRight32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	unsigned int a = state->hash[0], b = state->hash[1], c = state->hash[2], d = state->hash[3];
+	unsigned int e = state->hash[4], f = state->hash[5], g = state->hash[6], h = state->hash[7];
+
+	for (int i = 0; i < 64; i++) {
+		unsigned int s1 = RotateRight32(e, 6) ^ RotateRight32(e, 11) ^ RotateRight32(e, 25);
+		unsigned int choose = (e & f) ^ (~e & g);
+		unsigned int temp1 = h + s1 + choose + g_sha256K[i] + w[i];
+		unsigned int s0 = RotateRight32(a, 2) ^ RotateRight32(a, 13) ^ RotateRight32(a, 22);
+		unsigned int majority = (a & b) ^ (a & c) ^ (b & c);
+		unsigned int temp2 = s0 + majority;
+
+		h = g; g = f; f = e; e = d + temp1;
+		d = c; c = b; b = a; a = temp1 + temp2;
+	}
+
+	state->hash[0] += a; state->hash[1] += b; state->hash[2] += c; state->hash[3] += d;
+	state->hash[4] += e; state->hash[5] += f; state->hash[6] += g; state->hash[7] += h;
+
+	SecureZeroMemory(w, sizeof(w));
+}
+
+static void Sha256Init(Sha256State* state) {
+	static const unsigned int initialHash[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	memcpy(state->hash, initialHash, sizeof(initialHash));
+	state->blockLength = 0;
+	state->totalLength = 0;
+}
+
+static void Sha256Update(Sha256State* state, const unsigned char* data, size_t length) {
+	state->totalLength += length;
+
+	while (length > 0) {
+		size_t take = sizeof(state->block) - state->blockLength;
+		if (take > length) {
+			take = length;
+		}
+
+		memcpy(state->block + state->blockLength, data, take);
+		state->blockLength += take;
+		data += take;
+		length -= take;
+
+		if (state->blockLength == sizeof(state->block)) {
+			Sha256Compress(state, state->block);
+			state->blockLength = 0;
+		}
+	}
+}
+
+static void Sha256Final(Sha256State* state, unsigned char* digest) {
+	unsigned long long bitLength = state->totalLength * 8;
+
+	// 填充：0x80，补零到56字节，最后8字节为大端位长度
+	unsigned char padding[64 + 8] = { 0x80 };
+	size_t paddingLength = (state->blockLength < 56 ? 56 : 120) - state->blockLength;
+	for (int i = 0; i < 8; i++) {
+		padding[paddingLength + i] = (unsigned char)(bitLength >> (56 - i * 8));
+	}
+	Sha256Update(state, padding, paddingLength + 8);
+
+	for (int i = 0; i < 8; i++) {
+		digest[i * 4] = (unsigned char)(state->hash[i] >> 24);
+		digest[i * 4 + 1] = (unsigned char)(state->hash[i] >> 16);
+		digest[i * 4 + 2] = (unsigned char)(state->hash[i] >> 8);
+		digest[i * 4 + 3] = (unsigned char)state->hash[i];
+	}
+
+	SecureZeroMemory(state, sizeof(*state));
+}
+
+// ========== AES-256（可移植实现） ==========
+
+static unsigned char g_aesSbox[256];                        // S盒（首次使用时生成）
+static INIT_ONCE g_aesSboxOnce = INIT_ONCE_STATIC_INIT;
+
+static inline unsigned char RotateLeft8(unsigned char value, int bits) {
+	return (unsigned char)((value << bits) | (value >> (8 - bits)));
+}
+
+// 按 GF(2^8) 乘法逆元 + 仿射变换生成S盒
+static BOOL CALLBACK InitAesSbox(PINIT_ONCE initOnce, PVOID parameter, PVOID* context) {
+	unsigned char p = 1;
+	unsigned char q = 1;
+
+	do {
+		// p 乘以3，q 除以3，q 始终是 p 的乘法逆元
+		p = (unsigned char)(p ^ (p << 1) ^ ((p & 0x80) ? 0x1B : 0));
+		q ^= (unsigned char)(q << 1);
+		q ^= (unsigned char)(q << 2);
+		q ^= (unsigned char)(q << 4);
+		if (q & 0x80) {
+			q ^= 0x09;
+		}
+
+		g_aesSbox[p] = (unsigned char)(q ^ RotateLeft8(q, 1) ^ RotateLeft8(q, 2) ^ RotateLeft8(q, 3) ^ RotateLeft8(q, 4) ^ 0x63);
+	} while (p != 1);
+
+	g_aesSbox[0] = 0x63;
+	return TRUE;
+}
+
+static inline unsigned char AesMultiply2(unsigned char value) {
+	return (unsigned char)((value << 1) ^ ((value & 0x80) ? 0x1B : 0));
+}
+
+// 密钥扩展（AES-NI 与可移植实现共用同一组轮密钥）
+static void AesExpandKey256(const unsigned char* key, unsigned char* roundKeys) {
+	unsigned char rcon = 1;
+
+	memcpy(roundKeys, key, AES_256_KEY_SIZE);
+
+	for (int i = AES_256_KEY_SIZE / 4; i < (AES_256_ROUNDS + 1) * 4; i++) {
+		unsigned char temp[4];
+		memcpy(temp, roundKeys + (i - 1) * 4, 4);
+
+		if (i % 8 == 0) {
+			unsigned char first = temp[0];
+			temp[0] = (unsigned char)(g_aesSbox[temp[1]] ^ rcon);
+			temp[1] = g_aesSbox[temp[2]];
+			temp[2] = g_aesSbox[temp[3]];
+			temp[3] = g_aesSbox[first];
+			rcon = AesMultiply2(rcon);
+		}
+		else if (i % 8 == 4) {
+			for (int j = 0; j < 4; j++) {
+				temp[j] = g_aesSbox[temp[j]];
+			}
+		}
+
+		for (int j = 0; j < 4; j++) {
+			roundKeys[i * 4 + j] = roundKeys[(i - 8) * 4 + j] ^ temp[j];
+		}
+	}
+}
+
+static void AesEncryptBlockPortable(const unsigned char* roundKeys, const unsigned char* input, unsigned char* output) {
+	unsigned char state[AES_BLOCK_SIZE];
+
+	for (int i = 0; i < AES_BLOCK_SIZE; i++) {
+		state[i] = input[i] ^ roundKeys[i];
+	}
+
+	for (int round = 1; round <= AES_256_ROUNDS; round++) {
+		// 字节替换 + 行移位（状态按列存储，第 r 行循环左移 r 字节）
+		unsigned char shifted[AES_BLOCK_SIZE];
+		for (int column = 0; column < 4; column++) {
+			for (int row = 0; row < 4; row++) {
+				shifted[column * 4 + row] = g_aesSbox[state[((column + row) % 4) * 4 + row]];
+			}
+		}
+
+		// 列混合（最后一轮省略）
+		if (round < AES_256_ROUNDS) {
+			for (int column = 0; column < 4; column++) {
+				unsigned char* a = shifted + column * 4;
+				unsigned char all = a[0] ^ a[1] ^ a[2] ^ a[3];
+				unsigned char first = a[0];
+				a[0] ^= all ^ AesMultiply2(a[0] ^ a[1]);
+				a[1] ^= all ^ AesMultiply2(a[1] ^ a[2]);
+				a[2] ^= all ^ AesMultiply2(a[2] ^ a[3]);
+				a[3] ^= all ^ AesMultiply2(a[3] ^ first);
+			}
+		}
+
+		for (int i = 0; i < AES_BLOCK_SIZE; i++) {
+			state[i] = shifted[i] ^ roundKeys[round * AES_BLOCK_SIZE + i];
+		}
+	}
+
+	memcpy(output, state, AES_BLOCK_SIZE);
+	SecureZeroMemory(state, sizeof(state));
+}
+
+// ========== GHASH ==========
+
+static inline unsigned long long LoadBigEndian64(const unsigned char* data) {
+	unsigned long long value = 0;
+	for (int i = 0; i < 8; i++) {
+		value = (value << 8) | data[i];
+	}
+	return value;
+}
+
+static inline void StoreBigEndian64(unsigned char* data, unsigned long long value) {
+	for (int i = 7; i >= 0; i--) {
+		data[i] = (unsigned char)value;
+		value >>= 8;
+	}
+}
+
+// x = x * h（GF(2^128)，GCM 位序），逐位实现且不按数据分支
+static void GhashMultiplyPortable(unsigned char* x, const unsigned char* h) {
+	unsigned long long zHigh = 0;
+	unsigned long long zLow = 0;
+	unsigned long long vHigh = LoadBigEndian64(h);
+	unsigned long long vLow = LoadBigEndian64(h + 8);
+
+	for (int i = 0; i < 128; i++) {
+		unsigned long long bit = 0 - (unsigned long long)((x[i / 8] >> (7 - i % 8)) & 1);
+		zHigh ^= vHigh & bit;
+		zLow ^= vLow & bit;
+
+		unsigned long long carry = 0 - (vLow & 1);
+		vLow = (vLow >> 1) | (vHigh << 63);
+		vHigh = (vHigh >> 1) ^ (0xE100000000000000ULL & carry);
+	}
+
+	StoreBigEndian64(x, zHigh);
+	StoreBigEndian64(x + 8, zLow);
+}
+
+// ========== AES-NI + PCLMULQDQ ==========
+
+static inline __m128i ByteSwap128(__m128i value) {
+	return _mm_shuffle_epi8(value, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+// GF(2^128) 乘法（输入输出均为字节反序表示，Intel GCM 白皮书算法）
+static inline __m128i GhashMultiplyAccelerated(__m128i a, __m128i b) {
+	__m128i low = _mm_clmulepi64_si128(a, b, 0x00);
+	__m128i middle = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01));
+	__m128i high = _mm_clmulepi64_si128(a, b, 0x11);
+
+	low = _mm_xor_si128(low, _mm_slli_si128(middle, 8));
+	high = _mm_xor_si128(high, _mm_srli_si128(middle, 8));
+
+	// 256位乘积整体左移1位（GCM 位反射）
+	__m128i lowCarry = _mm_srli_epi32(low, 31);
+	__m128i highCarry = _mm_srli_epi32(high, 31);
+	low = _mm_slli_epi32(low, 1);
+	high = _mm_slli_epi32(high, 1);
+	__m128i crossCarry = _mm_srli_si128(lowCarry, 12);
+	highCarry = _mm_slli_si128(highCarry, 4);
+	lowCarry = _mm_slli_si128(lowCarry, 4);
+	low = _mm_or_si128(low, lowCarry);
+	high = _mm_or_si128(high, highCarry);
+	high = _mm_or_si128(high, crossCarry);
+
+	// 按 x^128 + x^7 + x^2 + x + 1 约简
+	__m128i fold = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(low, 31), _mm_slli_epi32(low, 30)), _mm_slli_epi32(low, 25));
+	__m128i foldHigh = _mm_srli_si128(fold, 4);
+	fold = _mm_slli_si128(fold, 12);
+	low = _mm_xor_si128(low, fold);
+
+	__m128i shifted = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(low, 1), _mm_srli_epi32(low, 2)), _mm_srli_epi32(low, 7));
+	shifted = _mm_xor_si128(shifted, foldHigh);
+	low = _mm_xor_si128(low, shifted);
+
+	return _mm_xor_si128(high, low);
+}
+
+static inline __m128i AesEncryptBlockAccelerated(__m128i block, const __m128i* roundKeys) {
+	block = _mm_xor_si128(block, roundKeys[0]);
+	for (int round = 1; round < AES_256_ROUNDS; round++) {
+		block = _mm_aesenc_si128(block, roundKeys[round]);
+	}
+	return _mm_aesenclast_si128(block, roundKeys[AES_256_ROUNDS]);
+}
+
+// 检测 AES-NI、PCLMULQDQ 和 SSSE3（字节反序使用）
+static int HasAesAcceleration() {
+	int info[4];
+	__cpuid(info, 1);
+
+	const int required = (1 << 25) | (1 << 1) | (1 << 9);
+	return (info[2] & required) == required;
+}
+
+// ========== 引擎实现 ==========
+
+// 数据流状态（GHASH 相关字段均为自然字节序）
+struct AesGcmContext {
+	unsigned char roundKeys[(AES_256_ROUNDS + 1) * AES_BLOCK_SIZE];
+	unsigned char hashPowers[GCM_HASH_POWERS][AES_BLOCK_SIZE];  // H, H^2, H^3, H^4
+	unsigned char counter0[AES_BLOCK_SIZE];                     // J0 = 随机数 || 1
+	unsigned char ghash[AES_BLOCK_SIZE];                        // GHASH 累加值
+	unsigned char keystream[AES_BLOCK_SIZE];                    // 最后一个不完整块的密钥流
+	unsigned char pending[AES_BLOCK_SIZE];                      // 最后一个不完整块的密文（等待 GHASH）
+	unsigned long long dataLength;                              // 已处理的字节数
+	int exhausted;                                              // 数据量超过 GCM_MAX_DATA_LENGTH（此后不再输出密文）
+	int encrypt;
+	int accelerated;                                            // 使用 AES-NI + PCLMULQDQ
+};
+
+// 第 blockIndex 个数据块的计数器块：J0 的低32位（大端）加上 blockIndex + 1
+static void GcmCounterBlock(const AesGcmContext* state, unsigned long long blockIndex, unsigned char* block) {
+	unsigned int counter = (unsigned int)(blockIndex + 2);
+
+	memcpy(block, state->counter0, GCM_NONCE_SIZE);
+	block[12] = (unsigned char)(counter >> 24);
+	block[13] = (unsigned char)(counter >> 16);
+	block[14] = (unsigned char)(counter >> 8);
+	block[15] = (unsigned char)counter;
+}
+
+static void AesGcmEncryptBlock(const AesGcmContext* state, const unsigned char* input, unsigned char* output) {
+	if (state->accelerated) {
+		__m128i roundKeys[AES_256_ROUNDS + 1];
+		for (int i = 0; i <= AES_256_ROUNDS; i++) {
+			roundKeys[i] = _mm_loadu_si128((const __m128i*)(state->roundKeys + i * AES_BLOCK_SIZE));
+		}
+		_mm_storeu_si128((__m128i*)output, AesEncryptBlockAccelerated(_mm_loadu_si128((const __m128i*)input), roundKeys));
+		SecureZeroMemory(roundKeys, sizeof(roundKeys));
+	}
+	else {
+		AesEncryptBlockPortable(state->roundKeys, input, output);
+	}
+}
+
+// 将一个完整的密文块并入 GHASH
+static void GhashBlock(AesGcmContext* state, const unsigned char* block) {
+	for (int i = 0; i < AES_BLOCK_SIZE; i++) {
+		state->ghash[i] ^= block[i];
+	}
+
+	if (state->accelerated) {
+		__m128i x = ByteSwap128(_mm_loadu_si128((const __m128i*)state->ghash));
+		__m128i h = ByteSwap128(_mm_loadu_si128((const __m128i*)state->hashPowers[0]));
+		_mm_storeu_si128((__m128i*)state->ghash, ByteSwap128(GhashMultiplyAccelerated(x, h)));
+	}
+	else {
+		GhashMultiplyPortable(state->ghash, state->hashPowers[0]);
+	}
+}
+
+// 处理不完整块中从 offset 开始的 length 字节
+static void AesGcmTransformPartial(AesGcmContext* state, unsigned char* output, const unsigned char* input, size_t length, size_t offset) {
+	for (size_t i = 0; i < length; i++) {
+		unsigned char in = input[i];
+		unsigned char out = in ^ state->keystream[offset + i];
+		state->pending[offset + i] = state->encrypt ? out : in;
+		output[i] = out;
+	}
+
+	state->dataLength += length;
+	if (offset + length == AES_BLOCK_SIZE) {
+		GhashBlock(state, state->pending);
+	}
+}
+
+// 处理整块数据（可移植实现）
+static void AesGcmTransformBlocksPortable(AesGcmContext* state, unsigned char* output, const unsigned char* input, size_t blocks) {
+	unsigned long long blockIndex = state->dataLength / AES_BLOCK_SIZE;
+	unsigned char counter[AES_BLOCK_SIZE];
+	unsigned char keystream[AES_BLOCK_SIZE];
+	unsigned char ciphertext[AES_BLOCK_SIZE];
+
+	for (size_t i = 0; i < blocks; i++) {
+		GcmCounterBlock(state, blockIndex + i, counter);
+		AesEncryptBlockPortable(state->roundKeys, counter, keystream);
+
+		for (int j = 0; j < AES_BLOCK_SIZE; j++) {
+			unsigned char in = input[i * AES_BLOCK_SIZE + j];
+			unsigned char out = in ^ keystream[j];
+			ciphertext[j] = state->encrypt ? out : in;
+			output[i * AES_BLOCK_SIZE + j] = out;
+		}
+
+		GhashBlock(state, ciphertext);
+	}
+
+	state->dataLength += blocks * AES_BLOCK_SIZE;
+	SecureZeroMemory(keystream, sizeof(keystream));
+}
+
+// 处理整块数据（AES-NI：8个计数器块交错加密，GHASH 每4块聚合一次约简依赖）
+static void AesGcmTransformBlocksAccelerated(AesGcmContext* state, unsigned char* output, const unsigned char* input, size_t blocks) {
+	__m128i roundKeys[AES_256_ROUNDS + 1];
+	for (int i = 0; i <= AES_256_ROUNDS; i++) {
+		roundKeys[i] = _mm_loadu_si128((const __m128i*)(state->roundKeys + i * AES_BLOCK_SIZE));
+	}
+
+	__m128i hashPowers[GCM_HASH_POWERS];
+	for (int i = 0; i < GCM_HASH_POWERS; i++) {
+		hashPowers[i] = ByteSwap128(_mm_loadu_si128((const __m128i*)state->hashPowers[i]));
+	}
+
+	// 计数器以字节反序保存，低32位即大端计数值，可以直接做32位加法
+	unsigned long long blockIndex = state->dataLength / AES_BLOCK_SIZE;
+	__m128i counter = ByteSwap128(_mm_loadu_si128((const __m128i*)state->counter0));
+	counter = _mm_add_epi32(counter, _mm_set_epi32(0, 0, 0, (int)(unsigned int)(blockIndex + 1)));
+	const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+
+	__m128i x = ByteSwap128(_mm_loadu_si128((const __m128i*)state->ghash));
+	const int encrypt = state->encrypt;
+	size_t i = 0;
+
+	for (; i + GCM_PARALLEL_BLOCKS <= blocks; i += GCM_PARALLEL_BLOCKS) {
+		__m128i keystream[GCM_PARALLEL_BLOCKS];
+		for (int k = 0; k < GCM_PARALLEL_BLOCKS; k++) {
+			keystream[k] = _mm_xor_si128(ByteSwap128(counter), roundKeys[0]);
+			counter = _mm_add_epi32(counter, one);
+		}
+		for (int round = 1; round < AES_256_ROUNDS; round++) {
+			for (int k = 0; k < GCM_PARALLEL_BLOCKS; k++) {
+				keystream[k] = _mm_aesenc_si128(keystream[k], roundKeys[round]);
+			}
+		}
+
+		// 先读入全部输入再写出，output 位于 input 之前的原地处理也是安全的
+		__m128i ciphertext[GCM_PARALLEL_BLOCKS];
+		__m128i result[GCM_PARALLEL_BLOCKS];
+		for (int k = 0; k < GCM_PARALLEL_BLOCKS; k++) {
+			__m128i data = _mm_loadu_si128((const __m128i*)(input + (i + k) * AES_BLOCK_SIZE));
+			result[k] = _mm_xor_si128(data, _mm_aesenclast_si128(keystream[k], roundKeys[AES_256_ROUNDS]));
+			ciphertext[k] = ByteSwap128(encrypt ? result[k] : data);
+		}
+		for (int k = 0; k < GCM_PARALLEL_BLOCKS; k++) {
+			_mm_storeu_si128((__m128i*)(output + (i + k) * AES_BLOCK_SIZE), result[k]);
+		}
+
+		// X = (X ^ C1)·H^4 ^ C2·H^3 ^ C3·H^2 ^ C4·H，四个乘法互不依赖
+		for (int k = 0; k < GCM_PARALLEL_BLOCKS; k += GCM_HASH_POWERS) {
+			__m128i sum = GhashMultiplyAccelerated(_mm_xor_si128(x, ciphertext[k]), hashPowers[3]);
+			sum = _mm_xor_si128(sum, GhashMultiplyAccelerated(ciphertext[k + 1], hashPowers[2]));
+			sum = _mm_xor_si128(sum, GhashMultiplyAccelerated(ciphertext[k + 2], hashPowers[1]));
+			x = _mm_xor_si128(sum, GhashMultiplyAccelerated(ciphertext[k + 3], hashPowers[0]));
+		}
+	}
+
+	for (; i < blocks; i++) {
+		__m128i data = _mm_loadu_si128((const __m128i*)(input + i * AES_BLOCK_SIZE));
+		__m128i result = _mm_xor_si128(data, AesEncryptBlockAccelerated(ByteSwap128(counter), roundKeys));
+		counter = _mm_add_epi32(counter, one);
+
+		_mm_storeu_si128((__m128i*)(output + i * AES_BLOCK_SIZE), result);
+		x = GhashMultiplyAccelerated(_mm_xor_si128(x, ByteSwap128(encrypt ? result : data)), hashPowers[0]);
+	}
+
+	_mm_storeu_si128((__m128i*)state->ghash, ByteSwap128(x));
+	state->dataLength += blocks * AES_BLOCK_SIZE;
+	SecureZeroMemory(roundKeys, sizeof(roundKeys));
+}
+
+// 用 AES-256 密钥与随机数初始化数据流状态；accelerated 非0时使用 AES-NI（调用方已生成S盒）
+static void AesGcmSetKey(AesGcmContext* state, const unsigned char* aesKey, const unsigned char* nonce, int encrypt, int accelerated) {
+	memset(state, 0, sizeof(*state));
+	state->encrypt = encrypt;
+	state->accelerated = accelerated;
+
+	AesExpandKey256(aesKey, state->roundKeys);
+
+	// H = E(K, 0)，预先计算聚合GHASH使用的幂次
+	const unsigned char zeroBlock[AES_BLOCK_SIZE] = { 0 };
+	AesEncryptBlockPortable(state->roundKeys, zeroBlock, state->hashPowers[0]);
+	for (int i = 1; i < GCM_HASH_POWERS; i++) {
+		memcpy(state->hashPowers[i], state->hashPowers[i - 1], AES_BLOCK_SIZE);
+		GhashMultiplyPortable(state->hashPowers[i], state->hashPowers[0]);
+	}
+
+	memcpy(state->counter0, nonce, GCM_NONCE_SIZE);
+	state->counter0[AES_BLOCK_SIZE - 1] = 1;
+}
+
+static int AesGcmInit(void* context, const unsigned char* key, int keyLength, const unsigned char* engineHeader, int encrypt) {
+	InitOnceExecuteOnce(&g_aesSboxOnce, InitAesSbox, NULL, NULL);
+
+	// 由组合密钥派生 AES-256 密钥
+	Sha256State sha;
+	unsigned char aesKey[AES_256_KEY_SIZE];
+	Sha256Init(&sha);
+	Sha256Update(&sha, (const unsigned char*)g_aesGcmKeyDomain, sizeof(g_aesGcmKeyDomain) - 1);
+	Sha256Update(&sha, key, keyLength);
+	Sha256Final(&sha, aesKey);
+
+	AesGcmSetKey((AesGcmContext*)context, aesKey, engineHeader, encrypt, HasAesAcceleration());
+	SecureZeroMemory(aesKey, sizeof(aesKey));
+
+	return 0;
+}
+
+static void AesGcmTransform(void* context, unsigned char* output, const unsigned char* input, size_t length, __int64 position) {
+	AesGcmContext* state = (AesGcmContext*)context;
+
+	// 超过上限后32位块计数器会回绕而重复使用密钥流：超出的数据一律输出0，finalize 报告失败
+	if (state->exhausted || length > GCM_MAX_DATA_LENGTH - state->dataLength) {
+		state->exhausted = 1;
+		memset(output, 0, length);
+		return;
+	}
+
+	// 先用完上一次调用剩余的密钥流
+	size_t offset = (size_t)(state->dataLength % AES_BLOCK_SIZE);
+	if (offset > 0) {
+		size_t take = AES_BLOCK_SIZE - offset < length ? AES_BLOCK_SIZE - offset : length;
+		AesGcmTransformPartial(state, output, input, take, offset);
+		output += take;
+		input += take;
+		length -= take;
+	}
+
+	size_t blocks = length / AES_BLOCK_SIZE;
+	if (blocks > 0) {
+		if (state->accelerated) {
+			AesGcmTransformBlocksAccelerated(state, output, input, blocks);
+		}
+		else {
+			AesGcmTransformBlocksPortable(state, output, input, blocks);
+		}
+		output += blocks * AES_BLOCK_SIZE;
+		input += blocks * AES_BLOCK_SIZE;
+		length -= blocks * AES_BLOCK_SIZE;
+	}
+
+	// 剩余不足一块的数据生成新的密钥流块，后续调用继续使用
+	if (length > 0) {
+		unsigned char counter[AES_BLOCK_SIZE];
+		GcmCounterBlock(state, state->dataLength / AES_BLOCK_SIZE, counter);
+		AesGcmEncryptBlock(state, counter, state->keystream);
+		AesGcmTransformPartial(state, output, input, length, 0);
+	}
+}
+
+static int AesGcmFinalize(void* context, unsigned char* trailer) {
+	AesGcmContext* state = (AesGcmContext*)context;
+
+	if (state->exhausted) {
+		return -1;
+	}
+
+	// 最后一个不完整块补零后并入 GHASH
+	size_t offset = (size_t)(state->dataLength % AES_BLOCK_SIZE);
+	if (offset > 0) {
+		memset(state->pending + offset, 0, AES_BLOCK_SIZE - offset);
+		GhashBlock(state, state->pending);
+	}
+
+	// 长度块：附加数据位长度（0）|| 密文位长度
+	unsigned char lengths[AES_BLOCK_SIZE] = { 0 };
+	StoreBigEndian64(lengths + 8, state->dataLength * 8);
+	GhashBlock(state, lengths);
+
+	// 认证标签 = E(K, J0) ^ GHASH
+	unsigned char tag[GCM_TAG_SIZE];
+	AesGcmEncryptBlock(state, state->counter0, tag);
+	for (int i = 0; i < GCM_TAG_SIZE; i++) {
+		tag[i] ^= state->ghash[i];
+	}
+
+	if (state->encrypt) {
+		memcpy(trailer, tag, GCM_TAG_SIZE);
+		return 0;
+	}
+
+	// 常数时间比较
+	unsigned char difference = 0;
+	for (int i = 0; i < GCM_TAG_SIZE; i++) {
+		difference |= tag[i] ^ trailer[i];
+	}
+
+	return difference == 0 ? 0 : -1;
+}
+
+// 随机访问只做 CTR 变换：计数器由偏移直接算出，GHASH 与已处理长度保持不变
+static void AesGcmTransformAt(void* context, unsigned char* output, const unsigned char* input, size_t length, __int64 position) {
+	const AesGcmContext* state = (const AesGcmContext*)context;
+
+	// 超出上限的范围没有合法的密钥流（计数器会回绕）
+	if (position < 0 || (unsigned long long)position > GCM_MAX_DATA_LENGTH || length > GCM_MAX_DATA_LENGTH - (unsigned long long)position) {
+		memset(output, 0, length);
+		return;
+	}
+
+	unsigned long long blockIndex = (unsigned long long)position / AES_BLOCK_SIZE;
+	size_t offset = (size_t)((unsigned long long)position % AES_BLOCK_SIZE);
+	unsigned char counter[AES_BLOCK_SIZE];
+	unsigned char keystream[AES_BLOCK_SIZE];
+
+	__m128i roundKeys[AES_256_ROUNDS + 1];
+	if (state->accelerated) {
+		for (int i = 0; i <= AES_256_ROUNDS; i++) {
+			roundKeys[i] = _mm_loadu_si128((const __m128i*)(state->roundKeys + i * AES_BLOCK_SIZE));
+		}
+	}
+
+	while (length > 0) {
+		GcmCounterBlock(state, blockIndex, counter);
+		if (state->accelerated) {
+			_mm_storeu_si128((__m128i*)keystream, AesEncryptBlockAccelerated(_mm_loadu_si128((const __m128i*)counter), roundKeys));
+		}
+		else {
+			AesEncryptBlockPortable(state->roundKeys, counter, keystream);
+		}
+
+		size_t take = AES_BLOCK_SIZE - offset < length ? AES_BLOCK_SIZE - offset : length;
+		for (size_t i = 0; i < take; i++) {
+			output[i] = input[i] ^ keystream[offset + i];
+		}
+
+		output += take;
+		input += take;
+		length -= take;
+		offset = 0;
+		blockIndex++;
+	}
+
+	SecureZeroMemory(keystream, sizeof(keystream));
+	if (state->accelerated) {
+		SecureZeroMemory(roundKeys, sizeof(roundKeys));
+	}
+}
+
+static void AesGcmCleanup(void* context) {
+	SecureZeroMemory(context, sizeof(AesGcmContext));
+}
+
+// ========== 已知答案自检 ==========
+
+#define GCM_SELF_TEST_MAX_DATA 64                                                    // 测试向量明文的最大字节数
+#define GCM_SELF_TEST_PATH_DATA (GCM_PARALLEL_BLOCKS * AES_BLOCK_SIZE * 2 + 7)      // 两条实现路径对照的数据量
+
+// NIST GCM 测试向量（McGrew & Viega, The Galois/Counter Mode of Operation, 测试用例 13-15，无附加数据）
+struct AesGcmTestVector {
+	const char* key;
+	const char* nonce;
+	const char* plaintext;
+	const char* ciphertext;
+	const char* tag;
+};
+
+static const AesGcmTestVector g_aesGcmTestVectors[] = {
+	{
+		"0000000000000000000000000000000000000000000000000000000000000000",
+		"000000000000000000000000",
+		"",
+		"",
+		"530f8afbc74536b9a963b4f1c4cb738b"
+	},
+	{
+		"0000000000000000000000000000000000000000000000000000000000000000",
+		"000000000000000000000000",
+		"00000000000000000000000000000000",
+		"cea7403d4d606b6e074ec5d3baf39d18",
+		"d0d1c8a799996bf0265b98b5d48ab919"
+	},
+	{
+		"feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308",
+		"cafebabefacedbaddecaf888",
+		"d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+		"1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255",
+		"522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa"
+		"8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662898015ad",
+		"b094dac5d93471bdec1a502270e3cc6c"
+	},
+};
+
+// SHA-256("abc")（FIPS 180-2 附录 B.1）
+static const char g_sha256TestDigest[] = "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+
+static inline unsigned char HexDigitValue(char digit) {
+	if (digit >= '0' && digit <= '9') return (unsigned char)(digit - '0');
+	if (digit >= 'a' && digit <= 'f') return (unsigned char)(digit - 'a' + 10);
+	return (unsigned char)(digit - 'A' + 10);
+}
+
+// 解码十六进制串，返回字节数
+static size_t DecodeHex(const char* hex, unsigned char* output) {
+	size_t length = 0;
+	for (; hex[0] && hex[1]; hex += 2) {
+		output[length++] = (unsigned char)((HexDigitValue(hex[0]) << 4) | HexDigitValue(hex[1]));
+	}
+	return length;
+}
+
+// 按测试向量加密与解密（分两次变换以覆盖不完整块的密钥流接续），并确认篡改的标签被拒绝
+static bool CheckAesGcmVector(const AesGcmTestVector* vector, int accelerated) {
+	unsigned char key[AES_256_KEY_SIZE];
+	unsigned char nonce[GCM_NONCE_SIZE];
+	unsigned char plaintext[GCM_SELF_TEST_MAX_DATA];
+	unsigned char ciphertext[GCM_SELF_TEST_MAX_DATA];
+	unsigned char tag[GCM_TAG_SIZE];
+	unsigned char output[GCM_SELF_TEST_MAX_DATA];
+	unsigned char trailer[GCM_TAG_SIZE];
+
+	DecodeHex(vector->key, key);
+	DecodeHex(vector->nonce, nonce);
+	size_t length = DecodeHex(vector->plaintext, plaintext);
+	DecodeHex(vector->ciphertext, ciphertext);
+	DecodeHex(vector->tag, tag);
+
+	size_t split = length / 3;
+	bool passed = true;
+	AesGcmContext state;
+
+	for (int encrypt = 1; encrypt >= 0; encrypt--) {
+		const unsigned char* input = encrypt ? plaintext : ciphertext;
+		AesGcmSetKey(&state, key, nonce, encrypt, accelerated);
+		AesGcmTransform(&state, output, input, split, 0);
+		AesGcmTransform(&state, output + split, input + split, length - split, split);
+
+		memcpy(trailer, tag, GCM_TAG_SIZE);
+		if (AesGcmFinalize(&state, trailer) != 0 || memcmp(trailer, tag, GCM_TAG_SIZE) != 0
+			|| memcmp(output, encrypt ? ciphertext : plaintext, length) != 0) {
+			passed = false;
+		}
+	}
+
+	AesGcmSetKey(&state, key, nonce, 0, accelerated);
+	AesGcmTransform(&state, output, ciphertext, length, 0);
+	tag[GCM_TAG_SIZE - 1] ^= 1;
+	if (AesGcmFinalize(&state, tag) == 0) {
+		passed = false;
+	}
+
+	AesGcmCleanup(&state);
+	return passed;
+}
+
+// AES-NI 路径（8块流水线、4块聚合GHASH、随机访问）与已由测试向量验证的可移植路径逐字节对照
+static bool CheckAesGcmPaths() {
+	const AesGcmTestVector* vector = &g_aesGcmTestVectors[2];
+	unsigned char key[AES_256_KEY_SIZE];
+	unsigned char nonce[GCM_NONCE_SIZE];
+	unsigned char input[GCM_SELF_TEST_PATH_DATA];
+	unsigned char output[2][GCM_SELF_TEST_PATH_DATA];
+	unsigned char tags[2][GCM_TAG_SIZE];
+	unsigned char random[GCM_SELF_TEST_PATH_DATA];
+
+	DecodeHex(vector->key, key);
+	DecodeHex(vector->nonce, nonce);
+	for (size_t i = 0; i < sizeof(input); i++) {
+		input[i] = (unsigned char)(i * 7 + 1);
+	}
+
+	AesGcmContext state;
+	for (int accelerated = 0; accelerated <= 1; accelerated++) {
+		AesGcmSetKey(&state, key, nonce, 1, accelerated);
+		AesGcmTransform(&state, output[accelerated], input, sizeof(input), 0);
+		AesGcmFinalize(&state, tags[accelerated]);
+	}
+
+	AesGcmSetKey(&state, key, nonce, 1, 1);
+	AesGcmTransformAt(&state, random, input + 5, sizeof(input) - 5, 5);
+	AesGcmCleanup(&state);
+
+	return memcmp(output[0], output[1], sizeof(input)) == 0 && memcmp(tags[0], tags[1], GCM_TAG_SIZE) == 0
+		&& memcmp(random, output[0] + 5, sizeof(input) - 5) == 0;
+}
+
+// 首次使用引擎前由 FindCipherEngine 调用一次：SHA-256 密钥派生、可移植路径的测试向量，CPU 支持时再验证 AES-NI 路径
+static int AesGcmSelfTest() {
+	InitOnceExecuteOnce(&g_aesSboxOnce, InitAesSbox, NULL, NULL);
+
+	Sha256State sha;
+	unsigned char digest[32];
+	unsigned char expected[32];
+	Sha256Init(&sha);
+	Sha256Update(&sha, (const unsigned char*)"abc", 3);
+	Sha256Final(&sha, digest);
+	DecodeHex(g_sha256TestDigest, expected);
+	if (memcmp(digest, expected, sizeof(digest)) != 0) {
+		return -1;
+	}
+
+	int accelerated = HasAesAcceleration();
+	for (size_t i = 0; i < sizeof(g_aesGcmTestVectors) / sizeof(g_aesGcmTestVectors[0]); i++) {
+		if (!CheckAesGcmVector(&g_aesGcmTestVectors[i], 0) || (accelerated && !CheckAesGcmVector(&g_aesGcmTestVectors[i], 1))) {
+			return -1;
+		}
+	}
+
+	if (accelerated && !CheckAesGcmPaths()) {
+		return -1;
+	}
+	return 0;
+}
+
+const CipherEngine g_aesGcmEngine = {
+	ENCODE_ENGINE_AES_256_GCM, "aes-256-gcm", sizeof(AesGcmContext), GCM_NONCE_SIZE, GCM_TAG_SIZE,
+	AesGcmInit, AesGcmTransform, AesGcmFinalize, AesGcmCleanup, AesGcmTransformAt, AesGcmSelfTest, GCM_MAX_DATA_LENGTH
+};
@@ -1,5 +1,6 @@
 ﻿// dllmain.cpp : 定义 DLL 应用程序的入口点。
 #include "pch.h"
+#include "encode_internal.h"
 
 BOOL APIENTRY DllMain( HMODULE hModule,
                        DWORD  ul_reason_for_call,
@@ -11,7 +12,12 @@ BOOL APIENTRY DllMain( HMODULE hModule,
     case DLL_PROCESS_ATTACH:
     case DLL_THREAD_ATTACH:
     case DLL_THREAD_DETACH:
+        break;
     case DLL_PROCESS_DETACH:
+        // FreeLibrary（或内存加载器释放模块）时释放 FLS 槽位；进程退出时其它线程已结束，不再清理
+        if (lpReserved == NULL) {
+            ReleaseFiberLocalSlots();
+        }
         break;
     }
     return TRUE;
@@ -1,15 +1,21 @@
 #include "pch.h"
 #include "encode.h"
+#include "encode_internal.h"
+#include "encode.hpp"
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <windows.h>
 #include <process.h>
+#include <io.h>
 #include <wincrypt.h>
+#include <emmintrin.h>
 
 // 加密算法相关常量定义
 #define BUFFER_SIZE 4096                   // 标准缓冲区大小
 #define MAGIC_HEADER "ENCV1.0"             // 加密文件魔数头标识
+#define MAGIC_HEADER_V11 "ENCV1.1"         // 带引擎标识的加密文件魔数头（引擎0以外的引擎使用）
 #define MAGIC_HEADER_SIZE 7                // 魔数头大小
 #define CHUNK_SIZE 1024                    // 数据块大小
 #define MAX_THREADS 4                      // 最大线程数量
@@ -25,1765 +31,7664 @@
 #define ERR_THREAD_CREATION_FAILED -6     // 线程创建失败
 #define ERR_INVALID_PARAMETER -7          // 无效参数
 #define ERR_PRIVATE_KEY_NOT_SET -8        // 私钥未设置
+#define ERR_BUFFER_TOO_SMALL -9           // 调用者提供的缓冲区不足
+#define ERR_MEMORY_BUDGET_EXCEEDED -10    // 内存预算已用尽（等待超时）
+#define ERR_UNSUPPORTED_ENGINE -11        // 加密引擎不可用
+#define ERR_OPERATION_CANCELLED -12       // 异步操作已取消
+#define ERR_OPERATION_PENDING -13         // 异步操作尚未完成（等待超时）
+#define ERR_FILE_WRITE_FAILED -14         // 输出文件写入失败（磁盘已满等）
+
+// ========== 可替换内存分配器与单次调用内存区 ==========
+
+// 分配器记录：发布后只读，且永不释放（已分配的块在块头中记录所属分配器，替换分配器后仍能正确释放）
+struct EncodeAllocator {
+	EncodeAllocFunc alloc;
+	EncodeFreeFunc free;
+	void* user;
+};
+
+// 块头：记录分配该块的分配器和大小，大小保持数据区按 MEMORY_ALLOCATION_ALIGNMENT 对齐
+struct EncodeAllocHeader {
+	EncodeAllocator* allocator;
+	size_t size;                           // 计入内存用量的字节数
+	size_t budgeted;                       // 非0表示该块计入预算（释放时归还预算并唤醒等待者）
+	size_t reserved;                       // 保持数据区按 MEMORY_ALLOCATION_ALIGNMENT 对齐
+};
+
+static void* DefaultEncodeAlloc(size_t size, void* user) {
+	return malloc(size);
+}
 
-// ========== 双密钥系统全局变量 ==========
-static unsigned char* g_privateKey = nullptr;
-static int g_privateKeyLength = 0;
-static CRITICAL_SECTION g_keySection;
-static bool g_keyInitialized = false;
+static void DefaultEncodeFree(void* memory, void* user) {
+	free(memory);
+}
 
-// ========== 双密钥系统函数实现 ==========
+static EncodeAllocator g_defaultAllocator = { DefaultEncodeAlloc, DefaultEncodeFree, nullptr };
+static EncodeAllocator* volatile g_allocator = &g_defaultAllocator;     // 当前分配器
+
+// 内存预算：所有 EncodeAlloc 分配都计入用量；缓冲区和输出数据等大块分配另外计入预算用量，只有它们受预算约束
+static volatile LONGLONG g_memoryUsed = 0;             // 当前用量（字节）
+static volatile LONGLONG g_memoryCharged = 0;          // 计入预算的用量（字节）
+static volatile LONGLONG g_memoryPeak = 0;             // 峰值用量（字节）
+static volatile LONGLONG g_memoryBudget = 0;           // 预算上限，0表示不限制
+static volatile LONG g_budgetWaitMilliseconds = 0;     // 预算不足时的最长等待时间
+static volatile LONG g_budgetWaiters = 0;              // 正在等待预算的线程数
+static SRWLOCK g_budgetLock = SRWLOCK_INIT;
+static CONDITION_VARIABLE g_budgetReleased = CONDITION_VARIABLE_INIT;
+
+static void SweepStreamBufferCaches(bool force);
+static void ReclaimDecryptedBlobs(size_t bytes);
+
+static void UpdateMemoryPeak(LONGLONG used) {
+	LONGLONG peak = g_memoryPeak;
+	while (used > peak) {
+		LONGLONG observed = InterlockedCompareExchange64(&g_memoryPeak, used, peak);
+		if (observed == peak) {
+			break;
+		}
+		peak = observed;
+	}
+}
 
-// 初始化私钥
-int InitStreamFile(const char* privateKey) {
-	if (!privateKey) {
-		return ERR_INVALID_PARAMETER;
+// 在预算内计入用量，超出预算时不计入并返回 false
+static bool TryChargeMemory(size_t size) {
+	LONGLONG budget = g_memoryBudget;
+	LONGLONG charged = g_memoryCharged;
+
+	for (;;) {
+		if (budget > 0 && charged + (LONGLONG)size > budget) {
+			return false;
+		}
+		LONGLONG observed = InterlockedCompareExchange64(&g_memoryCharged, charged + (LONGLONG)size, charged);
+		if (observed == charged) {
+			break;
+		}
+		charged = observed;
 	}
 
-	// 初始化临界区（只初始化一次）
-	if (!g_keyInitialized) {
-		InitializeCriticalSection(&g_keySection);
-		g_keyInitialized = true;
+	UpdateMemoryPeak(InterlockedExchangeAdd64(&g_memoryUsed, (LONGLONG)size) + (LONGLONG)size);
+	return true;
+}
+
+// 请求本身是否可能放进预算（超过预算上限的请求等待多久都无法满足）
+static bool FitsMemoryBudget(size_t size) {
+	LONGLONG budget = g_memoryBudget;
+	return budget <= 0 || size <= (size_t)budget;
+}
+
+static void UnchargeMemory(size_t size) {
+	InterlockedExchangeAdd64(&g_memoryCharged, -(LONGLONG)size);
+	InterlockedExchangeAdd64(&g_memoryUsed, -(LONGLONG)size);
+
+	// 在锁内唤醒，保证等待者不会在检查用量与进入睡眠之间错过通知
+	if (g_budgetWaiters > 0) {
+		AcquireSRWLockExclusive(&g_budgetLock);
+		ReleaseSRWLockExclusive(&g_budgetLock);
+		WakeAllConditionVariable(&g_budgetReleased);
 	}
+}
 
-	EnterCriticalSection(&g_keySection);
+// 按预算计入用量：先释放各线程闲置的缓存缓冲区和解密结果缓存，仍不足时等待其它操作释放内存
+// 超过预算上限的请求立即失败
+static int ChargeMemoryWithinBudget(size_t size) {
+	if (TryChargeMemory(size)) {
+		return SUCCESS;
+	}
 
-	// 清理之前的私钥
-	if (g_privateKey) {
-		SecureZeroMemory(g_privateKey, g_privateKeyLength);
-		free(g_privateKey);
-		g_privateKey = nullptr;
-		g_privateKeyLength = 0;
+	if (!FitsMemoryBudget(size)) {
+		return ERR_MEMORY_BUDGET_EXCEEDED;
 	}
 
-	// 存储新私钥（支持任意长度）
-	g_privateKeyLength = strlen(privateKey);
-	if (g_privateKeyLength == 0) {
-		LeaveCriticalSection(&g_keySection);
-		return ERR_INVALID_PARAMETER;
+	SweepStreamBufferCaches(true);
+	if (TryChargeMemory(size)) {
+		return SUCCESS;
 	}
 
-	g_privateKey = (unsigned char*)malloc(g_privateKeyLength + 1);
-	if (!g_privateKey) {
-		g_privateKeyLength = 0;
-		LeaveCriticalSection(&g_keySection);
-		return ERR_MEMORY_ALLOCATION_FAILED;
+	// 解密结果缓存只在淘汰时释放内存，等待其它操作不会让它让出预算
+	ReclaimDecryptedBlobs(size);
+	if (TryChargeMemory(size)) {
+		return SUCCESS;
 	}
 
-	memcpy(g_privateKey, privateKey, g_privateKeyLength);
-	g_privateKey[g_privateKeyLength] = '\0';
+	DWORD waitMilliseconds = (DWORD)g_budgetWaitMilliseconds;
+	ULONGLONG deadline = GetTickCount64() + waitMilliseconds;
+	int result = ERR_MEMORY_BUDGET_EXCEEDED;
+
+	AcquireSRWLockExclusive(&g_budgetLock);
+	InterlockedIncrement(&g_budgetWaiters);
+	for (;;) {
+		if (TryChargeMemory(size)) {
+			result = SUCCESS;
+			break;
+		}
 
-	LeaveCriticalSection(&g_keySection);
+		// 等待期间预算可能被调低到请求之下
+		ULONGLONG now = GetTickCount64();
+		if (!FitsMemoryBudget(size) || waitMilliseconds == 0 || (waitMilliseconds != INFINITE && now >= deadline)) {
+			break;
+		}
 
-	return SUCCESS;
+		DWORD timeout = waitMilliseconds == INFINITE ? INFINITE : (DWORD)(deadline - now);
+		SleepConditionVariableSRW(&g_budgetReleased, &g_budgetLock, timeout, 0);
+	}
+	InterlockedDecrement(&g_budgetWaiters);
+	ReleaseSRWLockExclusive(&g_budgetLock);
+
+	return result;
 }
 
-// 清理私钥
-void ClearPrivateKey() {
-	if (!g_keyInitialized) return;
+// 释放块的用量（计入预算的块同时归还预算）
+static void UnchargeBlock(size_t size, bool budgeted) {
+	if (budgeted) {
+		UnchargeMemory(size);
+	}
+	else {
+		InterlockedExchangeAdd64(&g_memoryUsed, -(LONGLONG)size);
+	}
+}
 
-	EnterCriticalSection(&g_keySection);
+// 分配已计入用量的内存块（budgeted 表示已经由 TryChargeMemory/ChargeMemoryWithinBudget 计入预算）
+static void* AllocateCharged(size_t size, bool budgeted) {
+	EncodeAllocator* allocator = g_allocator;
 
-	if (g_privateKey) {
-		SecureZeroMemory(g_privateKey, g_privateKeyLength);
-		free(g_privateKey);
-		g_privateKey = nullptr;
-		g_privateKeyLength = 0;
+	EncodeAllocHeader* header = (EncodeAllocHeader*)allocator->alloc(sizeof(EncodeAllocHeader) + size, allocator->user);
+	if (!header) {
+		UnchargeBlock(size, budgeted);
+		return nullptr;
 	}
+	header->allocator = allocator;
+	header->size = size;
+	header->budgeted = budgeted ? 1 : 0;
 
-	LeaveCriticalSection(&g_keySection);
+	return header + 1;
 }
 
-// 检查私钥是否已设置
-int IsPrivateKeySet() {
-	if (!g_keyInitialized) return 0;
+// 本模块所有堆内存都经由此函数分配（小块内部结构，计入用量但不计入预算，也不受预算约束）
+static void* EncodeAlloc(size_t size) {
+	if (size > (size_t)-1 - sizeof(EncodeAllocHeader)) {
+		return nullptr;
+	}
 
-	EnterCriticalSection(&g_keySection);
-	int result = (g_privateKey != nullptr && g_privateKeyLength > 0) ? 1 : 0;
-	LeaveCriticalSection(&g_keySection);
+	UpdateMemoryPeak(InterlockedExchangeAdd64(&g_memoryUsed, (LONGLONG)size) + (LONGLONG)size);
+	return AllocateCharged(size, false);
+}
 
-	return result;
+// 受预算约束的分配（流式缓冲区、输出数据等大块内存）
+// result 返回 ERR_MEMORY_BUDGET_EXCEEDED 或 ERR_MEMORY_ALLOCATION_FAILED
+static void* EncodeAllocWithinBudget(size_t size, int* result) {
+	if (size > (size_t)-1 - sizeof(EncodeAllocHeader)) {
+		*result = ERR_MEMORY_ALLOCATION_FAILED;
+		return nullptr;
+	}
+
+	*result = ChargeMemoryWithinBudget(size);
+	if (*result != SUCCESS) {
+		return nullptr;
+	}
+
+	void* memory = AllocateCharged(size, true);
+	if (!memory) {
+		*result = ERR_MEMORY_ALLOCATION_FAILED;
+	}
+	return memory;
 }
 
-// 组合私钥和公钥生成最终加密密钥
-unsigned char* CombineKeys(const unsigned char* publicKey, int* combinedLength) {
-	if (!g_privateKey || !publicKey) return nullptr;
+// 释放由 EncodeAlloc 分配的内存（交还给分配该块的分配器）
+static void EncodeFree(void* memory) {
+	if (!memory) return;
 
-	int pubKeyLen = strlen((const char*)publicKey);
-	if (pubKeyLen == 0) return nullptr;
+	EncodeAllocHeader* header = (EncodeAllocHeader*)memory - 1;
+	size_t size = header->size;
+	bool budgeted = header->budgeted != 0;
+	header->allocator->free(header, header->allocator->user);
+	UnchargeBlock(size, budgeted);
+}
 
-	// 使用交错组合算法
-	int totalLen = g_privateKeyLength + pubKeyLen;
-	unsigned char* combinedKey = (unsigned char*)malloc(totalLen + 1);
-	if (!combinedKey) return nullptr;
+// 设置内存预算（0表示不限制），预算不足时最多等待 waitMilliseconds 毫秒
+int SetMemoryBudget(size_t budgetBytes, unsigned int waitMilliseconds) {
+	InterlockedExchange(&g_budgetWaitMilliseconds, (LONG)waitMilliseconds);
+	InterlockedExchange64(&g_memoryBudget, (LONGLONG)budgetBytes);
 
-	// 交错组合两个密钥，增强安全性
-	for (int i = 0; i < totalLen; i++) {
-		if (i % 2 == 0) {
-			// 偶数位置使用私钥
-			combinedKey[i] = g_privateKey[i / 2 % g_privateKeyLength];
-		}
-		else {
-			// 奇数位置使用公钥
-			combinedKey[i] = publicKey[i / 2 % pubKeyLen];
-		}
-		// 应用位运算增强混合效果
-		combinedKey[i] ^= (unsigned char)(i * 7 + 13);
+	// 新预算低于当前用量时先释放闲置的缓存缓冲区
+	if (budgetBytes > 0 && g_memoryCharged > (LONGLONG)budgetBytes) {
+		SweepStreamBufferCaches(true);
 	}
 
-	combinedKey[totalLen] = '\0';
-	*combinedLength = totalLen;
+	// 预算变化后让等待者重新检查
+	AcquireSRWLockExclusive(&g_budgetLock);
+	ReleaseSRWLockExclusive(&g_budgetLock);
+	WakeAllConditionVariable(&g_budgetReleased);
 
-	return combinedKey;
+	return SUCCESS;
 }
 
-// 计算数据校验和用于文件完整性验证
-unsigned int CalculateChecksum(const unsigned char* data, size_t length) {
-	unsigned int checksum = 0;
-	for (size_t i = 0; i < length; i++) {
-		checksum = (checksum << 1) ^ data[i];
+// 查询内存用量
+void GetMemoryUsage(size_t* currentBytes, size_t* peakBytes, size_t* budgetBytes) {
+	if (currentBytes) {
+		*currentBytes = (size_t)g_memoryUsed;
+	}
+	if (peakBytes) {
+		*peakBytes = (size_t)g_memoryPeak;
+	}
+	if (budgetBytes) {
+		*budgetBytes = (size_t)g_memoryBudget;
 	}
-	return checksum;
 }
 
-// 新增：计算更强的CRC32校验和，减少碰撞概率
-unsigned int CalculateCRC32(const unsigned char* data, size_t length) {
-	unsigned int crc = 0xFFFFFFFF;
-	static const unsigned int crc_table[256] = {
-		0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
-		0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
-		0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
-		0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
-		0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9,
-		0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
-		0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C,
-		0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
-		0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
-		0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
-		0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D, 0x76DC4190, 0x01DB7106,
-		0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
-		0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D,
-		0x91646C97, 0xE6635C01, 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
-		0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
-		0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
-		0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7,
-		0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
-		0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA,
-		0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
-		0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
-		0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
-		0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683, 0xE3630B12, 0x94643B84,
-		0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
-		0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB,
-		0x196C3671, 0x6E6B06E7, 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
-		0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
-		0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
-		0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55,
-		0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
-		0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28,
-		0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
-		0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
-		0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
-		0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242,
-		0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
-		0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69,
-		0x616BFFD3, 0x166CCF45, 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
-		0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
-		0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
-		0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693,
-		0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
-		0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
-	};
-	
-	for (size_t i = 0; i < length; i++) {
-		crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+// 设置内存分配器（两个函数都为空时恢复默认的 malloc/free）
+int SetEncodeAllocator(EncodeAllocFunc allocFunc, EncodeFreeFunc freeFunc, void* user) {
+	if (!allocFunc && !freeFunc) {
+		InterlockedExchangePointer((PVOID volatile*)&g_allocator, &g_defaultAllocator);
+		return SUCCESS;
+	}
+
+	if (!allocFunc || !freeFunc) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	EncodeAllocator* allocator = (EncodeAllocator*)malloc(sizeof(EncodeAllocator));
+	if (!allocator) {
+		return ERR_MEMORY_ALLOCATION_FAILED;
 	}
-	return crc ^ 0xFFFFFFFF;
+
+	allocator->alloc = allocFunc;
+	allocator->free = freeFunc;
+	allocator->user = user;
+
+	InterlockedExchangePointer((PVOID volatile*)&g_allocator, allocator);
+	return SUCCESS;
 }
 
-// 新增：计算公钥哈希值用于完整性验证
-unsigned int CalculatePublicKeyHash(const unsigned char* publicKey) {
-	if (!publicKey) return 0;
-	
-	size_t keyLen = strlen((const char*)publicKey);
-	if (keyLen == 0) return 0;
-	
-	// 使用更复杂的哈希算法，结合CRC32和MD5风格的混合
-	unsigned int hash1 = CalculateCRC32(publicKey, keyLen);
-	unsigned int hash2 = 0;
-	
-	// 第二轮哈希：MD5风格的块处理
-	for (size_t i = 0; i < keyLen; i++) {
-		hash2 = ((hash2 << 5) + hash2) + publicKey[i];
-		hash2 ^= (hash2 >> 11);
-		hash2 += (hash2 << 3);
-		hash2 ^= (hash2 >> 5);
-		hash2 += (hash2 << 2);
-		hash2 ^= (hash2 >> 15);
-		hash2 += (hash2 << 10);
-	}
-	
-	// 组合两个哈希值
-	return hash1 ^ hash2;
+// ========== 每线程状态（FLS 槽位） ==========
+
+// 本库可能由 EncodeLib 的内存加载器（DLLFromMemory）载入：加载器只调用 TLS 回调，既不分配 _tls_index，
+// 也不为线程安装模块的 TLS 数据块，因此隐式 TLS（thread_local / __declspec(thread)）在这种加载方式下不可用。
+// 每线程状态一律放在 FlsAlloc 分配的槽位中：线程退出时由槽位回调释放，DLL 卸载时 FlsFree 对各线程中的值调用回调
+struct FiberLocalSlot {
+	INIT_ONCE once;
+	DWORD index;                                   // FLS_OUT_OF_INDEXES 表示分配失败（调用方退回到不使用每线程状态的路径）
+	PFLS_CALLBACK_FUNCTION cleanup;                // 线程退出或槽位释放时对非空值调用
+	FiberLocalSlot* next;                          // 已分配槽位链表（DLL 卸载时逐个释放）
+};
+
+#define FIBER_LOCAL_SLOT_INIT(cleanup) { INIT_ONCE_STATIC_INIT, FLS_OUT_OF_INDEXES, cleanup, nullptr }
+
+static SRWLOCK g_fiberLocalSlotsLock = SRWLOCK_INIT;          // 保护已分配槽位链表
+static FiberLocalSlot* g_fiberLocalSlots = nullptr;
+
+static BOOL CALLBACK AllocFiberLocalSlot(PINIT_ONCE initOnce, PVOID parameter, PVOID* context) {
+	FiberLocalSlot* slot = (FiberLocalSlot*)parameter;
+	slot->index = FlsAlloc(slot->cleanup);
+	if (slot->index != FLS_OUT_OF_INDEXES) {
+		AcquireSRWLockExclusive(&g_fiberLocalSlotsLock);
+		slot->next = g_fiberLocalSlots;
+		g_fiberLocalSlots = slot;
+		ReleaseSRWLockExclusive(&g_fiberLocalSlotsLock);
+	}
+	return TRUE;
 }
 
-// 优化的流式文件加密函数（支持双密钥系统和复杂位旋转）
-int StreamEncryptFile(const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback) {
-	FILE* inputFile = NULL;
-	FILE* outputFile = NULL;
-	unsigned char* buffer = NULL;
-	unsigned char* combinedKey = NULL;
-	int result = SUCCESS;
-	int combinedKeyLength = 0;
+// 取得当前线程在槽位中的值（尚未设置或槽位不可用时为空）
+static void* GetFiberLocal(FiberLocalSlot* slot) {
+	InitOnceExecuteOnce(&slot->once, AllocFiberLocalSlot, slot, NULL);
+	return slot->index != FLS_OUT_OF_INDEXES ? FlsGetValue(slot->index) : nullptr;
+}
 
-	const size_t STREAM_BUFFER_SIZE = 4 * 1024 * 1024;  // 4MB大缓冲区用于高性能处理
+// 设置当前线程在槽位中的值，槽位不可用时返回 false
+static bool SetFiberLocal(FiberLocalSlot* slot, void* value) {
+	InitOnceExecuteOnce(&slot->once, AllocFiberLocalSlot, slot, NULL);
+	return slot->index != FLS_OUT_OF_INDEXES && FlsSetValue(slot->index, value);
+}
 
-	// 检查私钥是否已设置
-	if (!IsPrivateKeySet()) {
-		return ERR_PRIVATE_KEY_NOT_SET;
+// DLL 卸载时释放全部槽位：FlsFree 对各线程中的非空值调用清理回调，之后线程退出不再回调本模块的代码
+void ReleaseFiberLocalSlots() {
+	AcquireSRWLockExclusive(&g_fiberLocalSlotsLock);
+	for (FiberLocalSlot* slot = g_fiberLocalSlots; slot; slot = slot->next) {
+		FlsFree(slot->index);
 	}
+	g_fiberLocalSlots = nullptr;
+	ReleaseSRWLockExclusive(&g_fiberLocalSlotsLock);
+}
 
-	if (!publicKey) {
-		return ERR_INVALID_PARAMETER;
-	}
+// ========== 线程本地流式缓冲区缓存 ==========
 
-	// 进入临界区获取组合密钥
-	EnterCriticalSection(&g_keySection);
-	combinedKey = CombineKeys(publicKey, &combinedKeyLength);
-	LeaveCriticalSection(&g_keySection);
+// 文件操作内存区：输入/输出文件的 stdio 缓冲区 + 流式处理缓冲区
+#define FILE_CALL_ARENA_SIZE(streamBufferSize) (2 * BUFFER_SIZE + (streamBufferSize))
 
-	if (!combinedKey || combinedKeyLength == 0) {
-		return ERR_ENCRYPTION_FAILED;
+#define MAX_STREAM_BUFFER_SIZE (4 * 1024 * 1024)   // 最大流式缓冲区（4MB，用于大文件）
+#define STREAM_BUFFER_CLASS_COUNT 3                // 缓冲区大小档位数量
+#define STREAM_BUFFER_IDLE_MS 30000                // 缓存块闲置超过此时间后释放
+#define STREAM_BUFFER_SWEEP_MS 1000                // 闲置清理扫描的最小间隔
+
+// 按文件大小选择流式缓冲区档位，小文件使用小缓冲区
+static const size_t g_streamBufferClassSizes[STREAM_BUFFER_CLASS_COUNT] = { 64 * 1024, 512 * 1024, MAX_STREAM_BUFFER_SIZE };
+
+#define STREAM_SLOT_EMPTY 0                        // 无缓存块
+#define STREAM_SLOT_CACHED 1                       // 缓存块空闲，可被所属线程取用或被清理
+#define STREAM_SLOT_IN_USE 2                       // 缓存块正被所属线程使用
+#define STREAM_SLOT_TRIMMING 3                     // 缓存块正在被清理
+
+// 每个档位缓存一个内存块；状态切换使用原子操作，所属线程与清理线程之间无需加锁
+struct StreamBufferSlot {
+	volatile LONG state;
+	void* block;                                   // 由 EncodeAlloc 分配，大小为该档位的 FILE_CALL_ARENA_SIZE
+	ULONGLONG lastUsed;                            // 最近一次归还的时间（GetTickCount64）
+};
+
+// 线程缓存：放在 FLS 槽位中，首次使用时创建并登记到全局链表以便清理闲置块，线程退出时由槽位回调释放全部缓存块
+struct StreamBufferCache {
+	StreamBufferCache* prev;
+	StreamBufferCache* next;
+	StreamBufferSlot slots[STREAM_BUFFER_CLASS_COUNT];
+};
+
+static SRWLOCK g_streamCacheListLock = SRWLOCK_INIT;           // 保护线程缓存链表
+static StreamBufferCache* g_streamCacheList = nullptr;
+static volatile LONGLONG g_lastStreamCacheSweep = 0;           // 上次闲置清理的时间
+
+// 槽位回调：从链表中摘除并释放缓存块（线程退出时在所属线程上调用，DLL 卸载时在卸载线程上调用）
+static VOID WINAPI FreeStreamBufferCache(PVOID data) {
+	StreamBufferCache* cache = (StreamBufferCache*)data;
+
+	// 持有独占锁时清理扫描不会同时访问本缓存
+	AcquireSRWLockExclusive(&g_streamCacheListLock);
+	if (cache->prev) {
+		cache->prev->next = cache->next;
+	}
+	else {
+		g_streamCacheList = cache->next;
+	}
+	if (cache->next) {
+		cache->next->prev = cache->prev;
 	}
+	ReleaseSRWLockExclusive(&g_streamCacheListLock);
 
-	// 打开输入文件
-	fopen_s(&inputFile, filePath, "rb");
-	if (!inputFile) {
-		free(combinedKey);
-		return ERR_FILE_OPEN_FAILED;
+	for (int i = 0; i < STREAM_BUFFER_CLASS_COUNT; i++) {
+		if (cache->slots[i].state == STREAM_SLOT_CACHED) {
+			EncodeFree(cache->slots[i].block);
+		}
 	}
+	HeapFree(GetProcessHeap(), 0, cache);
+}
 
-	// 获取文件大小用于进度计算
-	_fseeki64(inputFile, 0, SEEK_END);
-	__int64 totalFileSize = _ftelli64(inputFile);
-	_fseeki64(inputFile, 0, SEEK_SET);
+static FiberLocalSlot g_streamBufferCacheSlot = FIBER_LOCAL_SLOT_INIT(FreeStreamBufferCache);
 
-	// 打开输出文件
-	fopen_s(&outputFile, outputPath, "wb");
-	if (!outputFile) {
-		fclose(inputFile);
-		free(combinedKey);
-		return ERR_FILE_OPEN_FAILED;
+// 取得当前线程的缓存（首次使用时创建），无法创建时返回空（调用方不经缓存直接分配和释放）
+static StreamBufferCache* GetStreamBufferCache() {
+	StreamBufferCache* cache = (StreamBufferCache*)GetFiberLocal(&g_streamBufferCacheSlot);
+	if (cache) {
+		return cache;
 	}
 
-	// 分配大缓冲区用于高性能处理
-	buffer = (unsigned char*)malloc(STREAM_BUFFER_SIZE);
-	if (!buffer) {
-		fclose(inputFile);
-		fclose(outputFile);
-		free(combinedKey);
-		return ERR_MEMORY_ALLOCATION_FAILED;
+	// 缓存本身很小且随线程常驻，在进程堆上分配，不计入内存用量
+	cache = (StreamBufferCache*)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(StreamBufferCache));
+	if (!cache) {
+		return nullptr;
 	}
 
-	// 写入魔数头用于标识加密文件
-	fwrite(MAGIC_HEADER, 1, MAGIC_HEADER_SIZE, outputFile);
-	fwrite(&combinedKeyLength, sizeof(int), 1, outputFile);
-
-	// 新增：写入公钥哈希值用于完整性验证
-	unsigned int publicKeyHash = CalculatePublicKeyHash(publicKey);
-	fwrite(&publicKeyHash, sizeof(unsigned int), 1, outputFile);
+	AcquireSRWLockExclusive(&g_streamCacheListLock);
+	cache->next = g_streamCacheList;
+	if (cache->next) {
+		cache->next->prev = cache;
+	}
+	g_streamCacheList = cache;
+	ReleaseSRWLockExclusive(&g_streamCacheListLock);
 
-	// 初始进度回调通知
-	if (progressCallback) {
-		progressCallback(filePath, 0.0);
+	if (!SetFiberLocal(&g_streamBufferCacheSlot, cache)) {
+		FreeStreamBufferCache(cache);
+		return nullptr;
 	}
+	return cache;
+}
 
-	// 大块处理文件以实现复杂加密的最高速度
-	size_t bytesRead;
-	__int64 totalProcessed = 0;
+// 释放闲置的缓存块（force 为 true 时释放所有线程当前未使用的缓存块）
+static void SweepStreamBufferCaches(bool force) {
+	ULONGLONG now = GetTickCount64();
 
-	while ((bytesRead = fread(buffer, 1, STREAM_BUFFER_SIZE, inputFile)) > 0) {
-		// 高效双层XOR + 半字节交换加密算法（替代位旋转）
-		for (size_t i = 0; i < bytesRead; i++) {
-			// 使用全局位置计算密钥索引，确保与StreamDecryptData一致
-			__int64 globalIndex = totalProcessed + i;
-			unsigned char keyByte = combinedKey[globalIndex % combinedKeyLength];
-			unsigned char a1 = buffer[i];                                    // 原始字节
-			unsigned char a2 = a1 ^ keyByte;                                 // 第一次XOR
-			unsigned char a3 = ((a2 & 0x0F) << 4) | ((a2 & 0xF0) >> 4);    // 半字节交换
-			unsigned char a4 = a3 ^ keyByte;                                 // 第二次XOR
-			buffer[i] = a4;                                                  // 最终加密结果
+	if (!force) {
+		LONGLONG lastSweep = g_lastStreamCacheSweep;
+		if (now - (ULONGLONG)lastSweep < STREAM_BUFFER_SWEEP_MS) {
+			return;
+		}
+		// 同一时间只需一个线程扫描
+		if (InterlockedCompareExchange64(&g_lastStreamCacheSweep, (LONGLONG)now, lastSweep) != lastSweep) {
+			return;
 		}
+	}
 
-		// 立即写入加密数据
-		size_t bytesWritten = fwrite(buffer, 1, bytesRead, outputFile);
-		if (bytesWritten != bytesRead) {
-			result = ERR_ENCRYPTION_FAILED;
-			break;
+	AcquireSRWLockShared(&g_streamCacheListLock);
+	for (StreamBufferCache* cache = g_streamCacheList; cache; cache = cache->next) {
+		for (int i = 0; i < STREAM_BUFFER_CLASS_COUNT; i++) {
+			StreamBufferSlot* slot = &cache->slots[i];
+			if (slot->state != STREAM_SLOT_CACHED || (!force && now - slot->lastUsed < STREAM_BUFFER_IDLE_MS)) {
+				continue;
+			}
+			if (InterlockedCompareExchange(&slot->state, STREAM_SLOT_TRIMMING, STREAM_SLOT_CACHED) == STREAM_SLOT_CACHED) {
+				void* block = slot->block;
+				slot->block = nullptr;
+				InterlockedExchange(&slot->state, STREAM_SLOT_EMPTY);
+				EncodeFree(block);
+			}
 		}
+	}
+	ReleaseSRWLockShared(&g_streamCacheListLock);
+}
 
-		totalProcessed += bytesRead;
+// 根据文件大小选择缓冲区档位（无法获取大小时使用最小档位）
+static int StreamBufferClassFor(const char* filePath) {
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!filePath || !GetFileAttributesExA(filePath, GetFileExInfoStandard, &attributes)) {
+		return 0;
+	}
 
-		// 进度回调 - 报告基于数据处理的真实进度
-		if (progressCallback && totalFileSize > 0) {
-			// 计算数据处理进度（0-98%），为写校验和预留2%
-			double dataProgress = (double)totalProcessed / (double)totalFileSize;
-			double adjustedProgress = dataProgress * 0.98; // 数据处理占98%
-			progressCallback(filePath, adjustedProgress);
+	ULONGLONG fileSize = ((ULONGLONG)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+	for (int i = 0; i < STREAM_BUFFER_CLASS_COUNT - 1; i++) {
+		if (fileSize <= g_streamBufferClassSizes[i]) {
+			return i;
 		}
 	}
 
-	// 写入校验和
-	if (result == SUCCESS) {
-		// 进度回调 - 写校验和阶段（98%-100%）
-		if (progressCallback) {
-			progressCallback(filePath, 0.99); // 99% - 开始写校验和
-		}
+	return STREAM_BUFFER_CLASS_COUNT - 1;
+}
 
-		// 使用更强的CRC32校验和替代简单校验和
-		unsigned int checksum = CalculateCRC32(combinedKey, combinedKeyLength);
-		fwrite(&checksum, sizeof(unsigned int), 1, outputFile);
+// 从当前线程缓存取出指定档位的内存块
+static void* TakeCachedStreamBlock(int sizeClass) {
+	StreamBufferCache* cache = GetStreamBufferCache();
+	if (!cache) {
+		return nullptr;
+	}
 
-		// 最终进度回调 - 100%完成
-		if (progressCallback) {
-			progressCallback(filePath, 1.0);
+	StreamBufferSlot* slot = &cache->slots[sizeClass];
+	if (InterlockedCompareExchange(&slot->state, STREAM_SLOT_IN_USE, STREAM_SLOT_CACHED) == STREAM_SLOT_CACHED) {
+		return slot->block;
+	}
+
+	return nullptr;
+}
+
+// 取得流式内存块：优先使用线程缓存；预算紧张时逐级改用较小的档位，最小档位仍不足时等待
+// sizeClass 输入期望档位，输出实际档位
+static void* AcquireStreamBlock(int* sizeClass, int* result) {
+	*result = SUCCESS;
+
+	for (int candidate = *sizeClass; candidate >= 0; candidate--) {
+		size_t blockSize = FILE_CALL_ARENA_SIZE(g_streamBufferClassSizes[candidate]);
+
+		void* block = TakeCachedStreamBlock(candidate);
+		if (!block && TryChargeMemory(blockSize)) {
+			block = AllocateCharged(blockSize, true);
+			if (!block) {
+				*result = ERR_MEMORY_ALLOCATION_FAILED;
+				return nullptr;
+			}
+		}
+
+		if (block) {
+			*sizeClass = candidate;
+			return block;
 		}
 	}
 
-	// 清理资源
-	if (combinedKey) {
-		SecureZeroMemory(combinedKey, combinedKeyLength);
-		free(combinedKey);
+	*sizeClass = 0;
+	return EncodeAllocWithinBudget(FILE_CALL_ARENA_SIZE(g_streamBufferClassSizes[0]), result);
+}
+
+// 归还内存块：放回当前线程缓存，缓存已被占用（嵌套调用）或用量超出预算时直接释放
+static void ReleaseStreamBlock(int sizeClass, void* block) {
+	StreamBufferCache* cache = GetStreamBufferCache();
+	StreamBufferSlot* slot = cache ? &cache->slots[sizeClass] : nullptr;
+	LONGLONG budget = g_memoryBudget;
+
+	if (!slot) {
+		EncodeFree(block);
+	}
+	else if (budget > 0 && g_memoryCharged > budget) {
+		if (slot->state == STREAM_SLOT_IN_USE && slot->block == block) {
+			slot->block = nullptr;
+			InterlockedExchange(&slot->state, STREAM_SLOT_EMPTY);
+		}
+		EncodeFree(block);
+	}
+	else if (slot->state == STREAM_SLOT_IN_USE && slot->block == block) {
+		slot->lastUsed = GetTickCount64();
+		InterlockedExchange(&slot->state, STREAM_SLOT_CACHED);
+	}
+	else if (InterlockedCompareExchange(&slot->state, STREAM_SLOT_IN_USE, STREAM_SLOT_EMPTY) == STREAM_SLOT_EMPTY) {
+		slot->block = block;
+		slot->lastUsed = GetTickCount64();
+		InterlockedExchange(&slot->state, STREAM_SLOT_CACHED);
+	}
+	else {
+		EncodeFree(block);
 	}
-	free(buffer);
-	fclose(inputFile);
-	fclose(outputFile);
 
-	return result;
+	SweepStreamBufferCaches(false);
 }
 
-// 优化的流式文件解密函数（支持双密钥系统和复杂位旋转）
-int StreamDecryptFile(const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback) {
-	FILE* inputFile = NULL;
-	FILE* outputFile = NULL;
-	unsigned char* buffer = NULL;
-	unsigned char* combinedKey = NULL;
+// 立即释放所有线程当前未使用的缓存块
+void TrimStreamBufferCache() {
+	SweepStreamBufferCaches(true);
+}
+
+// 单次调用内存区：一次操作需要的所有临时缓冲区从同一块内存中顺序切分，操作结束时整体释放
+#define CALL_ARENA_ALIGNMENT 16
+
+struct CallArena {
+	unsigned char* base;
+	size_t capacity;
+	size_t used;
+	int cacheClass;                                // 内存块所属的线程缓存档位
+};
+
+// 为文件操作准备内存区（从线程缓存取得），streamBufferSize 返回按文件大小和预算选择的流式缓冲区大小
+static int CallArenaReserveFile(CallArena* arena, const char* filePath, size_t* streamBufferSize) {
+	int sizeClass = StreamBufferClassFor(filePath);
 	int result = SUCCESS;
-	char header[MAGIC_HEADER_SIZE + 1];
-	int storedKeyLength = 0;
-	int combinedKeyLength = 0;
 
-	const size_t STREAM_BUFFER_SIZE = 4 * 1024 * 1024;  // 4MB大缓冲区
+	arena->base = (unsigned char*)AcquireStreamBlock(&sizeClass, &result);
+	arena->capacity = arena->base ? FILE_CALL_ARENA_SIZE(g_streamBufferClassSizes[sizeClass]) : 0;
+	arena->used = 0;
+	arena->cacheClass = sizeClass;
 
-	// 检查私钥是否已设置
-	if (!IsPrivateKeySet()) {
-		return ERR_PRIVATE_KEY_NOT_SET;
-	}
+	*streamBufferSize = g_streamBufferClassSizes[sizeClass];
+	return result;
+}
 
-	if (!publicKey) {
-		return ERR_INVALID_PARAMETER;
+static void* CallArenaAlloc(CallArena* arena, size_t size) {
+	size_t offset = (arena->used + CALL_ARENA_ALIGNMENT - 1) & ~(size_t)(CALL_ARENA_ALIGNMENT - 1);
+	if (offset > arena->capacity || size > arena->capacity - offset) {
+		return nullptr;
 	}
 
-	// 进入临界区获取组合密钥
-	EnterCriticalSection(&g_keySection);
-	combinedKey = CombineKeys(publicKey, &combinedKeyLength);
-	LeaveCriticalSection(&g_keySection);
+	arena->used = offset + size;
+	return arena->base + offset;
+}
 
-	if (!combinedKey || combinedKeyLength == 0) {
-		return ERR_DECRYPTION_FAILED;
+static void CallArenaRelease(CallArena* arena) {
+	if (arena->base) {
+		ReleaseStreamBlock(arena->cacheClass, arena->base);
 	}
+	arena->base = nullptr;
+	arena->capacity = 0;
+	arena->used = 0;
+}
 
-	// 打开输入文件
-	fopen_s(&inputFile, filePath, "rb");
-	if (!inputFile) {
-		free(combinedKey);
-		return ERR_FILE_OPEN_FAILED;
+// 让 stdio 使用内存区中的缓冲区，避免 CRT 为每个文件再分配一次（必须在文件打开后、任何读写之前调用）
+static void AttachStdioBuffer(FILE* file, CallArena* arena) {
+	char* buffer = (char*)CallArenaAlloc(arena, BUFFER_SIZE);
+	if (buffer) {
+		setvbuf(file, buffer, _IOFBF, BUFFER_SIZE);
 	}
+}
 
-	// 读取并验证文件头（早期格式检测）
-	if (fread(header, 1, MAGIC_HEADER_SIZE, inputFile) != MAGIC_HEADER_SIZE) {
-		fclose(inputFile);
-		free(combinedKey);
-		return ERR_INVALID_HEADER;
-	}
+// ========== 密钥材料安全内存区 ==========
 
-	header[MAGIC_HEADER_SIZE] = '\0';
-	if (strcmp(header, MAGIC_HEADER) != 0) {
-		fclose(inputFile);
-		free(combinedKey);
-		return ERR_INVALID_HEADER;
+#define SECURE_SLOT_SIZE 1024                      // 每个槽位大小（可容纳2048位私钥与常见长度公钥的组合密钥）
+#define SECURE_ARENA_SIZE (256 * 1024)             // 安全内存区总大小（256个槽位）
+
+// 超出槽位大小或内存区用尽时回退到堆内存，块头记录大小以便释放时擦除
+struct SecureHeapBlock {
+	size_t size;
+	size_t reserved;                       // 保持数据区按 MEMORY_ALLOCATION_ALIGNMENT 对齐
+};
+
+static unsigned char* g_secureArena = nullptr;                 // 锁定页内存区（进程内常驻）
+static SLIST_HEADER g_secureFreeList;                          // 空闲槽位无锁链表
+static INIT_ONCE g_secureArenaOnce = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK InitSecureArena(PINIT_ONCE initOnce, PVOID parameter, PVOID* context) {
+	InitializeSListHead(&g_secureFreeList);
+
+	unsigned char* arena = (unsigned char*)VirtualAlloc(NULL, SECURE_ARENA_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (!arena) {
+		return TRUE;    // 分配失败时所有密钥材料回退到堆内存
 	}
 
-	// 读取存储的密钥长度
-	if (fread(&storedKeyLength, sizeof(int), 1, inputFile) != 1) {
-		fclose(inputFile);
-		free(combinedKey);
-		return ERR_INVALID_HEADER;
+	// 锁定页面防止密钥被换出到页面文件；可锁定页数受最小工作集限制，失败时扩大工作集后重试
+	if (!VirtualLock(arena, SECURE_ARENA_SIZE)) {
+		SIZE_T minimumWorkingSet = 0;
+		SIZE_T maximumWorkingSet = 0;
+		if (GetProcessWorkingSetSize(GetCurrentProcess(), &minimumWorkingSet, &maximumWorkingSet) &&
+			SetProcessWorkingSetSize(GetCurrentProcess(), minimumWorkingSet + SECURE_ARENA_SIZE, maximumWorkingSet + SECURE_ARENA_SIZE)) {
+			VirtualLock(arena, SECURE_ARENA_SIZE);
+		}
 	}
 
-	// 新增：读取并验证公钥哈希值
-	unsigned int storedPublicKeyHash;
-	if (fread(&storedPublicKeyHash, sizeof(unsigned int), 1, inputFile) != 1) {
-		fclose(inputFile);
-		free(combinedKey);
-		return ERR_INVALID_HEADER;
+	// 逆序入栈，使低地址槽位先被使用
+	for (size_t offset = SECURE_ARENA_SIZE; offset >= SECURE_SLOT_SIZE; offset -= SECURE_SLOT_SIZE) {
+		InterlockedPushEntrySList(&g_secureFreeList, (PSLIST_ENTRY)(arena + offset - SECURE_SLOT_SIZE));
 	}
 
-	// 新增：早期公钥完整性验证
-	unsigned int currentPublicKeyHash = CalculatePublicKeyHash(publicKey);
-	if (storedPublicKeyHash != currentPublicKeyHash) {
-		fclose(inputFile);
-		free(combinedKey);
-		return ERR_DECRYPTION_FAILED; // 公钥不匹配
+	g_secureArena = arena;
+	return TRUE;
+}
+
+// 分配密钥材料内存（优先使用锁定页槽位，无系统调用、无堆分配）
+static unsigned char* SecureKeyAlloc(size_t size) {
+	InitOnceExecuteOnce(&g_secureArenaOnce, InitSecureArena, NULL, NULL);
+
+	if (g_secureArena && size <= SECURE_SLOT_SIZE) {
+		PSLIST_ENTRY slot = InterlockedPopEntrySList(&g_secureFreeList);
+		if (slot) {
+			return (unsigned char*)slot;
+		}
 	}
 
-	// Validate key length (early validation)
-	if (storedKeyLength != combinedKeyLength) {
-		fclose(inputFile);
-		free(combinedKey);
-		return ERR_DECRYPTION_FAILED;
+	SecureHeapBlock* block = (SecureHeapBlock*)EncodeAlloc(sizeof(SecureHeapBlock) + size);
+	if (!block) {
+		return nullptr;
+	}
+	block->size = size;
+
+	return (unsigned char*)(block + 1);
+}
+
+// 擦除并释放由 SecureKeyAlloc 分配的内存
+static void SecureKeyFree(void* memory) {
+	if (!memory) return;
+
+	unsigned char* pointer = (unsigned char*)memory;
+	if (g_secureArena && pointer >= g_secureArena && pointer < g_secureArena + SECURE_ARENA_SIZE) {
+		SecureZeroMemory(pointer, SECURE_SLOT_SIZE);
+		InterlockedPushEntrySList(&g_secureFreeList, (PSLIST_ENTRY)pointer);
+		return;
+	}
+
+	SecureHeapBlock* block = (SecureHeapBlock*)pointer - 1;
+	SecureZeroMemory(pointer, block->size);
+	EncodeFree(block);
+}
+
+// encode.hpp 加解密器的密钥材料分配器（使用安全内存区）
+struct SecureArenaKeyAllocator {
+	static unsigned char* Allocate(size_t size) noexcept {
+		return SecureKeyAlloc(size);
+	}
+
+	static void Free(unsigned char* memory, size_t size) noexcept {
+		SecureKeyFree(memory);
+	}
+};
+
+// 引擎0字节数组函数使用的加解密器
+typedef encode::Encoder<encode::StreamKey, encode::CallerBufferIo, encode::Sse2Kernel, SecureArenaKeyAllocator> StreamDataEncoder;
+typedef encode::Encoder<encode::SelfContainedKey, encode::CallerBufferIo, encode::Sse2Kernel, SecureArenaKeyAllocator> SelfContainedDataEncoder;
+
+// ========== 双密钥系统全局变量 ==========
+// 私钥快照：发布后只读，由引用计数管理生命周期（全局发布本身持有一个引用），位于安全内存区
+struct PrivateKeySnapshot {
+	volatile LONG refCount;      // 引用计数
+	LONG generation;             // 快照代号（每次创建递增，用于识别缓存结果对应的私钥）
+	int length;                  // 私钥长度
+	unsigned char* key;          // 私钥数据（与快照同一块内存，紧跟在结构体之后）
+};
+
+static PrivateKeySnapshot* volatile g_keySnapshot = nullptr;   // 当前发布的私钥快照
+static volatile LONG g_keyEpoch = 0;                           // 读者纪元，写者每次替换快照后递增
+static volatile LONG g_keyReaders[2] = { 0, 0 };               // 按纪元奇偶分组的在途读者数量
+static SRWLOCK g_keyWriterLock = SRWLOCK_INIT;                 // 仅用于串行化写者（静态初始化，无初始化竞争）
+static volatile LONG g_keyGeneration = 0;                      // 最近一次创建的快照代号
+
+static void EvictKeyBoundDecryptedBlobs();
+
+// ========== 双密钥系统函数实现 ==========
+
+// 创建私钥快照（引用计数初始为1）
+static PrivateKeySnapshot* CreateKeySnapshot(const unsigned char* privateKey, int keyLength) {
+	PrivateKeySnapshot* snapshot = (PrivateKeySnapshot*)SecureKeyAlloc(sizeof(PrivateKeySnapshot) + keyLength + 1);
+	if (!snapshot) return nullptr;
+
+	snapshot->refCount = 1;
+	snapshot->generation = InterlockedIncrement(&g_keyGeneration);
+	snapshot->length = keyLength;
+	snapshot->key = (unsigned char*)(snapshot + 1);
+	memcpy(snapshot->key, privateKey, keyLength);
+	snapshot->key[keyLength] = '\0';
+
+	return snapshot;
+}
+
+// 释放私钥快照引用，最后一个引用释放时擦除并回收内存
+static void ReleaseKeySnapshot(PrivateKeySnapshot* snapshot) {
+	if (!snapshot) return;
+
+	if (InterlockedDecrement(&snapshot->refCount) == 0) {
+		SecureKeyFree(snapshot);
+	}
+}
+
+// 获取当前私钥快照的引用（读者路径无锁，不会被写者阻塞）
+// 返回nullptr表示私钥未设置；使用完毕后必须调用 ReleaseKeySnapshot
+static PrivateKeySnapshot* AcquireKeySnapshot() {
+	LONG epoch;
+
+	// 登记为当前纪元的读者；若登记期间纪元已切换则重新登记
+	for (;;) {
+		epoch = g_keyEpoch;
+		InterlockedIncrement(&g_keyReaders[epoch & 1]);
+		if (epoch == g_keyEpoch) break;
+		InterlockedDecrement(&g_keyReaders[epoch & 1]);
+	}
+
+	PrivateKeySnapshot* snapshot = g_keySnapshot;
+	if (snapshot) {
+		InterlockedIncrement(&snapshot->refCount);
+	}
+
+	InterlockedDecrement(&g_keyReaders[epoch & 1]);
+	return snapshot;
+}
+
+// 发布新快照（可为nullptr），等待旧纪元读者完成引用计数登记后释放旧快照的全局引用
+static void PublishKeySnapshot(PrivateKeySnapshot* snapshot) {
+	AcquireSRWLockExclusive(&g_keyWriterLock);
+
+	PrivateKeySnapshot* oldSnapshot = (PrivateKeySnapshot*)InterlockedExchangePointer((PVOID volatile*)&g_keySnapshot, snapshot);
+
+	LONG epoch = g_keyEpoch;
+	InterlockedExchange(&g_keyEpoch, epoch + 1);
+
+	// 旧纪元的读者只在"读取指针+增加引用计数"这一极短窗口内停留
+	while (g_keyReaders[epoch & 1] != 0) {
+		YieldProcessor();
+	}
+
+	ReleaseSRWLockExclusive(&g_keyWriterLock);
+
+	// 仍在使用旧私钥的调用持有各自的引用，旧快照在它们全部释放后才会被回收
+	ReleaseKeySnapshot(oldSnapshot);
+
+	// 旧私钥解密出的缓存明文不再可能命中，立即移出缓存
+	EvictKeyBoundDecryptedBlobs();
+}
+
+// 初始化私钥
+int InitStreamFile(const char* privateKey) {
+	if (!privateKey) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	// 存储新私钥（支持任意长度）
+	int privateKeyLength = (int)strlen(privateKey);
+	if (privateKeyLength == 0) {
+		// 与之前行为保持一致：空私钥会清理之前的私钥
+		PublishKeySnapshot(nullptr);
+		return ERR_INVALID_PARAMETER;
+	}
+
+	PrivateKeySnapshot* snapshot = CreateKeySnapshot((const unsigned char*)privateKey, privateKeyLength);
+	if (!snapshot) {
+		return ERR_MEMORY_ALLOCATION_FAILED;
+	}
+
+	PublishKeySnapshot(snapshot);
+
+	return SUCCESS;
+}
+
+// 清理私钥
+void ClearPrivateKey() {
+	PublishKeySnapshot(nullptr);
+}
+
+// 检查私钥是否已设置
+int IsPrivateKeySet() {
+	return g_keySnapshot != nullptr ? 1 : 0;
+}
+
+// 交错组合私钥和公钥，写入 combinedKey（需至少 privateKeyLength + pubKeyLen + 1 字节）
+static void InterleaveKeys(unsigned char* combinedKey, const unsigned char* privateKey, int privateKeyLength, const unsigned char* publicKey, int pubKeyLen) {
+	encode::detail::InterleaveKeys(combinedKey, privateKey, privateKeyLength, publicKey, pubKeyLen);
+	combinedKey[privateKeyLength + pubKeyLen] = '\0';
+}
+
+// 组合私钥和公钥生成最终加密密钥（结果位于安全内存区，使用 SecureKeyFree 释放）
+unsigned char* CombineKeys(const PrivateKeySnapshot* snapshot, const unsigned char* publicKey, int* combinedLength) {
+	if (!snapshot || !publicKey) return nullptr;
+
+	int pubKeyLen = strlen((const char*)publicKey);
+	if (pubKeyLen == 0) return nullptr;
+
+	// 使用交错组合算法
+	int totalLen = snapshot->length + pubKeyLen;
+	unsigned char* combinedKey = SecureKeyAlloc(totalLen + 1);
+	if (!combinedKey) return nullptr;
+
+	InterleaveKeys(combinedKey, snapshot->key, snapshot->length, publicKey, pubKeyLen);
+	*combinedLength = totalLen;
+
+	return combinedKey;
+}
+
+// 计算数据校验和用于文件完整性验证
+unsigned int CalculateChecksum(const unsigned char* data, size_t length) {
+	unsigned int checksum = 0;
+	for (size_t i = 0; i < length; i++) {
+		checksum = (checksum << 1) ^ data[i];
+	}
+	return checksum;
+}
+
+// 新增：计算更强的CRC32校验和，减少碰撞概率
+unsigned int CalculateCRC32(const unsigned char* data, size_t length) {
+	return encode::detail::Crc32(data, length);
+}
+
+// 新增：计算公钥哈希值用于完整性验证
+unsigned int CalculatePublicKeyHash(const unsigned char* publicKey) {
+	if (!publicKey) return 0;
+
+	return encode::detail::PublicKeyHash(publicKey, strlen((const char*)publicKey));
+}
+
+// 双密钥格式头大小：魔数头 + 组合密钥长度 + 公钥哈希
+#define STREAM_HEADER_SIZE (MAGIC_HEADER_SIZE + sizeof(int) + sizeof(unsigned int))
+#define CHECKSUM_SIZE sizeof(unsigned int)         // 尾部CRC32校验和大小
+
+// 双层XOR + 半字节交换变换（自逆操作，加密与解密共用，实现见 encode.hpp）
+// position: 本段数据在整个数据区中的起始偏移，密钥索引按全局位置计算
+// output 可以等于 input，也可以位于 input 之前（原地处理时逐字节向前写入是安全的）
+static void TransformKeystream(unsigned char* output, const unsigned char* input, size_t length, const unsigned char* key, int keyLength, __int64 position) {
+	encode::ScalarKernel::Transform(output, input, length, key, keyLength, position);
+}
+
+// ========== SSE2 多缓冲区变换内核 ==========
+
+#define SIMD_BLOCK_SIZE 16                 // 每个向量处理的字节数
+#define MULTI_BUFFER_LANES 4               // 多缓冲区内核同时交错处理的消息数
+
+// 扩展密钥：组合密钥后追加 SIMD_BLOCK_SIZE 字节的循环重复，任意位置都可以直接加载16字节密钥流
+static unsigned char* CreateExtendedKey(const unsigned char* key, int keyLength) {
+	unsigned char* extendedKey = SecureKeyAlloc(keyLength + SIMD_BLOCK_SIZE);
+	if (!extendedKey) {
+		return NULL;
+	}
+
+	for (int i = 0; i < keyLength + SIMD_BLOCK_SIZE; i++) {
+		extendedKey[i] = key[i % keyLength];
+	}
+
+	return extendedKey;
+}
+
+static_assert(SIMD_BLOCK_SIZE == encode::Sse2Kernel::KeyPadding, "扩展密钥填充长度必须与 SSE2 内核一致");
+
+// 16字节并行变换：与 TransformKeystream 逐字节结果一致
+static inline __m128i TransformBlock(__m128i data, __m128i key) {
+	return encode::Sse2Kernel::TransformBlock(data, key);
+}
+
+// 单数据流向量化变换（output 可以等于 input）
+static void TransformKeystreamSimd(unsigned char* output, const unsigned char* input, size_t length, const unsigned char* extendedKey, int keyLength, __int64 position) {
+	encode::Sse2Kernel::Transform(output, input, length, extendedKey, keyLength, position);
+}
+
+// 多缓冲区变换：最多 MULTI_BUFFER_LANES 条从位置0开始的消息按相同密钥流位置交错处理，
+// 每个密钥块只加载一次，各消息的向量运算互不依赖，可以填满流水线
+static void TransformKeystreamLanes(unsigned char* const* outputs, const unsigned char* const* inputs, const size_t* lengths, int lanes, const unsigned char* extendedKey, int keyLength) {
+	size_t common = lengths[0];
+	for (int lane = 1; lane < lanes; lane++) {
+		if (lengths[lane] < common) {
+			common = lengths[lane];
+		}
+	}
+
+	size_t blocks = common - common % SIMD_BLOCK_SIZE;
+	size_t keyIndex = 0;
+
+	for (size_t i = 0; i < blocks; i += SIMD_BLOCK_SIZE) {
+		__m128i key = _mm_loadu_si128((const __m128i*)(extendedKey + keyIndex));
+		for (int lane = 0; lane < lanes; lane++) {
+			__m128i data = _mm_loadu_si128((const __m128i*)(inputs[lane] + i));
+			_mm_storeu_si128((__m128i*)(outputs[lane] + i), TransformBlock(data, key));
+		}
+
+		keyIndex += SIMD_BLOCK_SIZE;
+		if (keyIndex >= (size_t)keyLength) {
+			keyIndex %= keyLength;
+		}
+	}
+
+	// 各消息超出公共长度的部分单独处理
+	for (int lane = 0; lane < lanes; lane++) {
+		TransformKeystreamSimd(outputs[lane] + blocks, inputs[lane] + blocks, lengths[lane] - blocks, extendedKey, keyLength, blocks);
+	}
+}
+
+// 换钥变换：先按旧密钥流还原再按新密钥流变换，中间结果只在寄存器中
+// 两个密钥长度可以不同，各自按全局位置计算密钥索引
+static void RekeyKeystreamSimd(unsigned char* output, const unsigned char* input, size_t length, const unsigned char* oldExtendedKey, int oldKeyLength, const unsigned char* newExtendedKey, int newKeyLength, __int64 position) {
+	size_t oldIndex = (size_t)(position % oldKeyLength);
+	size_t newIndex = (size_t)(position % newKeyLength);
+	size_t i = 0;
+
+	for (; i + SIMD_BLOCK_SIZE <= length; i += SIMD_BLOCK_SIZE) {
+		__m128i oldKey = _mm_loadu_si128((const __m128i*)(oldExtendedKey + oldIndex));
+		__m128i newKey = _mm_loadu_si128((const __m128i*)(newExtendedKey + newIndex));
+		__m128i data = _mm_loadu_si128((const __m128i*)(input + i));
+		_mm_storeu_si128((__m128i*)(output + i), TransformBlock(TransformBlock(data, oldKey), newKey));
+
+		oldIndex += SIMD_BLOCK_SIZE;
+		if (oldIndex >= (size_t)oldKeyLength) {
+			oldIndex %= oldKeyLength;
+		}
+		newIndex += SIMD_BLOCK_SIZE;
+		if (newIndex >= (size_t)newKeyLength) {
+			newIndex %= newKeyLength;
+		}
+	}
+
+	TransformKeystream(output + i, input + i, length - i, oldExtendedKey, oldKeyLength, oldIndex);
+	TransformKeystream(output + i, output + i, length - i, newExtendedKey, newKeyLength, newIndex);
+}
+
+// ========== 异步操作取消标志 ==========
+
+// 异步操作在库的工作线程上执行同步实现，取消标志作为参数传给各文件函数，在块边界检查；同步调用传 NULL
+// （不使用线程本地变量：从内存加载本库时加载器不初始化隐式 TLS）
+static inline bool OperationCancelled(const volatile LONG* cancelFlag) {
+	return cancelFlag && *cancelFlag != 0;
+}
+
+// ========== 可轮询进度对象 ==========
+
+// 文件循环每处理一块只更新原子计数器；回调按最小时间间隔和最小进度步长限流，调用者也可以随时查询
+struct EncodeProgress {
+	volatile LONG refCount;                      // 调用者与正在使用它的异步操作各持有一个引用
+	volatile LONG phase;                         // ENCODE_PHASE_*
+	volatile LONG result;
+	volatile LONGLONG bytesDone;
+	volatile LONGLONG bytesTotal;
+	volatile LONGLONG startTick;
+	volatile LONGLONG lastNotifyTick;
+	volatile LONGLONG lastNotifyBytes;
+	EncodeProgressCallback callback;
+	void* userData;
+	unsigned int minIntervalMilliseconds;
+	double minStep;
+};
+
+// 当前线程绑定的进度对象（SetThreadProgress 设置，异步操作在工作线程上替换为提交时绑定的对象）
+// 绑定不持有引用，线程退出时无需清理
+static FiberLocalSlot g_progressSlot = FIBER_LOCAL_SLOT_INIT(nullptr);
+
+static inline EncodeProgress* GetThreadProgress() {
+	return (EncodeProgress*)GetFiberLocal(&g_progressSlot);
+}
+
+static inline LONGLONG ReadProgressCounter(volatile LONGLONG* counter) {
+	return InterlockedCompareExchange64(counter, 0, 0);   // 32位进程中64位读取也保持原子
+}
+
+static void FillProgressInfo(EncodeProgress* progress, EncodeProgressInfo* info) {
+	info->phase = progress->phase;
+	info->result = progress->result;
+	info->bytesDone = (unsigned long long)ReadProgressCounter(&progress->bytesDone);
+	info->bytesTotal = (unsigned long long)ReadProgressCounter(&progress->bytesTotal);
+	info->fraction = info->bytesTotal > 0 ? (double)info->bytesDone / (double)info->bytesTotal : (info->phase == ENCODE_PHASE_COMPLETED ? 1.0 : 0.0);
+
+	ULONGLONG elapsed = GetTickCount64() - (ULONGLONG)ReadProgressCounter(&progress->startTick);
+	info->bytesPerSecond = elapsed > 0 ? (double)info->bytesDone * 1000.0 / (double)elapsed : 0.0;
+}
+
+// 满足限流条件时调用回调；多个线程同时满足条件时只有一个线程调用
+static void NotifyProgress(EncodeProgress* progress, bool force) {
+	if (!progress->callback) {
+		return;
+	}
+
+	ULONGLONG now = GetTickCount64();
+	LONGLONG lastTick = ReadProgressCounter(&progress->lastNotifyTick);
+	if (!force) {
+		if (now - (ULONGLONG)lastTick < progress->minIntervalMilliseconds) {
+			return;
+		}
+
+		LONGLONG total = ReadProgressCounter(&progress->bytesTotal);
+		LONGLONG advanced = ReadProgressCounter(&progress->bytesDone) - ReadProgressCounter(&progress->lastNotifyBytes);
+		if (progress->minStep > 0.0 && total > 0 && (double)advanced < progress->minStep * (double)total) {
+			return;
+		}
+
+		if (InterlockedCompareExchange64(&progress->lastNotifyTick, (LONGLONG)now, lastTick) != lastTick) {
+			return;
+		}
+	}
+	else {
+		InterlockedExchange64(&progress->lastNotifyTick, (LONGLONG)now);
+	}
+
+	EncodeProgressInfo info;
+	info.cbSize = sizeof(info);
+	FillProgressInfo(progress, &info);
+	InterlockedExchange64(&progress->lastNotifyBytes, (LONGLONG)info.bytesDone);
+	progress->callback(&info, progress->userData);
+}
+
+static inline void ProgressBegin(__int64 bytesTotal) {
+	EncodeProgress* progress = GetThreadProgress();
+	if (progress) {
+		InterlockedExchange64(&progress->bytesDone, 0);
+		InterlockedExchange64(&progress->bytesTotal, bytesTotal);
+		InterlockedExchange64(&progress->lastNotifyBytes, 0);
+		InterlockedExchange64(&progress->startTick, (LONGLONG)GetTickCount64());
+		InterlockedExchange(&progress->result, SUCCESS);
+		// 开始回调只在进入运行阶段时调用一次，不受限流影响（异步操作提交时已进入运行阶段，实际开始时只更新总量）
+		if (InterlockedExchange(&progress->phase, ENCODE_PHASE_RUNNING) != ENCODE_PHASE_RUNNING) {
+			NotifyProgress(progress, true);
+		}
+	}
+}
+
+static inline void ProgressAdvance(__int64 bytesDone) {
+	EncodeProgress* progress = GetThreadProgress();
+	if (progress) {
+		InterlockedExchange64(&progress->bytesDone, bytesDone);
+		NotifyProgress(progress, false);
+	}
+}
+
+// 进入结束阶段；只有从运行阶段结束时才调用回调（重复结束不会重复通知）
+static inline void ProgressEnd(int result) {
+	EncodeProgress* progress = GetThreadProgress();
+	if (progress) {
+		InterlockedExchange(&progress->result, result);
+		LONG phase = result == SUCCESS ? ENCODE_PHASE_COMPLETED : (result == ERR_OPERATION_CANCELLED ? ENCODE_PHASE_CANCELLED : ENCODE_PHASE_FAILED);
+		if (InterlockedExchange(&progress->phase, phase) == ENCODE_PHASE_RUNNING) {
+			NotifyProgress(progress, true);
+		}
+	}
+}
+
+int CreateProgress(const EncodeProgressOptions* options, EncodeProgress** progress) {
+	if (!progress || (options && options->cbSize < sizeof(EncodeProgressOptions))) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	*progress = NULL;
+
+	EncodeProgress* tracker = (EncodeProgress*)EncodeAlloc(sizeof(EncodeProgress));
+	if (!tracker) {
+		return ERR_MEMORY_ALLOCATION_FAILED;
+	}
+
+	memset(tracker, 0, sizeof(EncodeProgress));
+	tracker->refCount = 1;
+	tracker->phase = ENCODE_PHASE_IDLE;
+	tracker->startTick = (LONGLONG)GetTickCount64();
+	if (options) {
+		tracker->callback = options->callback;
+		tracker->userData = options->userData;
+		tracker->minIntervalMilliseconds = options->minIntervalMilliseconds;
+		tracker->minStep = options->minStep > 0.0 ? options->minStep : 0.0;
+	}
+
+	*progress = tracker;
+	return SUCCESS;
+}
+
+int QueryProgress(EncodeProgress* progress, EncodeProgressInfo* info) {
+	if (!progress || !info || info->cbSize < sizeof(EncodeProgressInfo)) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	FillProgressInfo(progress, info);
+	return SUCCESS;
+}
+
+static void AddProgressRef(EncodeProgress* progress) {
+	if (progress) {
+		InterlockedIncrement(&progress->refCount);
+	}
+}
+
+static void ReleaseProgress(EncodeProgress* progress) {
+	if (progress && InterlockedDecrement(&progress->refCount) == 0) {
+		EncodeFree(progress);
+	}
+}
+
+void DestroyProgress(EncodeProgress* progress) {
+	ReleaseProgress(progress);
+}
+
+EncodeProgress* SetThreadProgress(EncodeProgress* progress) {
+	EncodeProgress* previous = GetThreadProgress();
+	SetFiberLocal(&g_progressSlot, progress);
+	return previous;
+}
+
+// ========== 可插拔加密引擎 ==========
+
+static int FillRandomBytes(unsigned char* output, size_t length);
+
+// 引擎0：双层XOR + 半字节交换（原有算法，使用 V1.0 文件头，无引擎参数和尾部数据）
+struct XorNibbleContext {
+	unsigned char* extendedKey;
+	int keyLength;
+};
+
+static int XorNibbleInit(void* context, const unsigned char* key, int keyLength, const unsigned char* engineHeader, int encrypt) {
+	XorNibbleContext* state = (XorNibbleContext*)context;
+	state->extendedKey = CreateExtendedKey(key, keyLength);
+	state->keyLength = keyLength;
+	return state->extendedKey ? 0 : -1;
+}
+
+static void XorNibbleTransform(void* context, unsigned char* output, const unsigned char* input, size_t length, __int64 position) {
+	XorNibbleContext* state = (XorNibbleContext*)context;
+	TransformKeystreamSimd(output, input, length, state->extendedKey, state->keyLength, position);
+}
+
+static int XorNibbleFinalize(void* context, unsigned char* trailer) {
+	return 0;
+}
+
+static void XorNibbleCleanup(void* context) {
+	XorNibbleContext* state = (XorNibbleContext*)context;
+	SecureKeyFree(state->extendedKey);
+	state->extendedKey = NULL;
+}
+
+static const CipherEngine g_xorNibbleEngine = {
+	ENCODE_ENGINE_XOR_NIBBLE, "xor-nibble", sizeof(XorNibbleContext), 0, 0,
+	XorNibbleInit, XorNibbleTransform, XorNibbleFinalize, XorNibbleCleanup, XorNibbleTransform, NULL, 0
+};
+
+// 引擎注册表
+static const CipherEngine* const g_cipherEngines[] = {
+	&g_xorNibbleEngine,
+	&g_aesGcmEngine,
+};
+
+#define CIPHER_ENGINE_COUNT (sizeof(g_cipherEngines) / sizeof(g_cipherEngines[0]))
+
+static INIT_ONCE g_cipherEngineSelfTestOnce[CIPHER_ENGINE_COUNT];   // 零初始化即 INIT_ONCE_STATIC_INIT
+static bool g_cipherEngineSelfTestPassed[CIPHER_ENGINE_COUNT];
+
+static BOOL CALLBACK RunCipherEngineSelfTest(PINIT_ONCE initOnce, PVOID parameter, PVOID* context) {
+	size_t index = (size_t)(ULONG_PTR)parameter;
+	const CipherEngine* engine = g_cipherEngines[index];
+	g_cipherEngineSelfTestPassed[index] = !engine->selfTest || engine->selfTest() == 0;
+	return TRUE;
+}
+
+const CipherEngine* FindCipherEngine(int engineId) {
+	for (size_t i = 0; i < CIPHER_ENGINE_COUNT; i++) {
+		if (g_cipherEngines[i]->id == engineId) {
+			// 每个引擎首次使用时运行一次自检，未通过的引擎加解密都返回 ERR_UNSUPPORTED_ENGINE
+			InitOnceExecuteOnce(&g_cipherEngineSelfTestOnce[i], RunCipherEngineSelfTest, (PVOID)(ULONG_PTR)i, NULL);
+			return g_cipherEngineSelfTestPassed[i] ? g_cipherEngines[i] : NULL;
+		}
+	}
+	return NULL;
+}
+
+int IsCipherEngineAvailable(int engineId) {
+	return FindCipherEngine(engineId) ? 1 : 0;
+}
+
+// 从调用者选项中选择加密引擎（options 为空时使用引擎0）
+static int ResolveCipherEngine(const EncodeOptions* options, const CipherEngine** engine) {
+	int engineId = ENCODE_ENGINE_XOR_NIBBLE;
+
+	if (options) {
+		if (options->cbSize < offsetof(EncodeOptions, engineId) + sizeof(options->engineId)) {
+			return ERR_INVALID_PARAMETER;
+		}
+		engineId = options->engineId;
+	}
+
+	*engine = FindCipherEngine(engineId);
+	return *engine ? SUCCESS : ERR_UNSUPPORTED_ENGINE;
+}
+
+// 加密数据格式：V1.0 魔数表示引擎0；V1.1 魔数后紧跟1字节引擎标识和引擎参数，其余字段与 V1.0 相同，
+// 引擎尾部数据位于CRC32校验和之前
+struct EncodedFormat {
+	const char* magic;                     // V1.0 魔数（引擎0）
+	const char* engineMagic;               // V1.1 魔数（其它引擎）
+	size_t magicSize;
+};
+
+#define ENGINE_PREFIX_MAX_SIZE (16 + 1 + CIPHER_ENGINE_MAX_HEADER)     // 魔数 + 引擎标识 + 引擎参数的上限
+
+static const EncodedFormat g_streamFormat = { MAGIC_HEADER, MAGIC_HEADER_V11, MAGIC_HEADER_SIZE };
+
+// 魔数与引擎参数部分的大小
+static size_t EnginePrefixSize(const EncodedFormat* format, const CipherEngine* engine) {
+	if (engine->id == ENCODE_ENGINE_XOR_NIBBLE) {
+		return format->magicSize;
+	}
+	return format->magicSize + 1 + engine->headerSize;
+}
+
+// 写入魔数与引擎参数，返回写入的字节数
+static size_t WriteEnginePrefix(unsigned char* output, const EncodedFormat* format, const CipherEngine* engine, const unsigned char* engineHeader) {
+	if (engine->id == ENCODE_ENGINE_XOR_NIBBLE) {
+		memcpy(output, format->magic, format->magicSize);
+		return format->magicSize;
+	}
+
+	memcpy(output, format->engineMagic, format->magicSize);
+	output[format->magicSize] = (unsigned char)engine->id;
+	memcpy(output + format->magicSize + 1, engineHeader, engine->headerSize);
+	return EnginePrefixSize(format, engine);
+}
+
+// 解析内存中的魔数与引擎参数
+static int ParseEnginePrefix(const unsigned char* data, size_t length, const EncodedFormat* format, const CipherEngine** engine, unsigned char* engineHeader, size_t* prefixSize) {
+	if (length < format->magicSize) {
+		return ERR_INVALID_HEADER;
+	}
+
+	if (memcmp(data, format->magic, format->magicSize) == 0) {
+		*engine = &g_xorNibbleEngine;
+		*prefixSize = format->magicSize;
+		return SUCCESS;
+	}
+
+	if (memcmp(data, format->engineMagic, format->magicSize) != 0 || length < format->magicSize + 1) {
+		return ERR_INVALID_HEADER;
+	}
+
+	*engine = FindCipherEngine(data[format->magicSize]);
+	if (!*engine) {
+		return ERR_UNSUPPORTED_ENGINE;
+	}
+
+	*prefixSize = EnginePrefixSize(format, *engine);
+	if (length < *prefixSize) {
+		return ERR_INVALID_HEADER;
+	}
+
+	memcpy(engineHeader, data + format->magicSize + 1, (*engine)->headerSize);
+	return SUCCESS;
+}
+
+// 从文件当前位置读取魔数与引擎参数
+static int ReadEnginePrefix(FILE* file, const EncodedFormat* format, const CipherEngine** engine, unsigned char* engineHeader) {
+	unsigned char prefix[ENGINE_PREFIX_MAX_SIZE];
+	size_t length = format->magicSize;
+
+	if (fread(prefix, 1, length, file) != length) {
+		return ERR_INVALID_HEADER;
+	}
+
+	if (memcmp(prefix, format->engineMagic, format->magicSize) == 0) {
+		if (fread(prefix + length, 1, 1, file) != 1) {
+			return ERR_INVALID_HEADER;
+		}
+		length++;
+
+		const CipherEngine* found = FindCipherEngine(prefix[format->magicSize]);
+		if (found) {
+			if (fread(prefix + length, 1, found->headerSize, file) != found->headerSize) {
+				return ERR_INVALID_HEADER;
+			}
+			length += found->headerSize;
+		}
+	}
+
+	size_t prefixSize = 0;
+	return ParseEnginePrefix(prefix, length, format, engine, engineHeader, &prefixSize);
+}
+
+// 一个数据流的引擎实例
+struct CipherStream {
+	const CipherEngine* engine;
+	void* context;
+};
+
+// 用已有的引擎参数创建引擎实例（续做加密时沿用输出文件头中的引擎参数）
+static int CipherStreamAttach(CipherStream* stream, const CipherEngine* engine, const unsigned char* key, int keyLength, const unsigned char* engineHeader, int encrypt) {
+	stream->engine = engine;
+	stream->context = SecureKeyAlloc(engine->contextSize);
+	if (!stream->context) {
+		return ERR_MEMORY_ALLOCATION_FAILED;
+	}
+
+	if (engine->init(stream->context, key, keyLength, engineHeader, encrypt) != 0) {
+		SecureKeyFree(stream->context);
+		stream->context = NULL;
+		return encrypt ? ERR_ENCRYPTION_FAILED : ERR_DECRYPTION_FAILED;
+	}
+
+	return SUCCESS;
+}
+
+// 创建引擎实例；加密时先为引擎参数生成随机数
+static int CipherStreamOpen(CipherStream* stream, const CipherEngine* engine, const unsigned char* key, int keyLength, unsigned char* engineHeader, int encrypt) {
+	if (encrypt && engine->headerSize > 0) {
+		stream->context = NULL;
+		int result = FillRandomBytes(engineHeader, engine->headerSize);
+		if (result != SUCCESS) {
+			return result;
+		}
+	}
+
+	return CipherStreamAttach(stream, engine, key, keyLength, engineHeader, encrypt);
+}
+
+// 数据量是否在引擎单个数据流的上限之内（加密时在写出任何数据前检查）
+static bool EngineAcceptsLength(const CipherEngine* engine, unsigned long long length) {
+	return engine->maxDataLength == 0 || length <= engine->maxDataLength;
+}
+
+// 擦除并释放引擎实例
+static void CipherStreamClose(CipherStream* stream) {
+	if (stream->context) {
+		stream->engine->cleanup(stream->context);
+		SecureKeyFree(stream->context);
+		stream->context = NULL;
+	}
+}
+
+// 双密钥格式在明文之外的开销：文件头 + 引擎尾部数据 + 校验和
+static size_t StreamOverheadFor(const CipherEngine* engine) {
+	return STREAM_HEADER_SIZE - MAGIC_HEADER_SIZE + EnginePrefixSize(&g_streamFormat, engine) + engine->trailerSize + CHECKSUM_SIZE;
+}
+
+// 优化的流式文件加密函数（支持双密钥系统和复杂位旋转）
+static int StreamEncryptFileWithSnapshot(const PrivateKeySnapshot* keySnapshot, const CipherEngine* engine, const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback, const volatile LONG* cancelFlag) {
+	FILE* inputFile = NULL;
+	FILE* outputFile = NULL;
+	unsigned char* buffer = NULL;
+	CallArena arena;
+	unsigned char* combinedKey = NULL;
+	int result = SUCCESS;
+	int combinedKeyLength = 0;
+
+	size_t streamBufferSize = 0;                       // 按文件大小从线程缓存中选择
+
+	// 检查私钥是否已设置
+	if (!keySnapshot) {
+		return ERR_PRIVATE_KEY_NOT_SET;
+	}
+
+	if (!publicKey) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	combinedKey = CombineKeys(keySnapshot, publicKey, &combinedKeyLength);
+
+	if (!combinedKey || combinedKeyLength == 0) {
+		return ERR_ENCRYPTION_FAILED;
+	}
+
+	// 创建引擎实例（同时生成引擎参数）
+	CipherStream cipher;
+	unsigned char engineHeader[CIPHER_ENGINE_MAX_HEADER];
+	result = CipherStreamOpen(&cipher, engine, combinedKey, combinedKeyLength, engineHeader, 1);
+	if (result != SUCCESS) {
+		SecureKeyFree(combinedKey);
+		return result;
+	}
+
+	// 从线程缓存取得流式缓冲区和两个文件的 stdio 缓冲区
+	int arenaResult = CallArenaReserveFile(&arena, filePath, &streamBufferSize);
+	if (arenaResult != SUCCESS) {
+		CipherStreamClose(&cipher);
+		SecureKeyFree(combinedKey);
+		return arenaResult;
+	}
+	buffer = (unsigned char*)CallArenaAlloc(&arena, streamBufferSize);
+
+	// 打开输入文件
+	fopen_s(&inputFile, filePath, "rb");
+	if (!inputFile) {
+		CipherStreamClose(&cipher);
+		SecureKeyFree(combinedKey);
+		CallArenaRelease(&arena);
+		return ERR_FILE_OPEN_FAILED;
+	}
+	AttachStdioBuffer(inputFile, &arena);
+
+	// 获取文件大小用于进度计算
+	_fseeki64(inputFile, 0, SEEK_END);
+	__int64 totalFileSize = _ftelli64(inputFile);
+	_fseeki64(inputFile, 0, SEEK_SET);
+
+	// 超过引擎单个数据流的上限时在创建输出文件之前拒绝
+	if (!EngineAcceptsLength(engine, (unsigned long long)totalFileSize)) {
+		fclose(inputFile);
+		CipherStreamClose(&cipher);
+		SecureKeyFree(combinedKey);
+		CallArenaRelease(&arena);
+		return ERR_INVALID_PARAMETER;
+	}
+
+	// 打开输出文件
+	fopen_s(&outputFile, outputPath, "wb");
+	if (!outputFile) {
+		fclose(inputFile);
+		CipherStreamClose(&cipher);
+		SecureKeyFree(combinedKey);
+		CallArenaRelease(&arena);
+		return ERR_FILE_OPEN_FAILED;
+	}
+	AttachStdioBuffer(outputFile, &arena);
+
+	// 写入魔数头用于标识加密文件（引擎0以外的引擎附带引擎标识和引擎参数）
+	unsigned char prefix[ENGINE_PREFIX_MAX_SIZE];
+	fwrite(prefix, 1, WriteEnginePrefix(prefix, &g_streamFormat, engine, engineHeader), outputFile);
+	fwrite(&combinedKeyLength, sizeof(int), 1, outputFile);
+
+	// 新增：写入公钥哈希值用于完整性验证
+	unsigned int publicKeyHash = CalculatePublicKeyHash(publicKey);
+	fwrite(&publicKeyHash, sizeof(unsigned int), 1, outputFile);
+
+	// 初始进度回调通知
+	ProgressBegin(totalFileSize);
+	if (progressCallback) {
+		progressCallback(filePath, 0.0);
+	}
+
+	// 大块处理文件以实现复杂加密的最高速度
+	size_t bytesRead;
+	__int64 totalProcessed = 0;
+
+	while ((bytesRead = fread(buffer, 1, streamBufferSize, inputFile)) > 0) {
+		// 异步操作被取消时在块边界停止
+		if (OperationCancelled(cancelFlag)) {
+			result = ERR_OPERATION_CANCELLED;
+			break;
+		}
+
+		// 按文件头记录的引擎加密
+		engine->transform(cipher.context, buffer, buffer, bytesRead, totalProcessed);
+
+		// 立即写入加密数据
+		size_t bytesWritten = fwrite(buffer, 1, bytesRead, outputFile);
+		if (bytesWritten != bytesRead) {
+			result = ERR_ENCRYPTION_FAILED;
+			break;
+		}
+
+		totalProcessed += bytesRead;
+		ProgressAdvance(totalProcessed);
+
+		// 进度回调 - 报告基于数据处理的真实进度
+		if (progressCallback && totalFileSize > 0) {
+			// 计算数据处理进度（0-98%），为写校验和预留2%
+			double dataProgress = (double)totalProcessed / (double)totalFileSize;
+			double adjustedProgress = dataProgress * 0.98; // 数据处理占98%
+			progressCallback(filePath, adjustedProgress);
+		}
+	}
+
+	// 写入引擎尾部数据（如认证标签）
+	if (result == SUCCESS) {
+		unsigned char trailer[CIPHER_ENGINE_MAX_TRAILER];
+		if (engine->finalize(cipher.context, trailer) != 0) {
+			result = ERR_ENCRYPTION_FAILED;
+		}
+		else if (engine->trailerSize > 0) {
+			fwrite(trailer, 1, engine->trailerSize, outputFile);
+		}
+	}
+
+	// 写入校验和
+	if (result == SUCCESS) {
+		// 进度回调 - 写校验和阶段（98%-100%）
+		if (progressCallback) {
+			progressCallback(filePath, 0.99); // 99% - 开始写校验和
+		}
+
+		// 使用更强的CRC32校验和替代简单校验和
+		unsigned int checksum = CalculateCRC32(combinedKey, combinedKeyLength);
+		fwrite(&checksum, sizeof(unsigned int), 1, outputFile);
+
+		// 最终进度回调 - 100%完成
+		if (progressCallback) {
+			progressCallback(filePath, 1.0);
+		}
+	}
+
+	// 清理资源
+	CipherStreamClose(&cipher);
+	SecureKeyFree(combinedKey);
+	fclose(inputFile);
+	fclose(outputFile);
+	CallArenaRelease(&arena);
+
+	if (result != SUCCESS) {
+		remove(outputPath);  // 加密失败或被取消时删除不完整的输出文件
+	}
+
+	ProgressEnd(result);
+
+	return result;
+}
+
+// 优化的流式文件解密函数（支持双密钥系统和复杂位旋转）
+static int StreamDecryptFileWithSnapshot(const PrivateKeySnapshot* keySnapshot, const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback, const volatile LONG* cancelFlag) {
+	FILE* inputFile = NULL;
+	FILE* outputFile = NULL;
+	unsigned char* buffer = NULL;
+	CallArena arena;
+	unsigned char* combinedKey = NULL;
+	int result = SUCCESS;
+	const CipherEngine* engine = NULL;
+	unsigned char engineHeader[CIPHER_ENGINE_MAX_HEADER];
+	int storedKeyLength = 0;
+	int combinedKeyLength = 0;
+
+	size_t streamBufferSize = 0;                       // 按文件大小从线程缓存中选择
+
+	// 检查私钥是否已设置
+	if (!keySnapshot) {
+		return ERR_PRIVATE_KEY_NOT_SET;
+	}
+
+	if (!publicKey) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	combinedKey = CombineKeys(keySnapshot, publicKey, &combinedKeyLength);
+
+	if (!combinedKey || combinedKeyLength == 0) {
+		return ERR_DECRYPTION_FAILED;
+	}
+
+	// 从线程缓存取得流式缓冲区和两个文件的 stdio 缓冲区
+	int arenaResult = CallArenaReserveFile(&arena, filePath, &streamBufferSize);
+	if (arenaResult != SUCCESS) {
+		SecureKeyFree(combinedKey);
+		return arenaResult;
+	}
+	buffer = (unsigned char*)CallArenaAlloc(&arena, streamBufferSize);
+
+	// 打开输入文件
+	fopen_s(&inputFile, filePath, "rb");
+	if (!inputFile) {
+		SecureKeyFree(combinedKey);
+		CallArenaRelease(&arena);
+		return ERR_FILE_OPEN_FAILED;
+	}
+	AttachStdioBuffer(inputFile, &arena);
+
+	// 读取并验证文件头（早期格式检测），确定加密引擎
+	result = ReadEnginePrefix(inputFile, &g_streamFormat, &engine, engineHeader);
+	if (result != SUCCESS) {
+		fclose(inputFile);
+		SecureKeyFree(combinedKey);
+		CallArenaRelease(&arena);
+		return result;
+	}
+
+	// 读取存储的密钥长度
+	if (fread(&storedKeyLength, sizeof(int), 1, inputFile) != 1) {
+		fclose(inputFile);
+		SecureKeyFree(combinedKey);
+		CallArenaRelease(&arena);
+		return ERR_INVALID_HEADER;
+	}
+
+	// 新增：读取并验证公钥哈希值
+	unsigned int storedPublicKeyHash;
+	if (fread(&storedPublicKeyHash, sizeof(unsigned int), 1, inputFile) != 1) {
+		fclose(inputFile);
+		SecureKeyFree(combinedKey);
+		CallArenaRelease(&arena);
+		return ERR_INVALID_HEADER;
+	}
+
+	// 新增：早期公钥完整性验证
+	unsigned int currentPublicKeyHash = CalculatePublicKeyHash(publicKey);
+	if (storedPublicKeyHash != currentPublicKeyHash) {
+		fclose(inputFile);
+		SecureKeyFree(combinedKey);
+		CallArenaRelease(&arena);
+		return ERR_DECRYPTION_FAILED; // 公钥不匹配
+	}
+
+	// Validate key length (early validation)
+	if (storedKeyLength != combinedKeyLength) {
+		fclose(inputFile);
+		SecureKeyFree(combinedKey);
+		CallArenaRelease(&arena);
+		return ERR_DECRYPTION_FAILED;
 	}
 
 	// *** 新增：立即验证校验和，避免大文件错误解密 ***
 	// 保存当前文件位置
 	__int64 currentPos = _ftelli64(inputFile);
 
-	// 跳到文件末尾读取校验和
-	_fseeki64(inputFile, -(__int64)sizeof(unsigned int), SEEK_END);
-	unsigned int storedChecksum;
-	if (fread(&storedChecksum, sizeof(unsigned int), 1, inputFile) == 1) {
-		// 使用更强的CRC32校验和替代简单校验和
-		unsigned int calculatedChecksum = CalculateCRC32(combinedKey, combinedKeyLength);
-		if (storedChecksum != calculatedChecksum) {
-			fclose(inputFile);
-			free(combinedKey);
-			return ERR_DECRYPTION_FAILED;
-		}
+	// 跳到文件末尾读取校验和
+	_fseeki64(inputFile, -(__int64)sizeof(unsigned int), SEEK_END);
+	unsigned int storedChecksum;
+	if (fread(&storedChecksum, sizeof(unsigned int), 1, inputFile) == 1) {
+		// 使用更强的CRC32校验和替代简单校验和
+		unsigned int calculatedChecksum = CalculateCRC32(combinedKey, combinedKeyLength);
+		if (storedChecksum != calculatedChecksum) {
+			fclose(inputFile);
+			SecureKeyFree(combinedKey);
+			CallArenaRelease(&arena);
+			return ERR_DECRYPTION_FAILED;
+		}
+	}
+	else {
+		fclose(inputFile);
+		SecureKeyFree(combinedKey);
+		CallArenaRelease(&arena);
+		return ERR_INVALID_HEADER;
+	}
+
+	// 获取文件大小并计算数据区大小（不含引擎尾部数据和校验和）
+	_fseeki64(inputFile, 0, SEEK_END);
+	__int64 fileSize = _ftelli64(inputFile);
+	__int64 dataSize = fileSize - currentPos - (__int64)engine->trailerSize - (__int64)CHECKSUM_SIZE;
+	if (dataSize < 0) {
+		fclose(inputFile);
+		SecureKeyFree(combinedKey);
+		CallArenaRelease(&arena);
+		return ERR_INVALID_HEADER;
+	}
+
+	// 读取引擎尾部数据
+	unsigned char trailer[CIPHER_ENGINE_MAX_TRAILER];
+	_fseeki64(inputFile, currentPos + dataSize, SEEK_SET);
+	if (fread(trailer, 1, engine->trailerSize, inputFile) != engine->trailerSize) {
+		fclose(inputFile);
+		SecureKeyFree(combinedKey);
+		CallArenaRelease(&arena);
+		return ERR_INVALID_HEADER;
+	}
+
+	// 恢复文件位置到数据开始处
+	_fseeki64(inputFile, currentPos, SEEK_SET);
+
+	// 创建引擎实例
+	CipherStream cipher;
+	result = CipherStreamOpen(&cipher, engine, combinedKey, combinedKeyLength, engineHeader, 0);
+	if (result != SUCCESS) {
+		fclose(inputFile);
+		SecureKeyFree(combinedKey);
+		CallArenaRelease(&arena);
+		return result;
+	}
+
+	// 打开输出文件
+	fopen_s(&outputFile, outputPath, "wb");
+	if (!outputFile) {
+		fclose(inputFile);
+		CipherStreamClose(&cipher);
+		SecureKeyFree(combinedKey);
+		CallArenaRelease(&arena);
+		return ERR_FILE_OPEN_FAILED;
+	}
+	AttachStdioBuffer(outputFile, &arena);
+
+	// 初始进度回调通知
+	ProgressBegin(dataSize);
+	if (progressCallback) {
+		progressCallback(filePath, 0.0);
+	}
+
+	// 大块处理文件以实现复杂解密的最高速度
+	size_t bytesRead;
+	__int64 totalProcessed = 0;
+
+	while ((bytesRead = fread(buffer, 1, streamBufferSize, inputFile)) > 0) {
+		// 异步操作被取消时在块边界停止
+		if (OperationCancelled(cancelFlag)) {
+			result = ERR_OPERATION_CANCELLED;
+			break;
+		}
+
+		// 处理包含校验和的最后数据块
+		if (totalProcessed + bytesRead >= dataSize) {
+			bytesRead = dataSize - totalProcessed;
+			if (bytesRead <= 0) break;
+		}
+
+		// 按文件头记录的引擎解密
+		engine->transform(cipher.context, buffer, buffer, bytesRead, totalProcessed);
+
+		// 立即写入解密数据
+		size_t bytesWritten = fwrite(buffer, 1, bytesRead, outputFile);
+		if (bytesWritten != bytesRead) {
+			result = ERR_DECRYPTION_FAILED;
+			break;
+		}
+
+		totalProcessed += bytesRead;
+		ProgressAdvance(totalProcessed);
+
+		// 进度回调 - 报告基于数据处理的真实进度
+		if (progressCallback && dataSize > 0) {
+			// 现在数据处理占100%，因为校验和已在开头验证
+			double dataProgress = (double)totalProcessed / (double)dataSize;
+			progressCallback(filePath, dataProgress);
+		}
+	}
+
+	// 解密完成后校验引擎尾部数据（如认证标签）
+	if (result == SUCCESS && (totalProcessed != dataSize || engine->finalize(cipher.context, trailer) != 0)) {
+		result = ERR_DECRYPTION_FAILED;
+	}
+
+	// 解密完成后的最终处理
+	if (result == SUCCESS) {
+		// 最终进度回调 - 100%完成
+		if (progressCallback) {
+			progressCallback(filePath, 1.0);
+		}
+	}
+
+	// 清理资源
+	CipherStreamClose(&cipher);
+	SecureKeyFree(combinedKey);
+	fclose(inputFile);
+	fclose(outputFile);
+	CallArenaRelease(&arena);
+
+	if (result != SUCCESS) {
+		remove(outputPath);  // 如果解密失败则删除输出文件
+	}
+
+	ProgressEnd(result);
+
+	return result;
+}
+
+static int ValidateEncryptedFileWithSnapshot(const PrivateKeySnapshot* keySnapshot, const char* filePath, const unsigned char* publicKey) {
+	FILE* inputFile = NULL;
+	unsigned char* combinedKey = NULL;
+	const CipherEngine* engine = NULL;
+	unsigned char engineHeader[CIPHER_ENGINE_MAX_HEADER];
+	int storedKeyLength = 0;
+	int combinedKeyLength = 0;
+	bool isValid = false;
+
+	if (!publicKey) {
+		return 0; // Invalid
+	}
+
+	// 检查私钥是否已设置
+	if (!keySnapshot) {
+		return 0; // Invalid
+	}
+
+	combinedKey = CombineKeys(keySnapshot, publicKey, &combinedKeyLength);
+
+	if (!combinedKey || combinedKeyLength == 0) {
+		return 0; // Invalid
+	}
+
+	// Open input file
+	fopen_s(&inputFile, filePath, "rb");
+	if (!inputFile) {
+		SecureKeyFree(combinedKey);
+		return 0; // Invalid
+	}
+
+	// Read and validate header (early format detection)
+	if (ReadEnginePrefix(inputFile, &g_streamFormat, &engine, engineHeader) != SUCCESS) {
+		fclose(inputFile);
+		SecureKeyFree(combinedKey);
+		return 0; // Invalid
+	}
+
+	// Read stored key length
+	if (fread(&storedKeyLength, sizeof(int), 1, inputFile) != 1) {
+		fclose(inputFile);
+		SecureKeyFree(combinedKey);
+		return 0; // Invalid
+	}
+
+	// 新增：读取并验证公钥哈希值
+	unsigned int storedPublicKeyHash;
+	if (fread(&storedPublicKeyHash, sizeof(unsigned int), 1, inputFile) != 1) {
+		fclose(inputFile);
+		SecureKeyFree(combinedKey);
+		return 0; // Invalid
+	}
+
+	// 新增：早期公钥完整性验证
+	unsigned int currentPublicKeyHash = CalculatePublicKeyHash(publicKey);
+	if (storedPublicKeyHash != currentPublicKeyHash) {
+		fclose(inputFile);
+		SecureKeyFree(combinedKey);
+		return 0; // Invalid - 公钥不匹配
+	}
+
+	// Validate key length (early validation)
+	if (storedKeyLength != combinedKeyLength) {
+		fclose(inputFile);
+		SecureKeyFree(combinedKey);
+		return 0; // Invalid
+	}
+
+	// Validate checksum at the end of file
+	_fseeki64(inputFile, -(__int64)sizeof(unsigned int), SEEK_END);
+	unsigned int storedChecksum;
+	if (fread(&storedChecksum, sizeof(unsigned int), 1, inputFile) == 1) {
+		// 使用更强的CRC32校验和替代简单校验和
+		unsigned int calculatedChecksum = CalculateCRC32(combinedKey, combinedKeyLength);
+		if (storedChecksum == calculatedChecksum) {
+			isValid = true;
+		}
+	}
+
+	// Clean up
+	SecureKeyFree(combinedKey);
+	fclose(inputFile);
+
+	return isValid ? 1 : 0;
+}
+
+// 双密钥格式加密后的数据大小
+size_t EncryptedSizeFor(size_t inputLength) {
+	return STREAM_HEADER_SIZE + inputLength + CHECKSUM_SIZE;
+}
+
+// 字节数组加密到调用者提供的缓冲区（双密钥系统）
+// inputData 可以位于 output + STREAM_HEADER_SIZE 处（原地加密）
+static int StreamEncryptDataIntoWithSnapshot(const PrivateKeySnapshot* keySnapshot, const CipherEngine* engine, const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char* output, size_t outputCapacity, size_t* outputLength) {
+	unsigned char* combinedKey = NULL;
+	int combinedKeyLength = 0;
+
+	// 检查输入参数
+	if (!inputData || inputLength == 0 || !publicKey || !output || !outputLength) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	*outputLength = 0;
+
+	// 检查私钥是否已设置
+	if (!keySnapshot) {
+		return ERR_PRIVATE_KEY_NOT_SET;
+	}
+
+	// 输出数据大小：魔数头 + 密钥长度 + 公钥哈希 + 原始数据 + 引擎尾部数据 + CRC32校验和
+	size_t outputSize = inputLength + StreamOverheadFor(engine);
+	if (outputCapacity < outputSize) {
+		return ERR_BUFFER_TOO_SMALL;
+	}
+	if (!EngineAcceptsLength(engine, inputLength)) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	// 引擎0直接使用 encode.hpp 的加解密器
+	if (engine == &g_xorNibbleEngine) {
+		StreamDataEncoder encoder;
+		if (encoder.Init(encode::ByteView(keySnapshot->key, keySnapshot->length), publicKey) != SUCCESS) {
+			return ERR_ENCRYPTION_FAILED;
+		}
+		return encoder.Encrypt(encode::ByteView(inputData, inputLength), encode::MutableByteView(output, outputCapacity), outputLength);
+	}
+
+	combinedKey = CombineKeys(keySnapshot, publicKey, &combinedKeyLength);
+
+	if (!combinedKey || combinedKeyLength == 0) {
+		return ERR_ENCRYPTION_FAILED;
+	}
+
+	// 创建引擎实例（同时生成引擎参数）
+	CipherStream cipher;
+	unsigned char engineHeader[CIPHER_ENGINE_MAX_HEADER];
+	int result = CipherStreamOpen(&cipher, engine, combinedKey, combinedKeyLength, engineHeader, 1);
+	if (result != SUCCESS) {
+		SecureKeyFree(combinedKey);
+		return result;
+	}
+
+	unsigned char* outPtr = output;
+
+	// 写入魔数头（引擎0以外的引擎附带引擎标识和引擎参数）
+	outPtr += WriteEnginePrefix(outPtr, &g_streamFormat, engine, engineHeader);
+
+	// 写入组合密钥长度
+	memcpy(outPtr, &combinedKeyLength, sizeof(int));
+	outPtr += sizeof(int);
+
+	// 写入公钥哈希值
+	unsigned int publicKeyHash = CalculatePublicKeyHash(publicKey);
+	memcpy(outPtr, &publicKeyHash, sizeof(unsigned int));
+	outPtr += sizeof(unsigned int);
+
+	// 加密数据
+	engine->transform(cipher.context, outPtr, inputData, inputLength, 0);
+	outPtr += inputLength;
+
+	// 写入引擎尾部数据
+	if (engine->finalize(cipher.context, outPtr) != 0) {
+		CipherStreamClose(&cipher);
+		SecureKeyFree(combinedKey);
+		return ERR_ENCRYPTION_FAILED;
+	}
+	outPtr += engine->trailerSize;
+
+	// 写入CRC32校验和
+	unsigned int checksum = CalculateCRC32(combinedKey, combinedKeyLength);
+	memcpy(outPtr, &checksum, sizeof(unsigned int));
+
+	*outputLength = outputSize;
+
+	// 清理资源
+	CipherStreamClose(&cipher);
+	SecureKeyFree(combinedKey);
+
+	return SUCCESS;
+}
+
+// 字节数组解密到调用者提供的缓冲区（双密钥系统）
+// output 可以等于 inputData（原地解密，明文移动到缓冲区起始处）
+static int StreamDecryptDataIntoWithSnapshot(const PrivateKeySnapshot* keySnapshot, const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char* output, size_t outputCapacity, size_t* outputLength) {
+	unsigned char* combinedKey = NULL;
+	const CipherEngine* engine = NULL;
+	unsigned char engineHeader[CIPHER_ENGINE_MAX_HEADER];
+	size_t prefixSize = 0;
+	int storedKeyLength = 0;
+	int combinedKeyLength = 0;
+
+	// 检查输入参数
+	if (!inputData || inputLength == 0 || !publicKey || !output || !outputLength) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	*outputLength = 0;
+
+	// 验证魔数头并确定加密引擎
+	int result = ParseEnginePrefix(inputData, inputLength, &g_streamFormat, &engine, engineHeader, &prefixSize);
+	if (result != SUCCESS) {
+		return result;
+	}
+
+	// 检查数据最小长度
+	if (inputLength < StreamOverheadFor(engine)) {
+		return ERR_INVALID_HEADER;
+	}
+
+	// 检查私钥是否已设置
+	if (!keySnapshot) {
+		return ERR_PRIVATE_KEY_NOT_SET;
+	}
+
+	// 计算数据区大小
+	size_t dataSize = inputLength - StreamOverheadFor(engine);
+	if (outputCapacity < dataSize) {
+		return ERR_BUFFER_TOO_SMALL;
+	}
+
+	// 引擎0直接使用 encode.hpp 的加解密器
+	if (engine == &g_xorNibbleEngine) {
+		StreamDataEncoder decoder;
+		if (decoder.Init(encode::ByteView(keySnapshot->key, keySnapshot->length), publicKey) != SUCCESS) {
+			return ERR_DECRYPTION_FAILED;
+		}
+		return decoder.Decrypt(encode::ByteView(inputData, inputLength), encode::MutableByteView(output, outputCapacity), outputLength);
+	}
+
+	combinedKey = CombineKeys(keySnapshot, publicKey, &combinedKeyLength);
+
+	if (!combinedKey || combinedKeyLength == 0) {
+		return ERR_DECRYPTION_FAILED;
+	}
+
+	const unsigned char* inPtr = inputData + prefixSize;
+
+	// 读取存储的密钥长度
+	memcpy(&storedKeyLength, inPtr, sizeof(int));
+	inPtr += sizeof(int);
+
+	// 读取并验证公钥哈希值
+	unsigned int storedPublicKeyHash;
+	memcpy(&storedPublicKeyHash, inPtr, sizeof(unsigned int));
+	inPtr += sizeof(unsigned int);
+
+	// 验证公钥完整性
+	unsigned int currentPublicKeyHash = CalculatePublicKeyHash(publicKey);
+	if (storedPublicKeyHash != currentPublicKeyHash) {
+		SecureKeyFree(combinedKey);
+		return ERR_DECRYPTION_FAILED; // 公钥不匹配
+	}
+
+	// 验证密钥长度
+	if (storedKeyLength != combinedKeyLength) {
+		SecureKeyFree(combinedKey);
+		return ERR_DECRYPTION_FAILED;
+	}
+
+	// 验证校验和（从末尾读取）
+	unsigned int storedChecksum;
+	memcpy(&storedChecksum, inputData + inputLength - sizeof(unsigned int), sizeof(unsigned int));
+	unsigned int calculatedChecksum = CalculateCRC32(combinedKey, combinedKeyLength);
+	if (storedChecksum != calculatedChecksum) {
+		SecureKeyFree(combinedKey);
+		return ERR_DECRYPTION_FAILED;
+	}
+
+	// 原地解密会覆盖输入，先复制引擎尾部数据
+	unsigned char trailer[CIPHER_ENGINE_MAX_TRAILER];
+	memcpy(trailer, inPtr + dataSize, engine->trailerSize);
+
+	CipherStream cipher;
+	result = CipherStreamOpen(&cipher, engine, combinedKey, combinedKeyLength, engineHeader, 0);
+	if (result != SUCCESS) {
+		SecureKeyFree(combinedKey);
+		return result;
+	}
+
+	// 解密数据并校验引擎尾部数据，校验失败时擦除已输出的明文
+	engine->transform(cipher.context, output, inPtr, dataSize, 0);
+	if (engine->finalize(cipher.context, trailer) != 0) {
+		SecureZeroMemory(output, dataSize);
+		result = ERR_DECRYPTION_FAILED;
+	}
+	else {
+		*outputLength = dataSize;
+	}
+
+	// 清理资源
+	CipherStreamClose(&cipher);
+	SecureKeyFree(combinedKey);
+
+	return result;
+}
+
+// 新增：字节数组加密函数（双密钥系统）
+static int StreamEncryptDataWithSnapshot(const PrivateKeySnapshot* keySnapshot, const CipherEngine* engine, const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char** outputData, size_t* outputLength) {
+	// 检查输入参数
+	if (!inputData || inputLength == 0 || !publicKey || !outputData || !outputLength) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	// 初始化输出参数
+	*outputData = NULL;
+	*outputLength = 0;
+
+	// 检查私钥是否已设置
+	if (!keySnapshot) {
+		return ERR_PRIVATE_KEY_NOT_SET;
+	}
+
+	// 分配输出缓冲区
+	size_t outputSize = inputLength + StreamOverheadFor(engine);
+	int result = SUCCESS;
+	unsigned char* output = (unsigned char*)EncodeAllocWithinBudget(outputSize, &result);
+	if (!output) {
+		return result;
+	}
+
+	result = StreamEncryptDataIntoWithSnapshot(keySnapshot, engine, inputData, inputLength, publicKey, output, outputSize, outputLength);
+	if (result != SUCCESS) {
+		EncodeFree(output);
+		return result;
+	}
+
+	*outputData = output;
+	return SUCCESS;
+}
+
+// 新增：字节数组解密函数（双密钥系统）
+static int StreamDecryptDataWithSnapshot(const PrivateKeySnapshot* keySnapshot, const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char** outputData, size_t* outputLength) {
+	// 检查输入参数
+	if (!inputData || inputLength == 0 || !publicKey || !outputData || !outputLength) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	// 初始化输出参数
+	*outputData = NULL;
+	*outputLength = 0;
+
+	// 根据文件头计算明文大小
+	size_t dataSize = 0;
+	int result = DecryptedSizeOf(inputData, inputLength, &dataSize);
+	if (result != SUCCESS) {
+		return result;
+	}
+
+	// 检查私钥是否已设置
+	if (!keySnapshot) {
+		return ERR_PRIVATE_KEY_NOT_SET;
+	}
+
+	// 分配输出缓冲区
+	unsigned char* output = (unsigned char*)EncodeAllocWithinBudget(dataSize, &result);
+	if (!output) {
+		return result;
+	}
+
+	result = StreamDecryptDataIntoWithSnapshot(keySnapshot, inputData, inputLength, publicKey, output, dataSize, outputLength);
+	if (result != SUCCESS) {
+		EncodeFree(output);
+		return result;
+	}
+
+	*outputData = output;
+	return SUCCESS;
+}
+
+// ========== 双密钥系统导出函数（使用全局私钥） ==========
+
+// 流式加密文件（使用 InitStreamFile 设置的全局私钥）
+int StreamEncryptFile(const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback) {
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = StreamEncryptFileWithSnapshot(keySnapshot, &g_xorNibbleEngine, filePath, outputPath, publicKey, progressCallback, NULL);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// 流式加密文件（指定加密引擎，使用全局私钥）
+int StreamEncryptFileEx(const char* filePath, const char* outputPath, const unsigned char* publicKey, const EncodeOptions* options, ProgressCallback progressCallback) {
+	const CipherEngine* engine = NULL;
+	int result = ResolveCipherEngine(options, &engine);
+	if (result != SUCCESS) {
+		return result;
+	}
+
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	result = StreamEncryptFileWithSnapshot(keySnapshot, engine, filePath, outputPath, publicKey, progressCallback, NULL);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// 流式解密文件（使用 InitStreamFile 设置的全局私钥，按文件头选择加密引擎）
+int StreamDecryptFile(const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback) {
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = StreamDecryptFileWithSnapshot(keySnapshot, filePath, outputPath, publicKey, progressCallback, NULL);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// 验证加密文件有效性（使用 InitStreamFile 设置的全局私钥）
+int ValidateEncryptedFile(const char* filePath, const unsigned char* publicKey) {
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = ValidateEncryptedFileWithSnapshot(keySnapshot, filePath, publicKey);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// 字节数组加密（使用 InitStreamFile 设置的全局私钥）
+int StreamEncryptData(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char** outputData, size_t* outputLength) {
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = StreamEncryptDataWithSnapshot(keySnapshot, &g_xorNibbleEngine, inputData, inputLength, publicKey, outputData, outputLength);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// 字节数组加密（指定加密引擎，使用全局私钥）
+int StreamEncryptDataEx(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, const EncodeOptions* options, unsigned char** outputData, size_t* outputLength) {
+	const CipherEngine* engine = NULL;
+	int result = ResolveCipherEngine(options, &engine);
+	if (result != SUCCESS) {
+		return result;
+	}
+
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	result = StreamEncryptDataWithSnapshot(keySnapshot, engine, inputData, inputLength, publicKey, outputData, outputLength);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// 字节数组解密（使用 InitStreamFile 设置的全局私钥）
+int StreamDecryptData(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char** outputData, size_t* outputLength) {
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = StreamDecryptDataWithSnapshot(keySnapshot, inputData, inputLength, publicKey, outputData, outputLength);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// 字节数组加密到调用者提供的缓冲区（使用 InitStreamFile 设置的全局私钥）
+int StreamEncryptDataInto(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char* output, size_t outputCapacity, size_t* outputLength) {
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = StreamEncryptDataIntoWithSnapshot(keySnapshot, &g_xorNibbleEngine, inputData, inputLength, publicKey, output, outputCapacity, outputLength);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// 字节数组解密到调用者提供的缓冲区（使用 InitStreamFile 设置的全局私钥）
+int StreamDecryptDataInto(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char* output, size_t outputCapacity, size_t* outputLength) {
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = StreamDecryptDataIntoWithSnapshot(keySnapshot, inputData, inputLength, publicKey, output, outputCapacity, outputLength);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// 原地加密：buffer 前 dataLength 字节为明文，加密结果覆盖写入 buffer
+int StreamEncryptDataInPlace(unsigned char* buffer, size_t bufferCapacity, size_t dataLength, const unsigned char* publicKey, size_t* outputLength) {
+	if (!buffer || dataLength == 0 || !publicKey || !outputLength) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	*outputLength = 0;
+	if (bufferCapacity < EncryptedSizeFor(dataLength)) {
+		return ERR_BUFFER_TOO_SMALL;
+	}
+
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	if (!keySnapshot) {
+		return ERR_PRIVATE_KEY_NOT_SET;
+	}
+
+	// 明文后移为文件头腾出空间，随后逐字节原地变换
+	memmove(buffer + STREAM_HEADER_SIZE, buffer, dataLength);
+	int result = StreamEncryptDataIntoWithSnapshot(keySnapshot, &g_xorNibbleEngine, buffer + STREAM_HEADER_SIZE, dataLength, publicKey, buffer, bufferCapacity, outputLength);
+	if (result != SUCCESS) {
+		memmove(buffer, buffer + STREAM_HEADER_SIZE, dataLength);   // 失败时恢复原始明文
+	}
+
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// 原地解密：buffer 中为完整加密数据，明文覆盖写入 buffer 起始处
+int StreamDecryptDataInPlace(unsigned char* buffer, size_t bufferLength, const unsigned char* publicKey, size_t* outputLength) {
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = StreamDecryptDataIntoWithSnapshot(keySnapshot, buffer, bufferLength, publicKey, buffer, bufferLength, outputLength);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// ========== 公钥轮换（单遍重新加密） ==========
+
+// 加密文件的布局（双密钥格式由 ReadStreamFileLayout、自包含式格式由 ReadSelfContainedFileLayout 读取并校验）
+struct EncryptedFileLayout {
+	const CipherEngine* engine;
+	unsigned char engineHeader[CIPHER_ENGINE_MAX_HEADER];
+	unsigned char trailer[CIPHER_ENGINE_MAX_TRAILER];  // 引擎尾部数据（如认证标签）
+	__int64 dataOffset;                                // 数据区在文件中的偏移
+	__int64 dataSize;                                  // 数据区大小
+	int format;                                        // 按魔数头识别的格式（ENCODE_FORMAT_*）
+};
+
+static int ReadEncryptedFileTail(FILE* file, const unsigned char* combinedKey, int combinedKeyLength, EncryptedFileLayout* layout);
+
+// 读取并校验文件头、公钥哈希、密钥长度、末尾校验和与引擎尾部数据，成功时文件位置停在数据区开头
+static int ReadStreamFileLayout(FILE* file, const unsigned char* combinedKey, int combinedKeyLength, const unsigned char* publicKey, EncryptedFileLayout* layout) {
+	int result = ReadEnginePrefix(file, &g_streamFormat, &layout->engine, layout->engineHeader);
+	if (result != SUCCESS) {
+		return result;
+	}
+
+	int storedKeyLength = 0;
+	unsigned int storedPublicKeyHash = 0;
+	if (fread(&storedKeyLength, sizeof(int), 1, file) != 1 || fread(&storedPublicKeyHash, sizeof(unsigned int), 1, file) != 1) {
+		return ERR_INVALID_HEADER;
+	}
+
+	if (storedPublicKeyHash != CalculatePublicKeyHash(publicKey) || storedKeyLength != combinedKeyLength) {
+		return ERR_DECRYPTION_FAILED;
+	}
+
+	return ReadEncryptedFileTail(file, combinedKey, combinedKeyLength, layout);
+}
+
+// 文件头之后：读取引擎尾部数据与末尾校验和并校验组合密钥，成功时文件位置停在数据区开头
+static int ReadEncryptedFileTail(FILE* file, const unsigned char* combinedKey, int combinedKeyLength, EncryptedFileLayout* layout) {
+	layout->dataOffset = _ftelli64(file);
+
+	_fseeki64(file, 0, SEEK_END);
+	__int64 fileSize = _ftelli64(file);
+	layout->dataSize = fileSize - layout->dataOffset - (__int64)layout->engine->trailerSize - (__int64)CHECKSUM_SIZE;
+	if (layout->dataSize < 0) {
+		return ERR_INVALID_HEADER;
+	}
+
+	// 引擎尾部数据与校验和相邻，一次读入
+	unsigned char tail[CIPHER_ENGINE_MAX_TRAILER + CHECKSUM_SIZE];
+	_fseeki64(file, layout->dataOffset + layout->dataSize, SEEK_SET);
+	if (fread(tail, 1, layout->engine->trailerSize + CHECKSUM_SIZE, file) != layout->engine->trailerSize + CHECKSUM_SIZE) {
+		return ERR_INVALID_HEADER;
+	}
+
+	unsigned int storedChecksum;
+	memcpy(&storedChecksum, tail + layout->engine->trailerSize, sizeof(unsigned int));
+	if (storedChecksum != CalculateCRC32(combinedKey, combinedKeyLength)) {
+		return ERR_DECRYPTION_FAILED;
+	}
+
+	memcpy(layout->trailer, tail, layout->engine->trailerSize);
+	_fseeki64(file, layout->dataOffset, SEEK_SET);
+	return SUCCESS;
+}
+
+// 只读校验数据区的引擎尾部数据，不写出任何数据（缓冲区中的明文在返回前擦除）
+static int VerifyStreamFileData(FILE* file, const EncryptedFileLayout* layout, const unsigned char* combinedKey, int combinedKeyLength, unsigned char* buffer, size_t bufferSize) {
+	CipherStream cipher;
+	unsigned char engineHeader[CIPHER_ENGINE_MAX_HEADER];
+	unsigned char trailer[CIPHER_ENGINE_MAX_TRAILER];
+	memcpy(engineHeader, layout->engineHeader, layout->engine->headerSize);
+	memcpy(trailer, layout->trailer, layout->engine->trailerSize);
+
+	int result = CipherStreamOpen(&cipher, layout->engine, combinedKey, combinedKeyLength, engineHeader, 0);
+	if (result != SUCCESS) {
+		return result;
+	}
+
+	_fseeki64(file, layout->dataOffset, SEEK_SET);
+	__int64 totalProcessed = 0;
+	while (totalProcessed < layout->dataSize) {
+		size_t chunk = bufferSize;
+		if ((__int64)chunk > layout->dataSize - totalProcessed) {
+			chunk = (size_t)(layout->dataSize - totalProcessed);
+		}
+		if (fread(buffer, 1, chunk, file) != chunk) {
+			result = ERR_DECRYPTION_FAILED;
+			break;
+		}
+
+		layout->engine->transform(cipher.context, buffer, buffer, chunk, totalProcessed);
+		totalProcessed += chunk;
+	}
+
+	if (result == SUCCESS && layout->engine->finalize(cipher.context, trailer) != 0) {
+		result = ERR_DECRYPTION_FAILED;
+	}
+
+	SecureZeroMemory(buffer, bufferSize);
+	CipherStreamClose(&cipher);
+	_fseeki64(file, layout->dataOffset, SEEK_SET);
+	return result;
+}
+
+// 一块数据换钥：引擎0使用融合内核，明文不落到内存；其它引擎先解密再加密，明文只在流式缓冲区中停留
+static void RekeyBlock(const CipherStream* oldCipher, const CipherStream* newCipher, unsigned char* buffer, size_t length, __int64 position) {
+	if (oldCipher->engine == &g_xorNibbleEngine) {
+		const XorNibbleContext* oldState = (const XorNibbleContext*)oldCipher->context;
+		const XorNibbleContext* newState = (const XorNibbleContext*)newCipher->context;
+		RekeyKeystreamSimd(buffer, buffer, length, oldState->extendedKey, oldState->keyLength, newState->extendedKey, newState->keyLength, position);
+		return;
+	}
+
+	oldCipher->engine->transform(oldCipher->context, buffer, buffer, length, position);
+	newCipher->engine->transform(newCipher->context, buffer, buffer, length, position);
+}
+
+// 单遍换钥：读取旧公钥加密的文件，逐块换成新公钥加密后写出，保留原文件的加密引擎
+// outputPath 为空时原地换钥：文件头大小不变，数据区逐块覆盖，最后写入新的尾部数据、校验和与文件头
+static int RekeyFileWithSnapshot(const PrivateKeySnapshot* keySnapshot, const char* filePath, const char* outputPath, const unsigned char* oldPublicKey, const unsigned char* newPublicKey, ProgressCallback progressCallback) {
+	FILE* inputFile = NULL;
+	FILE* outputFile = NULL;
+	unsigned char* buffer = NULL;
+	CallArena arena;
+	unsigned char* oldKey = NULL;
+	unsigned char* newKey = NULL;
+	int oldKeyLength = 0;
+	int newKeyLength = 0;
+	int result = SUCCESS;
+	const bool inPlace = (outputPath == NULL);
+
+	size_t streamBufferSize = 0;                       // 按文件大小从线程缓存中选择
+
+	// 检查私钥是否已设置
+	if (!keySnapshot) {
+		return ERR_PRIVATE_KEY_NOT_SET;
+	}
+
+	if (!filePath || !oldPublicKey || !newPublicKey) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	oldKey = CombineKeys(keySnapshot, oldPublicKey, &oldKeyLength);
+	newKey = CombineKeys(keySnapshot, newPublicKey, &newKeyLength);
+
+	if (!oldKey || !newKey || oldKeyLength == 0 || newKeyLength == 0) {
+		SecureKeyFree(oldKey);
+		SecureKeyFree(newKey);
+		return ERR_ENCRYPTION_FAILED;
+	}
+
+	// 从线程缓存取得流式缓冲区和文件的 stdio 缓冲区
+	int arenaResult = CallArenaReserveFile(&arena, filePath, &streamBufferSize);
+	if (arenaResult != SUCCESS) {
+		SecureKeyFree(oldKey);
+		SecureKeyFree(newKey);
+		return arenaResult;
+	}
+	buffer = (unsigned char*)CallArenaAlloc(&arena, streamBufferSize);
+
+	// 打开输入文件（原地换钥时以读写方式打开）
+	fopen_s(&inputFile, filePath, inPlace ? "r+b" : "rb");
+	if (!inputFile) {
+		SecureKeyFree(oldKey);
+		SecureKeyFree(newKey);
+		CallArenaRelease(&arena);
+		return ERR_FILE_OPEN_FAILED;
+	}
+	AttachStdioBuffer(inputFile, &arena);
+
+	// 用旧公钥校验文件头和校验和
+	EncryptedFileLayout layout;
+	result = ReadStreamFileLayout(inputFile, oldKey, oldKeyLength, oldPublicKey, &layout);
+
+	// 新实例按同一引擎重新加密全部数据，超过引擎单个数据流的上限时在写出任何数据前拒绝
+	if (result == SUCCESS && !EngineAcceptsLength(layout.engine, (unsigned long long)layout.dataSize)) {
+		result = ERR_INVALID_PARAMETER;
+	}
+
+	// 带认证的引擎原地换钥前先只读校验一遍，避免覆盖到一半才发现数据被篡改
+	if (result == SUCCESS && inPlace && layout.engine->trailerSize > 0) {
+		result = VerifyStreamFileData(inputFile, &layout, oldKey, oldKeyLength, buffer, streamBufferSize);
+	}
+
+	// 旧公钥的解密实例与新公钥的加密实例（新实例生成新的引擎参数）
+	CipherStream oldCipher = { NULL, NULL };
+	CipherStream newCipher = { NULL, NULL };
+	unsigned char newEngineHeader[CIPHER_ENGINE_MAX_HEADER];
+	if (result == SUCCESS) {
+		result = CipherStreamOpen(&oldCipher, layout.engine, oldKey, oldKeyLength, layout.engineHeader, 0);
+	}
+	if (result == SUCCESS) {
+		result = CipherStreamOpen(&newCipher, layout.engine, newKey, newKeyLength, newEngineHeader, 1);
+	}
+
+	// 新文件头：魔数与引擎参数 + 组合密钥长度 + 新公钥哈希
+	unsigned char header[ENGINE_PREFIX_MAX_SIZE + sizeof(int) + sizeof(unsigned int)];
+	size_t headerLength = 0;
+	if (result == SUCCESS) {
+		unsigned int publicKeyHash = CalculatePublicKeyHash(newPublicKey);
+		headerLength = WriteEnginePrefix(header, &g_streamFormat, layout.engine, newEngineHeader);
+		memcpy(header + headerLength, &newKeyLength, sizeof(int));
+		headerLength += sizeof(int);
+		memcpy(header + headerLength, &publicKeyHash, sizeof(unsigned int));
+		headerLength += sizeof(unsigned int);
+	}
+
+	// 打开输出文件（原地换钥时输出即输入，文件头最后写入）
+	if (result == SUCCESS) {
+		if (inPlace) {
+			outputFile = inputFile;
+		}
+		else {
+			fopen_s(&outputFile, outputPath, "wb");
+			if (!outputFile) {
+				result = ERR_FILE_OPEN_FAILED;
+			}
+			else {
+				AttachStdioBuffer(outputFile, &arena);
+				if (fwrite(header, 1, headerLength, outputFile) != headerLength) {
+					result = ERR_ENCRYPTION_FAILED;
+				}
+			}
+		}
+	}
+
+	// 初始进度回调通知
+	if (result == SUCCESS && progressCallback) {
+		progressCallback(filePath, 0.0);
+	}
+
+	// 逐块读入密文，换钥后立即写出
+	__int64 totalProcessed = 0;
+	while (result == SUCCESS && totalProcessed < layout.dataSize) {
+		size_t chunk = streamBufferSize;
+		if ((__int64)chunk > layout.dataSize - totalProcessed) {
+			chunk = (size_t)(layout.dataSize - totalProcessed);
+		}
+		if (fread(buffer, 1, chunk, inputFile) != chunk) {
+			result = ERR_DECRYPTION_FAILED;
+			break;
+		}
+
+		RekeyBlock(&oldCipher, &newCipher, buffer, chunk, totalProcessed);
+
+		// 原地换钥时回到本块起始处覆盖写入（读写切换前必须重新定位）
+		if (inPlace) {
+			_fseeki64(outputFile, layout.dataOffset + totalProcessed, SEEK_SET);
+		}
+
+		if (fwrite(buffer, 1, chunk, outputFile) != chunk) {
+			result = ERR_ENCRYPTION_FAILED;
+			break;
+		}
+
+		totalProcessed += chunk;
+
+		if (inPlace) {
+			_fseeki64(inputFile, layout.dataOffset + totalProcessed, SEEK_SET);
+		}
+
+		// 进度回调 - 数据处理占98%，为尾部数据和文件头预留2%
+		if (progressCallback && layout.dataSize > 0) {
+			progressCallback(filePath, (double)totalProcessed / (double)layout.dataSize * 0.98);
+		}
+	}
+
+	// 校验旧尾部数据，生成新尾部数据
+	unsigned char newTrailer[CIPHER_ENGINE_MAX_TRAILER];
+	if (result == SUCCESS && layout.engine->finalize(oldCipher.context, layout.trailer) != 0) {
+		result = ERR_DECRYPTION_FAILED;
+	}
+	if (result == SUCCESS && layout.engine->finalize(newCipher.context, newTrailer) != 0) {
+		result = ERR_ENCRYPTION_FAILED;
+	}
+
+	// 写入新尾部数据、校验和（原地换钥时再覆盖文件头）
+	if (result == SUCCESS) {
+		unsigned int checksum = CalculateCRC32(newKey, newKeyLength);
+
+		if (inPlace) {
+			_fseeki64(outputFile, layout.dataOffset + layout.dataSize, SEEK_SET);
+		}
+		if (fwrite(newTrailer, 1, layout.engine->trailerSize, outputFile) != layout.engine->trailerSize
+			|| fwrite(&checksum, sizeof(unsigned int), 1, outputFile) != 1) {
+			result = ERR_ENCRYPTION_FAILED;
+		}
+
+		if (result == SUCCESS && inPlace) {
+			_fseeki64(outputFile, 0, SEEK_SET);
+			if (fwrite(header, 1, headerLength, outputFile) != headerLength) {
+				result = ERR_ENCRYPTION_FAILED;
+			}
+		}
+
+		if (result == SUCCESS && fflush(outputFile) != 0) {
+			result = ERR_ENCRYPTION_FAILED;
+		}
+	}
+
+	// 最终进度回调 - 100%完成
+	if (result == SUCCESS && progressCallback) {
+		progressCallback(filePath, 1.0);
+	}
+
+	// 清理资源
+	CipherStreamClose(&oldCipher);
+	CipherStreamClose(&newCipher);
+	SecureKeyFree(oldKey);
+	SecureKeyFree(newKey);
+	fclose(inputFile);
+	if (outputFile && !inPlace) {
+		fclose(outputFile);
+	}
+	CallArenaRelease(&arena);
+
+	if (result != SUCCESS && outputFile && !inPlace) {
+		remove(outputPath);  // 如果换钥失败则删除输出文件
+	}
+
+	return result;
+}
+
+// 换钥到新文件（使用 InitStreamFile 设置的全局私钥）
+int RekeyFile(const char* filePath, const char* outputPath, const unsigned char* oldPublicKey, const unsigned char* newPublicKey, ProgressCallback progressCallback) {
+	if (!outputPath) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = RekeyFileWithSnapshot(keySnapshot, filePath, outputPath, oldPublicKey, newPublicKey, progressCallback);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// 原地换钥（使用 InitStreamFile 设置的全局私钥）
+int RekeyFileInPlace(const char* filePath, const unsigned char* oldPublicKey, const unsigned char* newPublicKey, ProgressCallback progressCallback) {
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = RekeyFileWithSnapshot(keySnapshot, filePath, NULL, oldPublicKey, newPublicKey, progressCallback);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// ========== 广播加密（一次读取输入，按多个公钥分别加密） ==========
+
+#define MULTI_MAX_RECIPIENTS 4096          // 单次广播的接收方上限（受进程可同时打开的文件数限制）
+#define MULTI_SLICE_SIZE (64 * 1024)       // 每个接收方的加密切片大小，共享输入块按切片加密后写出
+
+// 一个接收方的输出流
+struct MultiRecipient {
+	FILE* outputFile;
+	unsigned char* combinedKey;
+	int combinedKeyLength;
+	CipherStream cipher;
+	unsigned char* slice;                  // 加密切片缓冲区（MULTI_SLICE_SIZE）
+	char* stdioBuffer;                     // 输出文件的 stdio 缓冲区（BUFFER_SIZE）
+	int result;
+};
+
+// 当前输入块的分发状态：调用线程和线程池线程按序号领取接收方，同一块内每个接收方只由一个线程处理
+struct MultiDispatch {
+	MultiRecipient* recipients;
+	size_t count;
+	const CipherEngine* engine;
+	const unsigned char* chunk;            // 共享的只读输入块
+	size_t chunkLength;
+	__int64 position;                      // 输入块在数据区中的偏移
+	volatile LONG nextRecipient;
+};
+
+// 把当前输入块加密写入一个接收方
+static void EncryptChunkForRecipient(const MultiDispatch* dispatch, MultiRecipient* recipient) {
+	if (recipient->result != SUCCESS) {
+		return;
+	}
+
+	for (size_t offset = 0; offset < dispatch->chunkLength; offset += MULTI_SLICE_SIZE) {
+		size_t length = dispatch->chunkLength - offset;
+		if (length > MULTI_SLICE_SIZE) {
+			length = MULTI_SLICE_SIZE;
+		}
+
+		dispatch->engine->transform(recipient->cipher.context, recipient->slice, dispatch->chunk + offset, length, dispatch->position + offset);
+		if (fwrite(recipient->slice, 1, length, recipient->outputFile) != length) {
+			recipient->result = ERR_FILE_WRITE_FAILED;
+			return;
+		}
+	}
+}
+
+// 领取并处理接收方，直到当前输入块分发完毕
+static void DrainMultiDispatch(MultiDispatch* dispatch) {
+	for (;;) {
+		size_t index = (size_t)(InterlockedIncrement(&dispatch->nextRecipient) - 1);
+		if (index >= dispatch->count) {
+			break;
+		}
+		EncryptChunkForRecipient(dispatch, &dispatch->recipients[index]);
+	}
+}
+
+static void CALLBACK MultiDispatchWorkCallback(PTP_CALLBACK_INSTANCE instance, PVOID context, PTP_WORK work) {
+	DrainMultiDispatch((MultiDispatch*)context);
+}
+
+// 打开一个接收方的输出文件并写入文件头（失败时记录在 recipient->result 中）
+static void OpenMultiRecipient(const PrivateKeySnapshot* keySnapshot, const CipherEngine* engine, const char* outputPath, const unsigned char* publicKey, MultiRecipient* recipient) {
+	recipient->combinedKey = CombineKeys(keySnapshot, publicKey, &recipient->combinedKeyLength);
+	if (!recipient->combinedKey || recipient->combinedKeyLength == 0) {
+		recipient->result = ERR_ENCRYPTION_FAILED;
+		return;
+	}
+
+	unsigned char engineHeader[CIPHER_ENGINE_MAX_HEADER];
+	recipient->result = CipherStreamOpen(&recipient->cipher, engine, recipient->combinedKey, recipient->combinedKeyLength, engineHeader, 1);
+	if (recipient->result != SUCCESS) {
+		return;
+	}
+
+	fopen_s(&recipient->outputFile, outputPath, "wb");
+	if (!recipient->outputFile) {
+		recipient->result = ERR_FILE_OPEN_FAILED;
+		return;
+	}
+	setvbuf(recipient->outputFile, recipient->stdioBuffer, _IOFBF, BUFFER_SIZE);
+
+	// 文件头与 StreamEncryptFileEx 相同
+	unsigned char prefix[ENGINE_PREFIX_MAX_SIZE];
+	unsigned int publicKeyHash = CalculatePublicKeyHash(publicKey);
+	size_t prefixLength = WriteEnginePrefix(prefix, &g_streamFormat, engine, engineHeader);
+	if (fwrite(prefix, 1, prefixLength, recipient->outputFile) != prefixLength
+		|| fwrite(&recipient->combinedKeyLength, sizeof(int), 1, recipient->outputFile) != 1
+		|| fwrite(&publicKeyHash, sizeof(unsigned int), 1, recipient->outputFile) != 1) {
+		recipient->result = ERR_FILE_WRITE_FAILED;
+	}
+}
+
+// 写入尾部数据与校验和并关闭输出文件
+static void CloseMultiRecipient(const CipherEngine* engine, MultiRecipient* recipient) {
+	if (recipient->result == SUCCESS) {
+		unsigned char trailer[CIPHER_ENGINE_MAX_TRAILER];
+		if (engine->finalize(recipient->cipher.context, trailer) != 0) {
+			recipient->result = ERR_ENCRYPTION_FAILED;
+		}
+		else {
+			unsigned int checksum = CalculateCRC32(recipient->combinedKey, recipient->combinedKeyLength);
+			if (fwrite(trailer, 1, engine->trailerSize, recipient->outputFile) != engine->trailerSize
+				|| fwrite(&checksum, sizeof(unsigned int), 1, recipient->outputFile) != 1) {
+				recipient->result = ERR_FILE_WRITE_FAILED;
+			}
+		}
+	}
+
+	if (recipient->outputFile && fclose(recipient->outputFile) != 0 && recipient->result == SUCCESS) {
+		recipient->result = ERR_FILE_WRITE_FAILED;
+	}
+	recipient->outputFile = NULL;
+
+	CipherStreamClose(&recipient->cipher);
+	SecureKeyFree(recipient->combinedKey);
+	recipient->combinedKey = NULL;
+}
+
+// 整体失败时每个接收方的结果都是同一错误码（results 可为空）
+static int FillMultiResults(int* results, size_t count, int result) {
+	for (size_t i = 0; results && i < count; i++) {
+		results[i] = result;
+	}
+	return result;
+}
+
+// 广播加密：输入文件每块只读一次，由调用线程和线程池线程并行加密写入各接收方
+static int EncryptFileMultiWithSnapshot(const PrivateKeySnapshot* keySnapshot, const CipherEngine* engine, const char* filePath, const char* const* outputPaths, const unsigned char* const* publicKeys, size_t count, int* results, ProgressCallback progressCallback) {
+	FILE* inputFile = NULL;
+	unsigned char* buffer = NULL;
+	CallArena arena;
+	int result = SUCCESS;
+
+	size_t streamBufferSize = 0;                       // 按文件大小从线程缓存中选择
+
+	// 检查私钥是否已设置
+	if (!keySnapshot) {
+		return FillMultiResults(results, count, ERR_PRIVATE_KEY_NOT_SET);
+	}
+
+	if (!filePath || !outputPaths || !publicKeys || count == 0 || count > MULTI_MAX_RECIPIENTS) {
+		return FillMultiResults(results, count, ERR_INVALID_PARAMETER);
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		if (!outputPaths[i] || !publicKeys[i]) {
+			return FillMultiResults(results, count, ERR_INVALID_PARAMETER);
+		}
+	}
+
+	// 接收方状态、加密切片与 stdio 缓冲区一次分配
+	// 之后还要在持有它的同时取得输入缓冲区：两者之和（输入缓冲区按最小档位）超过预算时等待也无法满足，立即失败
+	size_t recipientBufferSize = MULTI_SLICE_SIZE + BUFFER_SIZE;
+	size_t recipientsSize = count * (sizeof(MultiRecipient) + recipientBufferSize);
+	MultiRecipient* recipients = NULL;
+	if (FitsMemoryBudget(recipientsSize + FILE_CALL_ARENA_SIZE(g_streamBufferClassSizes[0]))) {
+		recipients = (MultiRecipient*)EncodeAllocWithinBudget(recipientsSize, &result);
+	}
+	else {
+		result = ERR_MEMORY_BUDGET_EXCEEDED;
+	}
+	if (!recipients) {
+		return FillMultiResults(results, count, result);
+	}
+
+	unsigned char* recipientBuffers = (unsigned char*)(recipients + count);
+	for (size_t i = 0; i < count; i++) {
+		MultiRecipient* recipient = &recipients[i];
+		memset(recipient, 0, sizeof(*recipient));
+		recipient->slice = recipientBuffers + i * recipientBufferSize;
+		recipient->stdioBuffer = (char*)(recipient->slice + MULTI_SLICE_SIZE);
+		recipient->result = SUCCESS;
+	}
+
+	// 从线程缓存取得共享的输入缓冲区
+	result = CallArenaReserveFile(&arena, filePath, &streamBufferSize);
+	if (result != SUCCESS) {
+		EncodeFree(recipients);
+		return FillMultiResults(results, count, result);
+	}
+	buffer = (unsigned char*)CallArenaAlloc(&arena, streamBufferSize);
+
+	// 打开输入文件
+	fopen_s(&inputFile, filePath, "rb");
+	if (!inputFile) {
+		EncodeFree(recipients);
+		CallArenaRelease(&arena);
+		return FillMultiResults(results, count, ERR_FILE_OPEN_FAILED);
+	}
+	AttachStdioBuffer(inputFile, &arena);
+
+	// 获取文件大小用于进度计算
+	_fseeki64(inputFile, 0, SEEK_END);
+	__int64 totalFileSize = _ftelli64(inputFile);
+	_fseeki64(inputFile, 0, SEEK_SET);
+
+	// 超过引擎单个数据流的上限时在创建任何输出文件之前拒绝
+	if (!EngineAcceptsLength(engine, (unsigned long long)totalFileSize)) {
+		fclose(inputFile);
+		EncodeFree(recipients);
+		CallArenaRelease(&arena);
+		return FillMultiResults(results, count, ERR_INVALID_PARAMETER);
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		OpenMultiRecipient(keySnapshot, engine, outputPaths[i], publicKeys[i], &recipients[i]);
+	}
+
+	// 并行度：接收方数量与处理器数量中的较小者，调用线程自身也参与处理
+	MultiDispatch dispatch;
+	dispatch.recipients = recipients;
+	dispatch.count = count;
+	dispatch.engine = engine;
+
+	DWORD processorCount = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+	size_t helperCount = (count < processorCount ? count : processorCount);
+	helperCount = helperCount > 0 ? helperCount - 1 : 0;
+
+	PTP_WORK work = NULL;
+	if (helperCount > 0) {
+		work = CreateThreadpoolWork(MultiDispatchWorkCallback, &dispatch, NULL);
+		if (!work) {
+			helperCount = 0;   // 线程池不可用时由调用线程依次处理
+		}
+	}
+
+	// 初始进度回调通知
+	if (progressCallback) {
+		progressCallback(filePath, 0.0);
+	}
+
+	size_t bytesRead;
+	__int64 totalProcessed = 0;
+
+	while ((bytesRead = fread(buffer, 1, streamBufferSize, inputFile)) > 0) {
+		dispatch.chunk = buffer;
+		dispatch.chunkLength = bytesRead;
+		dispatch.position = totalProcessed;
+		dispatch.nextRecipient = 0;
+
+		for (size_t i = 0; i < helperCount; i++) {
+			SubmitThreadpoolWork(work);
+		}
+		DrainMultiDispatch(&dispatch);
+		if (work) {
+			WaitForThreadpoolWorkCallbacks(work, FALSE);
+		}
+
+		totalProcessed += bytesRead;
+
+		// 所有接收方都已失败时不再读取
+		size_t active = 0;
+		for (size_t i = 0; i < count; i++) {
+			if (recipients[i].result == SUCCESS) {
+				active++;
+			}
+		}
+		if (active == 0) {
+			break;
+		}
+
+		// 进度回调 - 数据处理占98%，为写尾部数据和校验和预留2%
+		if (progressCallback && totalFileSize > 0) {
+			progressCallback(filePath, (double)totalProcessed / (double)totalFileSize * 0.98);
+		}
+	}
+
+	// 读取输入出错时所有接收方都失败
+	int readFailed = ferror(inputFile);
+
+	if (work) {
+		CloseThreadpoolWork(work);
+	}
+
+	// 写入各接收方的尾部数据与校验和，汇总结果（返回第一个失败的错误码）
+	result = SUCCESS;
+	for (size_t i = 0; i < count; i++) {
+		MultiRecipient* recipient = &recipients[i];
+		if (readFailed && recipient->result == SUCCESS) {
+			recipient->result = ERR_ENCRYPTION_FAILED;
+		}
+
+		bool opened = (recipient->outputFile != NULL);
+		CloseMultiRecipient(engine, recipient);
+
+		if (recipient->result != SUCCESS) {
+			if (opened) {
+				remove(outputPaths[i]);  // 加密失败则删除该接收方的输出文件
+			}
+			if (result == SUCCESS) {
+				result = recipient->result;
+			}
+		}
+
+		if (results) {
+			results[i] = recipient->result;
+		}
+	}
+
+	// 最终进度回调 - 100%完成
+	if (result == SUCCESS && progressCallback) {
+		progressCallback(filePath, 1.0);
+	}
+
+	// 清理资源
+	fclose(inputFile);
+	EncodeFree(recipients);
+	CallArenaRelease(&arena);
+
+	return result;
+}
+
+// 广播加密（使用 InitStreamFile 设置的全局私钥）
+int EncryptFileMulti(const char* filePath, const char* const* outputPaths, const unsigned char* const* publicKeys, size_t count, const EncodeOptions* options, int* results, ProgressCallback progressCallback) {
+	const CipherEngine* engine = NULL;
+	int result = ResolveCipherEngine(options, &engine);
+	if (result != SUCCESS) {
+		return FillMultiResults(results, count, result);
+	}
+
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	result = EncryptFileMultiWithSnapshot(keySnapshot, engine, filePath, outputPaths, publicKeys, count, results, progressCallback);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// ========== 分散/聚集加解密（多个不连续缓冲区作为一个逻辑数据流） ==========
+
+// 缓冲区段游标：按顺序遍历段数组，跳过已耗尽的段
+struct SegmentCursor {
+	const EncodeBufferSegment* segments;
+	size_t count;
+	size_t index;     // 当前段
+	size_t offset;    // 当前段内偏移
+};
+
+static void InitSegmentCursor(SegmentCursor* cursor, const EncodeBufferSegment* segments, size_t count) {
+	cursor->segments = segments;
+	cursor->count = count;
+	cursor->index = 0;
+	cursor->offset = 0;
+}
+
+// 返回当前段剩余的连续字节数，0表示所有段已耗尽
+static size_t SegmentCursorAvailable(SegmentCursor* cursor) {
+	while (cursor->index < cursor->count && cursor->offset >= cursor->segments[cursor->index].length) {
+		cursor->index++;
+		cursor->offset = 0;
+	}
+	if (cursor->index >= cursor->count) {
+		return 0;
+	}
+	return cursor->segments[cursor->index].length - cursor->offset;
+}
+
+static unsigned char* SegmentCursorPointer(const SegmentCursor* cursor) {
+	return cursor->segments[cursor->index].data + cursor->offset;
+}
+
+// 从段数组读取 length 字节到连续缓冲区（destination 为空时仅跳过）
+static void SegmentCursorRead(SegmentCursor* cursor, unsigned char* destination, size_t length) {
+	while (length > 0) {
+		size_t chunk = SegmentCursorAvailable(cursor);
+		if (chunk > length) {
+			chunk = length;
+		}
+		if (destination) {
+			memcpy(destination, SegmentCursorPointer(cursor), chunk);
+			destination += chunk;
+		}
+		cursor->offset += chunk;
+		length -= chunk;
+	}
+}
+
+// 将连续缓冲区中的 length 字节写入段数组
+static void SegmentCursorWrite(SegmentCursor* cursor, const unsigned char* source, size_t length) {
+	while (length > 0) {
+		size_t chunk = SegmentCursorAvailable(cursor);
+		if (chunk > length) {
+			chunk = length;
+		}
+		memcpy(SegmentCursorPointer(cursor), source, chunk);
+		source += chunk;
+		cursor->offset += chunk;
+		length -= chunk;
+	}
+}
+
+// 在两个段数组之间直接变换 length 字节，密钥流位置跨段连续
+static void SegmentCursorTransform(SegmentCursor* input, SegmentCursor* output, size_t length, const StreamDataEncoder* encoder) {
+	__int64 position = 0;
+
+	while (length > 0) {
+		size_t chunk = SegmentCursorAvailable(input);
+		size_t outputAvailable = SegmentCursorAvailable(output);
+		if (chunk > outputAvailable) {
+			chunk = outputAvailable;
+		}
+		if (chunk > length) {
+			chunk = length;
+		}
+
+		encoder->Transform(SegmentCursorPointer(output), SegmentCursorPointer(input), chunk, position);
+
+		input->offset += chunk;
+		output->offset += chunk;
+		position += chunk;
+		length -= chunk;
+	}
+}
+
+// 计算段数组总长度，段指针为空但长度非0时返回 false
+static bool SegmentTotalLength(const EncodeBufferSegment* segments, size_t count, size_t* totalLength) {
+	*totalLength = 0;
+	if (count > 0 && !segments) {
+		return false;
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (segments[i].length > 0 && !segments[i].data) {
+			return false;
+		}
+		*totalLength += segments[i].length;
+	}
+	return true;
+}
+
+// 分散/聚集加密（双密钥系统），输出与加密各段拼接后的数据完全一致
+static int EncryptDataVWithSnapshot(const PrivateKeySnapshot* keySnapshot, const EncodeBufferSegment* inputSegments, size_t inputCount, const unsigned char* publicKey, const EncodeBufferSegment* outputSegments, size_t outputCount, size_t* outputLength) {
+	size_t inputLength = 0;
+	size_t outputCapacity = 0;
+
+	// 检查输入参数
+	if (!publicKey || !outputLength) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	*outputLength = 0;
+
+	if (!SegmentTotalLength(inputSegments, inputCount, &inputLength) || inputLength == 0 ||
+		!SegmentTotalLength(outputSegments, outputCount, &outputCapacity)) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	// 检查私钥是否已设置
+	if (!keySnapshot) {
+		return ERR_PRIVATE_KEY_NOT_SET;
+	}
+
+	size_t outputSize = EncryptedSizeFor(inputLength);
+	if (outputCapacity < outputSize) {
+		return ERR_BUFFER_TOO_SMALL;
+	}
+
+	StreamDataEncoder encoder;
+	if (encoder.Init(encode::ByteView(keySnapshot->key, keySnapshot->length), publicKey) != SUCCESS) {
+		return ERR_ENCRYPTION_FAILED;
+	}
+
+	// 组装文件头：魔数头 + 组合密钥长度 + 公钥哈希值
+	unsigned char header[STREAM_HEADER_SIZE];
+	encoder.WriteHeader(header);
+
+	unsigned int checksum = encoder.Checksum();
+
+	SegmentCursor input;
+	SegmentCursor output;
+	InitSegmentCursor(&input, inputSegments, inputCount);
+	InitSegmentCursor(&output, outputSegments, outputCount);
+
+	SegmentCursorWrite(&output, header, STREAM_HEADER_SIZE);
+	SegmentCursorTransform(&input, &output, inputLength, &encoder);
+	SegmentCursorWrite(&output, (const unsigned char*)&checksum, sizeof(unsigned int));
+
+	*outputLength = outputSize;
+
+	return SUCCESS;
+}
+
+// 分散/聚集解密（双密钥系统），文件头和校验和可以跨段
+static int DecryptDataVWithSnapshot(const PrivateKeySnapshot* keySnapshot, const EncodeBufferSegment* inputSegments, size_t inputCount, const unsigned char* publicKey, const EncodeBufferSegment* outputSegments, size_t outputCount, size_t* outputLength) {
+	int storedKeyLength = 0;
+	size_t inputLength = 0;
+	size_t outputCapacity = 0;
+
+	// 检查输入参数
+	if (!publicKey || !outputLength) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	*outputLength = 0;
+
+	if (!SegmentTotalLength(inputSegments, inputCount, &inputLength) || inputLength == 0 ||
+		!SegmentTotalLength(outputSegments, outputCount, &outputCapacity)) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	// 检查数据最小长度
+	if (inputLength < STREAM_HEADER_SIZE + CHECKSUM_SIZE) {
+		return ERR_INVALID_HEADER;
+	}
+
+	// 检查私钥是否已设置
+	if (!keySnapshot) {
+		return ERR_PRIVATE_KEY_NOT_SET;
+	}
+
+	size_t dataSize = inputLength - STREAM_HEADER_SIZE - CHECKSUM_SIZE;
+	if (outputCapacity < dataSize) {
+		return ERR_BUFFER_TOO_SMALL;
+	}
+
+	SegmentCursor input;
+	InitSegmentCursor(&input, inputSegments, inputCount);
+
+	// 验证魔数头
+	unsigned char header[STREAM_HEADER_SIZE];
+	SegmentCursorRead(&input, header, STREAM_HEADER_SIZE);
+	if (memcmp(header, MAGIC_HEADER, MAGIC_HEADER_SIZE) != 0) {
+		return ERR_INVALID_HEADER;
+	}
+
+	StreamDataEncoder decoder;
+	if (decoder.Init(encode::ByteView(keySnapshot->key, keySnapshot->length), publicKey) != SUCCESS) {
+		return ERR_DECRYPTION_FAILED;
+	}
+
+	// 验证公钥完整性和密钥长度
+	unsigned int storedPublicKeyHash;
+	memcpy(&storedKeyLength, header + MAGIC_HEADER_SIZE, sizeof(int));
+	memcpy(&storedPublicKeyHash, header + MAGIC_HEADER_SIZE + sizeof(int), sizeof(unsigned int));
+	if (storedPublicKeyHash != decoder.PublicKeyHash() || storedKeyLength != decoder.CombinedKeyLength()) {
+		return ERR_DECRYPTION_FAILED;
+	}
+
+	// 验证校验和（从末尾读取）
+	SegmentCursor trailer;
+	unsigned int storedChecksum;
+	InitSegmentCursor(&trailer, inputSegments, inputCount);
+	SegmentCursorRead(&trailer, NULL, inputLength - CHECKSUM_SIZE);
+	SegmentCursorRead(&trailer, (unsigned char*)&storedChecksum, CHECKSUM_SIZE);
+	if (storedChecksum != decoder.Checksum()) {
+		return ERR_DECRYPTION_FAILED;
+	}
+
+	// 解密数据
+	SegmentCursor output;
+	InitSegmentCursor(&output, outputSegments, outputCount);
+	SegmentCursorTransform(&input, &output, dataSize, &decoder);
+
+	*outputLength = dataSize;
+
+	return SUCCESS;
+}
+
+// 分散/聚集加密（使用 InitStreamFile 设置的全局私钥）
+int EncryptDataV(const EncodeBufferSegment* inputSegments, size_t inputCount, const unsigned char* publicKey, const EncodeBufferSegment* outputSegments, size_t outputCount, size_t* outputLength) {
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = EncryptDataVWithSnapshot(keySnapshot, inputSegments, inputCount, publicKey, outputSegments, outputCount, outputLength);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// 分散/聚集解密（使用 InitStreamFile 设置的全局私钥）
+int DecryptDataV(const EncodeBufferSegment* inputSegments, size_t inputCount, const unsigned char* publicKey, const EncodeBufferSegment* outputSegments, size_t outputCount, size_t* outputLength) {
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = DecryptDataVWithSnapshot(keySnapshot, inputSegments, inputCount, publicKey, outputSegments, outputCount, outputLength);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// ========== 增量流式加解密上下文（Begin/Update/Final） ==========
+
+#define STREAM_CONTEXT_ENCRYPT 1
+#define STREAM_CONTEXT_DECRYPT 2
+
+static_assert(ENCODE_STREAM_HEADER_SIZE == STREAM_HEADER_SIZE, "ENCODE_STREAM_HEADER_SIZE must match the ENCV1.0 header");
+static_assert(ENCODE_STREAM_TRAILER_SIZE == CHECKSUM_SIZE, "ENCODE_STREAM_TRAILER_SIZE must match the ENCV1.0 checksum");
+static_assert(StreamDataEncoder::HeaderSize == STREAM_HEADER_SIZE, "encode.hpp StreamKey header must match the ENCV1.0 header");
+
+// 每个数据流的状态：加解密器 + 密钥流位置 + 解密时暂存的文件头与末尾校验和，大小与数据量无关
+struct EncodeStreamContext {
+	int mode;                                    // STREAM_CONTEXT_ENCRYPT / STREAM_CONTEXT_DECRYPT
+	int status;                                  // 出错后保持错误码，后续调用直接返回
+	StreamDataEncoder encoder;                   // 组合密钥、公钥哈希与校验和（密钥材料位于安全内存区）
+	__int64 position;                            // 已变换的数据字节数（密钥流位置）
+	size_t headerReceived;                       // 解密：已收到的文件头字节数
+	unsigned char header[STREAM_HEADER_SIZE];
+	size_t tailLength;                           // 解密：暂缓输出的末尾字节数（可能是校验和）
+	unsigned char tail[CHECKSUM_SIZE];
+};
+
+static int CreateStreamContext(int mode, const unsigned char* publicKey, EncodeStreamContext** context) {
+	if (!publicKey || !context) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	*context = NULL;
+
+	void* memory = EncodeAlloc(sizeof(EncodeStreamContext));
+	if (!memory) {
+		return ERR_MEMORY_ALLOCATION_FAILED;
+	}
+	EncodeStreamContext* ctx = new (memory) EncodeStreamContext();
+
+	// 组合密钥只在创建时计算一次，之后更换全局私钥不影响进行中的数据流
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	if (!keySnapshot) {
+		FreeStreamContext(ctx);
+		return ERR_PRIVATE_KEY_NOT_SET;
+	}
+
+	int result = ctx->encoder.Init(encode::ByteView(keySnapshot->key, keySnapshot->length), publicKey);
+	ReleaseKeySnapshot(keySnapshot);
+
+	if (result != SUCCESS) {
+		FreeStreamContext(ctx);
+		return mode == STREAM_CONTEXT_ENCRYPT ? ERR_ENCRYPTION_FAILED : ERR_DECRYPTION_FAILED;
+	}
+
+	ctx->mode = mode;
+	ctx->status = SUCCESS;
+
+	*context = ctx;
+	return SUCCESS;
+}
+
+// 开始加密数据流，写出文件头
+int EncryptBegin(const unsigned char* publicKey, EncodeStreamContext** context, unsigned char* header, size_t headerCapacity, size_t* headerLength) {
+	if (!publicKey || !context || !header || !headerLength) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	*context = NULL;
+	*headerLength = 0;
+
+	if (headerCapacity < STREAM_HEADER_SIZE) {
+		return ERR_BUFFER_TOO_SMALL;
+	}
+
+	EncodeStreamContext* ctx = NULL;
+	int result = CreateStreamContext(STREAM_CONTEXT_ENCRYPT, publicKey, &ctx);
+	if (result != SUCCESS) {
+		return result;
+	}
+
+	// 魔数头 + 组合密钥长度 + 公钥哈希值
+	ctx->encoder.WriteHeader(header);
+
+	*headerLength = STREAM_HEADER_SIZE;
+	*context = ctx;
+	return SUCCESS;
+}
+
+// 加密任意长度的数据片段，输出与输入等长（output 可以等于 input）
+int EncryptUpdate(EncodeStreamContext* context, const unsigned char* input, size_t inputLength, unsigned char* output, size_t* outputLength) {
+	if (!context || context->mode != STREAM_CONTEXT_ENCRYPT || (inputLength > 0 && (!input || !output)) || !outputLength) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	*outputLength = 0;
+
+	if (context->status != SUCCESS) {
+		return context->status;
+	}
+
+	context->encoder.Transform(output, input, inputLength, context->position);
+	context->position += inputLength;
+
+	*outputLength = inputLength;
+	return SUCCESS;
+}
+
+// 结束加密数据流，写出CRC32校验和
+int EncryptFinal(EncodeStreamContext* context, unsigned char* trailer, size_t trailerCapacity, size_t* trailerLength) {
+	if (!context || context->mode != STREAM_CONTEXT_ENCRYPT || !trailer || !trailerLength) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	*trailerLength = 0;
+
+	if (context->status != SUCCESS) {
+		return context->status;
+	}
+
+	if (trailerCapacity < CHECKSUM_SIZE) {
+		return ERR_BUFFER_TOO_SMALL;
+	}
+
+	unsigned int checksum = context->encoder.Checksum();
+	memcpy(trailer, &checksum, sizeof(unsigned int));
+
+	*trailerLength = CHECKSUM_SIZE;
+	return SUCCESS;
+}
+
+// 开始解密数据流
+int DecryptBegin(const unsigned char* publicKey, EncodeStreamContext** context) {
+	return CreateStreamContext(STREAM_CONTEXT_DECRYPT, publicKey, context);
+}
+
+// 校验已收齐的文件头
+static int ValidateStreamContextHeader(const EncodeStreamContext* context) {
+	int storedKeyLength = 0;
+	unsigned int storedPublicKeyHash = 0;
+
+	if (memcmp(context->header, MAGIC_HEADER, MAGIC_HEADER_SIZE) != 0) {
+		return ERR_INVALID_HEADER;
+	}
+
+	memcpy(&storedKeyLength, context->header + MAGIC_HEADER_SIZE, sizeof(int));
+	memcpy(&storedPublicKeyHash, context->header + MAGIC_HEADER_SIZE + sizeof(int), sizeof(unsigned int));
+
+	// 公钥不匹配或密钥长度不一致
+	if (storedPublicKeyHash != context->encoder.PublicKeyHash() || storedKeyLength != context->encoder.CombinedKeyLength()) {
+		return ERR_DECRYPTION_FAILED;
+	}
+
+	return SUCCESS;
+}
+
+// 解密任意长度的加密数据片段（可以从文件头开始任意切分）
+// 最后 CHECKSUM_SIZE 字节可能是校验和，暂缓输出，因此 outputLength 可能小于 inputLength
+int DecryptUpdate(EncodeStreamContext* context, const unsigned char* input, size_t inputLength, unsigned char* output, size_t* outputLength) {
+	if (!context || context->mode != STREAM_CONTEXT_DECRYPT || (inputLength > 0 && (!input || !output)) || !outputLength) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	*outputLength = 0;
+
+	if (context->status != SUCCESS) {
+		return context->status;
+	}
+
+	// 先收齐文件头
+	if (context->headerReceived < STREAM_HEADER_SIZE) {
+		size_t needed = STREAM_HEADER_SIZE - context->headerReceived;
+		size_t chunk = inputLength < needed ? inputLength : needed;
+		memcpy(context->header + context->headerReceived, input, chunk);
+		context->headerReceived += chunk;
+		input += chunk;
+		inputLength -= chunk;
+
+		if (context->headerReceived < STREAM_HEADER_SIZE) {
+			return SUCCESS;
+		}
+
+		context->status = ValidateStreamContextHeader(context);
+		if (context->status != SUCCESS) {
+			return context->status;
+		}
+	}
+
+	// 数据不足以确定末尾校验和位置时全部暂存
+	if (context->tailLength + inputLength <= CHECKSUM_SIZE) {
+		memcpy(context->tail + context->tailLength, input, inputLength);
+		context->tailLength += inputLength;
+		return SUCCESS;
+	}
+
+	// 可以输出的字节：暂存区 + 本次输入，保留最后 CHECKSUM_SIZE 字节
+	size_t emit = context->tailLength + inputLength - CHECKSUM_SIZE;
+	size_t fromTail = emit < context->tailLength ? emit : context->tailLength;
+	size_t fromInput = emit - fromTail;
+
+	context->encoder.Transform(output, context->tail, fromTail, context->position);
+	context->encoder.Transform(output + fromTail, input, fromInput, context->position + fromTail);
+	context->position += emit;
+
+	// 剩余的暂存字节前移，再追加本次输入的末尾
+	memmove(context->tail, context->tail + fromTail, context->tailLength - fromTail);
+	context->tailLength -= fromTail;
+	memcpy(context->tail + context->tailLength, input + fromInput, inputLength - fromInput);
+	context->tailLength += inputLength - fromInput;
+
+	*outputLength = emit;
+	return SUCCESS;
+}
+
+// 结束解密数据流，验证末尾的CRC32校验和
+int DecryptFinal(EncodeStreamContext* context) {
+	if (!context || context->mode != STREAM_CONTEXT_DECRYPT) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	if (context->status != SUCCESS) {
+		return context->status;
+	}
+
+	// 数据被截断
+	if (context->headerReceived < STREAM_HEADER_SIZE || context->tailLength < CHECKSUM_SIZE) {
+		return ERR_INVALID_HEADER;
+	}
+
+	unsigned int storedChecksum;
+	memcpy(&storedChecksum, context->tail, sizeof(unsigned int));
+	if (storedChecksum != context->encoder.Checksum()) {
+		return ERR_DECRYPTION_FAILED;
+	}
+
+	return SUCCESS;
+}
+
+// 释放流式上下文，擦除其中的密钥材料
+void FreeStreamContext(EncodeStreamContext* context) {
+	if (!context) {
+		return;
+	}
+
+	context->~EncodeStreamContext();             // 加解密器析构时擦除并释放密钥材料
+	SecureZeroMemory(context, sizeof(EncodeStreamContext));
+	EncodeFree(context);
+}
+
+// ========== 批量加解密（大量小消息共用一次密钥组合） ==========
+
+// 待变换消息队列：凑满 MULTI_BUFFER_LANES 条后交给多缓冲区内核
+struct BatchLaneQueue {
+	unsigned char* outputs[MULTI_BUFFER_LANES];
+	const unsigned char* inputs[MULTI_BUFFER_LANES];
+	size_t lengths[MULTI_BUFFER_LANES];
+	int count;
+};
+
+// 多缓冲区内核直接使用加解密器的密钥材料（组合密钥后的循环填充即扩展密钥）
+static void FlushBatchLanes(BatchLaneQueue* queue, const StreamDataEncoder* encoder) {
+	if (queue->count > 0) {
+		TransformKeystreamLanes(queue->outputs, queue->inputs, queue->lengths, queue->count, encoder->KeyMaterial(), encoder->CombinedKeyLength());
+		queue->count = 0;
+	}
+}
+
+static void PushBatchLane(BatchLaneQueue* queue, unsigned char* output, const unsigned char* input, size_t length, const StreamDataEncoder* encoder) {
+	queue->outputs[queue->count] = output;
+	queue->inputs[queue->count] = input;
+	queue->lengths[queue->count] = length;
+	if (++queue->count == MULTI_BUFFER_LANES) {
+		FlushBatchLanes(queue, encoder);
+	}
+}
+
+// 为一批消息准备共用的加解密器和文件头
+static int PrepareBatchKeys(const PrivateKeySnapshot* keySnapshot, const unsigned char* publicKey, StreamDataEncoder* encoder, unsigned char* header) {
+	int result = encoder->Init(encode::ByteView(keySnapshot->key, keySnapshot->length), publicKey);
+	if (result != SUCCESS) {
+		return result == ERR_MEMORY_ALLOCATION_FAILED ? result : ERR_ENCRYPTION_FAILED;
+	}
+
+	encoder->WriteHeader(header);
+	return SUCCESS;
+}
+
+// 批量加密（双密钥系统），每条消息的输出与单独调用 StreamEncryptData 完全一致
+static int EncryptDataBatchWithSnapshot(const PrivateKeySnapshot* keySnapshot, const EncodeBufferSegment* inputs, size_t count, const unsigned char* publicKey, unsigned char* outputArena, size_t arenaCapacity, size_t* offsets, size_t* arenaLength) {
+	StreamDataEncoder encoder;
+	unsigned char header[STREAM_HEADER_SIZE];
+
+	// 检查输入参数
+	if (!inputs || count == 0 || !publicKey || !offsets || !arenaLength) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	*arenaLength = 0;
+
+	// 计算输出区总大小
+	size_t required = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (!inputs[i].data || inputs[i].length == 0) {
+			return ERR_INVALID_PARAMETER;
+		}
+		required += EncryptedSizeFor(inputs[i].length);
+	}
+
+	// 输出区不足时返回所需大小
+	if (!outputArena || arenaCapacity < required) {
+		*arenaLength = required;
+		return ERR_BUFFER_TOO_SMALL;
+	}
+
+	// 检查私钥是否已设置
+	if (!keySnapshot) {
+		return ERR_PRIVATE_KEY_NOT_SET;
+	}
+
+	int result = PrepareBatchKeys(keySnapshot, publicKey, &encoder, header);
+	if (result != SUCCESS) {
+		return result;
+	}
+	unsigned int checksum = encoder.Checksum();
+
+	BatchLaneQueue queue;
+	queue.count = 0;
+
+	size_t offset = 0;
+	for (size_t i = 0; i < count; i++) {
+		unsigned char* outPtr = outputArena + offset;
+		offsets[i] = offset;
+
+		memcpy(outPtr, header, STREAM_HEADER_SIZE);
+		memcpy(outPtr + STREAM_HEADER_SIZE + inputs[i].length, &checksum, sizeof(unsigned int));
+		PushBatchLane(&queue, outPtr + STREAM_HEADER_SIZE, inputs[i].data, inputs[i].length, &encoder);
+
+		offset += EncryptedSizeFor(inputs[i].length);
+	}
+	FlushBatchLanes(&queue, &encoder);
+
+	offsets[count] = offset;
+	*arenaLength = offset;
+
+	return SUCCESS;
+}
+
+// 批量解密（双密钥系统），单条消息失败不影响其它消息
+static int DecryptDataBatchWithSnapshot(const PrivateKeySnapshot* keySnapshot, const EncodeBufferSegment* inputs, size_t count, const unsigned char* publicKey, unsigned char* outputArena, size_t arenaCapacity, size_t* offsets, int* results, size_t* arenaLength) {
+	StreamDataEncoder decoder;
+	unsigned char header[STREAM_HEADER_SIZE];
+
+	// 检查输入参数
+	if (!inputs || count == 0 || !publicKey || !offsets || !results || !arenaLength) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	*arenaLength = 0;
+
+	// 计算输出区大小上限（按全部消息都能解密计算）
+	size_t required = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (!inputs[i].data && inputs[i].length > 0) {
+			return ERR_INVALID_PARAMETER;
+		}
+		if (inputs[i].length >= STREAM_HEADER_SIZE + CHECKSUM_SIZE) {
+			required += inputs[i].length - STREAM_HEADER_SIZE - CHECKSUM_SIZE;
+		}
+	}
+
+	// 输出区不足时返回所需大小
+	if ((!outputArena && required > 0) || arenaCapacity < required) {
+		*arenaLength = required;
+		return ERR_BUFFER_TOO_SMALL;
+	}
+
+	// 检查私钥是否已设置
+	if (!keySnapshot) {
+		return ERR_PRIVATE_KEY_NOT_SET;
+	}
+
+	int result = PrepareBatchKeys(keySnapshot, publicKey, &decoder, header);
+	if (result != SUCCESS) {
+		return result == ERR_ENCRYPTION_FAILED ? ERR_DECRYPTION_FAILED : result;
+	}
+	unsigned int checksum = decoder.Checksum();
+
+	BatchLaneQueue queue;
+	queue.count = 0;
+
+	size_t offset = 0;
+	for (size_t i = 0; i < count; i++) {
+		const unsigned char* inPtr = inputs[i].data;
+		size_t inputLength = inputs[i].length;
+		offsets[i] = offset;
+
+		// 文件头与校验和对同一密钥的所有消息都相同，直接整体比较
+		if (inputLength < STREAM_HEADER_SIZE + CHECKSUM_SIZE || memcmp(inPtr, header, MAGIC_HEADER_SIZE) != 0) {
+			results[i] = ERR_INVALID_HEADER;
+			result = ERR_DECRYPTION_FAILED;
+			continue;
+		}
+		if (memcmp(inPtr + MAGIC_HEADER_SIZE, header + MAGIC_HEADER_SIZE, STREAM_HEADER_SIZE - MAGIC_HEADER_SIZE) != 0 ||
+			memcmp(inPtr + inputLength - CHECKSUM_SIZE, &checksum, sizeof(unsigned int)) != 0) {
+			results[i] = ERR_DECRYPTION_FAILED;
+			result = ERR_DECRYPTION_FAILED;
+			continue;
+		}
+
+		size_t dataSize = inputLength - STREAM_HEADER_SIZE - CHECKSUM_SIZE;
+		results[i] = SUCCESS;
+		PushBatchLane(&queue, outputArena + offset, inPtr + STREAM_HEADER_SIZE, dataSize, &decoder);
+
+		offset += dataSize;
+	}
+	FlushBatchLanes(&queue, &decoder);
+
+	offsets[count] = offset;
+	*arenaLength = offset;
+
+	return result;
+}
+
+// 批量加密（使用 InitStreamFile 设置的全局私钥）
+int EncryptDataBatch(const EncodeBufferSegment* inputs, size_t count, const unsigned char* publicKey, unsigned char* outputArena, size_t arenaCapacity, size_t* offsets, size_t* arenaLength) {
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = EncryptDataBatchWithSnapshot(keySnapshot, inputs, count, publicKey, outputArena, arenaCapacity, offsets, arenaLength);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// 批量解密（使用 InitStreamFile 设置的全局私钥）
+int DecryptDataBatch(const EncodeBufferSegment* inputs, size_t count, const unsigned char* publicKey, unsigned char* outputArena, size_t arenaCapacity, size_t* offsets, int* results, size_t* arenaLength) {
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = DecryptDataBatchWithSnapshot(keySnapshot, inputs, count, publicKey, outputArena, arenaCapacity, offsets, results, arenaLength);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// ========== 多租户私钥注册表 ==========
+
+#define KEY_REGISTRY_BUCKETS 1024                  // 注册表桶数量（2的幂）
+#define MAX_KEY_ID_LENGTH 256                      // 私钥标识最大长度
+
+// 注册表条目：私钥标识 -> 私钥快照
+struct KeyRegistryEntry {
+	KeyRegistryEntry* next;          // 同一桶内的下一个条目
+	unsigned int hash;               // 私钥标识哈希值
+	PrivateKeySnapshot* snapshot;    // 私钥快照（条目持有一个引用）
+	char keyId[1];                   // 私钥标识（变长，紧跟在结构体之后）
+};
+
+// 每个桶独立加读写锁，不同租户之间互不阻塞
+struct KeyRegistryBucket {
+	SRWLOCK lock;
+	KeyRegistryEntry* head;
+};
+
+static KeyRegistryBucket g_keyRegistry[KEY_REGISTRY_BUCKETS];   // 零初始化即为 SRWLOCK_INIT
+
+// 计算私钥标识哈希值（FNV-1a），返回0表示标识无效
+static unsigned int HashKeyId(const char* keyId, size_t* idLength) {
+	unsigned int hash = 2166136261u;
+	size_t length = 0;
+
+	while (keyId[length] != '\0') {
+		hash ^= (unsigned char)keyId[length];
+		hash *= 16777619u;
+		if (++length > MAX_KEY_ID_LENGTH) {
+			return 0;
+		}
+	}
+
+	*idLength = length;
+	return length > 0 ? (hash | 1) : 0;
+}
+
+// 按标识查找已注册私钥并获取其快照引用（未找到返回nullptr）
+static PrivateKeySnapshot* AcquireRegisteredKeySnapshot(const char* keyId) {
+	if (!keyId) return nullptr;
+
+	size_t idLength = 0;
+	unsigned int hash = HashKeyId(keyId, &idLength);
+	if (hash == 0) return nullptr;
+
+	KeyRegistryBucket* bucket = &g_keyRegistry[hash & (KEY_REGISTRY_BUCKETS - 1)];
+	PrivateKeySnapshot* snapshot = nullptr;
+
+	AcquireSRWLockShared(&bucket->lock);
+	for (KeyRegistryEntry* entry = bucket->head; entry; entry = entry->next) {
+		if (entry->hash == hash && strcmp(entry->keyId, keyId) == 0) {
+			snapshot = entry->snapshot;
+			InterlockedIncrement(&snapshot->refCount);
+			break;
+		}
+	}
+	ReleaseSRWLockShared(&bucket->lock);
+
+	return snapshot;
+}
+
+// 注册（或替换）指定标识的私钥
+int RegisterPrivateKey(const char* keyId, const char* privateKey) {
+	if (!keyId || !privateKey) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	size_t idLength = 0;
+	unsigned int hash = HashKeyId(keyId, &idLength);
+	int privateKeyLength = (int)strlen(privateKey);
+	if (hash == 0 || privateKeyLength == 0) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	PrivateKeySnapshot* snapshot = CreateKeySnapshot((const unsigned char*)privateKey, privateKeyLength);
+	if (!snapshot) {
+		return ERR_MEMORY_ALLOCATION_FAILED;
+	}
+
+	// 提前分配新条目，避免在桶锁内分配内存
+	KeyRegistryEntry* newEntry = (KeyRegistryEntry*)EncodeAlloc(sizeof(KeyRegistryEntry) + idLength);
+	if (!newEntry) {
+		ReleaseKeySnapshot(snapshot);
+		return ERR_MEMORY_ALLOCATION_FAILED;
+	}
+	newEntry->hash = hash;
+	newEntry->snapshot = snapshot;
+	memcpy(newEntry->keyId, keyId, idLength + 1);
+
+	KeyRegistryBucket* bucket = &g_keyRegistry[hash & (KEY_REGISTRY_BUCKETS - 1)];
+	PrivateKeySnapshot* oldSnapshot = nullptr;
+
+	AcquireSRWLockExclusive(&bucket->lock);
+	KeyRegistryEntry* entry = bucket->head;
+	for (; entry; entry = entry->next) {
+		if (entry->hash == hash && strcmp(entry->keyId, keyId) == 0) {
+			break;
+		}
+	}
+	if (entry) {
+		// 已存在：仅替换快照，正在使用旧私钥的调用不受影响
+		oldSnapshot = entry->snapshot;
+		entry->snapshot = snapshot;
+	}
+	else {
+		newEntry->next = bucket->head;
+		bucket->head = newEntry;
+		newEntry = nullptr;
+	}
+	ReleaseSRWLockExclusive(&bucket->lock);
+
+	EncodeFree(newEntry);
+	ReleaseKeySnapshot(oldSnapshot);
+
+	return SUCCESS;
+}
+
+// 注销指定标识的私钥
+int UnregisterPrivateKey(const char* keyId) {
+	if (!keyId) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	size_t idLength = 0;
+	unsigned int hash = HashKeyId(keyId, &idLength);
+	if (hash == 0) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	KeyRegistryBucket* bucket = &g_keyRegistry[hash & (KEY_REGISTRY_BUCKETS - 1)];
+	KeyRegistryEntry* removed = nullptr;
+
+	AcquireSRWLockExclusive(&bucket->lock);
+	for (KeyRegistryEntry** link = &bucket->head; *link; link = &(*link)->next) {
+		if ((*link)->hash == hash && strcmp((*link)->keyId, keyId) == 0) {
+			removed = *link;
+			*link = removed->next;
+			break;
+		}
+	}
+	ReleaseSRWLockExclusive(&bucket->lock);
+
+	if (!removed) {
+		return ERR_PRIVATE_KEY_NOT_SET;
+	}
+
+	ReleaseKeySnapshot(removed->snapshot);
+	EncodeFree(removed);
+
+	return SUCCESS;
+}
+
+// 检查指定标识的私钥是否已注册
+int IsPrivateKeyRegistered(const char* keyId) {
+	PrivateKeySnapshot* keySnapshot = AcquireRegisteredKeySnapshot(keyId);
+	ReleaseKeySnapshot(keySnapshot);
+	return keySnapshot ? 1 : 0;
+}
+
+// 流式加密文件（使用注册表中的指定私钥）
+int StreamEncryptFileWithKey(const char* keyId, const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback) {
+	PrivateKeySnapshot* keySnapshot = AcquireRegisteredKeySnapshot(keyId);
+	int result = StreamEncryptFileWithSnapshot(keySnapshot, &g_xorNibbleEngine, filePath, outputPath, publicKey, progressCallback, NULL);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// 流式解密文件（使用注册表中的指定私钥）
+int StreamDecryptFileWithKey(const char* keyId, const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback) {
+	PrivateKeySnapshot* keySnapshot = AcquireRegisteredKeySnapshot(keyId);
+	int result = StreamDecryptFileWithSnapshot(keySnapshot, filePath, outputPath, publicKey, progressCallback, NULL);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// 验证加密文件有效性（使用注册表中的指定私钥）
+int ValidateEncryptedFileWithKey(const char* keyId, const char* filePath, const unsigned char* publicKey) {
+	PrivateKeySnapshot* keySnapshot = AcquireRegisteredKeySnapshot(keyId);
+	int result = ValidateEncryptedFileWithSnapshot(keySnapshot, filePath, publicKey);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// 字节数组加密（使用注册表中的指定私钥）
+int StreamEncryptDataWithKey(const char* keyId, const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char** outputData, size_t* outputLength) {
+	PrivateKeySnapshot* keySnapshot = AcquireRegisteredKeySnapshot(keyId);
+	int result = StreamEncryptDataWithSnapshot(keySnapshot, &g_xorNibbleEngine, inputData, inputLength, publicKey, outputData, outputLength);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// 字节数组解密（使用注册表中的指定私钥）
+int StreamDecryptDataWithKey(const char* keyId, const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char** outputData, size_t* outputLength) {
+	PrivateKeySnapshot* keySnapshot = AcquireRegisteredKeySnapshot(keyId);
+	int result = StreamDecryptDataWithSnapshot(keySnapshot, inputData, inputLength, publicKey, outputData, outputLength);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// 新增：释放加密数据内存
+void FreeEncryptedData(unsigned char* data) {
+	if (data) {
+		EncodeFree(data);
+	}
+}
+
+// 新增：释放解密数据内存
+void FreeDecryptedData(unsigned char* data) {
+	if (data) {
+		EncodeFree(data);
+	}
+}
+
+// ========== 自包含式加密/解密系统实现 ==========
+
+#define SELF_CONTAINED_MAGIC_HEADER "SELFV1.0"     // 自包含式加密文件魔数头
+#define SELF_CONTAINED_MAGIC_HEADER_V11 "SELFV1.1" // 带引擎标识的自包含式加密文件魔数头
+#define SELF_CONTAINED_MAGIC_SIZE 8                // 自包含式魔数头大小
+#define PRIVATE_KEY_SIZE_2048_BITS 256             // 2048位私钥大小（256字节）
+
+// 自包含式格式头大小：魔数头 + 组合密钥长度 + 公钥哈希 + 私钥长度 + 私钥 + 私钥哈希
+#define SELF_CONTAINED_HEADER_SIZE (SELF_CONTAINED_MAGIC_SIZE + sizeof(int) + sizeof(unsigned int) + sizeof(int) + PRIVATE_KEY_SIZE_2048_BITS + sizeof(unsigned int))
+
+static const EncodedFormat g_selfContainedFormat = { SELF_CONTAINED_MAGIC_HEADER, SELF_CONTAINED_MAGIC_HEADER_V11, SELF_CONTAINED_MAGIC_SIZE };
+
+// 自包含式格式在明文之外的开销：文件头 + 引擎尾部数据 + 校验和
+static size_t SelfContainedOverheadFor(const CipherEngine* engine) {
+	return SELF_CONTAINED_HEADER_SIZE - SELF_CONTAINED_MAGIC_SIZE + EnginePrefixSize(&g_selfContainedFormat, engine) + engine->trailerSize + CHECKSUM_SIZE;
+}
+
+// ========== 进程级随机数源 ==========
+
+#define RANDOM_POOL_SIZE 4096                      // 每线程熵池大小（一次批量填充的字节数）
+
+static HCRYPTPROV g_cryptProvider = 0;                         // 进程级CryptoAPI句柄（首次使用时获取，进程内常驻）
+static INIT_ONCE g_cryptProviderOnce = INIT_ONCE_STATIC_INIT;  // 保证句柄只获取一次
+
+// 每线程熵池：批量从系统获取随机数，按需取用；放在 FLS 槽位中，线程退出时擦除并释放
+// 熵池在进程堆上分配，不经过调用者设置的分配器，也不计入内存用量（与调用无关、随线程常驻）
+struct ThreadRandomPool {
+	unsigned char bytes[RANDOM_POOL_SIZE];
+	size_t available;                      // 剩余可用字节数（从尾部向前取用）
+};
+
+static VOID WINAPI FreeThreadRandomPool(PVOID pool) {
+	SecureZeroMemory(pool, sizeof(ThreadRandomPool));
+	HeapFree(GetProcessHeap(), 0, pool);
+}
+
+static FiberLocalSlot g_randomPoolSlot = FIBER_LOCAL_SLOT_INIT(FreeThreadRandomPool);
+
+// 取得当前线程的熵池（首次使用时创建），无法创建时返回空
+static ThreadRandomPool* GetThreadRandomPool() {
+	ThreadRandomPool* pool = (ThreadRandomPool*)GetFiberLocal(&g_randomPoolSlot);
+	if (pool) {
+		return pool;
+	}
+
+	pool = (ThreadRandomPool*)HeapAlloc(GetProcessHeap(), 0, sizeof(ThreadRandomPool));
+	if (!pool) {
+		return nullptr;
+	}
+
+	pool->available = 0;
+	if (!SetFiberLocal(&g_randomPoolSlot, pool)) {
+		HeapFree(GetProcessHeap(), 0, pool);
+		return nullptr;
+	}
+	return pool;
+}
+
+static BOOL CALLBACK InitCryptProvider(PINIT_ONCE initOnce, PVOID parameter, PVOID* context) {
+	return CryptAcquireContext(&g_cryptProvider, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT);
+}
+
+// 获取密码学安全随机字节（线程安全）
+static int FillRandomBytes(unsigned char* output, size_t length) {
+	if (!InitOnceExecuteOnce(&g_cryptProviderOnce, InitCryptProvider, NULL, NULL)) {
+		return ERR_ENCRYPTION_FAILED;
+	}
+
+	// 大块请求与无法建立熵池时直接由系统生成，不经过熵池
+	ThreadRandomPool* pool = length < RANDOM_POOL_SIZE ? GetThreadRandomPool() : nullptr;
+	if (!pool) {
+		return CryptGenRandom(g_cryptProvider, (DWORD)length, output) ? SUCCESS : ERR_ENCRYPTION_FAILED;
+	}
+
+	while (length > 0) {
+		if (pool->available == 0) {
+			// CryptGenRandom 对同一句柄的并发调用是安全的
+			if (!CryptGenRandom(g_cryptProvider, RANDOM_POOL_SIZE, pool->bytes)) {
+				return ERR_ENCRYPTION_FAILED;
+			}
+			pool->available = RANDOM_POOL_SIZE;
+		}
+
+		size_t take = length < pool->available ? length : pool->available;
+		unsigned char* source = pool->bytes + pool->available - take;
+		memcpy(output, source, take);
+		SecureZeroMemory(source, take);    // 已取出的随机字节立即擦除，保证不会被重复使用
+
+		pool->available -= take;
+		output += take;
+		length -= take;
+	}
+
+	return SUCCESS;
+}
+
+// 生成2048位随机私钥
+int Generate2048BitPrivateKey(unsigned char* privateKey, int* keyLength) {
+	if (!privateKey || !keyLength) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	// 从每线程熵池获取256字节（2048位）的随机私钥，避免每次获取/释放CryptoAPI上下文
+	int result = FillRandomBytes(privateKey, PRIVATE_KEY_SIZE_2048_BITS);
+	if (result != SUCCESS) {
+		return result;
+	}
+
+	*keyLength = PRIVATE_KEY_SIZE_2048_BITS;
+
+	return SUCCESS;
+}
+
+// 计算私钥哈希值用于完整性验证
+unsigned int CalculatePrivateKeyHash(const unsigned char* privateKey, int keyLength) {
+	return encode::detail::PrivateKeyHash(privateKey, keyLength);
+}
+
+// 自包含式文件加密函数
+static int SelfContainedEncryptFileWithEngine(const CipherEngine* engine, const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback, const volatile LONG* cancelFlag) {
+	FILE* inputFile = NULL;
+	FILE* outputFile = NULL;
+	unsigned char* buffer = NULL;
+	CallArena arena;
+	unsigned char* privateKey = NULL;
+	unsigned char* combinedKey = NULL;
+	int result = SUCCESS;
+	int privateKeyLength = 0;
+	int combinedKeyLength = 0;
+
+	size_t streamBufferSize = 0;                       // 按文件大小从线程缓存中选择
+
+	if (!filePath || !outputPath || !publicKey) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	// 分配私钥缓冲区
+	privateKey = SecureKeyAlloc(PRIVATE_KEY_SIZE_2048_BITS);
+	if (!privateKey) {
+		return ERR_MEMORY_ALLOCATION_FAILED;
+	}
+
+	// 生成2048位随机私钥
+	result = Generate2048BitPrivateKey(privateKey, &privateKeyLength);
+	if (result != SUCCESS) {
+		SecureKeyFree(privateKey);
+		return result;
+	}
+
+	// 使用生成的私钥组合公钥
+	int pubKeyLen = strlen((const char*)publicKey);
+	if (pubKeyLen == 0) {
+		SecureKeyFree(privateKey);
+		return ERR_INVALID_PARAMETER;
+	}
+
+	// 组合私钥和公钥（使用相同的交错算法）
+	int totalLen = privateKeyLength + pubKeyLen;
+	combinedKey = SecureKeyAlloc(totalLen + 1);
+	if (!combinedKey) {
+		SecureKeyFree(privateKey);
+		return ERR_MEMORY_ALLOCATION_FAILED;
+	}
+
+	// 交错组合两个密钥
+	InterleaveKeys(combinedKey, privateKey, privateKeyLength, publicKey, pubKeyLen);
+	combinedKeyLength = totalLen;
+
+	// 创建引擎实例（同时生成引擎参数）
+	CipherStream cipher;
+	unsigned char engineHeader[CIPHER_ENGINE_MAX_HEADER];
+	result = CipherStreamOpen(&cipher, engine, combinedKey, combinedKeyLength, engineHeader, 1);
+	if (result != SUCCESS) {
+		SecureKeyFree(privateKey);
+		SecureKeyFree(combinedKey);
+		return result;
+	}
+
+	// 从线程缓存取得流式缓冲区和两个文件的 stdio 缓冲区
+	int arenaResult = CallArenaReserveFile(&arena, filePath, &streamBufferSize);
+	if (arenaResult != SUCCESS) {
+		CipherStreamClose(&cipher);
+		SecureKeyFree(privateKey);
+		SecureKeyFree(combinedKey);
+		return arenaResult;
+	}
+	buffer = (unsigned char*)CallArenaAlloc(&arena, streamBufferSize);
+
+	// 打开输入文件
+	fopen_s(&inputFile, filePath, "rb");
+	if (!inputFile) {
+		CipherStreamClose(&cipher);
+		SecureKeyFree(privateKey);
+		SecureKeyFree(combinedKey);
+		CallArenaRelease(&arena);
+		return ERR_FILE_OPEN_FAILED;
+	}
+	AttachStdioBuffer(inputFile, &arena);
+
+	// 获取文件大小
+	_fseeki64(inputFile, 0, SEEK_END);
+	__int64 totalFileSize = _ftelli64(inputFile);
+	_fseeki64(inputFile, 0, SEEK_SET);
+
+	// 超过引擎单个数据流的上限时在创建输出文件之前拒绝
+	if (!EngineAcceptsLength(engine, (unsigned long long)totalFileSize)) {
+		fclose(inputFile);
+		CipherStreamClose(&cipher);
+		SecureKeyFree(privateKey);
+		SecureKeyFree(combinedKey);
+		CallArenaRelease(&arena);
+		return ERR_INVALID_PARAMETER;
+	}
+
+	// 打开输出文件
+	fopen_s(&outputFile, outputPath, "wb");
+	if (!outputFile) {
+		fclose(inputFile);
+		CipherStreamClose(&cipher);
+		SecureKeyFree(privateKey);
+		SecureKeyFree(combinedKey);
+		CallArenaRelease(&arena);
+		return ERR_FILE_OPEN_FAILED;
+	}
+	AttachStdioBuffer(outputFile, &arena);
+
+	// 写入自包含式文件头（引擎0以外的引擎附带引擎标识和引擎参数）
+	unsigned char prefix[ENGINE_PREFIX_MAX_SIZE];
+	fwrite(prefix, 1, WriteEnginePrefix(prefix, &g_selfContainedFormat, engine, engineHeader), outputFile);
+	fwrite(&combinedKeyLength, sizeof(int), 1, outputFile);
+
+	// 写入公钥哈希值
+	unsigned int publicKeyHash = CalculatePublicKeyHash(publicKey);
+	fwrite(&publicKeyHash, sizeof(unsigned int), 1, outputFile);
+
+	// 写入私钥长度和私钥数据
+	fwrite(&privateKeyLength, sizeof(int), 1, outputFile);
+	fwrite(privateKey, 1, privateKeyLength, outputFile);
+
+	// 写入私钥哈希值用于完整性验证
+	unsigned int privateKeyHash = CalculatePrivateKeyHash(privateKey, privateKeyLength);
+	fwrite(&privateKeyHash, sizeof(unsigned int), 1, outputFile);
+
+	// 进度回调初始化
+	ProgressBegin(totalFileSize);
+	if (progressCallback) {
+		progressCallback(filePath, 0.0);
+	}
+
+	// 加密文件数据
+	size_t bytesRead;
+	__int64 totalProcessed = 0;
+
+	while ((bytesRead = fread(buffer, 1, streamBufferSize, inputFile)) > 0) {
+		// 异步操作被取消时在块边界停止
+		if (OperationCancelled(cancelFlag)) {
+			result = ERR_OPERATION_CANCELLED;
+			break;
+		}
+
+		// 按文件头记录的引擎加密
+		engine->transform(cipher.context, buffer, buffer, bytesRead, totalProcessed);
+
+		size_t bytesWritten = fwrite(buffer, 1, bytesRead, outputFile);
+		if (bytesWritten != bytesRead) {
+			result = ERR_ENCRYPTION_FAILED;
+			break;
+		}
+
+		totalProcessed += bytesRead;
+		ProgressAdvance(totalProcessed);
+
+		// 进度回调
+		if (progressCallback && totalFileSize > 0) {
+			double dataProgress = (double)totalProcessed / (double)totalFileSize;
+			double adjustedProgress = dataProgress * 0.98;
+			progressCallback(filePath, adjustedProgress);
+		}
+	}
+
+	// 写入引擎尾部数据
+	if (result == SUCCESS) {
+		unsigned char trailer[CIPHER_ENGINE_MAX_TRAILER];
+		if (engine->finalize(cipher.context, trailer) != 0) {
+			result = ERR_ENCRYPTION_FAILED;
+		}
+		else if (engine->trailerSize > 0) {
+			fwrite(trailer, 1, engine->trailerSize, outputFile);
+		}
+	}
+
+	// 写入校验和
+	if (result == SUCCESS) {
+		if (progressCallback) {
+			progressCallback(filePath, 0.99);
+		}
+
+		unsigned int checksum = CalculateCRC32(combinedKey, combinedKeyLength);
+		fwrite(&checksum, sizeof(unsigned int), 1, outputFile);
+
+		if (progressCallback) {
+			progressCallback(filePath, 1.0);
+		}
+	}
+
+	// 清理资源
+	CipherStreamClose(&cipher);
+	SecureKeyFree(privateKey);
+	SecureKeyFree(combinedKey);
+	fclose(inputFile);
+	fclose(outputFile);
+	CallArenaRelease(&arena);
+
+	if (result != SUCCESS) {
+		remove(outputPath);  // 加密失败或被取消时删除不完整的输出文件
+	}
+
+	ProgressEnd(result);
+
+	return result;
+}
+
+// 自包含式文件加密（引擎0）
+int SelfContainedEncryptFile(const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback) {
+	return SelfContainedEncryptFileWithEngine(&g_xorNibbleEngine, filePath, outputPath, publicKey, progressCallback, NULL);
+}
+
+// 自包含式文件加密函数（指定加密引擎）
+int SelfContainedEncryptFileEx(const char* filePath, const char* outputPath, const unsigned char* publicKey, const EncodeOptions* options, ProgressCallback progressCallback) {
+	const CipherEngine* engine = NULL;
+	int result = ResolveCipherEngine(options, &engine);
+	if (result != SUCCESS) {
+		return result;
+	}
+
+	return SelfContainedEncryptFileWithEngine(engine, filePath, outputPath, publicKey, progressCallback, NULL);
+}
+
+// 自包含式文件解密（cancelFlag 为异步操作的取消标志，同步调用为 NULL）
+static int SelfContainedDecryptFileWithCancel(const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback, const volatile LONG* cancelFlag) {
+	FILE* inputFile = NULL;
+	FILE* outputFile = NULL;
+	unsigned char* buffer = NULL;
+	CallArena arena;
+	unsigned char* privateKey = NULL;
+	unsigned char* combinedKey = NULL;
+	int result = SUCCESS;
+	const CipherEngine* engine = NULL;
+	unsigned char engineHeader[CIPHER_ENGINE_MAX_HEADER];
+	int storedCombinedKeyLength = 0;
+	int privateKeyLength = 0;
+	int combinedKeyLength = 0;
+
+	size_t streamBufferSize = 0;                       // 按文件大小从线程缓存中选择
+
+	if (!filePath || !outputPath || !publicKey) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	// 从线程缓存取得流式缓冲区和两个文件的 stdio 缓冲区
+	int arenaResult = CallArenaReserveFile(&arena, filePath, &streamBufferSize);
+	if (arenaResult != SUCCESS) {
+		return arenaResult;
+	}
+	buffer = (unsigned char*)CallArenaAlloc(&arena, streamBufferSize);
+
+	// 打开输入文件
+	fopen_s(&inputFile, filePath, "rb");
+	if (!inputFile) {
+		CallArenaRelease(&arena);
+		return ERR_FILE_OPEN_FAILED;
+	}
+	AttachStdioBuffer(inputFile, &arena);
+
+	// 读取并验证文件头，确定加密引擎
+	result = ReadEnginePrefix(inputFile, &g_selfContainedFormat, &engine, engineHeader);
+	if (result != SUCCESS) {
+		fclose(inputFile);
+		CallArenaRelease(&arena);
+		return result;
+	}
+
+	// 读取组合密钥长度
+	if (fread(&storedCombinedKeyLength, sizeof(int), 1, inputFile) != 1) {
+		fclose(inputFile);
+		CallArenaRelease(&arena);
+		return ERR_INVALID_HEADER;
+	}
+
+	// 读取并验证公钥哈希值
+	unsigned int storedPublicKeyHash;
+	if (fread(&storedPublicKeyHash, sizeof(unsigned int), 1, inputFile) != 1) {
+		fclose(inputFile);
+		CallArenaRelease(&arena);
+		return ERR_INVALID_HEADER;
+	}
+
+	unsigned int currentPublicKeyHash = CalculatePublicKeyHash(publicKey);
+	if (storedPublicKeyHash != currentPublicKeyHash) {
+		fclose(inputFile);
+		CallArenaRelease(&arena);
+		return ERR_DECRYPTION_FAILED; // 公钥不匹配
+	}
+
+	// 读取私钥长度
+	if (fread(&privateKeyLength, sizeof(int), 1, inputFile) != 1) {
+		fclose(inputFile);
+		CallArenaRelease(&arena);
+		return ERR_INVALID_HEADER;
+	}
+
+	if (privateKeyLength != PRIVATE_KEY_SIZE_2048_BITS) {
+		fclose(inputFile);
+		CallArenaRelease(&arena);
+		return ERR_DECRYPTION_FAILED;
+	}
+
+	// 读取私钥
+	privateKey = SecureKeyAlloc(privateKeyLength);
+	if (!privateKey) {
+		fclose(inputFile);
+		CallArenaRelease(&arena);
+		return ERR_MEMORY_ALLOCATION_FAILED;
+	}
+
+	if (fread(privateKey, 1, privateKeyLength, inputFile) != privateKeyLength) {
+		SecureKeyFree(privateKey);
+		fclose(inputFile);
+		CallArenaRelease(&arena);
+		return ERR_INVALID_HEADER;
+	}
+
+	// 读取并验证私钥哈希值
+	unsigned int storedPrivateKeyHash;
+	if (fread(&storedPrivateKeyHash, sizeof(unsigned int), 1, inputFile) != 1) {
+		SecureKeyFree(privateKey);
+		fclose(inputFile);
+		CallArenaRelease(&arena);
+		return ERR_INVALID_HEADER;
+	}
+
+	unsigned int currentPrivateKeyHash = CalculatePrivateKeyHash(privateKey, privateKeyLength);
+	if (storedPrivateKeyHash != currentPrivateKeyHash) {
+		SecureKeyFree(privateKey);
+		fclose(inputFile);
+		CallArenaRelease(&arena);
+		return ERR_DECRYPTION_FAILED; // 私钥被篡改
+	}
+
+	// 重新组合私钥和公钥
+	int pubKeyLen = strlen((const char*)publicKey);
+	int totalLen = privateKeyLength + pubKeyLen;
+	combinedKey = SecureKeyAlloc(totalLen + 1);
+	if (!combinedKey) {
+		SecureKeyFree(privateKey);
+		fclose(inputFile);
+		CallArenaRelease(&arena);
+		return ERR_MEMORY_ALLOCATION_FAILED;
+	}
+
+	// 交错组合两个密钥
+	InterleaveKeys(combinedKey, privateKey, privateKeyLength, publicKey, pubKeyLen);
+	combinedKeyLength = totalLen;
+
+	// 验证组合密钥长度
+	if (storedCombinedKeyLength != combinedKeyLength) {
+		SecureKeyFree(privateKey);
+		SecureKeyFree(combinedKey);
+		fclose(inputFile);
+		CallArenaRelease(&arena);
+		return ERR_DECRYPTION_FAILED;
+	}
+
+	// 立即验证校验和
+	__int64 currentPos = _ftelli64(inputFile);
+	_fseeki64(inputFile, -(__int64)sizeof(unsigned int), SEEK_END);
+	unsigned int storedChecksum;
+	if (fread(&storedChecksum, sizeof(unsigned int), 1, inputFile) == 1) {
+		unsigned int calculatedChecksum = CalculateCRC32(combinedKey, combinedKeyLength);
+		if (storedChecksum != calculatedChecksum) {
+			SecureKeyFree(privateKey);
+			SecureKeyFree(combinedKey);
+			fclose(inputFile);
+			CallArenaRelease(&arena);
+			return ERR_DECRYPTION_FAILED;
+		}
+	}
+	else {
+		SecureKeyFree(privateKey);
+		SecureKeyFree(combinedKey);
+		fclose(inputFile);
+		CallArenaRelease(&arena);
+		return ERR_INVALID_HEADER;
+	}
+
+	// 计算数据区大小（不含引擎尾部数据和校验和）
+	_fseeki64(inputFile, 0, SEEK_END);
+	__int64 fileSize = _ftelli64(inputFile);
+	__int64 dataSize = fileSize - currentPos - (__int64)engine->trailerSize - (__int64)CHECKSUM_SIZE;
+	if (dataSize < 0) {
+		SecureKeyFree(privateKey);
+		SecureKeyFree(combinedKey);
+		fclose(inputFile);
+		CallArenaRelease(&arena);
+		return ERR_INVALID_HEADER;
+	}
+
+	// 读取引擎尾部数据
+	unsigned char trailer[CIPHER_ENGINE_MAX_TRAILER];
+	_fseeki64(inputFile, currentPos + dataSize, SEEK_SET);
+	if (fread(trailer, 1, engine->trailerSize, inputFile) != engine->trailerSize) {
+		SecureKeyFree(privateKey);
+		SecureKeyFree(combinedKey);
+		fclose(inputFile);
+		CallArenaRelease(&arena);
+		return ERR_INVALID_HEADER;
+	}
+
+	// 恢复文件位置到数据开始处
+	_fseeki64(inputFile, currentPos, SEEK_SET);
+
+	// 创建引擎实例
+	CipherStream cipher;
+	result = CipherStreamOpen(&cipher, engine, combinedKey, combinedKeyLength, engineHeader, 0);
+	if (result != SUCCESS) {
+		SecureKeyFree(privateKey);
+		SecureKeyFree(combinedKey);
+		fclose(inputFile);
+		CallArenaRelease(&arena);
+		return result;
+	}
+
+	// 打开输出文件
+	fopen_s(&outputFile, outputPath, "wb");
+	if (!outputFile) {
+		CipherStreamClose(&cipher);
+		SecureKeyFree(privateKey);
+		SecureKeyFree(combinedKey);
+		fclose(inputFile);
+		CallArenaRelease(&arena);
+		return ERR_FILE_OPEN_FAILED;
+	}
+	AttachStdioBuffer(outputFile, &arena);
+
+	// 进度回调初始化
+	ProgressBegin(dataSize);
+	if (progressCallback) {
+		progressCallback(filePath, 0.0);
+	}
+
+	// 解密文件数据
+	size_t bytesRead;
+	__int64 totalProcessed = 0;
+
+	while ((bytesRead = fread(buffer, 1, streamBufferSize, inputFile)) > 0) {
+		// 异步操作被取消时在块边界停止
+		if (OperationCancelled(cancelFlag)) {
+			result = ERR_OPERATION_CANCELLED;
+			break;
+		}
+
+		// 处理包含校验和的最后数据块
+		if (totalProcessed + bytesRead >= dataSize) {
+			bytesRead = dataSize - totalProcessed;
+			if (bytesRead <= 0) break;
+		}
+
+		// 按文件头记录的引擎解密
+		engine->transform(cipher.context, buffer, buffer, bytesRead, totalProcessed);
+
+		size_t bytesWritten = fwrite(buffer, 1, bytesRead, outputFile);
+		if (bytesWritten != bytesRead) {
+			result = ERR_DECRYPTION_FAILED;
+			break;
+		}
+
+		totalProcessed += bytesRead;
+		ProgressAdvance(totalProcessed);
+
+		// 进度回调
+		if (progressCallback && dataSize > 0) {
+			double dataProgress = (double)totalProcessed / (double)dataSize;
+			progressCallback(filePath, dataProgress);
+		}
+	}
+
+	// 校验引擎尾部数据
+	if (result == SUCCESS && (totalProcessed != dataSize || engine->finalize(cipher.context, trailer) != 0)) {
+		result = ERR_DECRYPTION_FAILED;
+	}
+
+	// 解密完成
+	if (result == SUCCESS) {
+		if (progressCallback) {
+			progressCallback(filePath, 1.0);
+		}
+	}
+
+	// 清理资源
+	CipherStreamClose(&cipher);
+	SecureKeyFree(privateKey);
+	SecureKeyFree(combinedKey);
+	fclose(inputFile);
+	fclose(outputFile);
+	CallArenaRelease(&arena);
+
+	if (result != SUCCESS) {
+		remove(outputPath);
+	}
+
+	ProgressEnd(result);
+
+	return result;
+}
+
+// 自包含式文件解密函数
+int SelfContainedDecryptFile(const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback) {
+	return SelfContainedDecryptFileWithCancel(filePath, outputPath, publicKey, progressCallback, NULL);
+}
+
+// 自包含式格式加密后的数据大小
+size_t SelfContainedEncryptedSizeFor(size_t inputLength) {
+	return SELF_CONTAINED_HEADER_SIZE + inputLength + CHECKSUM_SIZE;
+}
+
+// 自包含式数据加密到调用者提供的缓冲区
+// inputData 可以位于 output + SELF_CONTAINED_HEADER_SIZE 处（原地加密）
+static int SelfContainedEncryptDataIntoWithEngine(const CipherEngine* engine, const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char* output, size_t outputCapacity, size_t* outputLength) {
+	unsigned char* privateKey = NULL;
+	unsigned char* combinedKey = NULL;
+	int result = SUCCESS;
+	int privateKeyLength = 0;
+	int combinedKeyLength = 0;
+
+	if (!inputData || inputLength == 0 || !publicKey || !output || !outputLength) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	*outputLength = 0;
+
+	// 计算输出大小
+	size_t outputSize = inputLength + SelfContainedOverheadFor(engine);
+	if (outputCapacity < outputSize) {
+		return ERR_BUFFER_TOO_SMALL;
+	}
+	if (!EngineAcceptsLength(engine, inputLength)) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	// 组合私钥和公钥
+	int pubKeyLen = strlen((const char*)publicKey);
+	if (pubKeyLen == 0) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	// 分配私钥缓冲区并生成私钥
+	privateKey = SecureKeyAlloc(PRIVATE_KEY_SIZE_2048_BITS);
+	if (!privateKey) {
+		return ERR_MEMORY_ALLOCATION_FAILED;
+	}
+
+	result = Generate2048BitPrivateKey(privateKey, &privateKeyLength);
+	if (result != SUCCESS) {
+		SecureKeyFree(privateKey);
+		return result;
+	}
+
+	// 引擎0直接使用 encode.hpp 的加解密器
+	if (engine == &g_xorNibbleEngine) {
+		SelfContainedDataEncoder encoder;
+		result = encoder.Init(encode::ByteView(privateKey, privateKeyLength), publicKey);
+		SecureKeyFree(privateKey);
+		if (result != SUCCESS) {
+			return result;
+		}
+		return encoder.Encrypt(encode::ByteView(inputData, inputLength), encode::MutableByteView(output, outputCapacity), outputLength);
+	}
+
+	int totalLen = privateKeyLength + pubKeyLen;
+	combinedKey = SecureKeyAlloc(totalLen + 1);
+	if (!combinedKey) {
+		SecureKeyFree(privateKey);
+		return ERR_MEMORY_ALLOCATION_FAILED;
+	}
+
+	// 交错组合两个密钥
+	InterleaveKeys(combinedKey, privateKey, privateKeyLength, publicKey, pubKeyLen);
+	combinedKeyLength = totalLen;
+
+	// 创建引擎实例（同时生成引擎参数）
+	CipherStream cipher;
+	unsigned char engineHeader[CIPHER_ENGINE_MAX_HEADER];
+	result = CipherStreamOpen(&cipher, engine, combinedKey, combinedKeyLength, engineHeader, 1);
+	if (result != SUCCESS) {
+		SecureKeyFree(privateKey);
+		SecureKeyFree(combinedKey);
+		return result;
+	}
+
+	unsigned char* outPtr = output;
+
+	// 写入文件头
+	outPtr += WriteEnginePrefix(outPtr, &g_selfContainedFormat, engine, engineHeader);
+
+	memcpy(outPtr, &combinedKeyLength, sizeof(int));
+	outPtr += sizeof(int);
+
+	unsigned int publicKeyHash = CalculatePublicKeyHash(publicKey);
+	memcpy(outPtr, &publicKeyHash, sizeof(unsigned int));
+	outPtr += sizeof(unsigned int);
+
+	memcpy(outPtr, &privateKeyLength, sizeof(int));
+	outPtr += sizeof(int);
+
+	memcpy(outPtr, privateKey, privateKeyLength);
+	outPtr += privateKeyLength;
+
+	unsigned int privateKeyHash = CalculatePrivateKeyHash(privateKey, privateKeyLength);
+	memcpy(outPtr, &privateKeyHash, sizeof(unsigned int));
+	outPtr += sizeof(unsigned int);
+
+	// 加密数据
+	engine->transform(cipher.context, outPtr, inputData, inputLength, 0);
+	outPtr += inputLength;
+
+	// 写入引擎尾部数据
+	if (engine->finalize(cipher.context, outPtr) != 0) {
+		CipherStreamClose(&cipher);
+		SecureKeyFree(privateKey);
+		SecureKeyFree(combinedKey);
+		return ERR_ENCRYPTION_FAILED;
+	}
+	outPtr += engine->trailerSize;
+
+	// 写入校验和
+	unsigned int checksum = CalculateCRC32(combinedKey, combinedKeyLength);
+	memcpy(outPtr, &checksum, sizeof(unsigned int));
+
+	*outputLength = outputSize;
+
+	// 清理资源
+	CipherStreamClose(&cipher);
+	SecureKeyFree(privateKey);
+	SecureKeyFree(combinedKey);
+
+	return SUCCESS;
+}
+
+// 自包含式数据加密到调用者提供的缓冲区（引擎0）
+int SelfContainedEncryptDataInto(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char* output, size_t outputCapacity, size_t* outputLength) {
+	return SelfContainedEncryptDataIntoWithEngine(&g_xorNibbleEngine, inputData, inputLength, publicKey, output, outputCapacity, outputLength);
+}
+
+// 自包含式数据解密到调用者提供的缓冲区
+// output 可以等于 inputData（原地解密，明文移动到缓冲区起始处）
+int SelfContainedDecryptDataInto(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char* output, size_t outputCapacity, size_t* outputLength) {
+	unsigned char* privateKey = NULL;
+	unsigned char* combinedKey = NULL;
+	const CipherEngine* engine = NULL;
+	unsigned char engineHeader[CIPHER_ENGINE_MAX_HEADER];
+	size_t prefixSize = 0;
+	int storedCombinedKeyLength = 0;
+	int privateKeyLength = 0;
+	int combinedKeyLength = 0;
+
+	if (!inputData || inputLength == 0 || !publicKey || !output || !outputLength) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	*outputLength = 0;
+
+	// 验证文件头并确定加密引擎
+	int result = ParseEnginePrefix(inputData, inputLength, &g_selfContainedFormat, &engine, engineHeader, &prefixSize);
+	if (result != SUCCESS) {
+		return result;
+	}
+
+	// 检查最小长度
+	if (inputLength < SelfContainedOverheadFor(engine)) {
+		return ERR_INVALID_HEADER;
+	}
+
+	// 计算数据大小
+	size_t dataSize = inputLength - SelfContainedOverheadFor(engine);
+	if (outputCapacity < dataSize) {
+		return ERR_BUFFER_TOO_SMALL;
+	}
+
+	// 引擎0直接使用 encode.hpp 的加解密器
+	if (engine == &g_xorNibbleEngine) {
+		SelfContainedDataEncoder decoder;
+		result = decoder.Init(encode::ByteView(), publicKey);
+		if (result != SUCCESS) {
+			return result == ERR_MEMORY_ALLOCATION_FAILED ? result : ERR_DECRYPTION_FAILED;
+		}
+		return decoder.Decrypt(encode::ByteView(inputData, inputLength), encode::MutableByteView(output, outputCapacity), outputLength);
+	}
+
+	const unsigned char* inPtr = inputData + prefixSize;
+
+	// 读取组合密钥长度
+	memcpy(&storedCombinedKeyLength, inPtr, sizeof(int));
+	inPtr += sizeof(int);
+
+	// 验证公钥哈希
+	unsigned int storedPublicKeyHash;
+	memcpy(&storedPublicKeyHash, inPtr, sizeof(unsigned int));
+	inPtr += sizeof(unsigned int);
+
+	unsigned int currentPublicKeyHash = CalculatePublicKeyHash(publicKey);
+	if (storedPublicKeyHash != currentPublicKeyHash) {
+		return ERR_DECRYPTION_FAILED;
+	}
+
+	// 读取私钥长度
+	memcpy(&privateKeyLength, inPtr, sizeof(int));
+	inPtr += sizeof(int);
+
+	if (privateKeyLength != PRIVATE_KEY_SIZE_2048_BITS) {
+		return ERR_DECRYPTION_FAILED;
+	}
+
+	// 读取私钥（原地解密会覆盖文件头，先复制到安全内存区）
+	privateKey = SecureKeyAlloc(privateKeyLength);
+	if (!privateKey) {
+		return ERR_MEMORY_ALLOCATION_FAILED;
+	}
+
+	memcpy(privateKey, inPtr, privateKeyLength);
+	inPtr += privateKeyLength;
+
+	// 验证私钥哈希
+	unsigned int storedPrivateKeyHash;
+	memcpy(&storedPrivateKeyHash, inPtr, sizeof(unsigned int));
+	inPtr += sizeof(unsigned int);
+
+	unsigned int currentPrivateKeyHash = CalculatePrivateKeyHash(privateKey, privateKeyLength);
+	if (storedPrivateKeyHash != currentPrivateKeyHash) {
+		SecureKeyFree(privateKey);
+		return ERR_DECRYPTION_FAILED;
+	}
+
+	// 重新组合密钥
+	int pubKeyLen = strlen((const char*)publicKey);
+	int totalLen = privateKeyLength + pubKeyLen;
+	combinedKey = SecureKeyAlloc(totalLen + 1);
+	if (!combinedKey) {
+		SecureKeyFree(privateKey);
+		return ERR_MEMORY_ALLOCATION_FAILED;
+	}
+
+	// 交错组合两个密钥
+	InterleaveKeys(combinedKey, privateKey, privateKeyLength, publicKey, pubKeyLen);
+	combinedKeyLength = totalLen;
+
+	// 验证组合密钥长度
+	if (storedCombinedKeyLength != combinedKeyLength) {
+		SecureKeyFree(privateKey);
+		SecureKeyFree(combinedKey);
+		return ERR_DECRYPTION_FAILED;
+	}
+
+	// 验证校验和
+	unsigned int storedChecksum;
+	memcpy(&storedChecksum, inputData + inputLength - sizeof(unsigned int), sizeof(unsigned int));
+	unsigned int calculatedChecksum = CalculateCRC32(combinedKey, combinedKeyLength);
+	if (storedChecksum != calculatedChecksum) {
+		SecureKeyFree(privateKey);
+		SecureKeyFree(combinedKey);
+		return ERR_DECRYPTION_FAILED;
+	}
+
+	// 原地解密会覆盖输入，先复制引擎尾部数据
+	unsigned char trailer[CIPHER_ENGINE_MAX_TRAILER];
+	memcpy(trailer, inPtr + dataSize, engine->trailerSize);
+
+	CipherStream cipher;
+	result = CipherStreamOpen(&cipher, engine, combinedKey, combinedKeyLength, engineHeader, 0);
+	if (result != SUCCESS) {
+		SecureKeyFree(privateKey);
+		SecureKeyFree(combinedKey);
+		return result;
+	}
+
+	// 解密数据并校验引擎尾部数据，校验失败时擦除已输出的明文
+	engine->transform(cipher.context, output, inPtr, dataSize, 0);
+	if (engine->finalize(cipher.context, trailer) != 0) {
+		SecureZeroMemory(output, dataSize);
+		result = ERR_DECRYPTION_FAILED;
+	}
+	else {
+		*outputLength = dataSize;
+	}
+
+	// 清理资源
+	CipherStreamClose(&cipher);
+	SecureKeyFree(privateKey);
+	SecureKeyFree(combinedKey);
+
+	return result;
+}
+
+// 自包含式数据加密函数
+static int SelfContainedEncryptDataWithEngine(const CipherEngine* engine, const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char** outputData, size_t* outputLength) {
+	if (!inputData || inputLength == 0 || !publicKey || !outputData || !outputLength) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	*outputData = NULL;
+	*outputLength = 0;
+
+	// 分配输出缓冲区
+	size_t outputSize = inputLength + SelfContainedOverheadFor(engine);
+	int result = SUCCESS;
+	unsigned char* output = (unsigned char*)EncodeAllocWithinBudget(outputSize, &result);
+	if (!output) {
+		return result;
+	}
+
+	result = SelfContainedEncryptDataIntoWithEngine(engine, inputData, inputLength, publicKey, output, outputSize, outputLength);
+	if (result != SUCCESS) {
+		EncodeFree(output);
+		return result;
+	}
+
+	*outputData = output;
+	return SUCCESS;
+}
+
+// 自包含式数据加密（引擎0）
+int SelfContainedEncryptData(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char** outputData, size_t* outputLength) {
+	return SelfContainedEncryptDataWithEngine(&g_xorNibbleEngine, inputData, inputLength, publicKey, outputData, outputLength);
+}
+
+// 自包含式数据加密函数（指定加密引擎）
+int SelfContainedEncryptDataEx(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, const EncodeOptions* options, unsigned char** outputData, size_t* outputLength) {
+	const CipherEngine* engine = NULL;
+	int result = ResolveCipherEngine(options, &engine);
+	if (result != SUCCESS) {
+		return result;
+	}
+
+	return SelfContainedEncryptDataWithEngine(engine, inputData, inputLength, publicKey, outputData, outputLength);
+}
+
+// 自包含式数据解密函数
+int SelfContainedDecryptData(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char** outputData, size_t* outputLength) {
+	if (!inputData || inputLength == 0 || !publicKey || !outputData || !outputLength) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	*outputData = NULL;
+	*outputLength = 0;
+
+	// 根据文件头计算明文大小
+	size_t dataSize = 0;
+	int result = DecryptedSizeOf(inputData, inputLength, &dataSize);
+	if (result != SUCCESS) {
+		return result;
+	}
+
+	// 分配输出缓冲区
+	unsigned char* output = (unsigned char*)EncodeAllocWithinBudget(dataSize, &result);
+	if (!output) {
+		return result;
+	}
+
+	result = SelfContainedDecryptDataInto(inputData, inputLength, publicKey, output, dataSize, outputLength);
+	if (result != SUCCESS) {
+		EncodeFree(output);
+		return result;
+	}
+
+	*outputData = output;
+	return SUCCESS;
+}
+
+// 自包含式原地加密：buffer 前 dataLength 字节为明文，加密结果覆盖写入 buffer
+int SelfContainedEncryptDataInPlace(unsigned char* buffer, size_t bufferCapacity, size_t dataLength, const unsigned char* publicKey, size_t* outputLength) {
+	if (!buffer || dataLength == 0 || !publicKey || !outputLength) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	*outputLength = 0;
+	if (bufferCapacity < SelfContainedEncryptedSizeFor(dataLength)) {
+		return ERR_BUFFER_TOO_SMALL;
+	}
+
+	// 明文后移为文件头腾出空间，随后逐字节原地变换
+	memmove(buffer + SELF_CONTAINED_HEADER_SIZE, buffer, dataLength);
+	int result = SelfContainedEncryptDataInto(buffer + SELF_CONTAINED_HEADER_SIZE, dataLength, publicKey, buffer, bufferCapacity, outputLength);
+	if (result != SUCCESS) {
+		memmove(buffer, buffer + SELF_CONTAINED_HEADER_SIZE, dataLength);   // 失败时恢复原始明文
+	}
+
+	return result;
+}
+
+// 自包含式原地解密：buffer 中为完整加密数据，明文覆盖写入 buffer 起始处
+int SelfContainedDecryptDataInPlace(unsigned char* buffer, size_t bufferLength, const unsigned char* publicKey, size_t* outputLength) {
+	return SelfContainedDecryptDataInto(buffer, bufferLength, publicKey, buffer, bufferLength, outputLength);
+}
+
+// 根据加密数据头计算解密后的明文大小（自动识别双密钥/自包含式格式）
+int DecryptedSizeOf(const unsigned char* inputData, size_t inputLength, size_t* plaintextLength) {
+	if (!inputData || !plaintextLength) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	*plaintextLength = 0;
+
+	const CipherEngine* engine = NULL;
+	unsigned char engineHeader[CIPHER_ENGINE_MAX_HEADER];
+	size_t prefixSize = 0;
+	size_t overhead = 0;
+
+	int result = ParseEnginePrefix(inputData, inputLength, &g_streamFormat, &engine, engineHeader, &prefixSize);
+	if (result == SUCCESS) {
+		overhead = StreamOverheadFor(engine);
+	}
+	else if (result == ERR_INVALID_HEADER) {
+		result = ParseEnginePrefix(inputData, inputLength, &g_selfContainedFormat, &engine, engineHeader, &prefixSize);
+		if (result == SUCCESS) {
+			overhead = SelfContainedOverheadFor(engine);
+		}
+	}
+
+	if (result != SUCCESS) {
+		return result;
+	}
+
+	if (inputLength < overhead) {
+		return ERR_INVALID_HEADER;
+	}
+
+	*plaintextLength = inputLength - overhead;
+	return SUCCESS;
+}
+
+// 验证自包含式加密文件有效性
+int ValidateSelfContainedFile(const char* filePath, const unsigned char* publicKey) {
+	FILE* inputFile = NULL;
+	unsigned char* privateKey = NULL;
+	unsigned char* combinedKey = NULL;
+	const CipherEngine* engine = NULL;
+	unsigned char engineHeader[CIPHER_ENGINE_MAX_HEADER];
+	int storedCombinedKeyLength = 0;
+	int privateKeyLength = 0;
+	int combinedKeyLength = 0;
+	bool isValid = false;
+
+	if (!filePath || !publicKey) {
+		return 0;
+	}
+
+	// 打开文件
+	fopen_s(&inputFile, filePath, "rb");
+	if (!inputFile) {
+		return 0;
+	}
+
+	// 验证文件头
+	if (ReadEnginePrefix(inputFile, &g_selfContainedFormat, &engine, engineHeader) != SUCCESS) {
+		fclose(inputFile);
+		return 0;
+	}
+
+	// 读取组合密钥长度
+	if (fread(&storedCombinedKeyLength, sizeof(int), 1, inputFile) != 1) {
+		fclose(inputFile);
+		return 0;
+	}
+
+	// 验证公钥哈希
+	unsigned int storedPublicKeyHash;
+	if (fread(&storedPublicKeyHash, sizeof(unsigned int), 1, inputFile) != 1) {
+		fclose(inputFile);
+		return 0;
+	}
+
+	unsigned int currentPublicKeyHash = CalculatePublicKeyHash(publicKey);
+	if (storedPublicKeyHash != currentPublicKeyHash) {
+		fclose(inputFile);
+		return 0;
+	}
+
+	// 读取私钥长度
+	if (fread(&privateKeyLength, sizeof(int), 1, inputFile) != 1) {
+		fclose(inputFile);
+		return 0;
+	}
+
+	if (privateKeyLength != PRIVATE_KEY_SIZE_2048_BITS) {
+		fclose(inputFile);
+		return 0;
+	}
+
+	// 读取私钥
+	privateKey = SecureKeyAlloc(privateKeyLength);
+	if (!privateKey) {
+		fclose(inputFile);
+		return 0;
+	}
+
+	if (fread(privateKey, 1, privateKeyLength, inputFile) != privateKeyLength) {
+		SecureKeyFree(privateKey);
+		fclose(inputFile);
+		return 0;
+	}
+
+	// 验证私钥哈希
+	unsigned int storedPrivateKeyHash;
+	if (fread(&storedPrivateKeyHash, sizeof(unsigned int), 1, inputFile) != 1) {
+		SecureKeyFree(privateKey);
+		fclose(inputFile);
+		return 0;
+	}
+
+	unsigned int currentPrivateKeyHash = CalculatePrivateKeyHash(privateKey, privateKeyLength);
+	if (storedPrivateKeyHash != currentPrivateKeyHash) {
+		SecureKeyFree(privateKey);
+		fclose(inputFile);
+		return 0;
+	}
+
+	// 重新组合密钥
+	int pubKeyLen = strlen((const char*)publicKey);
+	int totalLen = privateKeyLength + pubKeyLen;
+	combinedKey = SecureKeyAlloc(totalLen + 1);
+	if (!combinedKey) {
+		SecureKeyFree(privateKey);
+		fclose(inputFile);
+		return 0;
+	}
+
+	// 交错组合两个密钥
+	InterleaveKeys(combinedKey, privateKey, privateKeyLength, publicKey, pubKeyLen);
+	combinedKeyLength = totalLen;
+
+	// 验证组合密钥长度
+	if (storedCombinedKeyLength != combinedKeyLength) {
+		SecureKeyFree(privateKey);
+		SecureKeyFree(combinedKey);
+		fclose(inputFile);
+		return 0;
+	}
+
+	// 验证校验和
+	_fseeki64(inputFile, -(__int64)sizeof(unsigned int), SEEK_END);
+	unsigned int storedChecksum;
+	if (fread(&storedChecksum, sizeof(unsigned int), 1, inputFile) == 1) {
+		unsigned int calculatedChecksum = CalculateCRC32(combinedKey, combinedKeyLength);
+		if (storedChecksum == calculatedChecksum) {
+			isValid = true;
+		}
+	}
+
+	// 清理资源
+	SecureKeyFree(privateKey);
+	SecureKeyFree(combinedKey);
+	fclose(inputFile);
+
+	return isValid ? 1 : 0;
+}
+
+// ========== 加密文件解密到内存 ==========
+
+// 读取并校验自包含式文件头，用内嵌私钥重新组合出组合密钥，成功时文件位置停在数据区开头
+// combinedKey 由 SecureKeyAlloc 分配，调用者负责释放
+static int ReadSelfContainedFileLayout(FILE* file, const unsigned char* publicKey, EncryptedFileLayout* layout, unsigned char** combinedKey, int* combinedKeyLength) {
+	int result = ReadEnginePrefix(file, &g_selfContainedFormat, &layout->engine, layout->engineHeader);
+	if (result != SUCCESS) {
+		return result;
+	}
+
+	int storedCombinedKeyLength = 0;
+	unsigned int storedPublicKeyHash = 0;
+	int privateKeyLength = 0;
+	if (fread(&storedCombinedKeyLength, sizeof(int), 1, file) != 1 ||
+		fread(&storedPublicKeyHash, sizeof(unsigned int), 1, file) != 1 ||
+		fread(&privateKeyLength, sizeof(int), 1, file) != 1) {
+		return ERR_INVALID_HEADER;
+	}
+
+	if (storedPublicKeyHash != CalculatePublicKeyHash(publicKey) || privateKeyLength != PRIVATE_KEY_SIZE_2048_BITS) {
+		return ERR_DECRYPTION_FAILED;
+	}
+
+	unsigned char* privateKey = SecureKeyAlloc(privateKeyLength);
+	if (!privateKey) {
+		return ERR_MEMORY_ALLOCATION_FAILED;
+	}
+
+	unsigned int storedPrivateKeyHash = 0;
+	if (fread(privateKey, 1, privateKeyLength, file) != (size_t)privateKeyLength ||
+		fread(&storedPrivateKeyHash, sizeof(unsigned int), 1, file) != 1) {
+		SecureKeyFree(privateKey);
+		return ERR_INVALID_HEADER;
+	}
+
+	if (storedPrivateKeyHash != CalculatePrivateKeyHash(privateKey, privateKeyLength)) {
+		SecureKeyFree(privateKey);
+		return ERR_DECRYPTION_FAILED; // 私钥被篡改
+	}
+
+	// 交错组合内嵌私钥和公钥
+	int publicKeyLength = (int)strlen((const char*)publicKey);
+	int keyLength = privateKeyLength + publicKeyLength;
+	unsigned char* key = SecureKeyAlloc(keyLength + 1);
+	if (!key) {
+		SecureKeyFree(privateKey);
+		return ERR_MEMORY_ALLOCATION_FAILED;
+	}
+	InterleaveKeys(key, privateKey, privateKeyLength, publicKey, publicKeyLength);
+	SecureKeyFree(privateKey);
+
+	result = storedCombinedKeyLength == keyLength ? ReadEncryptedFileTail(file, key, keyLength, layout) : ERR_DECRYPTION_FAILED;
+	if (result != SUCCESS) {
+		SecureKeyFree(key);
+		return result;
+	}
+
+	*combinedKey = key;
+	*combinedKeyLength = keyLength;
+	return SUCCESS;
+}
+
+// 按魔数头识别加密格式，长度不足或魔数不匹配时返回 ENCODE_FORMAT_UNKNOWN
+static int DetectEncodedFormat(const unsigned char* data, size_t length) {
+	if (length >= SELF_CONTAINED_MAGIC_SIZE &&
+		(memcmp(data, SELF_CONTAINED_MAGIC_HEADER, SELF_CONTAINED_MAGIC_SIZE) == 0 || memcmp(data, SELF_CONTAINED_MAGIC_HEADER_V11, SELF_CONTAINED_MAGIC_SIZE) == 0)) {
+		return ENCODE_FORMAT_SELF_CONTAINED;
+	}
+
+	if (length >= MAGIC_HEADER_SIZE &&
+		(memcmp(data, MAGIC_HEADER, MAGIC_HEADER_SIZE) == 0 || memcmp(data, MAGIC_HEADER_V11, MAGIC_HEADER_SIZE) == 0)) {
+		return ENCODE_FORMAT_STREAM;
+	}
+
+	return ENCODE_FORMAT_UNKNOWN;
+}
+
+// 按魔数头识别双密钥格式或自包含式格式，校验文件并取得组合密钥（双密钥格式需要私钥快照）
+// 识别出的格式记录在 layout->format 中（校验失败时同样有效）
+// combinedKey 由 SecureKeyAlloc 分配，调用者负责释放
+static int OpenEncryptedFileLayout(FILE* file, const PrivateKeySnapshot* keySnapshot, const unsigned char* publicKey, EncryptedFileLayout* layout, unsigned char** combinedKey, int* combinedKeyLength) {
+	*combinedKey = NULL;
+	*combinedKeyLength = 0;
+
+	unsigned char magic[SELF_CONTAINED_MAGIC_SIZE];
+	size_t magicLength = fread(magic, 1, sizeof(magic), file);
+	_fseeki64(file, 0, SEEK_SET);
+
+	layout->format = DetectEncodedFormat(magic, magicLength);
+	if (layout->format == ENCODE_FORMAT_SELF_CONTAINED) {
+		return ReadSelfContainedFileLayout(file, publicKey, layout, combinedKey, combinedKeyLength);
+	}
+
+	if (layout->format == ENCODE_FORMAT_UNKNOWN) {
+		return ERR_INVALID_HEADER;
+	}
+
+	if (!keySnapshot) {
+		return ERR_PRIVATE_KEY_NOT_SET;
+	}
+
+	unsigned char* key = CombineKeys(keySnapshot, publicKey, combinedKeyLength);
+	if (!key || *combinedKeyLength == 0) {
+		SecureKeyFree(key);
+		return ERR_DECRYPTION_FAILED;
+	}
+
+	int result = ReadStreamFileLayout(file, key, *combinedKeyLength, publicKey, layout);
+	if (result != SUCCESS) {
+		SecureKeyFree(key);
+		return result;
+	}
+
+	*combinedKey = key;
+	return SUCCESS;
+}
+
+#define DECRYPT_MEMORY_CHUNK_SIZE (1024 * 1024)    // 每次读入目标缓冲区并就地解密的大小（解密时数据仍在缓存中）
+
+// 按选项分配明文缓冲区：调用者分配器、页对齐（VirtualAlloc）或本库分配器
+static unsigned char* AllocateDecryptedMemory(const DecryptMemoryOptions* options, size_t size, int* result) {
+	*result = SUCCESS;
+
+	if (options && options->allocFunc) {
+		unsigned char* memory = (unsigned char*)options->allocFunc(size, options->allocUser);
+		if (!memory) {
+			*result = ERR_MEMORY_ALLOCATION_FAILED;
+		}
+		return memory;
+	}
+
+	// 页对齐缓冲区不经过 EncodeAlloc，单独计入预算（明文大于预算上限时立即返回 ERR_MEMORY_BUDGET_EXCEEDED）
+	if (options && (options->flags & DECRYPT_MEMORY_PAGE_ALIGNED)) {
+		*result = ChargeMemoryWithinBudget(size);
+		if (*result != SUCCESS) {
+			return NULL;
+		}
+		unsigned char* memory = (unsigned char*)VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		if (!memory) {
+			UnchargeMemory(size);
+			*result = ERR_MEMORY_ALLOCATION_FAILED;
+		}
+		return memory;
+	}
+
+	return (unsigned char*)EncodeAllocWithinBudget(size, result);
+}
+
+// 擦除并释放明文缓冲区（解密失败时使用）
+static void ReleaseDecryptedMemory(const DecryptMemoryOptions* options, unsigned char* memory, size_t size) {
+	SecureZeroMemory(memory, size);
+
+	if (options && options->allocFunc) {
+		if (options->freeFunc) {
+			options->freeFunc(memory, options->allocUser);
+		}
+	}
+	else if (options && (options->flags & DECRYPT_MEMORY_PAGE_ALIGNED)) {
+		FreeDecryptedPages(memory, size);
+	}
+	else {
+		EncodeFree(memory);
+	}
+}
+
+// 解密整个加密文件到一次分配的内存：按文件头得到明文大小，数据直接读入目标缓冲区后就地解密
+static int DecryptFileToMemoryWithSnapshot(const PrivateKeySnapshot* keySnapshot, const char* filePath, const unsigned char* publicKey, const DecryptMemoryOptions* options, unsigned char** outputData, size_t* outputLength) {
+	FILE* inputFile = NULL;
+	unsigned char* combinedKey = NULL;
+	int combinedKeyLength = 0;
+	int result = SUCCESS;
+
+	if (!filePath || !publicKey || !outputData || !outputLength) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	*outputData = NULL;
+	*outputLength = 0;
+
+	if (options && (options->cbSize < sizeof(DecryptMemoryOptions) || (options->allocFunc && !options->freeFunc))) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	// 打开输入文件（数据区直接读入目标缓冲区，只有文件头和尾部经过 stdio 缓冲区）
+	fopen_s(&inputFile, filePath, "rb");
+	if (!inputFile) {
+		return ERR_FILE_OPEN_FAILED;
+	}
+
+	EncryptedFileLayout layout;
+	result = OpenEncryptedFileLayout(inputFile, keySnapshot, publicKey, &layout, &combinedKey, &combinedKeyLength);
+	if (result != SUCCESS) {
+		fclose(inputFile);
+		return result;
+	}
+
+	if ((unsigned __int64)layout.dataSize > (size_t)-1) {
+		SecureKeyFree(combinedKey);
+		fclose(inputFile);
+		return ERR_MEMORY_ALLOCATION_FAILED;
+	}
+
+	// 一次分配明文大小（空数据区也分配1字节，保证成功时输出指针非空）
+	size_t dataSize = (size_t)layout.dataSize;
+	size_t allocationSize = dataSize > 0 ? dataSize : 1;
+	unsigned char* output = AllocateDecryptedMemory(options, allocationSize, &result);
+	if (!output) {
+		SecureKeyFree(combinedKey);
+		fclose(inputFile);
+		return result;
+	}
+
+	CipherStream cipher;
+	result = CipherStreamOpen(&cipher, layout.engine, combinedKey, combinedKeyLength, layout.engineHeader, 0);
+
+	size_t totalProcessed = 0;
+	while (result == SUCCESS && totalProcessed < dataSize) {
+		size_t chunk = dataSize - totalProcessed;
+		if (chunk > DECRYPT_MEMORY_CHUNK_SIZE) {
+			chunk = DECRYPT_MEMORY_CHUNK_SIZE;
+		}
+
+		if (fread(output + totalProcessed, 1, chunk, inputFile) != chunk) {
+			result = ERR_DECRYPTION_FAILED;
+			break;
+		}
+
+		layout.engine->transform(cipher.context, output + totalProcessed, output + totalProcessed, chunk, (__int64)totalProcessed);
+		totalProcessed += chunk;
+	}
+
+	// 校验引擎尾部数据（如认证标签）
+	if (result == SUCCESS && layout.engine->finalize(cipher.context, layout.trailer) != 0) {
+		result = ERR_DECRYPTION_FAILED;
+	}
+
+	// 清理资源
+	CipherStreamClose(&cipher);
+	SecureKeyFree(combinedKey);
+	fclose(inputFile);
+
+	if (result != SUCCESS) {
+		ReleaseDecryptedMemory(options, output, allocationSize);
+		return result;
+	}
+
+	*outputData = output;
+	*outputLength = dataSize;
+	return SUCCESS;
+}
+
+// 解密加密文件到内存（双密钥格式使用 InitStreamFile 设置的全局私钥）
+int DecryptFileToMemory(const char* filePath, const unsigned char* publicKey, const DecryptMemoryOptions* options, unsigned char** outputData, size_t* outputLength) {
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = DecryptFileToMemoryWithSnapshot(keySnapshot, filePath, publicKey, options, outputData, outputLength);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+// 释放 DECRYPT_MEMORY_PAGE_ALIGNED 分配的明文缓冲区
+void FreeDecryptedPages(unsigned char* data, size_t length) {
+	if (!data) {
+		return;
+	}
+
+	VirtualFree(data, 0, MEM_RELEASE);
+	UnchargeMemory(length > 0 ? length : 1);
+}
+
+// ========== 加密文件句柄（一次校验，多次解密） ==========
+
+// 打开时完成格式识别、文件头/校验和检查与密钥组合，之后的整体解密和随机读取都直接使用缓存的结果
+struct EncryptedFileHandle {
+	FILE* file;
+	SRWLOCK fileLock;                            // 串行化文件定位与读取
+	char* filePath;                              // 进度回调与流式缓冲区档位使用
+	unsigned char* combinedKey;                  // 组合密钥（安全内存区）
+	int combinedKeyLength;
+	EncryptedFileLayout layout;
+	CipherStream rangeCipher;                    // 随机读取共用的引擎实例（只通过 transformAt 使用）
+	volatile LONG verified;                      // 引擎尾部数据（如认证标签）已校验通过
+};
+
+static int OpenEncryptedFileWithSnapshot(const PrivateKeySnapshot* keySnapshot, const char* filePath, const unsigned char* publicKey, EncryptedFileHandle** handle) {
+	if (!filePath || !publicKey || !handle) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	*handle = NULL;
+
+	EncryptedFileHandle* fileHandle = (EncryptedFileHandle*)EncodeAlloc(sizeof(EncryptedFileHandle));
+	if (!fileHandle) {
+		return ERR_MEMORY_ALLOCATION_FAILED;
+	}
+	memset(fileHandle, 0, sizeof(EncryptedFileHandle));
+	InitializeSRWLock(&fileHandle->fileLock);
+
+	size_t pathLength = strlen(filePath);
+	fileHandle->filePath = (char*)EncodeAlloc(pathLength + 1);
+	if (!fileHandle->filePath) {
+		CloseEncryptedFile(fileHandle);
+		return ERR_MEMORY_ALLOCATION_FAILED;
+	}
+	memcpy(fileHandle->filePath, filePath, pathLength + 1);
+
+	fopen_s(&fileHandle->file, filePath, "rb");
+	if (!fileHandle->file) {
+		CloseEncryptedFile(fileHandle);
+		return ERR_FILE_OPEN_FAILED;
+	}
+
+	int result = OpenEncryptedFileLayout(fileHandle->file, keySnapshot, publicKey, &fileHandle->layout, &fileHandle->combinedKey, &fileHandle->combinedKeyLength);
+
+	// 随机读取的引擎实例只初始化一次（AES-GCM 的密钥派生与 H 幂次计算不随每次读取重复）
+	const CipherEngine* engine = fileHandle->layout.engine;
+	if (result == SUCCESS && engine->transformAt) {
+		result = CipherStreamOpen(&fileHandle->rangeCipher, engine, fileHandle->combinedKey, fileHandle->combinedKeyLength, fileHandle->layout.engineHeader, 0);
+	}
+
+	if (result != SUCCESS) {
+		CloseEncryptedFile(fileHandle);
+		return result;
+	}
+
+	// 没有尾部数据的引擎无需校验
+	fileHandle->verified = engine->trailerSize == 0;
+	*handle = fileHandle;
+	return SUCCESS;
+}
+
+// 打开加密文件句柄（双密钥格式使用 InitStreamFile 设置的全局私钥）
+int OpenEncryptedFile(const char* filePath, const unsigned char* publicKey, EncryptedFileHandle** handle) {
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = OpenEncryptedFileWithSnapshot(keySnapshot, filePath, publicKey, handle);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+int GetEncryptedFileInfo(EncryptedFileHandle* handle, unsigned long long* plaintextLength, int* engineId) {
+	if (!handle) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	if (plaintextLength) {
+		*plaintextLength = (unsigned long long)handle->layout.dataSize;
+	}
+	if (engineId) {
+		*engineId = handle->layout.engine->id;
+	}
+	return SUCCESS;
+}
+
+// 完整校验一遍引擎尾部数据，通过后记录在句柄中（调用者持有 fileLock）
+static int VerifyEncryptedFileHandle(EncryptedFileHandle* handle) {
+	if (handle->verified) {
+		return SUCCESS;
+	}
+
+	CallArena arena;
+	size_t streamBufferSize = 0;
+	int result = CallArenaReserveFile(&arena, handle->filePath, &streamBufferSize);
+	if (result != SUCCESS) {
+		return result;
+	}
+
+	unsigned char* buffer = (unsigned char*)CallArenaAlloc(&arena, streamBufferSize);
+	result = VerifyStreamFileData(handle->file, &handle->layout, handle->combinedKey, handle->combinedKeyLength, buffer, streamBufferSize);
+	CallArenaRelease(&arena);
+
+	if (result == SUCCESS) {
+		InterlockedExchange(&handle->verified, TRUE);
+	}
+	return result;
+}
+
+// 把已校验文件头的加密文件整体解密到输出文件（inputFile 位置任意，调用者持有 arena）
+// filePath 只用于进度回调；解密失败时删除输出文件，缓冲区中的明文在返回前擦除
+static int DecryptFileLayoutTo(FILE* inputFile, const EncryptedFileLayout* layout, const unsigned char* combinedKey, int combinedKeyLength,
+	const char* filePath, const char* outputPath, ProgressCallback progressCallback, CallArena* arena, unsigned char* buffer, size_t bufferSize) {
+	FILE* outputFile = NULL;
+
+	// 整体解密需要按顺序变换的引擎实例（AES-GCM 同时累计认证标签）
+	CipherStream cipher;
+	unsigned char engineHeader[CIPHER_ENGINE_MAX_HEADER];
+	memcpy(engineHeader, layout->engineHeader, layout->engine->headerSize);
+	int result = CipherStreamOpen(&cipher, layout->engine, combinedKey, combinedKeyLength, engineHeader, 0);
+	if (result != SUCCESS) {
+		return result;
+	}
+
+	fopen_s(&outputFile, outputPath, "wb");
+	if (!outputFile) {
+		CipherStreamClose(&cipher);
+		return ERR_FILE_OPEN_FAILED;
+	}
+	AttachStdioBuffer(outputFile, arena);
+
+	ProgressBegin(layout->dataSize);
+	if (progressCallback) {
+		progressCallback(filePath, 0.0);
+	}
+
+	_fseeki64(inputFile, layout->dataOffset, SEEK_SET);
+
+	__int64 totalProcessed = 0;
+	while (totalProcessed < layout->dataSize) {
+		size_t chunk = bufferSize;
+		if ((__int64)chunk > layout->dataSize - totalProcessed) {
+			chunk = (size_t)(layout->dataSize - totalProcessed);
+		}
+
+		if (fread(buffer, 1, chunk, inputFile) != chunk) {
+			result = ERR_DECRYPTION_FAILED;
+			break;
+		}
+
+		layout->engine->transform(cipher.context, buffer, buffer, chunk, totalProcessed);
+
+		if (fwrite(buffer, 1, chunk, outputFile) != chunk) {
+			result = ERR_DECRYPTION_FAILED;
+			break;
+		}
+
+		totalProcessed += chunk;
+		ProgressAdvance(totalProcessed);
+
+		if (progressCallback && layout->dataSize > 0) {
+			progressCallback(filePath, (double)totalProcessed / (double)layout->dataSize);
+		}
+	}
+
+	// 校验引擎尾部数据（如认证标签）
+	unsigned char trailer[CIPHER_ENGINE_MAX_TRAILER];
+	memcpy(trailer, layout->trailer, layout->engine->trailerSize);
+	if (result == SUCCESS && layout->engine->finalize(cipher.context, trailer) != 0) {
+		result = ERR_DECRYPTION_FAILED;
+	}
+
+	if (result == SUCCESS && progressCallback) {
+		progressCallback(filePath, 1.0);
+	}
+
+	// 清理资源
+	SecureZeroMemory(buffer, bufferSize);
+	CipherStreamClose(&cipher);
+	fclose(outputFile);
+
+	if (result != SUCCESS) {
+		remove(outputPath);  // 如果解密失败则删除输出文件
+	}
+
+	ProgressEnd(result);
+
+	return result;
+}
+
+int EncryptedFileDecrypt(EncryptedFileHandle* handle, const char* outputPath, ProgressCallback progressCallback) {
+	CallArena arena;
+	size_t streamBufferSize = 0;
+
+	if (!handle || !outputPath) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	int result = CallArenaReserveFile(&arena, handle->filePath, &streamBufferSize);
+	if (result != SUCCESS) {
+		return result;
+	}
+	unsigned char* buffer = (unsigned char*)CallArenaAlloc(&arena, streamBufferSize);
+
+	// 整个解密期间独占文件位置，随机读取在此期间等待
+	AcquireSRWLockExclusive(&handle->fileLock);
+	result = DecryptFileLayoutTo(handle->file, &handle->layout, handle->combinedKey, handle->combinedKeyLength,
+		handle->filePath, outputPath, progressCallback, &arena, buffer, streamBufferSize);
+
+	// 尾部数据校验通过后随机读取不再需要单独校验
+	if (result == SUCCESS) {
+		InterlockedExchange(&handle->verified, TRUE);
+	}
+	ReleaseSRWLockExclusive(&handle->fileLock);
+
+	CallArenaRelease(&arena);
+	return result;
+}
+
+int EncryptedFileDecryptRange(EncryptedFileHandle* handle, unsigned long long offset, unsigned char* output, size_t length, size_t* bytesRead) {
+	if (!handle || (!output && length > 0) || !bytesRead) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	*bytesRead = 0;
+
+	const EncryptedFileLayout* layout = &handle->layout;
+	if (!layout->engine->transformAt) {
+		return ERR_UNSUPPORTED_ENGINE;
+	}
+	if (offset > (unsigned long long)layout->dataSize) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	// 超出明文末尾的部分不读取
+	if ((unsigned long long)length > (unsigned long long)layout->dataSize - offset) {
+		length = (size_t)((unsigned long long)layout->dataSize - offset);
+	}
+
+	int result = SUCCESS;
+	AcquireSRWLockExclusive(&handle->fileLock);
+
+	// 带认证标签的引擎先完整校验一次，未通过校验的数据不输出
+	if (!handle->verified) {
+		result = VerifyEncryptedFileHandle(handle);
+	}
+
+	if (result == SUCCESS && length > 0) {
+		_fseeki64(handle->file, layout->dataOffset + (__int64)offset, SEEK_SET);
+		if (fread(output, 1, length, handle->file) != length) {
+			result = ERR_DECRYPTION_FAILED;
+		}
+	}
+	ReleaseSRWLockExclusive(&handle->fileLock);
+
+	if (result != SUCCESS) {
+		return result;
+	}
+
+	// 解密在锁外进行，多个线程的随机读取只在文件读取上串行
+	layout->engine->transformAt(handle->rangeCipher.context, output, output, length, (__int64)offset);
+	*bytesRead = length;
+	return SUCCESS;
+}
+
+void CloseEncryptedFile(EncryptedFileHandle* handle) {
+	if (!handle) {
+		return;
+	}
+
+	CipherStreamClose(&handle->rangeCipher);
+	SecureKeyFree(handle->combinedKey);
+	if (handle->file) {
+		fclose(handle->file);
+	}
+	EncodeFree(handle->filePath);
+	EncodeFree(handle);
+}
+
+// ========== 自动识别格式的解密入口 ==========
+
+// 打开文件并按魔数头识别格式后，在同一个文件句柄上校验与解密，不再先按一种格式尝试失败后重新打开
+static int DecryptFileAnyWithSnapshot(const PrivateKeySnapshot* keySnapshot, const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback, int* format) {
+	FILE* inputFile = NULL;
+	CallArena arena;
+	size_t streamBufferSize = 0;
+	EncryptedFileLayout layout;
+	unsigned char* combinedKey = NULL;
+	int combinedKeyLength = 0;
+
+	if (format) {
+		*format = ENCODE_FORMAT_UNKNOWN;
 	}
-	else {
-		fclose(inputFile);
-		free(combinedKey);
-		return ERR_INVALID_HEADER;
+
+	if (!filePath || !outputPath || !publicKey) {
+		return ERR_INVALID_PARAMETER;
 	}
 
-	// 恢复文件位置到数据开始处
-	_fseeki64(inputFile, currentPos, SEEK_SET);
+	// 从线程缓存取得流式缓冲区和两个文件的 stdio 缓冲区
+	int result = CallArenaReserveFile(&arena, filePath, &streamBufferSize);
+	if (result != SUCCESS) {
+		return result;
+	}
+	unsigned char* buffer = (unsigned char*)CallArenaAlloc(&arena, streamBufferSize);
 
-	// 打开输出文件
-	fopen_s(&outputFile, outputPath, "wb");
-	if (!outputFile) {
-		fclose(inputFile);
-		free(combinedKey);
+	fopen_s(&inputFile, filePath, "rb");
+	if (!inputFile) {
+		CallArenaRelease(&arena);
 		return ERR_FILE_OPEN_FAILED;
 	}
+	AttachStdioBuffer(inputFile, &arena);
 
-	// 分配大缓冲区
-	buffer = (unsigned char*)malloc(STREAM_BUFFER_SIZE);
-	if (!buffer) {
-		fclose(inputFile);
-		fclose(outputFile);
-		free(combinedKey);
-		return ERR_MEMORY_ALLOCATION_FAILED;
+	result = OpenEncryptedFileLayout(inputFile, keySnapshot, publicKey, &layout, &combinedKey, &combinedKeyLength);
+	if (format) {
+		*format = layout.format;
 	}
 
-	// 获取文件大小并计算数据区大小
-	_fseeki64(inputFile, 0, SEEK_END);
-	__int64 fileSize = _ftelli64(inputFile);
-	_fseeki64(inputFile, currentPos, SEEK_SET);
-	__int64 dataSize = fileSize - currentPos - sizeof(unsigned int);
-
-	// 初始进度回调通知
-	if (progressCallback) {
-		progressCallback(filePath, 0.0);
+	if (result == SUCCESS) {
+		result = DecryptFileLayoutTo(inputFile, &layout, combinedKey, combinedKeyLength, filePath, outputPath, progressCallback, &arena, buffer, streamBufferSize);
 	}
 
-	// 大块处理文件以实现复杂解密的最高速度
-	size_t bytesRead;
-	__int64 totalProcessed = 0;
+	// 清理资源
+	SecureKeyFree(combinedKey);
+	fclose(inputFile);
+	CallArenaRelease(&arena);
 
-	while ((bytesRead = fread(buffer, 1, STREAM_BUFFER_SIZE, inputFile)) > 0) {
-		// 处理包含校验和的最后数据块
-		if (totalProcessed + bytesRead >= dataSize) {
-			bytesRead = dataSize - totalProcessed;
-			if (bytesRead <= 0) break;
-		}
+	return result;
+}
 
-		// 高效双层XOR + 半字节交换解密算法（与加密算法相同，自逆操作）
-		for (size_t i = 0; i < bytesRead; i++) {
-			// 使用全局位置计算密钥索引，确保与StreamEncryptFile一致
-			__int64 globalIndex = totalProcessed + i;
-			unsigned char keyByte = combinedKey[globalIndex % combinedKeyLength];
-			unsigned char a1 = buffer[i];                                    // 加密字节
-			unsigned char a2 = a1 ^ keyByte;                                 // 第一次XOR（逆向第二次XOR）
-			unsigned char a3 = ((a2 & 0x0F) << 4) | ((a2 & 0xF0) >> 4);    // 半字节交换（自逆操作）
-			unsigned char a4 = a3 ^ keyByte;                                 // 第二次XOR（逆向第一次XOR）
-			buffer[i] = a4;                                                  // 最终解密结果
-		}
+int DecryptFileAny(const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback, int* format) {
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = DecryptFileAnyWithSnapshot(keySnapshot, filePath, outputPath, publicKey, progressCallback, format);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
 
-		// 立即写入解密数据
-		size_t bytesWritten = fwrite(buffer, 1, bytesRead, outputFile);
-		if (bytesWritten != bytesRead) {
-			result = ERR_DECRYPTION_FAILED;
-			break;
+int DecryptDataAny(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char** outputData, size_t* outputLength, int* format) {
+	int detected = inputData ? DetectEncodedFormat(inputData, inputLength) : ENCODE_FORMAT_UNKNOWN;
+	if (format) {
+		*format = detected;
+	}
+
+	// 两个格式的解析函数都直接在调用者缓冲区上工作，识别后只调用其中一个
+	switch (detected) {
+	case ENCODE_FORMAT_STREAM:
+		return StreamDecryptData(inputData, inputLength, publicKey, outputData, outputLength);
+	case ENCODE_FORMAT_SELF_CONTAINED:
+		return SelfContainedDecryptData(inputData, inputLength, publicKey, outputData, outputLength);
+	default:
+		if (!inputData || !publicKey || !outputData || !outputLength) {
+			return ERR_INVALID_PARAMETER;
 		}
+		*outputData = NULL;
+		*outputLength = 0;
+		return ERR_INVALID_HEADER;
+	}
+}
 
-		totalProcessed += bytesRead;
+static int ValidateAnyWithSnapshot(const PrivateKeySnapshot* keySnapshot, const char* filePath, const unsigned char* publicKey, int* format) {
+	FILE* inputFile = NULL;
+	EncryptedFileLayout layout;
+	unsigned char* combinedKey = NULL;
+	int combinedKeyLength = 0;
 
-		// 进度回调 - 报告基于数据处理的真实进度
-		if (progressCallback && dataSize > 0) {
-			// 现在数据处理占100%，因为校验和已在开头验证
-			double dataProgress = (double)totalProcessed / (double)dataSize;
-			progressCallback(filePath, dataProgress);
-		}
+	if (format) {
+		*format = ENCODE_FORMAT_UNKNOWN;
 	}
 
-	// 解密完成后的最终处理
-	if (result == SUCCESS) {
-		// 最终进度回调 - 100%完成
-		if (progressCallback) {
-			progressCallback(filePath, 1.0);
-		}
+	if (!filePath || !publicKey) {
+		return 0;
 	}
 
-	// 清理资源
-	if (combinedKey) {
-		SecureZeroMemory(combinedKey, combinedKeyLength);
-		free(combinedKey);
+	fopen_s(&inputFile, filePath, "rb");
+	if (!inputFile) {
+		return 0;
 	}
-	free(buffer);
-	fclose(inputFile);
-	fclose(outputFile);
 
-	if (result != SUCCESS) {
-		remove(outputPath);  // 如果解密失败则删除输出文件
+	// 与 ValidateEncryptedFile / ValidateSelfContainedFile 相同：校验文件头、密钥信息与末尾校验和
+	int result = OpenEncryptedFileLayout(inputFile, keySnapshot, publicKey, &layout, &combinedKey, &combinedKeyLength);
+	if (format) {
+		*format = layout.format;
 	}
 
+	SecureKeyFree(combinedKey);
+	fclose(inputFile);
+
+	return result == SUCCESS ? 1 : 0;
+}
+
+int ValidateAny(const char* filePath, const unsigned char* publicKey, int* format) {
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = ValidateAnyWithSnapshot(keySnapshot, filePath, publicKey, format);
+	ReleaseKeySnapshot(keySnapshot);
 	return result;
 }
 
-int ValidateEncryptedFile(const char* filePath, const unsigned char* publicKey) {
-	FILE* inputFile = NULL;
-	unsigned char* combinedKey = NULL;
-	char header[MAGIC_HEADER_SIZE + 1];
-	int storedKeyLength = 0;
-	int combinedKeyLength = 0;
-	bool isValid = false;
+// ========== 按需解密读取器（明文页 LRU 缓存） ==========
+
+#define READER_MIN_PAGE_SIZE 4096
+#define READER_MAX_PAGE_SIZE (16 * 1024 * 1024)
+#define READER_MAX_PAGE_COUNT (1 << 24)             // 缓存槽数上限（槽号与哈希桶号用 int 保存）
+#define READER_NO_PAGE -1
+
+// 缓存槽：按页号链接到哈希桶，按最近使用顺序链接到 LRU 链表（空闲槽通过 lruNext 组成空闲链表）
+struct ReaderPage {
+	unsigned long long pageIndex;
+	int hashNext;
+	int lruPrev;
+	int lruNext;
+	size_t length;                               // 页中有效的明文字节数（最后一页可能不满）
+};
+
+struct EncryptedFileReader {
+	EncryptedFileHandle* file;
+	SRWLOCK cacheLock;
+	size_t pageSize;
+	int pageCount;                               // 缓存槽数
+	int bucketMask;
+	ReaderPage* pages;
+	int* buckets;
+	unsigned char* pageData;                     // 全部缓存槽的明文（一次分配）
+	size_t pageDataSize;
+	int lruHead;                                 // 最近使用
+	int lruTail;                                 // 最久未用（优先淘汰）
+	int freeHead;
+	size_t cachedPages;
+	unsigned long long cacheHits;
+	unsigned long long cacheMisses;
+};
+
+static inline int ReaderBucketOf(const EncryptedFileReader* reader, unsigned long long pageIndex) {
+	return (int)((pageIndex * 0x9E3779B97F4A7C15ULL) >> 32) & reader->bucketMask;
+}
 
-	// 检查私钥是否已设置
-	if (!IsPrivateKeySet()) {
-		return 0; // Invalid
+static void ReaderLruUnlink(EncryptedFileReader* reader, int slot) {
+	ReaderPage* page = &reader->pages[slot];
+	if (page->lruPrev != READER_NO_PAGE) {
+		reader->pages[page->lruPrev].lruNext = page->lruNext;
+	}
+	else {
+		reader->lruHead = page->lruNext;
+	}
+	if (page->lruNext != READER_NO_PAGE) {
+		reader->pages[page->lruNext].lruPrev = page->lruPrev;
 	}
+	else {
+		reader->lruTail = page->lruPrev;
+	}
+}
 
-	if (!publicKey) {
-		return 0; // Invalid
+static void ReaderLruPushFront(EncryptedFileReader* reader, int slot) {
+	ReaderPage* page = &reader->pages[slot];
+	page->lruPrev = READER_NO_PAGE;
+	page->lruNext = reader->lruHead;
+	if (reader->lruHead != READER_NO_PAGE) {
+		reader->pages[reader->lruHead].lruPrev = slot;
+	}
+	else {
+		reader->lruTail = slot;
 	}
+	reader->lruHead = slot;
+}
 
-	// 进入临界区获取组合密钥
-	EnterCriticalSection(&g_keySection);
-	combinedKey = CombineKeys(publicKey, &combinedKeyLength);
-	LeaveCriticalSection(&g_keySection);
+static int ReaderFindPage(const EncryptedFileReader* reader, unsigned long long pageIndex) {
+	int slot = reader->buckets[ReaderBucketOf(reader, pageIndex)];
+	while (slot != READER_NO_PAGE && reader->pages[slot].pageIndex != pageIndex) {
+		slot = reader->pages[slot].hashNext;
+	}
+	return slot;
+}
 
-	if (!combinedKey || combinedKeyLength == 0) {
-		return 0; // Invalid
+static void ReaderUnlinkHash(EncryptedFileReader* reader, int slot) {
+	int* link = &reader->buckets[ReaderBucketOf(reader, reader->pages[slot].pageIndex)];
+	while (*link != slot) {
+		link = &reader->pages[*link].hashNext;
 	}
+	*link = reader->pages[slot].hashNext;
+}
 
-	// Open input file
-	fopen_s(&inputFile, filePath, "rb");
-	if (!inputFile) {
-		free(combinedKey);
-		return 0; // Invalid
+// 取得一个空闲槽，没有空闲槽时淘汰最久未用的页（明文先擦除）
+static int ReaderTakeSlot(EncryptedFileReader* reader) {
+	int slot = reader->freeHead;
+	if (slot != READER_NO_PAGE) {
+		reader->freeHead = reader->pages[slot].lruNext;
+		return slot;
 	}
 
-	// Read and validate header (early format detection)
-	if (fread(header, 1, MAGIC_HEADER_SIZE, inputFile) != MAGIC_HEADER_SIZE) {
-		fclose(inputFile);
-		free(combinedKey);
-		return 0; // Invalid
+	slot = reader->lruTail;
+	ReaderLruUnlink(reader, slot);
+	ReaderUnlinkHash(reader, slot);
+	SecureZeroMemory(reader->pageData + (size_t)slot * reader->pageSize, reader->pages[slot].length);
+	reader->cachedPages--;
+	return slot;
+}
+
+// 按页号查找缓存页，未命中时通过文件句柄解密该页（使用与 StreamDecryptFile 相同的按位置密钥流）
+static int ReaderGetPage(EncryptedFileReader* reader, unsigned long long pageIndex, int* slotOut) {
+	int slot = ReaderFindPage(reader, pageIndex);
+	if (slot != READER_NO_PAGE) {
+		reader->cacheHits++;
+		ReaderLruUnlink(reader, slot);
+		ReaderLruPushFront(reader, slot);
+		*slotOut = slot;
+		return SUCCESS;
 	}
 
-	header[MAGIC_HEADER_SIZE] = '\0';
-	if (strcmp(header, MAGIC_HEADER) != 0) {
-		fclose(inputFile);
-		free(combinedKey);
-		return 0; // Invalid
+	reader->cacheMisses++;
+	slot = ReaderTakeSlot(reader);
+
+	ReaderPage* page = &reader->pages[slot];
+	unsigned char* data = reader->pageData + (size_t)slot * reader->pageSize;
+	int result = EncryptedFileDecryptRange(reader->file, pageIndex * reader->pageSize, data, reader->pageSize, &page->length);
+	if (result != SUCCESS) {
+		SecureZeroMemory(data, reader->pageSize);
+		page->lruNext = reader->freeHead;
+		reader->freeHead = slot;
+		return result;
 	}
 
-	// Read stored key length
-	if (fread(&storedKeyLength, sizeof(int), 1, inputFile) != 1) {
-		fclose(inputFile);
-		free(combinedKey);
-		return 0; // Invalid
+	int bucket = ReaderBucketOf(reader, pageIndex);
+	page->pageIndex = pageIndex;
+	page->hashNext = reader->buckets[bucket];
+	reader->buckets[bucket] = slot;
+	ReaderLruPushFront(reader, slot);
+	reader->cachedPages++;
+
+	*slotOut = slot;
+	return SUCCESS;
+}
+
+static int OpenEncryptedFileReaderWithSnapshot(const PrivateKeySnapshot* keySnapshot, const char* filePath, const unsigned char* publicKey, const EncryptedReaderOptions* options, EncryptedFileReader** reader) {
+	if (!reader) {
+		return ERR_INVALID_PARAMETER;
 	}
 
-	// 新增：读取并验证公钥哈希值
-	unsigned int storedPublicKeyHash;
-	if (fread(&storedPublicKeyHash, sizeof(unsigned int), 1, inputFile) != 1) {
-		fclose(inputFile);
-		free(combinedKey);
-		return 0; // Invalid
+	*reader = NULL;
+
+	size_t pageSize = ENCRYPTED_READER_DEFAULT_PAGE_SIZE;
+	size_t cacheSize = ENCRYPTED_READER_DEFAULT_CACHE_SIZE;
+	if (options) {
+		if (options->cbSize < sizeof(EncryptedReaderOptions)) {
+			return ERR_INVALID_PARAMETER;
+		}
+		if (options->pageSize != 0) {
+			pageSize = options->pageSize;
+		}
+		if (options->cacheSize != 0) {
+			cacheSize = options->cacheSize;
+		}
 	}
 
-	// 新增：早期公钥完整性验证
-	unsigned int currentPublicKeyHash = CalculatePublicKeyHash(publicKey);
-	if (storedPublicKeyHash != currentPublicKeyHash) {
-		fclose(inputFile);
-		free(combinedKey);
-		return 0; // Invalid - 公钥不匹配
+	if (pageSize < READER_MIN_PAGE_SIZE || pageSize > READER_MAX_PAGE_SIZE || (pageSize & (pageSize - 1)) != 0) {
+		return ERR_INVALID_PARAMETER;
 	}
 
-	// Validate key length (early validation)
-	if (storedKeyLength != combinedKeyLength) {
-		fclose(inputFile);
-		free(combinedKey);
-		return 0; // Invalid
+	EncryptedFileReader* fileReader = (EncryptedFileReader*)EncodeAlloc(sizeof(EncryptedFileReader));
+	if (!fileReader) {
+		return ERR_MEMORY_ALLOCATION_FAILED;
 	}
+	memset(fileReader, 0, sizeof(EncryptedFileReader));
+	InitializeSRWLock(&fileReader->cacheLock);
 
-	// Validate checksum at the end of file
-	_fseeki64(inputFile, -(__int64)sizeof(unsigned int), SEEK_END);
-	unsigned int storedChecksum;
-	if (fread(&storedChecksum, sizeof(unsigned int), 1, inputFile) == 1) {
-		// 使用更强的CRC32校验和替代简单校验和
-		unsigned int calculatedChecksum = CalculateCRC32(combinedKey, combinedKeyLength);
-		if (storedChecksum == calculatedChecksum) {
-			isValid = true;
+	int result = OpenEncryptedFileWithSnapshot(keySnapshot, filePath, publicKey, &fileReader->file);
+	if (result != SUCCESS) {
+		CloseEncryptedFileReader(fileReader);
+		return result;
+	}
+
+	if (!fileReader->file->layout.engine->transformAt) {
+		CloseEncryptedFileReader(fileReader);
+		return ERR_UNSUPPORTED_ENGINE;
+	}
+
+	// 缓存槽数：容量允许的页数，但不超过文件的总页数（小文件不分配整个缓存）
+	unsigned long long filePages = ((unsigned long long)fileReader->file->layout.dataSize + pageSize - 1) / pageSize;
+	unsigned long long pageCount = cacheSize / pageSize;
+	if (pageCount > filePages) {
+		pageCount = filePages;
+	}
+	if (pageCount == 0) {
+		pageCount = 1;
+	}
+	if (pageCount > READER_MAX_PAGE_COUNT) {
+		pageCount = READER_MAX_PAGE_COUNT;
+	}
+
+	// 页缓存在读取器存在期间一直占用预算，第一次读取校验认证标签时还要再取得一个流式缓冲区（至少最小档位）。
+	// 两者之和超过预算上限时等待永远无法满足：缓存放不下时按预算缩小，连一页都放不下时立即失败
+	LONGLONG budget = g_memoryBudget;
+	if (budget > 0) {
+		size_t reserved = FILE_CALL_ARENA_SIZE(g_streamBufferClassSizes[0]);
+		size_t pageCost = pageSize + sizeof(ReaderPage) + 4 * sizeof(int);     // 页数据、页描述与散列桶（桶数不超过页数的4倍）
+		unsigned long long fittingPages = (size_t)budget > reserved ? ((size_t)budget - reserved) / pageCost : 0;
+		if (fittingPages == 0) {
+			CloseEncryptedFileReader(fileReader);
+			return ERR_MEMORY_BUDGET_EXCEEDED;
+		}
+		if (pageCount > fittingPages) {
+			pageCount = fittingPages;
 		}
 	}
 
-	// Clean up
-	if (combinedKey) {
-		SecureZeroMemory(combinedKey, combinedKeyLength);
-		free(combinedKey);
+	int bucketCount = 1;
+	while ((unsigned long long)bucketCount < pageCount * 2) {
+		bucketCount <<= 1;
 	}
-	fclose(inputFile);
 
-	return isValid ? 1 : 0;
+	fileReader->pageSize = pageSize;
+	fileReader->pageCount = (int)pageCount;
+	fileReader->bucketMask = bucketCount - 1;
+	fileReader->pageDataSize = (size_t)pageCount * pageSize;
+	fileReader->pages = (ReaderPage*)EncodeAllocWithinBudget(sizeof(ReaderPage) * (size_t)pageCount, &result);
+	if (fileReader->pages) {
+		fileReader->buckets = (int*)EncodeAllocWithinBudget(sizeof(int) * (size_t)bucketCount, &result);
+	}
+	if (fileReader->buckets) {
+		fileReader->pageData = (unsigned char*)EncodeAllocWithinBudget(fileReader->pageDataSize, &result);
+	}
+	if (!fileReader->pageData) {
+		CloseEncryptedFileReader(fileReader);
+		return result;
+	}
+
+	for (int i = 0; i < bucketCount; i++) {
+		fileReader->buckets[i] = READER_NO_PAGE;
+	}
+	for (int i = 0; i < fileReader->pageCount; i++) {
+		fileReader->pages[i].length = 0;
+		fileReader->pages[i].lruNext = i + 1 < fileReader->pageCount ? i + 1 : READER_NO_PAGE;
+	}
+	fileReader->freeHead = 0;
+	fileReader->lruHead = READER_NO_PAGE;
+	fileReader->lruTail = READER_NO_PAGE;
+
+	*reader = fileReader;
+	return SUCCESS;
 }
 
-// 新增：字节数组加密函数（双密钥系统）
-int StreamEncryptData(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char** outputData, size_t* outputLength) {
-	unsigned char* combinedKey = NULL;
+// 打开加密文件读取器（双密钥格式使用 InitStreamFile 设置的全局私钥）
+int OpenEncryptedFileReader(const char* filePath, const unsigned char* publicKey, const EncryptedReaderOptions* options, EncryptedFileReader** reader) {
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = OpenEncryptedFileReaderWithSnapshot(keySnapshot, filePath, publicKey, options, reader);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+int ReadEncryptedFileAt(EncryptedFileReader* reader, unsigned long long offset, void* buffer, size_t length, size_t* bytesRead) {
+	if (!reader || (!buffer && length > 0) || !bytesRead) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	*bytesRead = 0;
+
+	unsigned long long dataSize = (unsigned long long)reader->file->layout.dataSize;
+	if (offset >= dataSize) {
+		return SUCCESS;
+	}
+	if ((unsigned long long)length > dataSize - offset) {
+		length = (size_t)(dataSize - offset);
+	}
+
+	unsigned char* output = (unsigned char*)buffer;
+	size_t copied = 0;
 	int result = SUCCESS;
-	int combinedKeyLength = 0;
 
-	// 检查输入参数
-	if (!inputData || inputLength == 0 || !publicKey || !outputData || !outputLength) {
+	AcquireSRWLockExclusive(&reader->cacheLock);
+	while (copied < length) {
+		unsigned long long position = offset + copied;
+		unsigned long long pageIndex = position / reader->pageSize;
+		size_t pageOffset = (size_t)(position % reader->pageSize);
+
+		int slot = READER_NO_PAGE;
+		result = ReaderGetPage(reader, pageIndex, &slot);
+		if (result != SUCCESS) {
+			break;
+		}
+
+		size_t pageLength = reader->pages[slot].length;
+		if (pageOffset >= pageLength) {
+			break;
+		}
+
+		size_t take = pageLength - pageOffset;
+		if (take > length - copied) {
+			take = length - copied;
+		}
+		memcpy(output + copied, reader->pageData + (size_t)slot * reader->pageSize + pageOffset, take);
+		copied += take;
+	}
+	ReleaseSRWLockExclusive(&reader->cacheLock);
+
+	*bytesRead = copied;
+	return result;
+}
+
+int GetEncryptedFileReaderStats(EncryptedFileReader* reader, EncryptedReaderStats* stats) {
+	if (!reader || !stats || stats->cbSize < sizeof(EncryptedReaderStats)) {
 		return ERR_INVALID_PARAMETER;
 	}
 
-	// 初始化输出参数
-	*outputData = NULL;
-	*outputLength = 0;
+	AcquireSRWLockShared(&reader->cacheLock);
+	stats->plaintextLength = (unsigned long long)reader->file->layout.dataSize;
+	stats->cacheHits = reader->cacheHits;
+	stats->cacheMisses = reader->cacheMisses;
+	stats->cachedPages = reader->cachedPages;
+	ReleaseSRWLockShared(&reader->cacheLock);
+	return SUCCESS;
+}
 
-	// 检查私钥是否已设置
-	if (!IsPrivateKeySet()) {
-		return ERR_PRIVATE_KEY_NOT_SET;
+void CloseEncryptedFileReader(EncryptedFileReader* reader) {
+	if (!reader) {
+		return;
+	}
+
+	if (reader->pageData) {
+		SecureZeroMemory(reader->pageData, reader->pageDataSize);
+		EncodeFree(reader->pageData);
+	}
+	EncodeFree(reader->buckets);
+	EncodeFree(reader->pages);
+	CloseEncryptedFile(reader->file);
+	EncodeFree(reader);
+}
+
+// ========== 解密结果缓存（按密文内容与密钥身份查找） ==========
+
+#define BLOB_CACHE_BUCKETS 1024
+
+// 缓存项：结构体、公钥、密文副本与明文一次分配
+struct DecryptedBlob {
+	volatile LONG refCount;                      // 缓存持有一个引用，每次 AcquireDecryptedBlob 增加一个引用
+	int cached;                                  // 仍在缓存中（受 g_blobCacheLock 保护）
+	LONG keyGeneration;                          // 双密钥格式为解密时的私钥快照代号，自包含式为0
+	unsigned long long contentHash;
+	size_t allocationSize;
+	size_t publicKeyLength;
+	size_t ciphertextLength;
+	size_t plaintextLength;
+	DecryptedBlob* hashNext;
+	DecryptedBlob* lruPrev;
+	DecryptedBlob* lruNext;
+	unsigned char* publicKey;
+	unsigned char* ciphertext;                   // 内容哈希不是密码学哈希，命中时逐字节确认（不缓存时为空）
+	unsigned char* plaintext;
+};
+
+static SRWLOCK g_blobCacheLock = SRWLOCK_INIT;
+static DecryptedBlob* g_blobBuckets[BLOB_CACHE_BUCKETS];
+static DecryptedBlob* g_blobLruHead = NULL;                    // 最近使用
+static DecryptedBlob* g_blobLruTail = NULL;                    // 最久未用（优先淘汰）
+static size_t g_blobCacheLimit = 0;                            // 缓存上限字节数，0表示不缓存
+static size_t g_blobCacheBytes = 0;
+static size_t g_blobCount = 0;
+static unsigned long long g_blobCacheHits = 0;
+static unsigned long long g_blobCacheMisses = 0;
+
+static inline unsigned long long BlobHashRound(unsigned long long accumulator, unsigned long long input) {
+	accumulator += input * 0xC2B2AE3D27D4EB4FULL;
+	accumulator = (accumulator << 31) | (accumulator >> 33);
+	return accumulator * 0x9E3779B185EBCA87ULL;
+}
+
+// 密文内容哈希：四路独立累加，速度接近内存带宽，只用于定位缓存项
+static unsigned long long BlobContentHash(const unsigned char* data, size_t length) {
+	unsigned long long lanes[4] = { 0x60EA27EEADC0B5D6ULL, 0xC2B2AE3D27D4EB4FULL, 0x0ULL, 0x61C8864E7A143579ULL };
+	size_t i = 0;
+
+	for (; i + 32 <= length; i += 32) {
+		for (int k = 0; k < 4; k++) {
+			unsigned long long word;
+			memcpy(&word, data + i + k * 8, sizeof(word));
+			lanes[k] = BlobHashRound(lanes[k], word);
+		}
+	}
+
+	unsigned long long hash = (unsigned long long)length * 0x27D4EB2F165667C5ULL;
+	for (int k = 0; k < 4; k++) {
+		hash = BlobHashRound(hash, lanes[k]);
+	}
+	for (; i < length; i++) {
+		hash = BlobHashRound(hash, data[i]);
+	}
+
+	hash ^= hash >> 29;
+	hash *= 0x165667B19E3779F9ULL;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+// 擦除明文并释放缓存项（最后一个引用释放时调用）
+static void FreeDecryptedBlob(DecryptedBlob* blob) {
+	SecureZeroMemory(blob->plaintext, blob->plaintextLength);
+	EncodeFree(blob);
+}
+
+// 调用者持有 g_blobCacheLock
+static DecryptedBlob* FindDecryptedBlob(unsigned long long contentHash, LONG keyGeneration, const unsigned char* publicKey, size_t publicKeyLength, const unsigned char* ciphertext, size_t ciphertextLength) {
+	for (DecryptedBlob* blob = g_blobBuckets[contentHash % BLOB_CACHE_BUCKETS]; blob; blob = blob->hashNext) {
+		if (blob->contentHash == contentHash && blob->keyGeneration == keyGeneration &&
+			blob->ciphertextLength == ciphertextLength && blob->publicKeyLength == publicKeyLength &&
+			memcmp(blob->publicKey, publicKey, publicKeyLength) == 0 &&
+			memcmp(blob->ciphertext, ciphertext, ciphertextLength) == 0) {
+			return blob;
+		}
+	}
+	return NULL;
+}
+
+static void BlobLruUnlink(DecryptedBlob* blob) {
+	if (blob->lruPrev) {
+		blob->lruPrev->lruNext = blob->lruNext;
+	}
+	else {
+		g_blobLruHead = blob->lruNext;
+	}
+	if (blob->lruNext) {
+		blob->lruNext->lruPrev = blob->lruPrev;
 	}
-
-	// 进入临界区获取组合密钥
-	EnterCriticalSection(&g_keySection);
-	combinedKey = CombineKeys(publicKey, &combinedKeyLength);
-	LeaveCriticalSection(&g_keySection);
-
-	if (!combinedKey || combinedKeyLength == 0) {
-		return ERR_ENCRYPTION_FAILED;
+	else {
+		g_blobLruTail = blob->lruPrev;
 	}
+}
 
-	// 计算输出数据大小：魔数头 + 密钥长度 + 公钥哈希 + 原始数据 + CRC32校验和
-	size_t headerSize = MAGIC_HEADER_SIZE + sizeof(int) + sizeof(unsigned int);
-	size_t outputSize = headerSize + inputLength + sizeof(unsigned int);
-
-	// 分配输出缓冲区
-	*outputData = (unsigned char*)malloc(outputSize);
-	if (!*outputData) {
-		if (combinedKey) {
-			SecureZeroMemory(combinedKey, combinedKeyLength);
-			free(combinedKey);
-		}
-		return ERR_MEMORY_ALLOCATION_FAILED;
+static void BlobLruPushFront(DecryptedBlob* blob) {
+	blob->lruPrev = NULL;
+	blob->lruNext = g_blobLruHead;
+	if (g_blobLruHead) {
+		g_blobLruHead->lruPrev = blob;
 	}
+	else {
+		g_blobLruTail = blob;
+	}
+	g_blobLruHead = blob;
+}
 
-	unsigned char* outPtr = *outputData;
-
-	// 写入魔数头
-	memcpy(outPtr, MAGIC_HEADER, MAGIC_HEADER_SIZE);
-	outPtr += MAGIC_HEADER_SIZE;
+// 从缓存中移除（调用者持有 g_blobCacheLock），缓存持有的引用挂到 released 链表上，解锁后由 ReleaseBlobList 释放
+static void UnlinkDecryptedBlob(DecryptedBlob* blob, DecryptedBlob** released) {
+	DecryptedBlob** link = &g_blobBuckets[blob->contentHash % BLOB_CACHE_BUCKETS];
+	while (*link != blob) {
+		link = &(*link)->hashNext;
+	}
+	*link = blob->hashNext;
 
-	// 写入组合密钥长度
-	memcpy(outPtr, &combinedKeyLength, sizeof(int));
-	outPtr += sizeof(int);
+	BlobLruUnlink(blob);
+	blob->cached = 0;
+	g_blobCacheBytes -= blob->allocationSize;
+	g_blobCount--;
 
-	// 写入公钥哈希值
-	unsigned int publicKeyHash = CalculatePublicKeyHash(publicKey);
-	memcpy(outPtr, &publicKeyHash, sizeof(unsigned int));
-	outPtr += sizeof(unsigned int);
+	blob->hashNext = *released;
+	*released = blob;
+}
 
-	// 加密数据
-	for (size_t i = 0; i < inputLength; i++) {
-		unsigned char keyByte = combinedKey[i % combinedKeyLength];
-		unsigned char a1 = inputData[i];                                    // 原始字节
-		unsigned char a2 = a1 ^ keyByte;                                    // 第一次XOR
-		unsigned char a3 = ((a2 & 0x0F) << 4) | ((a2 & 0xF0) >> 4);       // 半字节交换
-		unsigned char a4 = a3 ^ keyByte;                                    // 第二次XOR
-		outPtr[i] = a4;                                                     // 最终加密结果
+// 释放缓存对被移除项的引用（仍被调用者使用的项在调用者释放后擦除）
+static void ReleaseBlobList(DecryptedBlob* released) {
+	while (released) {
+		DecryptedBlob* next = released->hashNext;
+		ReleaseDecryptedBlob(released);
+		released = next;
 	}
-	outPtr += inputLength;
+}
 
-	// 写入CRC32校验和
-	unsigned int checksum = CalculateCRC32(combinedKey, combinedKeyLength);
-	memcpy(outPtr, &checksum, sizeof(unsigned int));
+// 按 LRU 顺序淘汰，直到缓存不超过 targetBytes（调用者持有 g_blobCacheLock）
+static void TrimDecryptedBlobs(size_t targetBytes, DecryptedBlob** released) {
+	while (g_blobCacheBytes > targetBytes && g_blobLruTail) {
+		UnlinkDecryptedBlob(g_blobLruTail, released);
+	}
+}
 
-	*outputLength = outputSize;
+// 私钥更换后移除所有双密钥格式的缓存项
+static void EvictKeyBoundDecryptedBlobs() {
+	DecryptedBlob* released = NULL;
 
-	// 清理资源
-	if (combinedKey) {
-		SecureZeroMemory(combinedKey, combinedKeyLength);
-		free(combinedKey);
+	AcquireSRWLockExclusive(&g_blobCacheLock);
+	DecryptedBlob* blob = g_blobLruHead;
+	while (blob) {
+		DecryptedBlob* next = blob->lruNext;
+		if (blob->keyGeneration != 0) {
+			UnlinkDecryptedBlob(blob, &released);
+		}
+		blob = next;
 	}
+	ReleaseSRWLockExclusive(&g_blobCacheLock);
 
-	return SUCCESS;
+	ReleaseBlobList(released);
 }
 
-// 新增：字节数组解密函数（双密钥系统）
-int StreamDecryptData(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char** outputData, size_t* outputLength) {
-	unsigned char* combinedKey = NULL;
-	int result = SUCCESS;
-	char header[MAGIC_HEADER_SIZE + 1];
-	int storedKeyLength = 0;
-	int combinedKeyLength = 0;
-
-	// 检查输入参数
-	if (!inputData || inputLength == 0 || !publicKey || !outputData || !outputLength) {
+static int AcquireDecryptedBlobWithSnapshot(const PrivateKeySnapshot* keySnapshot, const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, DecryptedBlob** blob, const unsigned char** data, size_t* length) {
+	if (!inputData || !publicKey || !blob || !data || !length) {
 		return ERR_INVALID_PARAMETER;
 	}
 
-	// 初始化输出参数
-	*outputData = NULL;
-	*outputLength = 0;
-
-	// 检查数据最小长度
-	size_t minSize = MAGIC_HEADER_SIZE + sizeof(int) + sizeof(unsigned int) + sizeof(unsigned int);
-	if (inputLength < minSize) {
-		return ERR_INVALID_HEADER;
-	}
+	*blob = NULL;
+	*data = NULL;
+	*length = 0;
 
-	// 检查私钥是否已设置
-	if (!IsPrivateKeySet()) {
-		return ERR_PRIVATE_KEY_NOT_SET;
+	// 识别格式并取得明文大小；双密钥格式的结果与当前私钥绑定
+	size_t plaintextLength = 0;
+	int result = DecryptedSizeOf(inputData, inputLength, &plaintextLength);
+	if (result != SUCCESS) {
+		return result;
 	}
 
-	// 进入临界区获取组合密钥
-	EnterCriticalSection(&g_keySection);
-	combinedKey = CombineKeys(publicKey, &combinedKeyLength);
-	LeaveCriticalSection(&g_keySection);
+	const CipherEngine* engine = NULL;
+	unsigned char engineHeader[CIPHER_ENGINE_MAX_HEADER];
+	size_t prefixSize = 0;
+	int selfContained = ParseEnginePrefix(inputData, inputLength, &g_streamFormat, &engine, engineHeader, &prefixSize) != SUCCESS;
 
-	if (!combinedKey || combinedKeyLength == 0) {
-		return ERR_DECRYPTION_FAILED;
+	LONG keyGeneration = 0;
+	if (!selfContained) {
+		if (!keySnapshot) {
+			return ERR_PRIVATE_KEY_NOT_SET;
+		}
+		keyGeneration = keySnapshot->generation;
 	}
 
-	const unsigned char* inPtr = inputData;
+	size_t publicKeyLength = strlen((const char*)publicKey);
+	unsigned long long contentHash = BlobContentHash(inputData, inputLength);
 
-	// 验证魔数头
-	memcpy(header, inPtr, MAGIC_HEADER_SIZE);
-	header[MAGIC_HEADER_SIZE] = '\0';
-	if (strcmp(header, MAGIC_HEADER) != 0) {
-		if (combinedKey) {
-			SecureZeroMemory(combinedKey, combinedKeyLength);
-			free(combinedKey);
-		}
-		return ERR_INVALID_HEADER;
+	// 命中时只增加引用计数，不复制明文
+	AcquireSRWLockExclusive(&g_blobCacheLock);
+	DecryptedBlob* found = FindDecryptedBlob(contentHash, keyGeneration, publicKey, publicKeyLength, inputData, inputLength);
+	if (found) {
+		InterlockedIncrement(&found->refCount);
+		BlobLruUnlink(found);
+		BlobLruPushFront(found);
+		g_blobCacheHits++;
 	}
-	inPtr += MAGIC_HEADER_SIZE;
-
-	// 读取存储的密钥长度
-	memcpy(&storedKeyLength, inPtr, sizeof(int));
-	inPtr += sizeof(int);
+	else if (g_blobCacheLimit > 0) {
+		g_blobCacheMisses++;
+	}
+	size_t cacheLimit = g_blobCacheLimit;
+	ReleaseSRWLockExclusive(&g_blobCacheLock);
 
-	// 读取并验证公钥哈希值
-	unsigned int storedPublicKeyHash;
-	memcpy(&storedPublicKeyHash, inPtr, sizeof(unsigned int));
-	inPtr += sizeof(unsigned int);
+	if (found) {
+		*blob = found;
+		*data = found->plaintext;
+		*length = found->plaintextLength;
+		return SUCCESS;
+	}
 
-	// 验证公钥完整性
-	unsigned int currentPublicKeyHash = CalculatePublicKeyHash(publicKey);
-	if (storedPublicKeyHash != currentPublicKeyHash) {
-		if (combinedKey) {
-			SecureZeroMemory(combinedKey, combinedKeyLength);
-			free(combinedKey);
-		}
-		return ERR_DECRYPTION_FAILED; // 公钥不匹配
+	// 未命中：一次分配结构体、公钥、密文副本和明文（放不进缓存时不保存密文副本）
+	size_t plaintextSize = plaintextLength > 0 ? plaintextLength : 1;
+	size_t allocationSize = sizeof(DecryptedBlob) + publicKeyLength + 1 + plaintextSize;
+	// 密文副本是可选的：预算当前放不下副本时不缓存，只返回明文，不为副本等待其它操作释放内存
+	int cacheable = cacheLimit > 0 && allocationSize + inputLength <= cacheLimit && FitsMemoryBudget((size_t)g_memoryCharged + allocationSize + inputLength);
+	if (cacheable) {
+		allocationSize += inputLength;
 	}
 
-	// 验证密钥长度
-	if (storedKeyLength != combinedKeyLength) {
-		if (combinedKey) {
-			SecureZeroMemory(combinedKey, combinedKeyLength);
-			free(combinedKey);
-		}
-		return ERR_DECRYPTION_FAILED;
+	DecryptedBlob* entry = (DecryptedBlob*)EncodeAllocWithinBudget(allocationSize, &result);
+	if (!entry) {
+		return result;
 	}
 
-	// 计算数据区大小
-	size_t headerSize = MAGIC_HEADER_SIZE + sizeof(int) + sizeof(unsigned int);
-	size_t dataSize = inputLength - headerSize - sizeof(unsigned int);
+	memset(entry, 0, sizeof(DecryptedBlob));
+	entry->refCount = 1;
+	entry->keyGeneration = keyGeneration;
+	entry->contentHash = contentHash;
+	entry->allocationSize = allocationSize;
+	entry->publicKeyLength = publicKeyLength;
+	entry->plaintextLength = plaintextLength;
+	entry->plaintext = (unsigned char*)(entry + 1);
+	entry->publicKey = entry->plaintext + plaintextSize;
+	memcpy(entry->publicKey, publicKey, publicKeyLength + 1);
+	if (cacheable) {
+		entry->ciphertext = entry->publicKey + publicKeyLength + 1;
+		entry->ciphertextLength = inputLength;
+		memcpy(entry->ciphertext, inputData, inputLength);
+	}
 
-	// 验证校验和（从末尾读取）
-	unsigned int storedChecksum;
-	memcpy(&storedChecksum, inputData + inputLength - sizeof(unsigned int), sizeof(unsigned int));
-	unsigned int calculatedChecksum = CalculateCRC32(combinedKey, combinedKeyLength);
-	if (storedChecksum != calculatedChecksum) {
-		if (combinedKey) {
-			SecureZeroMemory(combinedKey, combinedKeyLength);
-			free(combinedKey);
-		}
-		return ERR_DECRYPTION_FAILED;
+	size_t written = 0;
+	if (selfContained) {
+		result = SelfContainedDecryptDataInto(inputData, inputLength, publicKey, entry->plaintext, plaintextSize, &written);
+	}
+	else {
+		result = StreamDecryptDataIntoWithSnapshot(keySnapshot, inputData, inputLength, publicKey, entry->plaintext, plaintextSize, &written);
 	}
 
-	// 分配输出缓冲区
-	*outputData = (unsigned char*)malloc(dataSize);
-	if (!*outputData) {
-		if (combinedKey) {
-			SecureZeroMemory(combinedKey, combinedKeyLength);
-			free(combinedKey);
-		}
-		return ERR_MEMORY_ALLOCATION_FAILED;
+	if (result != SUCCESS) {
+		FreeDecryptedBlob(entry);
+		return result;
 	}
 
-	// 解密数据
-	for (size_t i = 0; i < dataSize; i++) {
-		unsigned char keyByte = combinedKey[i % combinedKeyLength];
-		unsigned char a1 = inPtr[i];                                        // 加密字节
-		unsigned char a2 = a1 ^ keyByte;                                    // 第一次XOR（逆向第二次XOR）
-		unsigned char a3 = ((a2 & 0x0F) << 4) | ((a2 & 0xF0) >> 4);       // 半字节交换（自逆操作）
-		unsigned char a4 = a3 ^ keyByte;                                    // 第二次XOR（逆向第一次XOR）
-		(*outputData)[i] = a4;                                              // 最终解密结果
+	// 插入缓存；其它线程已插入相同内容时使用已有项，私钥在解密期间被更换时不插入（更换后的清理可能已经执行过）
+	DecryptedBlob* released = NULL;
+	if (cacheable) {
+		AcquireSRWLockExclusive(&g_blobCacheLock);
+		found = FindDecryptedBlob(contentHash, keyGeneration, publicKey, publicKeyLength, inputData, inputLength);
+		if (found) {
+			InterlockedIncrement(&found->refCount);
+		}
+		else if (g_blobCacheLimit > 0 && allocationSize <= g_blobCacheLimit &&
+			(selfContained || keySnapshot == g_keySnapshot)) {
+			DecryptedBlob** bucket = &g_blobBuckets[contentHash % BLOB_CACHE_BUCKETS];
+			entry->hashNext = *bucket;
+			*bucket = entry;
+			BlobLruPushFront(entry);
+			entry->cached = 1;
+			entry->refCount++;
+			g_blobCacheBytes += allocationSize;
+			g_blobCount++;
+			TrimDecryptedBlobs(g_blobCacheLimit, &released);
+		}
+		ReleaseSRWLockExclusive(&g_blobCacheLock);
 	}
 
-	*outputLength = dataSize;
+	ReleaseBlobList(released);
 
-	// 清理资源
-	if (combinedKey) {
-		SecureZeroMemory(combinedKey, combinedKeyLength);
-		free(combinedKey);
+	if (found) {
+		FreeDecryptedBlob(entry);
+		entry = found;
 	}
 
+	*blob = entry;
+	*data = entry->plaintext;
+	*length = entry->plaintextLength;
 	return SUCCESS;
 }
 
-// 新增：释放加密数据内存
-void FreeEncryptedData(unsigned char* data) {
-	if (data) {
-		free(data);
-	}
+// 解密并缓存（双密钥格式使用 InitStreamFile 设置的全局私钥）
+int AcquireDecryptedBlob(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, DecryptedBlob** blob, const unsigned char** data, size_t* length) {
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = AcquireDecryptedBlobWithSnapshot(keySnapshot, inputData, inputLength, publicKey, blob, data, length);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
 }
 
-// 新增：释放解密数据内存
-void FreeDecryptedData(unsigned char* data) {
-	if (data) {
-		free(data);
+void ReleaseDecryptedBlob(DecryptedBlob* blob) {
+	if (!blob) {
+		return;
+	}
+
+	if (InterlockedDecrement(&blob->refCount) == 0) {
+		FreeDecryptedBlob(blob);
 	}
 }
 
-// ========== 自包含式加密/解密系统实现 ==========
+void SetDecryptedBlobCacheLimit(size_t maxBytes) {
+	DecryptedBlob* released = NULL;
 
-#define SELF_CONTAINED_MAGIC_HEADER "SELFV1.0"     // 自包含式加密文件魔数头
-#define SELF_CONTAINED_MAGIC_SIZE 8                // 自包含式魔数头大小
-#define PRIVATE_KEY_SIZE_2048_BITS 256             // 2048位私钥大小（256字节）
+	AcquireSRWLockExclusive(&g_blobCacheLock);
+	g_blobCacheLimit = maxBytes;
+	TrimDecryptedBlobs(maxBytes, &released);
+	ReleaseSRWLockExclusive(&g_blobCacheLock);
 
-// 生成2048位随机私钥
-int Generate2048BitPrivateKey(unsigned char* privateKey, int* keyLength) {
-	if (!privateKey || !keyLength) {
-		return ERR_INVALID_PARAMETER;
-	}
+	ReleaseBlobList(released);
+}
 
-	// 使用Windows CryptoAPI生成高质量随机数
-	HCRYPTPROV hProv = 0;
-	if (!CryptAcquireContext(&hProv, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT)) {
-		return ERR_ENCRYPTION_FAILED;
+// 预算不足时按 LRU 顺序淘汰缓存项，直到腾出 bytes 字节（仍被调用者引用的项在释放后归还预算）
+static void ReclaimDecryptedBlobs(size_t bytes) {
+	DecryptedBlob* released = NULL;
+
+	AcquireSRWLockExclusive(&g_blobCacheLock);
+	TrimDecryptedBlobs(g_blobCacheBytes > bytes ? g_blobCacheBytes - bytes : 0, &released);
+	ReleaseSRWLockExclusive(&g_blobCacheLock);
+
+	ReleaseBlobList(released);
+}
+
+void ClearDecryptedBlobCache() {
+	DecryptedBlob* released = NULL;
+
+	AcquireSRWLockExclusive(&g_blobCacheLock);
+	TrimDecryptedBlobs(0, &released);
+	ReleaseSRWLockExclusive(&g_blobCacheLock);
+
+	ReleaseBlobList(released);
+}
+
+void GetDecryptedBlobCacheStats(size_t* cachedBytes, size_t* blobCount, unsigned long long* hits, unsigned long long* misses) {
+	AcquireSRWLockShared(&g_blobCacheLock);
+	if (cachedBytes) {
+		*cachedBytes = g_blobCacheBytes;
 	}
+	if (blobCount) {
+		*blobCount = g_blobCount;
+	}
+	if (hits) {
+		*hits = g_blobCacheHits;
+	}
+	if (misses) {
+		*misses = g_blobCacheMisses;
+	}
+	ReleaseSRWLockShared(&g_blobCacheLock);
+}
 
-	// 生成256字节（2048位）的随机私钥
-	if (!CryptGenRandom(hProv, PRIVATE_KEY_SIZE_2048_BITS, privateKey)) {
-		CryptReleaseContext(hProv, 0);
-		return ERR_ENCRYPTION_FAILED;
+// ========== 异步文件加解密 ==========
+
+#define ASYNC_STREAM_ENCRYPT 1
+#define ASYNC_STREAM_DECRYPT 2
+#define ASYNC_SELF_CONTAINED_ENCRYPT 3
+#define ASYNC_SELF_CONTAINED_DECRYPT 4
+
+// 调用者与工作线程各持有一个引用，最后释放的一方回收
+struct EncodeOperation {
+	volatile LONG refCount;
+	volatile LONG cancelled;
+	int kind;
+	const CipherEngine* engine;
+	PrivateKeySnapshot* keySnapshot;             // 双密钥格式：提交时的私钥快照
+	char* filePath;                              // 以下三个字符串与结构体同一次分配
+	char* outputPath;
+	unsigned char* publicKey;
+	ProgressCallback progressCallback;
+	CompletionCallback completionCallback;
+	void* userData;
+	EncodeProgress* progress;                    // 提交时调用线程绑定的进度对象（持有引用）
+	SRWLOCK lock;
+	CONDITION_VARIABLE completed;
+	int done;                                    // 受 lock 保护
+	int result;
+};
+
+static void ReleaseOperation(EncodeOperation* operation) {
+	if (InterlockedDecrement(&operation->refCount) == 0) {
+		ReleaseKeySnapshot(operation->keySnapshot);
+		ReleaseProgress(operation->progress);
+		SecureZeroMemory(operation->publicKey, strlen((const char*)operation->publicKey));
+		EncodeFree(operation);
 	}
+}
 
-	CryptReleaseContext(hProv, 0);
-	*keyLength = PRIVATE_KEY_SIZE_2048_BITS;
+static void CALLBACK AsyncOperationCallback(PTP_CALLBACK_INSTANCE instance, PVOID context) {
+	EncodeOperation* operation = (EncodeOperation*)context;
+	CallbackMayRunLong(instance);
 
-	return SUCCESS;
-}
+	// 进度对象从提交起即处于运行阶段，开始前失败或取消也会进入结束阶段
+	EncodeProgress* previousProgress = SetThreadProgress(operation->progress);
+	ProgressBegin(0);
 
-// 计算私钥哈希值用于完整性验证
-unsigned int CalculatePrivateKeyHash(const unsigned char* privateKey, int keyLength) {
-	if (!privateKey || keyLength <= 0) {
-		return 0;
+	// 提交后、开始前已取消的操作不再打开任何文件
+	int result = ERR_OPERATION_CANCELLED;
+	if (!operation->cancelled) {
+		switch (operation->kind) {
+		case ASYNC_STREAM_ENCRYPT:
+			result = StreamEncryptFileWithSnapshot(operation->keySnapshot, operation->engine, operation->filePath, operation->outputPath, operation->publicKey, operation->progressCallback, &operation->cancelled);
+			break;
+		case ASYNC_STREAM_DECRYPT:
+			result = StreamDecryptFileWithSnapshot(operation->keySnapshot, operation->filePath, operation->outputPath, operation->publicKey, operation->progressCallback, &operation->cancelled);
+			break;
+		case ASYNC_SELF_CONTAINED_ENCRYPT:
+			result = SelfContainedEncryptFileWithEngine(operation->engine, operation->filePath, operation->outputPath, operation->publicKey, operation->progressCallback, &operation->cancelled);
+			break;
+		default:
+			result = SelfContainedDecryptFileWithCancel(operation->filePath, operation->outputPath, operation->publicKey, operation->progressCallback, &operation->cancelled);
+			break;
+		}
 	}
 
-	// 使用双重哈希确保私钥完整性
-	unsigned int hash1 = CalculateCRC32(privateKey, keyLength);
-	unsigned int hash2 = 0;
+	ProgressEnd(result);
+	SetThreadProgress(previousProgress);
+
+	// 先发布结果并唤醒等待者，再通知完成回调：回调中可以等待或关闭本操作（工作线程的引用在回调返回后才释放）
+	AcquireSRWLockExclusive(&operation->lock);
+	operation->result = result;
+	operation->done = 1;
+	ReleaseSRWLockExclusive(&operation->lock);
+	WakeAllConditionVariable(&operation->completed);
 
-	// 第二轮哈希：增强安全性
-	for (int i = 0; i < keyLength; i++) {
-		hash2 = ((hash2 << 7) + hash2) + privateKey[i];
-		hash2 ^= (hash2 >> 13);
-		hash2 += (hash2 << 5);
-		hash2 ^= (hash2 >> 7);
-		hash2 += (hash2 << 3);
-		hash2 ^= (hash2 >> 17);
-		hash2 += (hash2 << 11);
+	if (operation->completionCallback) {
+		operation->completionCallback(operation, result, operation->userData);
 	}
 
-	// 组合两个哈希值，增加复杂度
-	return hash1 ^ hash2 ^ 0xABCDEF01;
+	ReleaseOperation(operation);
 }
 
-// 自包含式文件加密函数
-int SelfContainedEncryptFile(const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback) {
-	FILE* inputFile = NULL;
-	FILE* outputFile = NULL;
-	unsigned char* buffer = NULL;
-	unsigned char* privateKey = NULL;
-	unsigned char* combinedKey = NULL;
-	int result = SUCCESS;
-	int privateKeyLength = 0;
-	int combinedKeyLength = 0;
+// 复制参数并提交到进程线程池；双密钥格式在提交时取得私钥快照，之后更换全局私钥不影响已提交的操作
+static int SubmitFileOperation(int kind, const char* filePath, const char* outputPath, const unsigned char* publicKey, const EncodeOptions* options,
+	ProgressCallback progressCallback, CompletionCallback completionCallback, void* userData, EncodeOperation** operation) {
+	if (!operation) {
+		return ERR_INVALID_PARAMETER;
+	}
 
-	const size_t STREAM_BUFFER_SIZE = 4 * 1024 * 1024;  // 4MB大缓冲区
+	*operation = NULL;
 
 	if (!filePath || !outputPath || !publicKey) {
 		return ERR_INVALID_PARAMETER;
 	}
 
-	// 分配私钥缓冲区
-	privateKey = (unsigned char*)malloc(PRIVATE_KEY_SIZE_2048_BITS);
-	if (!privateKey) {
-		return ERR_MEMORY_ALLOCATION_FAILED;
-	}
-
-	// 生成2048位随机私钥
-	result = Generate2048BitPrivateKey(privateKey, &privateKeyLength);
+	const CipherEngine* engine = NULL;
+	int result = ResolveCipherEngine(options, &engine);
 	if (result != SUCCESS) {
-		free(privateKey);
 		return result;
 	}
 
-	// 使用生成的私钥组合公钥
-	int pubKeyLen = strlen((const char*)publicKey);
-	if (pubKeyLen == 0) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		free(privateKey);
-		return ERR_INVALID_PARAMETER;
-	}
+	size_t filePathSize = strlen(filePath) + 1;
+	size_t outputPathSize = strlen(outputPath) + 1;
+	size_t publicKeySize = strlen((const char*)publicKey) + 1;
 
-	// 组合私钥和公钥（使用相同的交错算法）
-	int totalLen = privateKeyLength + pubKeyLen;
-	combinedKey = (unsigned char*)malloc(totalLen + 1);
-	if (!combinedKey) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		free(privateKey);
+	EncodeOperation* op = (EncodeOperation*)EncodeAlloc(sizeof(EncodeOperation) + filePathSize + outputPathSize + publicKeySize);
+	if (!op) {
 		return ERR_MEMORY_ALLOCATION_FAILED;
 	}
 
-	// 交错组合两个密钥
-	for (int i = 0; i < totalLen; i++) {
-		if (i % 2 == 0) {
-			combinedKey[i] = privateKey[i / 2 % privateKeyLength];
-		}
-		else {
-			combinedKey[i] = publicKey[i / 2 % pubKeyLen];
+	memset(op, 0, sizeof(EncodeOperation));
+	op->refCount = 2;
+	op->kind = kind;
+	op->engine = engine;
+	op->filePath = (char*)(op + 1);
+	op->outputPath = op->filePath + filePathSize;
+	op->publicKey = (unsigned char*)(op->outputPath + outputPathSize);
+	memcpy(op->filePath, filePath, filePathSize);
+	memcpy(op->outputPath, outputPath, outputPathSize);
+	memcpy(op->publicKey, publicKey, publicKeySize);
+	op->progressCallback = progressCallback;
+	op->completionCallback = completionCallback;
+	op->userData = userData;
+	op->progress = GetThreadProgress();
+	AddProgressRef(op->progress);
+	InitializeSRWLock(&op->lock);
+	InitializeConditionVariable(&op->completed);
+
+	if (kind == ASYNC_STREAM_ENCRYPT || kind == ASYNC_STREAM_DECRYPT) {
+		op->keySnapshot = AcquireKeySnapshot();
+		if (!op->keySnapshot) {
+			op->refCount = 1;
+			ReleaseOperation(op);
+			return ERR_PRIVATE_KEY_NOT_SET;
 		}
-		combinedKey[i] ^= (unsigned char)(i * 7 + 13);
 	}
-	combinedKey[totalLen] = '\0';
-	combinedKeyLength = totalLen;
 
-	// 打开输入文件
-	fopen_s(&inputFile, filePath, "rb");
-	if (!inputFile) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		SecureZeroMemory(combinedKey, combinedKeyLength);
-		free(privateKey);
-		free(combinedKey);
-		return ERR_FILE_OPEN_FAILED;
+	if (!TrySubmitThreadpoolCallback(AsyncOperationCallback, op, NULL)) {
+		op->refCount = 1;
+		ReleaseOperation(op);
+		return ERR_THREAD_CREATION_FAILED;
 	}
 
-	// 获取文件大小
-	_fseeki64(inputFile, 0, SEEK_END);
-	__int64 totalFileSize = _ftelli64(inputFile);
-	_fseeki64(inputFile, 0, SEEK_SET);
+	*operation = op;
+	return SUCCESS;
+}
 
-	// 打开输出文件
-	fopen_s(&outputFile, outputPath, "wb");
-	if (!outputFile) {
-		fclose(inputFile);
-		SecureZeroMemory(privateKey, privateKeyLength);
-		SecureZeroMemory(combinedKey, combinedKeyLength);
-		free(privateKey);
-		free(combinedKey);
-		return ERR_FILE_OPEN_FAILED;
-	}
+int StreamEncryptFileAsync(const char* filePath, const char* outputPath, const unsigned char* publicKey, const EncodeOptions* options,
+	ProgressCallback progressCallback, CompletionCallback completionCallback, void* userData, EncodeOperation** operation) {
+	return SubmitFileOperation(ASYNC_STREAM_ENCRYPT, filePath, outputPath, publicKey, options, progressCallback, completionCallback, userData, operation);
+}
 
-	// 分配缓冲区
-	buffer = (unsigned char*)malloc(STREAM_BUFFER_SIZE);
-	if (!buffer) {
-		fclose(inputFile);
-		fclose(outputFile);
-		SecureZeroMemory(privateKey, privateKeyLength);
-		SecureZeroMemory(combinedKey, combinedKeyLength);
-		free(privateKey);
-		free(combinedKey);
-		return ERR_MEMORY_ALLOCATION_FAILED;
-	}
+int StreamDecryptFileAsync(const char* filePath, const char* outputPath, const unsigned char* publicKey,
+	ProgressCallback progressCallback, CompletionCallback completionCallback, void* userData, EncodeOperation** operation) {
+	return SubmitFileOperation(ASYNC_STREAM_DECRYPT, filePath, outputPath, publicKey, NULL, progressCallback, completionCallback, userData, operation);
+}
 
-	// 写入自包含式文件头
-	fwrite(SELF_CONTAINED_MAGIC_HEADER, 1, SELF_CONTAINED_MAGIC_SIZE, outputFile);
-	fwrite(&combinedKeyLength, sizeof(int), 1, outputFile);
+int SelfContainedEncryptFileAsync(const char* filePath, const char* outputPath, const unsigned char* publicKey, const EncodeOptions* options,
+	ProgressCallback progressCallback, CompletionCallback completionCallback, void* userData, EncodeOperation** operation) {
+	return SubmitFileOperation(ASYNC_SELF_CONTAINED_ENCRYPT, filePath, outputPath, publicKey, options, progressCallback, completionCallback, userData, operation);
+}
 
-	// 写入公钥哈希值
-	unsigned int publicKeyHash = CalculatePublicKeyHash(publicKey);
-	fwrite(&publicKeyHash, sizeof(unsigned int), 1, outputFile);
+int SelfContainedDecryptFileAsync(const char* filePath, const char* outputPath, const unsigned char* publicKey,
+	ProgressCallback progressCallback, CompletionCallback completionCallback, void* userData, EncodeOperation** operation) {
+	return SubmitFileOperation(ASYNC_SELF_CONTAINED_DECRYPT, filePath, outputPath, publicKey, NULL, progressCallback, completionCallback, userData, operation);
+}
 
-	// 写入私钥长度和私钥数据
-	fwrite(&privateKeyLength, sizeof(int), 1, outputFile);
-	fwrite(privateKey, 1, privateKeyLength, outputFile);
+int CancelOperation(EncodeOperation* operation) {
+	if (!operation) {
+		return ERR_INVALID_PARAMETER;
+	}
 
-	// 写入私钥哈希值用于完整性验证
-	unsigned int privateKeyHash = CalculatePrivateKeyHash(privateKey, privateKeyLength);
-	fwrite(&privateKeyHash, sizeof(unsigned int), 1, outputFile);
+	InterlockedExchange(&operation->cancelled, 1);
+	return SUCCESS;
+}
 
-	// 进度回调初始化
-	if (progressCallback) {
-		progressCallback(filePath, 0.0);
+int WaitOperation(EncodeOperation* operation, unsigned int timeoutMilliseconds) {
+	if (!operation) {
+		return ERR_INVALID_PARAMETER;
 	}
 
-	// 加密文件数据
-	size_t bytesRead;
-	__int64 totalProcessed = 0;
+	ULONGLONG deadline = GetTickCount64() + timeoutMilliseconds;
+	int result = ERR_OPERATION_PENDING;
 
-	while ((bytesRead = fread(buffer, 1, STREAM_BUFFER_SIZE, inputFile)) > 0) {
-		// 使用相同的双层XOR + 半字节交换加密算法
-		for (size_t i = 0; i < bytesRead; i++) {
-			// 使用全局位置计算密钥索引，确保一致性
-			__int64 globalIndex = totalProcessed + i;
-			unsigned char keyByte = combinedKey[globalIndex % combinedKeyLength];
-			unsigned char a1 = buffer[i];
-			unsigned char a2 = a1 ^ keyByte;
-			unsigned char a3 = ((a2 & 0x0F) << 4) | ((a2 & 0xF0) >> 4);
-			unsigned char a4 = a3 ^ keyByte;
-			buffer[i] = a4;
+	AcquireSRWLockExclusive(&operation->lock);
+	for (;;) {
+		if (operation->done) {
+			result = operation->result;
+			break;
 		}
 
-		size_t bytesWritten = fwrite(buffer, 1, bytesRead, outputFile);
-		if (bytesWritten != bytesRead) {
-			result = ERR_ENCRYPTION_FAILED;
+		ULONGLONG now = GetTickCount64();
+		if (timeoutMilliseconds == 0 || (timeoutMilliseconds != INFINITE && now >= deadline)) {
 			break;
 		}
 
-		totalProcessed += bytesRead;
+		DWORD timeout = timeoutMilliseconds == INFINITE ? INFINITE : (DWORD)(deadline - now);
+		SleepConditionVariableSRW(&operation->completed, &operation->lock, timeout, 0);
+	}
+	ReleaseSRWLockExclusive(&operation->lock);
 
-		// 进度回调
-		if (progressCallback && totalFileSize > 0) {
-			double dataProgress = (double)totalProcessed / (double)totalFileSize;
-			double adjustedProgress = dataProgress * 0.98;
-			progressCallback(filePath, adjustedProgress);
-		}
+	return result;
+}
+
+void CloseOperation(EncodeOperation* operation) {
+	if (operation) {
+		ReleaseOperation(operation);
 	}
+}
 
-	// 写入校验和
-	if (result == SUCCESS) {
-		if (progressCallback) {
-			progressCallback(filePath, 0.99);
-		}
+// ========== 目录树并行加解密 ==========
+
+#define DIRECTORY_MANIFEST_NAME ".encode_manifest"      // 默认清单文件名（位于输出根目录，遍历输入根目录时跳过同名文件）
+#define DIRECTORY_IO_DEPTH 2                            // 每个处理器同时处理的文件数（一个文件等待读写时由另一个文件占用处理器）
+#define DIRECTORY_MAX_WORKERS 64                        // 同时处理的文件数上限
+#define DIRECTORY_QUEUE_LIMIT 4096                      // 待处理文件队列上限（超过时遍历线程自己处理一个文件）
+#define DIRECTORY_MANIFEST_COMMIT_INTERVAL 256          // 每完成这么多文件把清单提交到磁盘一次
+#define DIRECTORY_MANIFEST_LINE_SIZE (32 * 1024 + 64)   // 清单行的最大长度（长路径 + 大小与修改时间）
+
+// 一个待处理文件；清单行 "大小 修改时间 相对路径" 与结构体同一次分配，relativePath 指向行内的路径部分
+struct DirectoryJob {
+	DirectoryJob* next;
+	unsigned long long size;
+	char* line;
+	char* relativePath;
+};
+
+struct DirectoryRun {
+	int decrypt;
+	int selfContained;
+	const CipherEngine* engine;
+	const PrivateKeySnapshot* keySnapshot;
+	const char* inputRoot;
+	const char* outputRoot;
+	const unsigned char* publicKey;
+	ProgressCallback progressCallback;
+
+	// 待处理文件队列（遍历线程写入，工作线程取出）
+	SRWLOCK queueLock;
+	CONDITION_VARIABLE queueReady;
+	DirectoryJob* head;
+	DirectoryJob* tail;
+	size_t queued;
+	int walkDone;
+
+	// 上次运行已完成的文件（清单行哈希的开放寻址集合，运行期间只读；0 表示空位）
+	unsigned long long* completed;
+	size_t completedMask;
+	size_t completedCount;
+
+	// 本次运行的清单（追加写入）
+	SRWLOCK manifestLock;
+	FILE* manifest;
+	size_t uncommitted;
+
+	volatile LONGLONG filesTotal;
+	volatile LONGLONG filesCompleted;
+	volatile LONGLONG filesSkipped;
+	volatile LONGLONG filesFailed;
+	volatile LONGLONG bytesProcessed;
+	volatile LONG firstError;
+};
+
+// 清单行哈希（0 保留为空位）
+static unsigned long long ManifestLineHash(const char* line, size_t length) {
+	unsigned long long hash = BlobContentHash((const unsigned char*)line, length);
+	return hash ? hash : 1;
+}
 
-		unsigned int checksum = CalculateCRC32(combinedKey, combinedKeyLength);
-		fwrite(&checksum, sizeof(unsigned int), 1, outputFile);
+static bool ManifestContains(const DirectoryRun* run, unsigned long long hash) {
+	if (!run->completed) {
+		return false;
+	}
 
-		if (progressCallback) {
-			progressCallback(filePath, 1.0);
+	for (size_t i = (size_t)hash & run->completedMask; run->completed[i] != 0; i = (i + 1) & run->completedMask) {
+		if (run->completed[i] == hash) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// 加入已完成集合，装载率超过一半时加倍
+static int ManifestInsert(DirectoryRun* run, unsigned long long hash) {
+	if (!run->completed || (run->completedCount + 1) * 2 > run->completedMask + 1) {
+		size_t capacity = run->completed ? (run->completedMask + 1) * 2 : 1024;
+		unsigned long long* table = (unsigned long long*)EncodeAlloc(capacity * sizeof(unsigned long long));
+		if (!table) {
+			return ERR_MEMORY_ALLOCATION_FAILED;
+		}
+		memset(table, 0, capacity * sizeof(unsigned long long));
+
+		unsigned long long* old = run->completed;
+		size_t oldCapacity = old ? run->completedMask + 1 : 0;
+		run->completed = table;
+		run->completedMask = capacity - 1;
+		run->completedCount = 0;
+
+		for (size_t i = 0; i < oldCapacity; i++) {
+			if (old[i] != 0) {
+				ManifestInsert(run, old[i]);
+			}
 		}
+		EncodeFree(old);
 	}
 
-	// 清理资源
-	SecureZeroMemory(privateKey, privateKeyLength);
-	SecureZeroMemory(combinedKey, combinedKeyLength);
-	free(privateKey);
-	free(combinedKey);
-	free(buffer);
-	fclose(inputFile);
-	fclose(outputFile);
+	if (ManifestContains(run, hash)) {
+		return SUCCESS;
+	}
 
-	return result;
+	size_t i = (size_t)hash & run->completedMask;
+	while (run->completed[i] != 0) {
+		i = (i + 1) & run->completedMask;
+	}
+	run->completed[i] = hash;
+	run->completedCount++;
+	return SUCCESS;
 }
 
-// 自包含式文件解密函数
-int SelfContainedDecryptFile(const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback) {
-	FILE* inputFile = NULL;
-	FILE* outputFile = NULL;
-	unsigned char* buffer = NULL;
-	unsigned char* privateKey = NULL;
-	unsigned char* combinedKey = NULL;
+// 读入上次运行的清单并以追加方式打开；进程中断时写到一半的最后一行被忽略，新记录从下一行开始
+// 第一行是头记录（方向、格式、引擎与密钥校验值），与本次运行不同时上次的记录全部作废，清单重新开始
+static int OpenDirectoryManifest(DirectoryRun* run, const char* manifestPath, const char* header) {
+	FILE* existing = NULL;
+	bool matched = false;
+	bool endsWithNewline = true;
 	int result = SUCCESS;
-	char header[SELF_CONTAINED_MAGIC_SIZE + 1];
-	int storedCombinedKeyLength = 0;
-	int privateKeyLength = 0;
-	int combinedKeyLength = 0;
 
-	const size_t STREAM_BUFFER_SIZE = 4 * 1024 * 1024;
+	fopen_s(&existing, manifestPath, "rb");
+	if (existing) {
+		char* line = (char*)EncodeAlloc(DIRECTORY_MANIFEST_LINE_SIZE);
+		if (!line) {
+			fclose(existing);
+			return ERR_MEMORY_ALLOCATION_FAILED;
+		}
+
+		size_t headerLength = strlen(header);
+		matched = fgets(line, DIRECTORY_MANIFEST_LINE_SIZE, existing) && strncmp(line, header, headerLength) == 0
+			&& (strcmp(line + headerLength, "\n") == 0 || strcmp(line + headerLength, "\r\n") == 0);
+
+		while (matched && result == SUCCESS && fgets(line, DIRECTORY_MANIFEST_LINE_SIZE, existing)) {
+			size_t length = strlen(line);
+			endsWithNewline = length > 0 && line[length - 1] == '\n';
+			if (!endsWithNewline) {
+				continue;      // 超长行的片段或未写完的最后一行
+			}
+
+			length--;
+			if (length > 0 && line[length - 1] == '\r') {
+				length--;
+			}
+			if (length > 0) {
+				result = ManifestInsert(run, ManifestLineHash(line, length));
+			}
+		}
 
-	if (!filePath || !outputPath || !publicKey) {
-		return ERR_INVALID_PARAMETER;
+		EncodeFree(line);
+		fclose(existing);
+		if (result != SUCCESS) {
+			return result;
+		}
 	}
 
-	// 打开输入文件
-	fopen_s(&inputFile, filePath, "rb");
-	if (!inputFile) {
+	fopen_s(&run->manifest, manifestPath, matched ? "ab" : "wb");
+	if (!run->manifest) {
 		return ERR_FILE_OPEN_FAILED;
 	}
 
-	// 读取并验证文件头
-	if (fread(header, 1, SELF_CONTAINED_MAGIC_SIZE, inputFile) != SELF_CONTAINED_MAGIC_SIZE) {
-		fclose(inputFile);
-		return ERR_INVALID_HEADER;
+	if (!matched) {
+		// 头记录先落盘，之后的每一行都属于这组参数
+		fputs(header, run->manifest);
+		fputc('\n', run->manifest);
+		if (fflush(run->manifest) != 0 || _commit(_fileno(run->manifest)) != 0) {
+			return ERR_FILE_OPEN_FAILED;
+		}
 	}
-
-	header[SELF_CONTAINED_MAGIC_SIZE] = '\0';
-	if (strcmp(header, SELF_CONTAINED_MAGIC_HEADER) != 0) {
-		fclose(inputFile);
-		return ERR_INVALID_HEADER;
+	else if (!endsWithNewline) {
+		fputc('\n', run->manifest);
 	}
+	return SUCCESS;
+}
 
-	// 读取组合密钥长度
-	if (fread(&storedCombinedKeyLength, sizeof(int), 1, inputFile) != 1) {
-		fclose(inputFile);
-		return ERR_INVALID_HEADER;
-	}
+// 记录一个已完成的文件：每行立即写出（进程退出不丢失），每隔一段提交到磁盘（断电最多重做这一段）
+static void AppendDirectoryManifest(DirectoryRun* run, const char* line) {
+	AcquireSRWLockExclusive(&run->manifestLock);
+	fputs(line, run->manifest);
+	fputc('\n', run->manifest);
+	fflush(run->manifest);
+	if (++run->uncommitted >= DIRECTORY_MANIFEST_COMMIT_INTERVAL) {
+		_commit(_fileno(run->manifest));
+		run->uncommitted = 0;
+	}
+	ReleaseSRWLockExclusive(&run->manifestLock);
+}
 
-	// 读取并验证公钥哈希值
-	unsigned int storedPublicKeyHash;
-	if (fread(&storedPublicKeyHash, sizeof(unsigned int), 1, inputFile) != 1) {
-		fclose(inputFile);
-		return ERR_INVALID_HEADER;
+// 拼接根目录与相对路径（相对路径为空时返回根目录副本），使用 EncodeFree 释放
+static char* JoinDirectoryPath(const char* root, const char* relativePath) {
+	size_t rootLength = strlen(root);
+	size_t relativeLength = strlen(relativePath);
+	char* path = (char*)EncodeAlloc(rootLength + 1 + relativeLength + 1);
+	if (!path) {
+		return NULL;
 	}
 
-	unsigned int currentPublicKeyHash = CalculatePublicKeyHash(publicKey);
-	if (storedPublicKeyHash != currentPublicKeyHash) {
-		fclose(inputFile);
-		return ERR_DECRYPTION_FAILED; // 公钥不匹配
+	memcpy(path, root, rootLength);
+	if (relativeLength > 0) {
+		path[rootLength] = '\\';
+		memcpy(path + rootLength + 1, relativePath, relativeLength + 1);
 	}
-
-	// 读取私钥长度
-	if (fread(&privateKeyLength, sizeof(int), 1, inputFile) != 1) {
-		fclose(inputFile);
-		return ERR_INVALID_HEADER;
+	else {
+		path[rootLength] = '\0';
 	}
+	return path;
+}
 
-	if (privateKeyLength != PRIVATE_KEY_SIZE_2048_BITS) {
-		fclose(inputFile);
-		return ERR_DECRYPTION_FAILED;
+// 创建输出目录（已存在时视为成功）
+static bool EnsureDirectory(const char* path) {
+	if (CreateDirectoryA(path, NULL)) {
+		return true;
 	}
+	DWORD attributes = GetFileAttributesA(path);
+	return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+}
 
-	// 读取私钥
-	privateKey = (unsigned char*)malloc(privateKeyLength);
-	if (!privateKey) {
-		fclose(inputFile);
-		return ERR_MEMORY_ALLOCATION_FAILED;
-	}
+static void RecordDirectoryFailure(DirectoryRun* run, int result) {
+	InterlockedIncrement64(&run->filesFailed);
+	InterlockedCompareExchange(&run->firstError, result, SUCCESS);
+}
 
-	if (fread(privateKey, 1, privateKeyLength, inputFile) != privateKeyLength) {
-		free(privateKey);
-		fclose(inputFile);
-		return ERR_INVALID_HEADER;
-	}
+// 处理一个文件：成功后写入清单，失败时记录第一个错误码后继续处理其它文件
+static void ProcessDirectoryJob(DirectoryRun* run, DirectoryJob* job) {
+	char* inputPath = JoinDirectoryPath(run->inputRoot, job->relativePath);
+	char* outputPath = JoinDirectoryPath(run->outputRoot, job->relativePath);
+	int result = ERR_MEMORY_ALLOCATION_FAILED;
 
-	// 读取并验证私钥哈希值
-	unsigned int storedPrivateKeyHash;
-	if (fread(&storedPrivateKeyHash, sizeof(unsigned int), 1, inputFile) != 1) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		free(privateKey);
-		fclose(inputFile);
-		return ERR_INVALID_HEADER;
+	if (inputPath && outputPath) {
+		if (run->decrypt) {
+			result = DecryptFileAnyWithSnapshot(run->keySnapshot, inputPath, outputPath, run->publicKey, NULL, NULL);
+		}
+		else if (run->selfContained) {
+			result = SelfContainedEncryptFileWithEngine(run->engine, inputPath, outputPath, run->publicKey, NULL, NULL);
+		}
+		else {
+			result = StreamEncryptFileWithSnapshot(run->keySnapshot, run->engine, inputPath, outputPath, run->publicKey, NULL, NULL);
+		}
 	}
 
-	unsigned int currentPrivateKeyHash = CalculatePrivateKeyHash(privateKey, privateKeyLength);
-	if (storedPrivateKeyHash != currentPrivateKeyHash) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		free(privateKey);
-		fclose(inputFile);
-		return ERR_DECRYPTION_FAILED; // 私钥被篡改
+	if (result == SUCCESS) {
+		AppendDirectoryManifest(run, job->line);
+		InterlockedIncrement64(&run->filesCompleted);
+		InterlockedExchangeAdd64(&run->bytesProcessed, (LONGLONG)job->size);
+		if (run->progressCallback) {
+			run->progressCallback(inputPath, 1.0);
+		}
 	}
-
-	// 重新组合私钥和公钥
-	int pubKeyLen = strlen((const char*)publicKey);
-	int totalLen = privateKeyLength + pubKeyLen;
-	combinedKey = (unsigned char*)malloc(totalLen + 1);
-	if (!combinedKey) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		free(privateKey);
-		fclose(inputFile);
-		return ERR_MEMORY_ALLOCATION_FAILED;
+	else {
+		RecordDirectoryFailure(run, result);
 	}
 
-	for (int i = 0; i < totalLen; i++) {
-		if (i % 2 == 0) {
-			combinedKey[i] = privateKey[i / 2 % privateKeyLength];
+	EncodeFree(inputPath);
+	EncodeFree(outputPath);
+	EncodeFree(job);
+}
+
+// 工作线程：处理队列中的文件，直到遍历结束且队列为空
+static void DrainDirectoryQueue(DirectoryRun* run) {
+	for (;;) {
+		AcquireSRWLockExclusive(&run->queueLock);
+		while (!run->head && !run->walkDone) {
+			SleepConditionVariableSRW(&run->queueReady, &run->queueLock, INFINITE, 0);
 		}
-		else {
-			combinedKey[i] = publicKey[i / 2 % pubKeyLen];
+
+		DirectoryJob* job = run->head;
+		if (job) {
+			run->head = job->next;
+			if (!run->head) {
+				run->tail = NULL;
+			}
+			run->queued--;
 		}
-		combinedKey[i] ^= (unsigned char)(i * 7 + 13);
+		ReleaseSRWLockExclusive(&run->queueLock);
+
+		if (!job) {
+			return;
+		}
+		ProcessDirectoryJob(run, job);
 	}
-	combinedKey[totalLen] = '\0';
-	combinedKeyLength = totalLen;
+}
 
-	// 验证组合密钥长度
-	if (storedCombinedKeyLength != combinedKeyLength) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		SecureZeroMemory(combinedKey, combinedKeyLength);
-		free(privateKey);
-		free(combinedKey);
-		fclose(inputFile);
-		return ERR_DECRYPTION_FAILED;
+static void CALLBACK DirectoryWorkCallback(PTP_CALLBACK_INSTANCE instance, PVOID context, PTP_WORK work) {
+	CallbackMayRunLong(instance);
+	DrainDirectoryQueue((DirectoryRun*)context);
+}
+
+// 加入队列；队列已满时遍历线程先处理一个文件，遍历不会无限领先于处理
+static void EnqueueDirectoryJob(DirectoryRun* run, DirectoryJob* job) {
+	DirectoryJob* overflow = NULL;
+
+	AcquireSRWLockExclusive(&run->queueLock);
+	if (run->queued >= DIRECTORY_QUEUE_LIMIT) {
+		overflow = run->head;
+		run->head = overflow->next;
+		run->queued--;
 	}
 
-	// 立即验证校验和
-	__int64 currentPos = _ftelli64(inputFile);
-	_fseeki64(inputFile, -(__int64)sizeof(unsigned int), SEEK_END);
-	unsigned int storedChecksum;
-	if (fread(&storedChecksum, sizeof(unsigned int), 1, inputFile) == 1) {
-		unsigned int calculatedChecksum = CalculateCRC32(combinedKey, combinedKeyLength);
-		if (storedChecksum != calculatedChecksum) {
-			SecureZeroMemory(privateKey, privateKeyLength);
-			SecureZeroMemory(combinedKey, combinedKeyLength);
-			free(privateKey);
-			free(combinedKey);
-			fclose(inputFile);
-			return ERR_DECRYPTION_FAILED;
-		}
+	job->next = NULL;
+	if (run->tail) {
+		run->tail->next = job;
 	}
 	else {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		SecureZeroMemory(combinedKey, combinedKeyLength);
-		free(privateKey);
-		free(combinedKey);
-		fclose(inputFile);
-		return ERR_INVALID_HEADER;
+		run->head = job;
 	}
+	run->tail = job;
+	run->queued++;
+	ReleaseSRWLockExclusive(&run->queueLock);
+	WakeConditionVariable(&run->queueReady);
 
-	// 恢复文件位置到数据开始处
-	_fseeki64(inputFile, currentPos, SEEK_SET);
-
-	// 打开输出文件
-	fopen_s(&outputFile, outputPath, "wb");
-	if (!outputFile) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		SecureZeroMemory(combinedKey, combinedKeyLength);
-		free(privateKey);
-		free(combinedKey);
-		fclose(inputFile);
-		return ERR_FILE_OPEN_FAILED;
+	if (overflow) {
+		ProcessDirectoryJob(run, overflow);
 	}
+}
 
-	// 分配缓冲区
-	buffer = (unsigned char*)malloc(STREAM_BUFFER_SIZE);
-	if (!buffer) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		SecureZeroMemory(combinedKey, combinedKeyLength);
-		free(privateKey);
-		free(combinedKey);
-		fclose(inputFile);
-		fclose(outputFile);
+// 为一个文件创建待处理项；清单中已完成（路径、大小与修改时间都相同）的文件跳过
+static int QueueDirectoryFile(DirectoryRun* run, const char* relativePath, const WIN32_FIND_DATAA* findData) {
+	unsigned long long size = ((unsigned long long)findData->nFileSizeHigh << 32) | findData->nFileSizeLow;
+	unsigned long long writeTime = ((unsigned long long)findData->ftLastWriteTime.dwHighDateTime << 32) | findData->ftLastWriteTime.dwLowDateTime;
+
+	char prefix[48];
+	int prefixLength = sprintf_s(prefix, sizeof(prefix), "%llu %llu ", size, writeTime);
+	size_t relativeLength = strlen(relativePath);
+
+	DirectoryJob* job = (DirectoryJob*)EncodeAlloc(sizeof(DirectoryJob) + prefixLength + relativeLength + 1);
+	if (!job) {
 		return ERR_MEMORY_ALLOCATION_FAILED;
 	}
+	job->size = size;
+	job->line = (char*)(job + 1);
+	job->relativePath = job->line + prefixLength;
+	memcpy(job->line, prefix, prefixLength);
+	memcpy(job->relativePath, relativePath, relativeLength + 1);
 
-	// 计算数据区大小
-	_fseeki64(inputFile, 0, SEEK_END);
-	__int64 fileSize = _ftelli64(inputFile);
-	_fseeki64(inputFile, currentPos, SEEK_SET);
-	__int64 dataSize = fileSize - currentPos - sizeof(unsigned int);
+	InterlockedIncrement64(&run->filesTotal);
+	if (ManifestContains(run, ManifestLineHash(job->line, prefixLength + relativeLength))) {
+		InterlockedIncrement64(&run->filesSkipped);
+		EncodeFree(job);
+		return SUCCESS;
+	}
 
-	// 进度回调初始化
-	if (progressCallback) {
-		progressCallback(filePath, 0.0);
+	EnqueueDirectoryJob(run, job);
+	return SUCCESS;
+}
+
+// 遍历输入目录树（深度优先，显式栈），在输出根目录下创建对应的目录，文件交给工作线程处理
+// 符号链接与挂载点目录不进入，避免循环
+static int WalkDirectoryTree(DirectoryRun* run) {
+	struct PendingDirectory {
+		PendingDirectory* next;
+		char* relativePath;
+	};
+
+	PendingDirectory* stack = (PendingDirectory*)EncodeAlloc(sizeof(PendingDirectory) + 1);
+	if (!stack) {
+		return ERR_MEMORY_ALLOCATION_FAILED;
 	}
+	stack->next = NULL;
+	stack->relativePath = (char*)(stack + 1);
+	stack->relativePath[0] = '\0';
 
-	// 解密文件数据
-	size_t bytesRead;
-	__int64 totalProcessed = 0;
+	int result = SUCCESS;
+	while (stack) {
+		PendingDirectory* current = stack;
+		stack = current->next;
 
-	while ((bytesRead = fread(buffer, 1, STREAM_BUFFER_SIZE, inputFile)) > 0) {
-		// 处理包含校验和的最后数据块
-		if (totalProcessed + bytesRead >= dataSize) {
-			bytesRead = dataSize - totalProcessed;
-			if (bytesRead <= 0) break;
+		char* directory = JoinDirectoryPath(run->inputRoot, current->relativePath);
+		char* pattern = directory ? JoinDirectoryPath(directory, "*") : NULL;
+		WIN32_FIND_DATAA findData;
+		HANDLE find = pattern ? FindFirstFileA(pattern, &findData) : INVALID_HANDLE_VALUE;
+
+		if (!pattern) {
+			result = ERR_MEMORY_ALLOCATION_FAILED;
+		}
+		else if (find == INVALID_HANDLE_VALUE) {
+			// 根目录无法打开时整个操作失败，子目录无法打开时记为一个失败项
+			if (current->relativePath[0] == '\0') {
+				result = ERR_FILE_OPEN_FAILED;
+			}
+			else {
+				RecordDirectoryFailure(run, ERR_FILE_OPEN_FAILED);
+			}
+		}
+		else {
+			do {
+				const char* name = findData.cFileName;
+				if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+					continue;
+				}
+				if (current->relativePath[0] == '\0' && strcmp(name, DIRECTORY_MANIFEST_NAME) == 0) {
+					continue;
+				}
+
+				char* relativePath = current->relativePath[0] ? JoinDirectoryPath(current->relativePath, name) : JoinDirectoryPath(name, "");
+				if (!relativePath) {
+					result = ERR_MEMORY_ALLOCATION_FAILED;
+					break;
+				}
+
+				if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+					if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+						// 先创建输出目录，再把子目录压栈（其中的文件入队前目录已存在）
+						char* outputDirectory = JoinDirectoryPath(run->outputRoot, relativePath);
+						PendingDirectory* child = outputDirectory && EnsureDirectory(outputDirectory) ? (PendingDirectory*)EncodeAlloc(sizeof(PendingDirectory)) : NULL;
+						if (child) {
+							child->relativePath = relativePath;
+							child->next = stack;
+							stack = child;
+							relativePath = NULL;
+						}
+						else {
+							RecordDirectoryFailure(run, outputDirectory ? ERR_FILE_OPEN_FAILED : ERR_MEMORY_ALLOCATION_FAILED);
+						}
+						EncodeFree(outputDirectory);
+					}
+				}
+				else {
+					result = QueueDirectoryFile(run, relativePath, &findData);
+				}
+
+				EncodeFree(relativePath);
+			} while (result == SUCCESS && FindNextFileA(find, &findData));
+
+			FindClose(find);
 		}
 
-		// 使用相同的双层XOR + 半字节交换解密算法
-		for (size_t i = 0; i < bytesRead; i++) {
-			// 使用全局位置计算密钥索引，确保一致性
-			__int64 globalIndex = totalProcessed + i;
-			unsigned char keyByte = combinedKey[globalIndex % combinedKeyLength];
-			unsigned char a1 = buffer[i];
-			unsigned char a2 = a1 ^ keyByte;
-			unsigned char a3 = ((a2 & 0x0F) << 4) | ((a2 & 0xF0) >> 4);
-			unsigned char a4 = a3 ^ keyByte;
-			buffer[i] = a4;
+		EncodeFree(pattern);
+		EncodeFree(directory);
+		if (current->relativePath != (char*)(current + 1)) {
+			EncodeFree(current->relativePath);
 		}
+		EncodeFree(current);
 
-		size_t bytesWritten = fwrite(buffer, 1, bytesRead, outputFile);
-		if (bytesWritten != bytesRead) {
-			result = ERR_DECRYPTION_FAILED;
+		if (result != SUCCESS) {
 			break;
 		}
+	}
 
-		totalProcessed += bytesRead;
+	// 出错提前结束时释放未遍历的目录
+	while (stack) {
+		PendingDirectory* next = stack->next;
+		EncodeFree(stack->relativePath);
+		EncodeFree(stack);
+		stack = next;
+	}
 
-		// 进度回调
-		if (progressCallback && dataSize > 0) {
-			double dataProgress = (double)totalProcessed / (double)dataSize;
-			progressCallback(filePath, dataProgress);
-		}
+	return result;
+}
+
+// 取得根目录的完整路径（解析相对路径与 . / ..）并去掉末尾的路径分隔符（保留驱动器根目录的分隔符）
+static int FullDirectoryRoot(const char* root, char** fullPath) {
+	*fullPath = NULL;
+
+	DWORD size = GetFullPathNameA(root, 0, NULL, NULL);
+	if (size == 0) {
+		return ERR_INVALID_PARAMETER;
 	}
 
-	// 解密完成
-	if (result == SUCCESS) {
-		if (progressCallback) {
-			progressCallback(filePath, 1.0);
-		}
+	char* path = (char*)EncodeAlloc(size);
+	if (!path) {
+		return ERR_MEMORY_ALLOCATION_FAILED;
 	}
 
-	// 清理资源
-	SecureZeroMemory(privateKey, privateKeyLength);
-	SecureZeroMemory(combinedKey, combinedKeyLength);
-	free(privateKey);
-	free(combinedKey);
-	free(buffer);
-	fclose(inputFile);
-	fclose(outputFile);
+	DWORD length = GetFullPathNameA(root, size, path, NULL);
+	if (length == 0 || length >= size) {
+		EncodeFree(path);
+		return ERR_INVALID_PARAMETER;
+	}
 
-	if (result != SUCCESS) {
-		remove(outputPath);
+	while (length > 1 && (path[length - 1] == '\\' || path[length - 1] == '/') && path[length - 2] != ':') {
+		length--;
 	}
+	path[length] = '\0';
 
-	return result;
+	*fullPath = path;
+	return SUCCESS;
 }
 
-// 自包含式数据加密函数
-int SelfContainedEncryptData(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char** outputData, size_t* outputLength) {
-	unsigned char* privateKey = NULL;
-	unsigned char* combinedKey = NULL;
-	int result = SUCCESS;
-	int privateKeyLength = 0;
-	int combinedKeyLength = 0;
+// path 是否为 root 本身或位于 root 之下（两者都是完整路径，不区分大小写）
+static bool IsWithinDirectory(const char* path, const char* root) {
+	size_t length = strlen(root);
+	while (length > 0 && (root[length - 1] == '\\' || root[length - 1] == '/')) {
+		length--;
+	}
+	return _strnicmp(path, root, length) == 0 && (path[length] == '\0' || path[length] == '\\' || path[length] == '/');
+}
 
-	if (!inputData || inputLength == 0 || !publicKey || !outputData || !outputLength) {
+static int ProcessDirectoryWithSnapshot(const PrivateKeySnapshot* keySnapshot, int decrypt, const char* inputRoot, const char* outputRoot, const unsigned char* publicKey,
+	const EncodeDirectoryOptions* options, ProgressCallback progressCallback, EncodeDirectoryStats* stats) {
+	if (!inputRoot || !outputRoot || !publicKey || (stats && stats->cbSize < sizeof(EncodeDirectoryStats))) {
+		return ERR_INVALID_PARAMETER;
+	}
+	if (options && options->cbSize < sizeof(EncodeDirectoryOptions)) {
 		return ERR_INVALID_PARAMETER;
 	}
 
-	*outputData = NULL;
-	*outputLength = 0;
-
-	// 分配私钥缓冲区并生成私钥
-	privateKey = (unsigned char*)malloc(PRIVATE_KEY_SIZE_2048_BITS);
-	if (!privateKey) {
-		return ERR_MEMORY_ALLOCATION_FAILED;
+	DirectoryRun run;
+	memset(&run, 0, sizeof(run));
+	run.decrypt = decrypt;
+	run.keySnapshot = keySnapshot;
+	run.publicKey = publicKey;
+	run.progressCallback = progressCallback;
+	InitializeSRWLock(&run.queueLock);
+	InitializeConditionVariable(&run.queueReady);
+	InitializeSRWLock(&run.manifestLock);
+
+	// 加密方式在开始前确定（解密按每个文件的魔数头识别格式）
+	if (!decrypt) {
+		EncodeOptions engineOptions = { sizeof(EncodeOptions), options ? options->engineId : ENCODE_ENGINE_XOR_NIBBLE };
+		int engineResult = ResolveCipherEngine(&engineOptions, &run.engine);
+		if (engineResult != SUCCESS) {
+			return engineResult;
+		}
+		run.selfContained = options && options->selfContained;
+		if (!run.selfContained && !keySnapshot) {
+			return ERR_PRIVATE_KEY_NOT_SET;
+		}
 	}
 
-	result = Generate2048BitPrivateKey(privateKey, &privateKeyLength);
-	if (result != SUCCESS) {
-		free(privateKey);
-		return result;
+	// 清单头记录：方向、格式、引擎与密钥校验值（与 FileCheckpoint 相同），参数变化后上次的清单作废
+	unsigned int keyCheck = 0;
+	if (keySnapshot && !run.selfContained) {
+		int combinedKeyLength = 0;
+		unsigned char* combinedKey = CombineKeys(keySnapshot, publicKey, &combinedKeyLength);
+		if (!combinedKey) {
+			return ERR_MEMORY_ALLOCATION_FAILED;
+		}
+		keyCheck = CalculateCRC32(combinedKey, combinedKeyLength);
+		SecureKeyFree(combinedKey);
 	}
 
-	// 组合私钥和公钥
-	int pubKeyLen = strlen((const char*)publicKey);
-	if (pubKeyLen == 0) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		free(privateKey);
-		return ERR_INVALID_PARAMETER;
+	char header[96];
+	sprintf_s(header, sizeof(header), "#encode-manifest 1 %s %d %d %08x %08x", decrypt ? "decrypt" : "encrypt",
+		decrypt ? ENCODE_FORMAT_UNKNOWN : (run.selfContained ? ENCODE_FORMAT_SELF_CONTAINED : ENCODE_FORMAT_STREAM),
+		decrypt ? -1 : run.engine->id, keyCheck, CalculatePublicKeyHash(publicKey));
+
+	char* input = NULL;
+	char* output = NULL;
+	char* defaultManifest = NULL;
+	int result = FullDirectoryRoot(inputRoot, &input);
+	if (result == SUCCESS) {
+		result = FullDirectoryRoot(outputRoot, &output);
 	}
 
-	int totalLen = privateKeyLength + pubKeyLen;
-	combinedKey = (unsigned char*)malloc(totalLen + 1);
-	if (!combinedKey) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		free(privateKey);
-		return ERR_MEMORY_ALLOCATION_FAILED;
+	// 输出树位于输入树之内（或反之）时遍历会读到自己的输出
+	if (result == SUCCESS && (IsWithinDirectory(output, input) || IsWithinDirectory(input, output))) {
+		result = ERR_INVALID_PARAMETER;
 	}
 
-	for (int i = 0; i < totalLen; i++) {
-		if (i % 2 == 0) {
-			combinedKey[i] = privateKey[i / 2 % privateKeyLength];
+	if (result == SUCCESS) {
+		defaultManifest = JoinDirectoryPath(output, DIRECTORY_MANIFEST_NAME);
+		if (!defaultManifest) {
+			result = ERR_MEMORY_ALLOCATION_FAILED;
+		}
+		else if (!EnsureDirectory(output)) {
+			result = ERR_FILE_OPEN_FAILED;
 		}
 		else {
-			combinedKey[i] = publicKey[i / 2 % pubKeyLen];
+			run.inputRoot = input;
+			run.outputRoot = output;
+			result = OpenDirectoryManifest(&run, options && options->manifestPath ? options->manifestPath : defaultManifest, header);
 		}
-		combinedKey[i] ^= (unsigned char)(i * 7 + 13);
 	}
-	combinedKey[totalLen] = '\0';
-	combinedKeyLength = totalLen;
-
-	// 计算输出大小
-	size_t headerSize = SELF_CONTAINED_MAGIC_SIZE + sizeof(int) + sizeof(unsigned int) + sizeof(int) + privateKeyLength + sizeof(unsigned int);
-	size_t outputSize = headerSize + inputLength + sizeof(unsigned int);
 
-	// 分配输出缓冲区
-	*outputData = (unsigned char*)malloc(outputSize);
-	if (!*outputData) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		SecureZeroMemory(combinedKey, combinedKeyLength);
-		free(privateKey);
-		free(combinedKey);
-		return ERR_MEMORY_ALLOCATION_FAILED;
-	}
+	if (result == SUCCESS) {
+		// 并行度：处理器数量 × I/O 深度（或调用者指定），调用线程负责遍历，遍历结束后也参与处理
+		DWORD processorCount = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+		size_t workerCount = options && options->workerCount ? options->workerCount : (size_t)processorCount * DIRECTORY_IO_DEPTH;
+		if (workerCount > DIRECTORY_MAX_WORKERS) {
+			workerCount = DIRECTORY_MAX_WORKERS;
+		}
+		size_t helperCount = workerCount > 0 ? workerCount - 1 : 0;
+
+		PTP_WORK work = NULL;
+		if (helperCount > 0) {
+			work = CreateThreadpoolWork(DirectoryWorkCallback, &run, NULL);
+			if (!work) {
+				helperCount = 0;   // 线程池不可用时由调用线程在遍历结束后依次处理
+			}
+		}
+		for (size_t i = 0; i < helperCount; i++) {
+			SubmitThreadpoolWork(work);
+		}
 
-	unsigned char* outPtr = *outputData;
+		// 调用线程上的文件处理不更新绑定在该线程上的进度对象
+		EncodeProgress* previousProgress = SetThreadProgress(nullptr);
 
-	// 写入文件头
-	memcpy(outPtr, SELF_CONTAINED_MAGIC_HEADER, SELF_CONTAINED_MAGIC_SIZE);
-	outPtr += SELF_CONTAINED_MAGIC_SIZE;
+		result = WalkDirectoryTree(&run);
 
-	memcpy(outPtr, &combinedKeyLength, sizeof(int));
-	outPtr += sizeof(int);
+		AcquireSRWLockExclusive(&run.queueLock);
+		run.walkDone = 1;
+		ReleaseSRWLockExclusive(&run.queueLock);
+		WakeAllConditionVariable(&run.queueReady);
 
-	unsigned int publicKeyHash = CalculatePublicKeyHash(publicKey);
-	memcpy(outPtr, &publicKeyHash, sizeof(unsigned int));
-	outPtr += sizeof(unsigned int);
+		DrainDirectoryQueue(&run);
+		if (work) {
+			WaitForThreadpoolWorkCallbacks(work, FALSE);
+			CloseThreadpoolWork(work);
+		}
 
-	memcpy(outPtr, &privateKeyLength, sizeof(int));
-	outPtr += sizeof(int);
+		SetThreadProgress(previousProgress);
 
-	memcpy(outPtr, privateKey, privateKeyLength);
-	outPtr += privateKeyLength;
+		fflush(run.manifest);
+		_commit(_fileno(run.manifest));
+	}
 
-	unsigned int privateKeyHash = CalculatePrivateKeyHash(privateKey, privateKeyLength);
-	memcpy(outPtr, &privateKeyHash, sizeof(unsigned int));
-	outPtr += sizeof(unsigned int);
+	if (run.manifest) {
+		fclose(run.manifest);
+	}
+	EncodeFree(run.completed);
+	EncodeFree(defaultManifest);
+	EncodeFree(input);
+	EncodeFree(output);
 
-	// 加密数据
-	for (size_t i = 0; i < inputLength; i++) {
-		unsigned char keyByte = combinedKey[i % combinedKeyLength];
-		unsigned char a1 = inputData[i];
-		unsigned char a2 = a1 ^ keyByte;
-		unsigned char a3 = ((a2 & 0x0F) << 4) | ((a2 & 0xF0) >> 4);
-		unsigned char a4 = a3 ^ keyByte;
-		outPtr[i] = a4;
+	if (stats) {
+		stats->filesTotal = (unsigned long long)run.filesTotal;
+		stats->filesCompleted = (unsigned long long)run.filesCompleted;
+		stats->filesSkipped = (unsigned long long)run.filesSkipped;
+		stats->filesFailed = (unsigned long long)run.filesFailed;
+		stats->bytesProcessed = (unsigned long long)run.bytesProcessed;
 	}
-	outPtr += inputLength;
 
-	// 写入校验和
-	unsigned int checksum = CalculateCRC32(combinedKey, combinedKeyLength);
-	memcpy(outPtr, &checksum, sizeof(unsigned int));
+	return result != SUCCESS ? result : run.firstError;
+}
 
-	*outputLength = outputSize;
+int EncryptDirectory(const char* inputRoot, const char* outputRoot, const unsigned char* publicKey, const EncodeDirectoryOptions* options, ProgressCallback progressCallback, EncodeDirectoryStats* stats) {
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = ProcessDirectoryWithSnapshot(keySnapshot, 0, inputRoot, outputRoot, publicKey, options, progressCallback, stats);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
 
-	// 清理资源
-	SecureZeroMemory(privateKey, privateKeyLength);
-	SecureZeroMemory(combinedKey, combinedKeyLength);
-	free(privateKey);
-	free(combinedKey);
+int DecryptDirectory(const char* inputRoot, const char* outputRoot, const unsigned char* publicKey, const EncodeDirectoryOptions* options, ProgressCallback progressCallback, EncodeDirectoryStats* stats) {
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = ProcessDirectoryWithSnapshot(keySnapshot, 1, inputRoot, outputRoot, publicKey, options, progressCallback, stats);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
 
-	return SUCCESS;
+// ========== 可续做的大文件加解密（检查点） ==========
+
+#define FILE_CHECKPOINT_MAGIC "ENCCKPT1"
+#define FILE_CHECKPOINT_MAGIC_SIZE 8
+#define FILE_CHECKPOINT_SUFFIX ".checkpoint"                     // 检查点文件名 = 输出文件名 + 后缀
+#define FILE_CHECKPOINT_TEMP_SUFFIX ".checkpoint.tmp"            // 写新检查点时的临时文件（写完后替换）
+#define FILE_CHECKPOINT_INTERVAL (256LL * 1024 * 1024)           // 每处理这么多数据提交一次检查点
+
+#define FILE_CHECKPOINT_ENCRYPT 0
+#define FILE_CHECKPOINT_DECRYPT 1
+
+// 检查点记录（保存在输出文件旁）：输出文件中前 headerSize + committed 字节已落盘，
+// 输入文件、格式、引擎与组合密钥与记录一致时可以从 committed 处继续
+struct FileCheckpoint {
+	char magic[FILE_CHECKPOINT_MAGIC_SIZE];
+	int direction;                             // FILE_CHECKPOINT_ENCRYPT / FILE_CHECKPOINT_DECRYPT
+	int format;                                // ENCODE_FORMAT_*
+	int engineId;
+	unsigned int keyCheck;                     // 组合密钥的 CRC32（与加密文件末尾的校验和相同）
+	unsigned int publicKeyHash;
+	unsigned long long inputSize;              // 输入文件大小与修改时间（输入被修改后检查点失效）
+	unsigned long long inputWriteTime;
+	unsigned long long headerSize;             // 加密：输出文件头大小；解密：输入文件中数据区的偏移
+	unsigned long long committed;              // 已落盘的数据区字节数
+	unsigned int crc;                          // 以上字段的 CRC32
+};
+
+// 一次可续做操作的状态
+struct ResumableFile {
+	const char* filePath;                      // 进度回调使用
+	char* checkpointPath;
+	char* checkpointTempPath;
+	FILE* input;
+	FILE* output;
+	CipherStream cipher;
+	unsigned char* buffer;
+	size_t bufferSize;
+	__int64 inputOffset;                       // 数据区在输入文件中的偏移
+	__int64 dataSize;                          // 数据区大小
+	int failure;                               // 读写失败时的错误码（加密/解密失败）
+	bool started;                              // 已进入数据处理阶段（结束时更新进度对象）
+	FileCheckpoint checkpoint;
+	ProgressCallback progressCallback;
+};
+
+// 取得输入文件的大小与修改时间
+static bool GetFileIdentity(const char* filePath, unsigned long long* size, unsigned long long* writeTime) {
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesExA(filePath, GetFileExInfoStandard, &attributes)) {
+		return false;
+	}
+
+	*size = ((unsigned long long)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+	*writeTime = ((unsigned long long)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+	return true;
 }
 
-// 自包含式数据解密函数
-int SelfContainedDecryptData(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char** outputData, size_t* outputLength) {
-	unsigned char* privateKey = NULL;
-	unsigned char* combinedKey = NULL;
-	int result = SUCCESS;
-	char header[SELF_CONTAINED_MAGIC_SIZE + 1];
-	int storedCombinedKeyLength = 0;
-	int privateKeyLength = 0;
-	int combinedKeyLength = 0;
+// 生成检查点文件与临时文件的路径（一次分配，使用 EncodeFree(file->checkpointPath) 释放）
+static bool AllocateCheckpointPaths(ResumableFile* file, const char* outputPath) {
+	size_t length = strlen(outputPath);
+	size_t checkpointSize = length + sizeof(FILE_CHECKPOINT_SUFFIX);
+	size_t tempSize = length + sizeof(FILE_CHECKPOINT_TEMP_SUFFIX);
 
-	if (!inputData || inputLength == 0 || !publicKey || !outputData || !outputLength) {
-		return ERR_INVALID_PARAMETER;
+	file->checkpointPath = (char*)EncodeAlloc(checkpointSize + tempSize);
+	if (!file->checkpointPath) {
+		return false;
 	}
+	file->checkpointTempPath = file->checkpointPath + checkpointSize;
 
-	*outputData = NULL;
-	*outputLength = 0;
+	memcpy(file->checkpointPath, outputPath, length);
+	memcpy(file->checkpointPath + length, FILE_CHECKPOINT_SUFFIX, sizeof(FILE_CHECKPOINT_SUFFIX));
+	memcpy(file->checkpointTempPath, outputPath, length);
+	memcpy(file->checkpointTempPath + length, FILE_CHECKPOINT_TEMP_SUFFIX, sizeof(FILE_CHECKPOINT_TEMP_SUFFIX));
+	return true;
+}
 
-	// 检查最小长度
-	size_t minSize = SELF_CONTAINED_MAGIC_SIZE + sizeof(int) + sizeof(unsigned int) + sizeof(int) + PRIVATE_KEY_SIZE_2048_BITS + sizeof(unsigned int) + sizeof(unsigned int);
-	if (inputLength < minSize) {
-		return ERR_INVALID_HEADER;
+// 读取检查点并与本次操作的参数比较（expected 中除 committed 外的字段都必须相同）
+static bool LoadFileCheckpoint(const ResumableFile* file, const FileCheckpoint* expected, FileCheckpoint* checkpoint) {
+	FILE* checkpointFile = NULL;
+	fopen_s(&checkpointFile, file->checkpointPath, "rb");
+	if (!checkpointFile) {
+		return false;
 	}
 
-	const unsigned char* inPtr = inputData;
-
-	// 验证文件头
-	memcpy(header, inPtr, SELF_CONTAINED_MAGIC_SIZE);
-	header[SELF_CONTAINED_MAGIC_SIZE] = '\0';
-	if (strcmp(header, SELF_CONTAINED_MAGIC_HEADER) != 0) {
-		return ERR_INVALID_HEADER;
+	size_t bytesRead = fread(checkpoint, 1, sizeof(FileCheckpoint), checkpointFile);
+	fclose(checkpointFile);
+	if (bytesRead != sizeof(FileCheckpoint) || checkpoint->crc != CalculateCRC32((const unsigned char*)checkpoint, offsetof(FileCheckpoint, crc))) {
+		return false;
 	}
-	inPtr += SELF_CONTAINED_MAGIC_SIZE;
 
-	// 读取组合密钥长度
-	memcpy(&storedCombinedKeyLength, inPtr, sizeof(int));
-	inPtr += sizeof(int);
+	return memcmp(checkpoint, expected, offsetof(FileCheckpoint, committed)) == 0;
+}
 
-	// 验证公钥哈希
-	unsigned int storedPublicKeyHash;
-	memcpy(&storedPublicKeyHash, inPtr, sizeof(unsigned int));
-	inPtr += sizeof(unsigned int);
+// 提交检查点：先让输出文件中已写出的数据落盘，再写临时文件并替换旧检查点
+// 任何时刻磁盘上的检查点都是完整的，且记录的字节数不超过已落盘的数据
+static int CommitFileCheckpoint(ResumableFile* file, __int64 committed) {
+	if (fflush(file->output) != 0 || _commit(_fileno(file->output)) != 0) {
+		return file->failure;
+	}
 
-	unsigned int currentPublicKeyHash = CalculatePublicKeyHash(publicKey);
-	if (storedPublicKeyHash != currentPublicKeyHash) {
-		return ERR_DECRYPTION_FAILED;
+	file->checkpoint.committed = (unsigned long long)committed;
+	file->checkpoint.crc = CalculateCRC32((const unsigned char*)&file->checkpoint, offsetof(FileCheckpoint, crc));
+
+	FILE* checkpointFile = NULL;
+	fopen_s(&checkpointFile, file->checkpointTempPath, "wb");
+	if (!checkpointFile) {
+		return ERR_FILE_OPEN_FAILED;
 	}
 
-	// 读取私钥长度
-	memcpy(&privateKeyLength, inPtr, sizeof(int));
-	inPtr += sizeof(int);
+	bool written = fwrite(&file->checkpoint, 1, sizeof(FileCheckpoint), checkpointFile) == sizeof(FileCheckpoint)
+		&& fflush(checkpointFile) == 0 && _commit(_fileno(checkpointFile)) == 0;
+	fclose(checkpointFile);
 
-	if (privateKeyLength != PRIVATE_KEY_SIZE_2048_BITS) {
-		return ERR_DECRYPTION_FAILED;
+	if (!written || !MoveFileExA(file->checkpointTempPath, file->checkpointPath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+		DeleteFileA(file->checkpointTempPath);
+		return ERR_FILE_OPEN_FAILED;
 	}
+	return SUCCESS;
+}
 
-	// 读取私钥
-	privateKey = (unsigned char*)malloc(privateKeyLength);
-	if (!privateKey) {
-		return ERR_MEMORY_ALLOCATION_FAILED;
+// 打开输出文件：检查点有效时截断到已提交的位置继续写，否则新建
+// 返回 true 表示从检查点继续（file->checkpoint 为读到的检查点），false 表示从头开始（committed 为0）
+static bool OpenResumableOutput(ResumableFile* file, const char* outputPath, const FileCheckpoint* expected, CallArena* arena) {
+	FileCheckpoint checkpoint;
+	if (LoadFileCheckpoint(file, expected, &checkpoint) && checkpoint.committed <= (unsigned long long)file->dataSize) {
+		fopen_s(&file->output, outputPath, "r+b");
+		if (file->output) {
+			AttachStdioBuffer(file->output, arena);
+			__int64 length = (__int64)(checkpoint.direction == FILE_CHECKPOINT_ENCRYPT ? checkpoint.headerSize : 0) + (__int64)checkpoint.committed;
+			_fseeki64(file->output, 0, SEEK_END);
+			if (_ftelli64(file->output) >= length && _chsize_s(_fileno(file->output), length) == 0) {
+				_fseeki64(file->output, length, SEEK_SET);
+				file->checkpoint = checkpoint;
+				return true;
+			}
+			fclose(file->output);
+			file->output = NULL;
+		}
 	}
 
-	memcpy(privateKey, inPtr, privateKeyLength);
-	inPtr += privateKeyLength;
+	fopen_s(&file->output, outputPath, "wb");
+	if (file->output) {
+		AttachStdioBuffer(file->output, arena);
+	}
+	file->checkpoint = *expected;
+	return false;
+}
 
-	// 验证私钥哈希
-	unsigned int storedPrivateKeyHash;
-	memcpy(&storedPrivateKeyHash, inPtr, sizeof(unsigned int));
-	inPtr += sizeof(unsigned int);
+// 从检查点处继续变换数据区，每隔 FILE_CHECKPOINT_INTERVAL 字节提交一次检查点
+// 可随机访问且没有尾部数据的引擎（如引擎0）直接从 committed 处开始；
+// 有尾部数据的引擎（如 AES-GCM 的认证标签）先重新读入已提交的部分恢复引擎状态，这部分不再写出
+static int ResumableTransformData(ResumableFile* file) {
+	const CipherEngine* engine = file->cipher.engine;
+	bool randomAccess = engine->transformAt && engine->trailerSize == 0;
+	__int64 committed = (__int64)file->checkpoint.committed;
+	__int64 position = randomAccess ? committed : 0;
+	__int64 lastCheckpoint = committed;
+	int result = SUCCESS;
 
-	unsigned int currentPrivateKeyHash = CalculatePrivateKeyHash(privateKey, privateKeyLength);
-	if (storedPrivateKeyHash != currentPrivateKeyHash) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		free(privateKey);
-		return ERR_DECRYPTION_FAILED;
+	file->started = true;
+	ProgressBegin(file->dataSize);
+	ProgressAdvance(committed);
+	if (file->progressCallback) {
+		file->progressCallback(file->filePath, file->dataSize > 0 ? (double)committed / (double)file->dataSize * 0.98 : 0.0);
 	}
 
-	// 重新组合密钥
-	int pubKeyLen = strlen((const char*)publicKey);
-	int totalLen = privateKeyLength + pubKeyLen;
-	combinedKey = (unsigned char*)malloc(totalLen + 1);
-	if (!combinedKey) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		free(privateKey);
-		return ERR_MEMORY_ALLOCATION_FAILED;
-	}
+	_fseeki64(file->input, file->inputOffset + position, SEEK_SET);
+
+	while (position < file->dataSize) {
+		size_t chunk = file->bufferSize;
+		if ((__int64)chunk > file->dataSize - position) {
+			chunk = (size_t)(file->dataSize - position);
+		}
+		// 重放阶段的一块不跨过 committed，之后的块全部写出
+		if (position < committed && (__int64)chunk > committed - position) {
+			chunk = (size_t)(committed - position);
+		}
+
+		if (fread(file->buffer, 1, chunk, file->input) != chunk) {
+			result = file->failure;
+			break;
+		}
 
-	for (int i = 0; i < totalLen; i++) {
-		if (i % 2 == 0) {
-			combinedKey[i] = privateKey[i / 2 % privateKeyLength];
+		if (randomAccess) {
+			engine->transformAt(file->cipher.context, file->buffer, file->buffer, chunk, position);
 		}
 		else {
-			combinedKey[i] = publicKey[i / 2 % pubKeyLen];
+			engine->transform(file->cipher.context, file->buffer, file->buffer, chunk, position);
 		}
-		combinedKey[i] ^= (unsigned char)(i * 7 + 13);
-	}
-	combinedKey[totalLen] = '\0';
-	combinedKeyLength = totalLen;
 
-	// 验证组合密钥长度
-	if (storedCombinedKeyLength != combinedKeyLength) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		SecureZeroMemory(combinedKey, combinedKeyLength);
-		free(privateKey);
-		free(combinedKey);
-		return ERR_DECRYPTION_FAILED;
+		if (position >= committed) {
+			if (fwrite(file->buffer, 1, chunk, file->output) != chunk) {
+				result = file->failure;
+				break;
+			}
+		}
+		position += chunk;
+
+		if (position > committed) {
+			ProgressAdvance(position);
+			if (file->progressCallback && file->dataSize > 0) {
+				file->progressCallback(file->filePath, (double)position / (double)file->dataSize * 0.98);
+			}
+
+			if (position - lastCheckpoint >= FILE_CHECKPOINT_INTERVAL) {
+				result = CommitFileCheckpoint(file, position);
+				if (result != SUCCESS) {
+					break;
+				}
+				lastCheckpoint = position;
+			}
+		}
 	}
 
-	// 验证校验和
-	unsigned int storedChecksum;
-	memcpy(&storedChecksum, inputData + inputLength - sizeof(unsigned int), sizeof(unsigned int));
-	unsigned int calculatedChecksum = CalculateCRC32(combinedKey, combinedKeyLength);
-	if (storedChecksum != calculatedChecksum) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		SecureZeroMemory(combinedKey, combinedKeyLength);
-		free(privateKey);
-		free(combinedKey);
-		return ERR_DECRYPTION_FAILED;
+	// 中断时把最后一段也记入检查点（失败原因是写入错误时可能提交不了，仍保留上一个检查点）
+	if (result != SUCCESS && position > lastCheckpoint && position > committed) {
+		CommitFileCheckpoint(file, position);
 	}
 
-	// 计算数据大小
-	size_t headerSize = SELF_CONTAINED_MAGIC_SIZE + sizeof(int) + sizeof(unsigned int) + sizeof(int) + privateKeyLength + sizeof(unsigned int);
-	size_t dataSize = inputLength - headerSize - sizeof(unsigned int);
+	SecureZeroMemory(file->buffer, file->bufferSize);
+	return result;
+}
 
-	// 分配输出缓冲区
-	*outputData = (unsigned char*)malloc(dataSize);
-	if (!*outputData) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		SecureZeroMemory(combinedKey, combinedKeyLength);
-		free(privateKey);
-		free(combinedKey);
-		return ERR_MEMORY_ALLOCATION_FAILED;
+// 结束一次可续做操作：成功时删除检查点；失败时保留输出与检查点，之后用相同参数调用即可继续
+static void CloseResumableFile(ResumableFile* file, int result) {
+	CipherStreamClose(&file->cipher);
+	if (file->input) {
+		fclose(file->input);
 	}
-
-	// 解密数据
-	for (size_t i = 0; i < dataSize; i++) {
-		unsigned char keyByte = combinedKey[i % combinedKeyLength];
-		unsigned char a1 = inPtr[i];
-		unsigned char a2 = a1 ^ keyByte;
-		unsigned char a3 = ((a2 & 0x0F) << 4) | ((a2 & 0xF0) >> 4);
-		unsigned char a4 = a3 ^ keyByte;
-		(*outputData)[i] = a4;
+	if (file->output) {
+		fclose(file->output);
 	}
 
-	*outputLength = dataSize;
-
-	// 清理资源
-	SecureZeroMemory(privateKey, privateKeyLength);
-	SecureZeroMemory(combinedKey, combinedKeyLength);
-	free(privateKey);
-	free(combinedKey);
+	if (result == SUCCESS && file->checkpointPath) {
+		DeleteFileA(file->checkpointPath);
+	}
+	EncodeFree(file->checkpointPath);
 
-	return SUCCESS;
+	if (file->started) {
+		ProgressEnd(result);
+	}
 }
 
-// 验证自包含式加密文件有效性
-int ValidateSelfContainedFile(const char* filePath, const unsigned char* publicKey) {
-	FILE* inputFile = NULL;
-	unsigned char* privateKey = NULL;
-	unsigned char* combinedKey = NULL;
-	char header[SELF_CONTAINED_MAGIC_SIZE + 1];
-	int storedCombinedKeyLength = 0;
-	int privateKeyLength = 0;
-	int combinedKeyLength = 0;
-	bool isValid = false;
+// 可续做的双密钥格式文件加密（输出与 StreamEncryptFileEx 相同）
+static int ResumeEncryptFileWithSnapshot(const PrivateKeySnapshot* keySnapshot, const char* filePath, const char* outputPath, const unsigned char* publicKey,
+	const EncodeOptions* options, ProgressCallback progressCallback) {
+	if (!filePath || !outputPath || !publicKey) {
+		return ERR_INVALID_PARAMETER;
+	}
 
-	if (!filePath || !publicKey) {
-		return 0;
+	const CipherEngine* engine = NULL;
+	int result = ResolveCipherEngine(options, &engine);
+	if (result != SUCCESS) {
+		return result;
 	}
 
-	// 打开文件
-	fopen_s(&inputFile, filePath, "rb");
-	if (!inputFile) {
-		return 0;
+	if (!keySnapshot) {
+		return ERR_PRIVATE_KEY_NOT_SET;
 	}
 
-	// 验证文件头
-	if (fread(header, 1, SELF_CONTAINED_MAGIC_SIZE, inputFile) != SELF_CONTAINED_MAGIC_SIZE) {
-		fclose(inputFile);
-		return 0;
+	unsigned long long inputSize = 0;
+	unsigned long long inputWriteTime = 0;
+	if (!GetFileIdentity(filePath, &inputSize, &inputWriteTime)) {
+		return ERR_FILE_OPEN_FAILED;
+	}
+	if (!EngineAcceptsLength(engine, inputSize)) {
+		return ERR_INVALID_PARAMETER;
 	}
 
-	header[SELF_CONTAINED_MAGIC_SIZE] = '\0';
-	if (strcmp(header, SELF_CONTAINED_MAGIC_HEADER) != 0) {
-		fclose(inputFile);
-		return 0;
+	int combinedKeyLength = 0;
+	unsigned char* combinedKey = CombineKeys(keySnapshot, publicKey, &combinedKeyLength);
+	if (!combinedKey || combinedKeyLength == 0) {
+		SecureKeyFree(combinedKey);
+		return ERR_ENCRYPTION_FAILED;
 	}
 
-	// 读取组合密钥长度
-	if (fread(&storedCombinedKeyLength, sizeof(int), 1, inputFile) != 1) {
-		fclose(inputFile);
-		return 0;
+	ResumableFile file;
+	memset(&file, 0, sizeof(file));
+	file.filePath = filePath;
+	file.dataSize = (__int64)inputSize;
+	file.failure = ERR_ENCRYPTION_FAILED;
+	file.progressCallback = progressCallback;
+
+	unsigned int publicKeyHash = CalculatePublicKeyHash(publicKey);
+	size_t headerSize = EnginePrefixSize(&g_streamFormat, engine) + sizeof(int) + sizeof(unsigned int);
+
+	FileCheckpoint expected;
+	memset(&expected, 0, sizeof(expected));
+	memcpy(expected.magic, FILE_CHECKPOINT_MAGIC, FILE_CHECKPOINT_MAGIC_SIZE);
+	expected.direction = FILE_CHECKPOINT_ENCRYPT;
+	expected.format = ENCODE_FORMAT_STREAM;
+	expected.engineId = engine->id;
+	expected.keyCheck = CalculateCRC32(combinedKey, combinedKeyLength);
+	expected.publicKeyHash = publicKeyHash;
+	expected.inputSize = inputSize;
+	expected.inputWriteTime = inputWriteTime;
+	expected.headerSize = headerSize;
+
+	CallArena arena;
+	result = CallArenaReserveFile(&arena, filePath, &file.bufferSize);
+	if (result != SUCCESS) {
+		SecureKeyFree(combinedKey);
+		return result;
 	}
+	file.buffer = (unsigned char*)CallArenaAlloc(&arena, file.bufferSize);
 
-	// 验证公钥哈希
-	unsigned int storedPublicKeyHash;
-	if (fread(&storedPublicKeyHash, sizeof(unsigned int), 1, inputFile) != 1) {
-		fclose(inputFile);
-		return 0;
+	if (!AllocateCheckpointPaths(&file, outputPath)) {
+		result = ERR_MEMORY_ALLOCATION_FAILED;
+	}
+	else {
+		fopen_s(&file.input, filePath, "rb");
+		if (!file.input) {
+			result = ERR_FILE_OPEN_FAILED;
+		}
 	}
 
-	unsigned int currentPublicKeyHash = CalculatePublicKeyHash(publicKey);
-	if (storedPublicKeyHash != currentPublicKeyHash) {
-		fclose(inputFile);
-		return 0;
+	if (result == SUCCESS) {
+		AttachStdioBuffer(file.input, &arena);
+
+		unsigned char engineHeader[CIPHER_ENGINE_MAX_HEADER];
+		if (OpenResumableOutput(&file, outputPath, &expected, &arena)) {
+			// 继续：引擎参数（如随机数）沿用输出文件头中已写出的值
+			const CipherEngine* headerEngine = NULL;
+			int storedKeyLength = 0;
+			unsigned int storedPublicKeyHash = 0;
+			_fseeki64(file.output, 0, SEEK_SET);
+			if (ReadEnginePrefix(file.output, &g_streamFormat, &headerEngine, engineHeader) != SUCCESS || headerEngine != engine
+				|| fread(&storedKeyLength, sizeof(int), 1, file.output) != 1 || fread(&storedPublicKeyHash, sizeof(unsigned int), 1, file.output) != 1
+				|| storedKeyLength != combinedKeyLength || storedPublicKeyHash != publicKeyHash || _ftelli64(file.output) != (__int64)headerSize) {
+				result = ERR_INVALID_HEADER;
+			}
+			else {
+				_fseeki64(file.output, (__int64)(headerSize + file.checkpoint.committed), SEEK_SET);
+				result = CipherStreamAttach(&file.cipher, engine, combinedKey, combinedKeyLength, engineHeader, 1);
+			}
+		}
+		else if (!file.output) {
+			result = ERR_FILE_OPEN_FAILED;
+		}
+		else {
+			// 从头开始：写出文件头后立即提交检查点，引擎参数随文件头一起落盘
+			result = CipherStreamOpen(&file.cipher, engine, combinedKey, combinedKeyLength, engineHeader, 1);
+			if (result == SUCCESS) {
+				unsigned char prefix[ENGINE_PREFIX_MAX_SIZE];
+				fwrite(prefix, 1, WriteEnginePrefix(prefix, &g_streamFormat, engine, engineHeader), file.output);
+				fwrite(&combinedKeyLength, sizeof(int), 1, file.output);
+				fwrite(&publicKeyHash, sizeof(unsigned int), 1, file.output);
+				result = CommitFileCheckpoint(&file, 0);
+			}
+		}
 	}
 
-	// 读取私钥长度
-	if (fread(&privateKeyLength, sizeof(int), 1, inputFile) != 1) {
-		fclose(inputFile);
-		return 0;
+	if (result == SUCCESS) {
+		result = ResumableTransformData(&file);
 	}
 
-	if (privateKeyLength != PRIVATE_KEY_SIZE_2048_BITS) {
-		fclose(inputFile);
-		return 0;
+	// 写入引擎尾部数据与校验和
+	if (result == SUCCESS) {
+		unsigned char trailer[CIPHER_ENGINE_MAX_TRAILER];
+		unsigned int checksum = CalculateCRC32(combinedKey, combinedKeyLength);
+		if (engine->finalize(file.cipher.context, trailer) != 0
+			|| fwrite(trailer, 1, engine->trailerSize, file.output) != engine->trailerSize
+			|| fwrite(&checksum, sizeof(unsigned int), 1, file.output) != 1 || fflush(file.output) != 0) {
+			result = ERR_ENCRYPTION_FAILED;
+		}
+		else if (progressCallback) {
+			progressCallback(filePath, 1.0);
+		}
 	}
 
-	// 读取私钥
-	privateKey = (unsigned char*)malloc(privateKeyLength);
-	if (!privateKey) {
-		fclose(inputFile);
-		return 0;
+	if (result == ERR_INVALID_HEADER) {
+		// 输出文件头与检查点不符：检查点不可信，下次从头开始
+		DeleteFileA(file.checkpointPath);
 	}
 
-	if (fread(privateKey, 1, privateKeyLength, inputFile) != privateKeyLength) {
-		free(privateKey);
-		fclose(inputFile);
-		return 0;
+	CloseResumableFile(&file, result);
+	SecureKeyFree(combinedKey);
+	CallArenaRelease(&arena);
+	return result;
+}
+
+// 可续做的文件解密（自动识别双密钥/自包含式格式，输出与 DecryptFileAny 相同）
+static int ResumeDecryptFileWithSnapshot(const PrivateKeySnapshot* keySnapshot, const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback) {
+	if (!filePath || !outputPath || !publicKey) {
+		return ERR_INVALID_PARAMETER;
 	}
 
-	// 验证私钥哈希
-	unsigned int storedPrivateKeyHash;
-	if (fread(&storedPrivateKeyHash, sizeof(unsigned int), 1, inputFile) != 1) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		free(privateKey);
-		fclose(inputFile);
-		return 0;
+	unsigned long long inputSize = 0;
+	unsigned long long inputWriteTime = 0;
+	if (!GetFileIdentity(filePath, &inputSize, &inputWriteTime)) {
+		return ERR_FILE_OPEN_FAILED;
 	}
 
-	unsigned int currentPrivateKeyHash = CalculatePrivateKeyHash(privateKey, privateKeyLength);
-	if (storedPrivateKeyHash != currentPrivateKeyHash) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		free(privateKey);
-		fclose(inputFile);
-		return 0;
+	ResumableFile file;
+	memset(&file, 0, sizeof(file));
+	file.filePath = filePath;
+	file.failure = ERR_DECRYPTION_FAILED;
+	file.progressCallback = progressCallback;
+
+	CallArena arena;
+	int result = CallArenaReserveFile(&arena, filePath, &file.bufferSize);
+	if (result != SUCCESS) {
+		return result;
 	}
+	file.buffer = (unsigned char*)CallArenaAlloc(&arena, file.bufferSize);
 
-	// 重新组合密钥
-	int pubKeyLen = strlen((const char*)publicKey);
-	int totalLen = privateKeyLength + pubKeyLen;
-	combinedKey = (unsigned char*)malloc(totalLen + 1);
-	if (!combinedKey) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		free(privateKey);
-		fclose(inputFile);
-		return 0;
+	fopen_s(&file.input, filePath, "rb");
+	if (!file.input) {
+		CallArenaRelease(&arena);
+		return ERR_FILE_OPEN_FAILED;
 	}
+	AttachStdioBuffer(file.input, &arena);
+
+	EncryptedFileLayout layout;
+	unsigned char* combinedKey = NULL;
+	int combinedKeyLength = 0;
+	result = OpenEncryptedFileLayout(file.input, keySnapshot, publicKey, &layout, &combinedKey, &combinedKeyLength);
 
-	for (int i = 0; i < totalLen; i++) {
-		if (i % 2 == 0) {
-			combinedKey[i] = privateKey[i / 2 % privateKeyLength];
+	if (result == SUCCESS) {
+		file.inputOffset = layout.dataOffset;
+		file.dataSize = layout.dataSize;
+
+		FileCheckpoint expected;
+		memset(&expected, 0, sizeof(expected));
+		memcpy(expected.magic, FILE_CHECKPOINT_MAGIC, FILE_CHECKPOINT_MAGIC_SIZE);
+		expected.direction = FILE_CHECKPOINT_DECRYPT;
+		expected.format = layout.format;
+		expected.engineId = layout.engine->id;
+		expected.keyCheck = CalculateCRC32(combinedKey, combinedKeyLength);
+		expected.publicKeyHash = CalculatePublicKeyHash(publicKey);
+		expected.inputSize = inputSize;
+		expected.inputWriteTime = inputWriteTime;
+		expected.headerSize = (unsigned long long)layout.dataOffset;
+
+		if (!AllocateCheckpointPaths(&file, outputPath)) {
+			result = ERR_MEMORY_ALLOCATION_FAILED;
 		}
 		else {
-			combinedKey[i] = publicKey[i / 2 % pubKeyLen];
+			bool resumed = OpenResumableOutput(&file, outputPath, &expected, &arena);
+			if (!file.output) {
+				result = ERR_FILE_OPEN_FAILED;
+			}
+			else {
+				result = CipherStreamAttach(&file.cipher, layout.engine, combinedKey, combinedKeyLength, layout.engineHeader, 0);
+				if (result == SUCCESS && !resumed) {
+					result = CommitFileCheckpoint(&file, 0);
+				}
+			}
 		}
-		combinedKey[i] ^= (unsigned char)(i * 7 + 13);
-	}
-	combinedKey[totalLen] = '\0';
-	combinedKeyLength = totalLen;
-
-	// 验证组合密钥长度
-	if (storedCombinedKeyLength != combinedKeyLength) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		SecureZeroMemory(combinedKey, combinedKeyLength);
-		free(privateKey);
-		free(combinedKey);
-		fclose(inputFile);
-		return 0;
 	}
 
-	// 验证校验和
-	_fseeki64(inputFile, -(__int64)sizeof(unsigned int), SEEK_END);
-	unsigned int storedChecksum;
-	if (fread(&storedChecksum, sizeof(unsigned int), 1, inputFile) == 1) {
-		unsigned int calculatedChecksum = CalculateCRC32(combinedKey, combinedKeyLength);
-		if (storedChecksum == calculatedChecksum) {
-			isValid = true;
+	if (result == SUCCESS) {
+		result = ResumableTransformData(&file);
+
+		// 校验引擎尾部数据（如认证标签）；校验失败说明输入已损坏，续做没有意义，删除输出与检查点
+		if (result == SUCCESS && layout.engine->finalize(file.cipher.context, layout.trailer) != 0) {
+			fclose(file.output);
+			file.output = NULL;
+			remove(outputPath);
+			DeleteFileA(file.checkpointPath);
+			result = ERR_DECRYPTION_FAILED;
+		}
+		else if (result == SUCCESS && progressCallback) {
+			progressCallback(filePath, 1.0);
 		}
 	}
 
-	// 清理资源
-	SecureZeroMemory(privateKey, privateKeyLength);
-	SecureZeroMemory(combinedKey, combinedKeyLength);
-	free(privateKey);
-	free(combinedKey);
-	fclose(inputFile);
+	CloseResumableFile(&file, result);
+	SecureKeyFree(combinedKey);
+	CallArenaRelease(&arena);
+	return result;
+}
 
-	return isValid ? 1 : 0;
+int ResumeEncryptFile(const char* filePath, const char* outputPath, const unsigned char* publicKey, const EncodeOptions* options, ProgressCallback progressCallback) {
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = ResumeEncryptFileWithSnapshot(keySnapshot, filePath, outputPath, publicKey, options, progressCallback);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
+}
+
+int ResumeDecryptFile(const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback) {
+	PrivateKeySnapshot* keySnapshot = AcquireKeySnapshot();
+	int result = ResumeDecryptFileWithSnapshot(keySnapshot, filePath, outputPath, publicKey, progressCallback);
+	ReleaseKeySnapshot(keySnapshot);
+	return result;
 }
 
 // ========== 私钥提取函数实现 ==========
@@ -1792,7 +7697,8 @@ int ValidateSelfContainedFile(const char* filePath, const unsigned char* publicK
 int ExtractPrivateKeyFromFile(const char* filePath, const unsigned char* publicKey, char** extractedPrivateKey) {
 	FILE* inputFile = NULL;
 	unsigned char* privateKey = NULL;
-	char header[SELF_CONTAINED_MAGIC_SIZE + 1];
+	const CipherEngine* engine = NULL;
+	unsigned char engineHeader[CIPHER_ENGINE_MAX_HEADER];
 	int storedCombinedKeyLength = 0;
 	int privateKeyLength = 0;
 
@@ -1810,15 +7716,10 @@ int ExtractPrivateKeyFromFile(const char* filePath, const unsigned char* publicK
 	}
 
 	// 读取并验证文件头
-	if (fread(header, 1, SELF_CONTAINED_MAGIC_SIZE, inputFile) != SELF_CONTAINED_MAGIC_SIZE) {
-		fclose(inputFile);
-		return ERR_INVALID_HEADER;
-	}
-
-	header[SELF_CONTAINED_MAGIC_SIZE] = '\0';
-	if (strcmp(header, SELF_CONTAINED_MAGIC_HEADER) != 0) {
+	int result = ReadEnginePrefix(inputFile, &g_selfContainedFormat, &engine, engineHeader);
+	if (result != SUCCESS) {
 		fclose(inputFile);
-		return ERR_INVALID_HEADER;
+		return result;
 	}
 
 	// 读取组合密钥长度
@@ -1852,14 +7753,14 @@ int ExtractPrivateKeyFromFile(const char* filePath, const unsigned char* publicK
 	}
 
 	// 读取私钥
-	privateKey = (unsigned char*)malloc(privateKeyLength);
+	privateKey = SecureKeyAlloc(privateKeyLength);
 	if (!privateKey) {
 		fclose(inputFile);
 		return ERR_MEMORY_ALLOCATION_FAILED;
 	}
 
 	if (fread(privateKey, 1, privateKeyLength, inputFile) != privateKeyLength) {
-		free(privateKey);
+		SecureKeyFree(privateKey);
 		fclose(inputFile);
 		return ERR_INVALID_HEADER;
 	}
@@ -1867,25 +7768,22 @@ int ExtractPrivateKeyFromFile(const char* filePath, const unsigned char* publicK
 	// 读取并验证私钥哈希值
 	unsigned int storedPrivateKeyHash;
 	if (fread(&storedPrivateKeyHash, sizeof(unsigned int), 1, inputFile) != 1) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		free(privateKey);
+		SecureKeyFree(privateKey);
 		fclose(inputFile);
 		return ERR_INVALID_HEADER;
 	}
 
 	unsigned int currentPrivateKeyHash = CalculatePrivateKeyHash(privateKey, privateKeyLength);
 	if (storedPrivateKeyHash != currentPrivateKeyHash) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		free(privateKey);
+		SecureKeyFree(privateKey);
 		fclose(inputFile);
 		return ERR_DECRYPTION_FAILED; // 私钥被篡改
 	}
 
 	// 提取私钥为十六进制字符串
-	*extractedPrivateKey = (char*)malloc(privateKeyLength * 2 + 1);
+	*extractedPrivateKey = (char*)EncodeAlloc(privateKeyLength * 2 + 1);
 	if (!*extractedPrivateKey) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		free(privateKey);
+		SecureKeyFree(privateKey);
 		fclose(inputFile);
 		return ERR_MEMORY_ALLOCATION_FAILED;
 	}
@@ -1897,8 +7795,7 @@ int ExtractPrivateKeyFromFile(const char* filePath, const unsigned char* publicK
 	(*extractedPrivateKey)[privateKeyLength * 2] = '\0';
 
 	// 清理资源
-	SecureZeroMemory(privateKey, privateKeyLength);
-	free(privateKey);
+	SecureKeyFree(privateKey);
 	fclose(inputFile);
 
 	return SUCCESS;
@@ -1907,7 +7804,9 @@ int ExtractPrivateKeyFromFile(const char* filePath, const unsigned char* publicK
 // 从自包含式加密数据中提取私钥
 int ExtractPrivateKeyFromData(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, char** extractedPrivateKey) {
 	unsigned char* privateKey = NULL;
-	char header[SELF_CONTAINED_MAGIC_SIZE + 1];
+	const CipherEngine* engine = NULL;
+	unsigned char engineHeader[CIPHER_ENGINE_MAX_HEADER];
+	size_t prefixSize = 0;
 	int storedCombinedKeyLength = 0;
 	int privateKeyLength = 0;
 
@@ -1918,21 +7817,19 @@ int ExtractPrivateKeyFromData(const unsigned char* inputData, size_t inputLength
 	// 初始化输出参数
 	*extractedPrivateKey = NULL;
 
+	// 验证文件头
+	int result = ParseEnginePrefix(inputData, inputLength, &g_selfContainedFormat, &engine, engineHeader, &prefixSize);
+	if (result != SUCCESS) {
+		return result;
+	}
+
 	// 检查最小长度
-	size_t minSize = SELF_CONTAINED_MAGIC_SIZE + sizeof(int) + sizeof(unsigned int) + sizeof(int) + PRIVATE_KEY_SIZE_2048_BITS + sizeof(unsigned int);
+	size_t minSize = prefixSize + sizeof(int) + sizeof(unsigned int) + sizeof(int) + PRIVATE_KEY_SIZE_2048_BITS + sizeof(unsigned int);
 	if (inputLength < minSize) {
 		return ERR_INVALID_HEADER;
 	}
 
-	const unsigned char* inPtr = inputData;
-
-	// 验证文件头
-	memcpy(header, inPtr, SELF_CONTAINED_MAGIC_SIZE);
-	header[SELF_CONTAINED_MAGIC_SIZE] = '\0';
-	if (strcmp(header, SELF_CONTAINED_MAGIC_HEADER) != 0) {
-		return ERR_INVALID_HEADER;
-	}
-	inPtr += SELF_CONTAINED_MAGIC_SIZE;
+	const unsigned char* inPtr = inputData + prefixSize;
 
 	// 读取组合密钥长度
 	memcpy(&storedCombinedKeyLength, inPtr, sizeof(int));
@@ -1957,7 +7854,7 @@ int ExtractPrivateKeyFromData(const unsigned char* inputData, size_t inputLength
 	}
 
 	// 读取私钥
-	privateKey = (unsigned char*)malloc(privateKeyLength);
+	privateKey = SecureKeyAlloc(privateKeyLength);
 	if (!privateKey) {
 		return ERR_MEMORY_ALLOCATION_FAILED;
 	}
@@ -1972,16 +7869,14 @@ int ExtractPrivateKeyFromData(const unsigned char* inputData, size_t inputLength
 
 	unsigned int currentPrivateKeyHash = CalculatePrivateKeyHash(privateKey, privateKeyLength);
 	if (storedPrivateKeyHash != currentPrivateKeyHash) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		free(privateKey);
+		SecureKeyFree(privateKey);
 		return ERR_DECRYPTION_FAILED;
 	}
 
 	// 提取私钥为十六进制字符串
-	*extractedPrivateKey = (char*)malloc(privateKeyLength * 2 + 1);
+	*extractedPrivateKey = (char*)EncodeAlloc(privateKeyLength * 2 + 1);
 	if (!*extractedPrivateKey) {
-		SecureZeroMemory(privateKey, privateKeyLength);
-		free(privateKey);
+		SecureKeyFree(privateKey);
 		return ERR_MEMORY_ALLOCATION_FAILED;
 	}
 
@@ -1992,8 +7887,7 @@ int ExtractPrivateKeyFromData(const unsigned char* inputData, size_t inputLength
 	(*extractedPrivateKey)[privateKeyLength * 2] = '\0';
 
 	// 清理资源
-	SecureZeroMemory(privateKey, privateKeyLength);
-	free(privateKey);
+	SecureKeyFree(privateKey);
 
 	return SUCCESS;
 }
@@ -13,6 +13,160 @@
 // progress: 0.0 到 1.0 的进度值（1.0 表示 100% 完成）
 typedef void (*ProgressCallback)(const char* filePath, double progress);
 
+// 分散/聚集缓冲区段（EncryptDataV / DecryptDataV 使用）
+// data: 段起始地址（length 为0时可为空）
+// length: 段长度
+typedef struct EncodeBufferSegment {
+	unsigned char* data;
+	size_t length;
+} EncodeBufferSegment;
+
+// 内存分配器回调（SetEncodeAllocator 使用）
+// size: 需要分配的字节数；memory: 需要释放的内存；user: 设置分配器时传入的用户数据
+typedef void* (*EncodeAllocFunc)(size_t size, void* user);
+typedef void (*EncodeFreeFunc)(void* memory, void* user);
+
+// 增量流式加解密上下文（不透明类型，由 EncryptBegin / DecryptBegin 创建，FreeStreamContext 释放）
+typedef struct EncodeStreamContext EncodeStreamContext;
+
+// 已打开的加密文件句柄（不透明类型，由 OpenEncryptedFile 创建，CloseEncryptedFile 关闭）
+typedef struct EncryptedFileHandle EncryptedFileHandle;
+
+// 异步操作（不透明类型，由 *Async 函数创建，CloseOperation 释放）
+typedef struct EncodeOperation EncodeOperation;
+
+// 异步操作完成回调（在库的工作线程上调用）
+// result: 与对应同步函数相同的返回值，取消时为 ERR_OPERATION_CANCELLED(-12)
+typedef void (*CompletionCallback)(EncodeOperation* operation, int result, void* userData);
+
+// 进度对象（不透明类型，由 CreateProgress 创建，DestroyProgress 释放）
+typedef struct EncodeProgress EncodeProgress;
+
+// 进度阶段
+#define ENCODE_PHASE_IDLE 0                // 尚未开始
+#define ENCODE_PHASE_RUNNING 1             // 正在处理
+#define ENCODE_PHASE_COMPLETED 2           // 成功完成
+#define ENCODE_PHASE_FAILED 3              // 失败（result 为错误码）
+#define ENCODE_PHASE_CANCELLED 4           // 已取消
+
+// 进度快照（QueryProgress 与进度回调使用）
+// cbSize: 调用 QueryProgress 前设置为 sizeof(EncodeProgressInfo)
+// bytesDone/bytesTotal: 已处理/总共需要处理的数据字节数；bytesPerSecond: 从开始到现在的平均速率
+typedef struct EncodeProgressInfo {
+	unsigned int cbSize;
+	int phase;
+	int result;
+	unsigned long long bytesDone;
+	unsigned long long bytesTotal;
+	double fraction;
+	double bytesPerSecond;
+} EncodeProgressInfo;
+
+// 限流的进度回调（在执行操作的线程上调用）
+typedef void (*EncodeProgressCallback)(const EncodeProgressInfo* info, void* userData);
+
+// CreateProgress 选项（为空时只能轮询）
+// minIntervalMilliseconds: 两次回调之间的最小间隔；minStep: 两次回调之间的最小进度增量（0.01 表示1%）
+// 两个条件同时满足时才回调；进入运行阶段与结束阶段时不受限制，各回调一次
+typedef struct EncodeProgressOptions {
+	unsigned int cbSize;
+	EncodeProgressCallback callback;
+	void* userData;
+	unsigned int minIntervalMilliseconds;
+	double minStep;
+} EncodeProgressOptions;
+
+// 解密结果缓存中的明文（不透明类型，引用计数，由 AcquireDecryptedBlob 取得，ReleaseDecryptedBlob 释放）
+typedef struct DecryptedBlob DecryptedBlob;
+
+// 带明文页缓存的加密文件读取器（不透明类型，由 OpenEncryptedFileReader 创建，CloseEncryptedFileReader 关闭）
+typedef struct EncryptedFileReader EncryptedFileReader;
+
+// 加密引擎标识（写入加密文件头，解密时自动识别）
+#define ENCODE_ENGINE_XOR_NIBBLE 0         // 双层XOR + 半字节交换（默认，文件格式与早期版本相同）
+#define ENCODE_ENGINE_AES_256_GCM 1        // AES-256-GCM（带认证标签，CPU支持时使用 AES-NI）
+// AES-256-GCM 首次使用时运行一次已知答案自检（NIST 测试向量，可移植实现与 AES-NI 实现都验证），未通过时视为不可用。
+// 单个文件/数据的明文上限为 2^36-32 字节（约64GB，NIST SP 800-38D），超过时加密函数在写出任何数据前返回 ERR_INVALID_PARAMETER。
+// 注意：没有 AES-NI + PCLMULQDQ 的CPU上使用的可移植实现按密钥相关的下标查表（S盒），不是常数时间的，
+// 与攻击者共享CPU缓存的环境中可能通过缓存计时泄露密钥；这类环境请确认 CPU 支持 AES-NI
+
+// 加密数据格式（DecryptFileAny / DecryptDataAny / ValidateAny 按魔数头识别后返回）
+#define ENCODE_FORMAT_UNKNOWN 0            // 无法识别的魔数头
+#define ENCODE_FORMAT_STREAM 1             // 双密钥格式（ENCV1.x，需要预先设置私钥）
+#define ENCODE_FORMAT_SELF_CONTAINED 2     // 自包含式格式（SELFV1.x，私钥内嵌在文件头中）
+
+// 加密选项（*Ex 函数使用，为空时等同于默认选项）
+// cbSize: 调用者设置为 sizeof(EncodeOptions)，以便今后扩展字段
+// engineId: 加密引擎标识
+typedef struct EncodeOptions {
+	unsigned int cbSize;
+	int engineId;
+} EncodeOptions;
+
+// DecryptFileToMemory 选项
+// flags: DECRYPT_MEMORY_PAGE_ALIGNED 表示明文缓冲区按页对齐（VirtualAlloc 分配，使用 FreeDecryptedPages 释放）
+// allocFunc/freeFunc/allocUser: allocFunc 非空时用调用者分配器分配明文缓冲区，由调用者释放；
+//                               freeFunc 必须同时提供，解密失败时用于释放缓冲区
+#define DECRYPT_MEMORY_PAGE_ALIGNED 0x1
+
+typedef struct DecryptMemoryOptions {
+	unsigned int cbSize;
+	unsigned int flags;
+	EncodeAllocFunc allocFunc;
+	EncodeFreeFunc freeFunc;
+	void* allocUser;
+} DecryptMemoryOptions;
+
+// EncryptDirectory / DecryptDirectory 选项（为空时使用默认值）
+// engineId: 加密引擎标识（仅加密时使用；解密按每个文件的魔数头识别格式与引擎）
+// selfContained: 非0表示加密为自包含式格式（无需预设私钥），否则为双密钥格式
+// workerCount: 同时处理的文件数（0表示处理器数量 × 2，上限64）
+// manifestPath: 清单文件路径（为空时为输出根目录下的 .encode_manifest）
+typedef struct EncodeDirectoryOptions {
+	unsigned int cbSize;
+	int engineId;
+	int selfContained;
+	unsigned int workerCount;
+	const char* manifestPath;
+} EncodeDirectoryOptions;
+
+// EncryptDirectory / DecryptDirectory 统计
+// filesSkipped: 清单中已记录为完成而跳过的文件数；bytesProcessed: 本次处理成功的输入文件字节数
+typedef struct EncodeDirectoryStats {
+	unsigned int cbSize;
+	unsigned long long filesTotal;
+	unsigned long long filesCompleted;
+	unsigned long long filesSkipped;
+	unsigned long long filesFailed;
+	unsigned long long bytesProcessed;
+} EncodeDirectoryStats;
+
+// OpenEncryptedFileReader 选项（为空时使用默认值）
+// pageSize: 缓存页大小，2的幂，4KB-16MB（0表示默认64KB）
+// cacheSize: 明文页缓存上限字节数（0表示默认16MB，至少缓存一页）
+#define ENCRYPTED_READER_DEFAULT_PAGE_SIZE (64 * 1024)
+#define ENCRYPTED_READER_DEFAULT_CACHE_SIZE (16 * 1024 * 1024)
+
+typedef struct EncryptedReaderOptions {
+	unsigned int cbSize;
+	unsigned int pageSize;
+	size_t cacheSize;
+} EncryptedReaderOptions;
+
+// GetEncryptedFileReaderStats 输出
+// cacheHits/cacheMisses: 按页统计的缓存命中/未命中次数；cachedPages: 当前缓存的页数
+typedef struct EncryptedReaderStats {
+	unsigned int cbSize;
+	unsigned long long plaintextLength;
+	unsigned long long cacheHits;
+	unsigned long long cacheMisses;
+	size_t cachedPages;
+} EncryptedReaderStats;
+
+// EncryptBegin 输出的文件头大小与 EncryptFinal 输出的校验和大小（字节）
+#define ENCODE_STREAM_HEADER_SIZE 15
+#define ENCODE_STREAM_TRAILER_SIZE 4
+
 extern "C" {
 
 	/// @brief 使用私钥初始化加密系统
@@ -27,6 +181,32 @@ extern "C" {
 	/// @return 1表示已设置，0表示未设置
 	PDUDLL_API int IsPrivateKeySet();
 
+	/// @brief 设置本库所有堆内存（缓冲区、输出数据、上下文等）使用的分配器
+	/// @param allocFunc 分配函数，freeFunc 释放函数；两者都为空时恢复默认的 malloc/free
+	/// @param user 原样传给回调的用户数据
+	/// @return 0表示成功，负数表示错误码
+	/// @note 替换前分配的内存仍由原分配器释放，因此原分配器需要在进程内保持可用；
+	///       通常在初始化时调用一次
+	PDUDLL_API int SetEncodeAllocator(EncodeAllocFunc allocFunc, EncodeFreeFunc freeFunc, void* user);
+
+	/// @brief 设置全库内存预算
+	/// @param budgetBytes 预算上限（字节），0表示不限制（默认）
+	/// @param waitMilliseconds 预算不足时的最长等待时间，0表示立即返回，0xFFFFFFFF表示一直等待
+	/// @return 0表示成功
+	/// @note 文件操作的流式缓冲区和 *Data 函数的输出数据从预算中申请。预算紧张时先释放闲置的缓存缓冲区，
+	///       文件操作再逐级改用较小的缓冲区，仍不足时等待其它操作释放内存，超时返回 ERR_MEMORY_BUDGET_EXCEEDED(-10)。
+	///       单次申请超过预算上限时不等待，立即返回 ERR_MEMORY_BUDGET_EXCEEDED(-10)。
+	///       内部小块结构计入 GetMemoryUsage 的用量，但不占用预算
+	PDUDLL_API int SetMemoryBudget(size_t budgetBytes, unsigned int waitMilliseconds);
+
+	/// @brief 查询本库当前堆内存用量、峰值用量和预算上限（参数可为空）
+	PDUDLL_API void GetMemoryUsage(size_t* currentBytes, size_t* peakBytes, size_t* budgetBytes);
+
+	/// @brief 立即释放所有线程缓存的闲置流式缓冲区
+	/// @note 文件加解密函数按文件大小选择缓冲区并按线程缓存复用，闲置超过30秒的缓冲区会在之后的调用中自动释放；
+	///       进程进入长时间空闲前可调用此函数主动归还内存
+	PDUDLL_API void TrimStreamBufferCache();
+
 	// 流式加密文件函数（双密钥系统：需要预先设置私钥，此处传入公钥）
 	// filePath: 输入文件路径
 	// outputPath: 输出文件路径
@@ -34,6 +214,13 @@ extern "C" {
 	// progressCallback: 进度回调函数（可为空）
 	PDUDLL_API int StreamEncryptFile(const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback = nullptr);
 
+	/// @brief 流式加密文件（指定加密引擎），其余参数与 StreamEncryptFile 相同
+	/// @param options 加密选项（可为空）
+	/// @return 0表示成功，ERR_UNSUPPORTED_ENGINE(-11)表示引擎不可用
+	/// @note 引擎0输出与 StreamEncryptFile 相同的 ENCV1.0 格式；其它引擎输出 ENCV1.1 格式，
+	///       文件头中记录引擎标识，StreamDecryptFile 等解密函数自动识别
+	PDUDLL_API int StreamEncryptFileEx(const char* filePath, const char* outputPath, const unsigned char* publicKey, const EncodeOptions* options, ProgressCallback progressCallback = nullptr);
+
 	// 流式解密文件函数（双密钥系统：需要预先设置私钥，此处传入公钥）
 	// filePath: 输入文件路径
 	// outputPath: 输出文件路径
@@ -41,6 +228,30 @@ extern "C" {
 	// progressCallback: 进度回调函数（可为空）
 	PDUDLL_API int StreamDecryptFile(const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback = nullptr);
 
+	/// @brief 公钥轮换：把旧公钥加密的文件单遍换成新公钥加密，不产生明文文件
+	/// @param filePath 旧公钥加密的文件，outputPath 输出文件路径（不能与 filePath 相同）
+	/// @param oldPublicKey 旧公钥，newPublicKey 新公钥（与预设私钥组合使用）
+	/// @return 0表示成功，负数表示错误码；失败时删除输出文件
+	/// @note 输出文件沿用原文件的加密引擎；每块数据读入后在内存中完成换钥再写出，
+	///       引擎0的旧密钥还原与新密钥变换在同一向量运算中完成
+	PDUDLL_API int RekeyFile(const char* filePath, const char* outputPath, const unsigned char* oldPublicKey, const unsigned char* newPublicKey, ProgressCallback progressCallback = nullptr);
+
+	/// @brief 原地公钥轮换，参数与 RekeyFile 相同
+	/// @note 文件大小不变，数据区逐块覆盖，文件头最后写入；带认证标签的引擎先只读校验一遍再覆盖。
+	///       覆盖过程中中断（断电、磁盘错误）会使文件无法恢复，重要数据请先备份或使用 RekeyFile
+	PDUDLL_API int RekeyFileInPlace(const char* filePath, const unsigned char* oldPublicKey, const unsigned char* newPublicKey, ProgressCallback progressCallback = nullptr);
+
+	/// @brief 广播加密：同一输入文件按多个公钥分别加密，输入只读取一遍
+	/// @param outputPaths/publicKeys 各接收方的输出文件路径与公钥（count 项，最多4096项，路径互不相同）
+	/// @param options 加密选项（可为空，为空时使用引擎0）
+	/// @param results 可为空；不为空时返回每个接收方的结果，整体失败（参数无效、无法打开输入文件等）时每一项都为返回的错误码
+	/// @return 全部成功返回0，否则返回第一个失败的接收方的错误码；失败的接收方的输出文件被删除，其余接收方不受影响
+	///         接收方状态（每个接收方约68KB）与输入缓冲区之和超过内存预算时立即返回 ERR_MEMORY_BUDGET_EXCEEDED(-10)；
+	///         某个接收方的输出文件写入不完整（磁盘已满等）时该接收方的结果为 ERR_FILE_WRITE_FAILED(-14)
+	/// @note 每个输出文件与 StreamEncryptFileEx 的输出格式相同；输入块由调用线程和线程池线程共享读取，
+	///       按接收方并行加密写出
+	PDUDLL_API int EncryptFileMulti(const char* filePath, const char* const* outputPaths, const unsigned char* const* publicKeys, size_t count, const EncodeOptions* options, int* results, ProgressCallback progressCallback = nullptr);
+
 	// 验证加密文件有效性（双密钥系统）
 	// filePath: 加密文件路径
 	// publicKey: 公钥（与预设私钥组合验证）
@@ -57,6 +268,10 @@ extern "C" {
 	// 注意: 调用者需要使用 FreeEncryptedData 释放 outputData 内存
 	PDUDLL_API int StreamEncryptData(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char** outputData, size_t* outputLength);
 
+	/// @brief 字节数组加密（指定加密引擎），其余参数与 StreamEncryptData 相同
+	/// @note 调用者需要使用 FreeEncryptedData 释放 outputData 内存
+	PDUDLL_API int StreamEncryptDataEx(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, const EncodeOptions* options, unsigned char** outputData, size_t* outputLength);
+
 	// 新增：字节数组解密函数（双密钥系统：需要预先设置私钥，此处传入公钥）
 	// inputData: 输入加密数据指针
 	// inputLength: 输入数据长度
@@ -75,12 +290,114 @@ extern "C" {
 	// data: 由 StreamDecryptData 分配的内存指针
 	PDUDLL_API void FreeDecryptedData(unsigned char* data);
 
+	/// @brief 检查加密引擎是否可用（首次查询时运行该引擎的自检）
+	/// @return 1表示可用，0表示未注册或自检未通过
+	PDUDLL_API int IsCipherEngineAvailable(int engineId);
+
 	// 新增：计算CRC32校验和（内部函数，用于更强的校验）
 	PDUDLL_API unsigned int CalculateCRC32(const unsigned char* data, size_t length);
 
 	// 新增：计算公钥哈希值（内部函数，用于公钥完整性验证）
 	PDUDLL_API unsigned int CalculatePublicKeyHash(const unsigned char* publicKey);
 
+	// ========== 分散/聚集加解密（双密钥系统） ==========
+
+	// 将多个不连续的输入段作为一个逻辑数据流加密/解密，输出按顺序写满各输出段。
+	// 密钥流位置跨段连续，结果与先拼接再调用 StreamEncryptData / StreamDecryptData 完全一致。
+	// inputSegments/inputCount: 输入段数组（解密时文件头和校验和可以跨段）
+	// outputSegments/outputCount: 输出段数组，总容量不足时返回 ERR_BUFFER_TOO_SMALL(-9)
+	// outputLength: 实际写入的总字节数
+	// 注意: 输入段与输出段不能重叠
+	PDUDLL_API int EncryptDataV(const EncodeBufferSegment* inputSegments, size_t inputCount, const unsigned char* publicKey, const EncodeBufferSegment* outputSegments, size_t outputCount, size_t* outputLength);
+
+	PDUDLL_API int DecryptDataV(const EncodeBufferSegment* inputSegments, size_t inputCount, const unsigned char* publicKey, const EncodeBufferSegment* outputSegments, size_t outputCount, size_t* outputLength);
+
+	// ========== 增量流式加解密（双密钥系统，数据分片到达时无需整体缓存） ==========
+
+	// 依次输出 EncryptBegin 的文件头、每次 EncryptUpdate 的输出、EncryptFinal 的校验和，
+	// 拼接结果与对完整数据调用 StreamEncryptData 完全一致。
+	// 上下文在 Begin 时绑定当前全局私钥，每个数据流的内存开销固定，与数据量无关。
+	// 上下文不是线程安全的，同一数据流的调用需由调用者串行化。
+
+	/// @brief 开始加密数据流
+	/// @param context 输出新建的上下文
+	/// @param header 输出文件头（至少 ENCODE_STREAM_HEADER_SIZE 字节）
+	/// @return 0表示成功，负数表示错误码
+	PDUDLL_API int EncryptBegin(const unsigned char* publicKey, EncodeStreamContext** context, unsigned char* header, size_t headerCapacity, size_t* headerLength);
+
+	/// @brief 加密一个数据片段，output 至少 inputLength 字节（可以等于 input）
+	PDUDLL_API int EncryptUpdate(EncodeStreamContext* context, const unsigned char* input, size_t inputLength, unsigned char* output, size_t* outputLength);
+
+	/// @brief 结束加密数据流
+	/// @param trailer 输出校验和（至少 ENCODE_STREAM_TRAILER_SIZE 字节）
+	PDUDLL_API int EncryptFinal(EncodeStreamContext* context, unsigned char* trailer, size_t trailerCapacity, size_t* trailerLength);
+
+	/// @brief 开始解密数据流
+	PDUDLL_API int DecryptBegin(const unsigned char* publicKey, EncodeStreamContext** context);
+
+	/// @brief 解密一个加密数据片段（包括文件头和校验和，可以任意切分）
+	/// @param output 至少 inputLength 字节，不能与 input 重叠
+	/// @param outputLength 本次输出的明文字节数（末尾可能是校验和的字节会暂缓到下次调用）
+	/// @return 0表示成功；文件头错误或公钥不匹配时返回错误码，之后的调用返回相同错误码
+	PDUDLL_API int DecryptUpdate(EncodeStreamContext* context, const unsigned char* input, size_t inputLength, unsigned char* output, size_t* outputLength);
+
+	/// @brief 结束解密数据流并验证校验和
+	/// @return 0表示成功，ERR_DECRYPTION_FAILED(-4)表示校验失败，ERR_INVALID_HEADER(-5)表示数据被截断
+	PDUDLL_API int DecryptFinal(EncodeStreamContext* context);
+
+	/// @brief 释放流式上下文（成功、失败或中途放弃后都需要调用）
+	PDUDLL_API void FreeStreamContext(EncodeStreamContext* context);
+
+	// ========== 批量加解密（双密钥系统，大量小消息一次调用） ==========
+
+	// 一批消息共用一次私钥读取、密钥组合和跨语言调用，结果连续写入调用者提供的输出区。
+	// inputs/count: 消息数组
+	// outputArena/arenaCapacity: 输出区；容量不足（或 outputArena 为空）时返回 ERR_BUFFER_TOO_SMALL(-9)，
+	//                            arenaLength 给出所需大小
+	// offsets: 偏移表（count + 1 个元素），第 i 条结果位于 [offsets[i], offsets[i + 1])
+	// arenaLength: 实际写入的总字节数
+
+	/// @brief 批量加密，每条消息的结果与单独调用 StreamEncryptData 完全一致
+	PDUDLL_API int EncryptDataBatch(const EncodeBufferSegment* inputs, size_t count, const unsigned char* publicKey, unsigned char* outputArena, size_t arenaCapacity, size_t* offsets, size_t* arenaLength);
+
+	/// @brief 批量解密
+	/// @param results 每条消息的结果码（count 个元素），失败的消息在输出区中长度为0
+	/// @return 0表示全部成功，ERR_DECRYPTION_FAILED(-4)表示至少一条失败（其余消息仍已解密）
+	PDUDLL_API int DecryptDataBatch(const EncodeBufferSegment* inputs, size_t count, const unsigned char* publicKey, unsigned char* outputArena, size_t arenaCapacity, size_t* offsets, int* results, size_t* arenaLength);
+
+	// ========== 多租户私钥注册表（按标识管理多个私钥，可跨租户并发使用） ==========
+
+	/// @brief 注册（或替换）指定标识的私钥
+	/// @param keyId 私钥标识（非空字符串，最长256字节）
+	/// @param privateKey 私钥字符串（支持任意长度）
+	/// @return 0表示成功，负数表示错误码
+	/// @note 替换已存在的私钥不会影响正在使用旧私钥的调用
+	PDUDLL_API int RegisterPrivateKey(const char* keyId, const char* privateKey);
+
+	/// @brief 注销指定标识的私钥，释放内存
+	/// @return 0表示成功，ERR_PRIVATE_KEY_NOT_SET(-8)表示标识未注册
+	PDUDLL_API int UnregisterPrivateKey(const char* keyId);
+
+	/// @brief 检查指定标识的私钥是否已注册
+	/// @return 1表示已注册，0表示未注册
+	PDUDLL_API int IsPrivateKeyRegistered(const char* keyId);
+
+	// 以下函数与对应的无 WithKey 版本行为和文件格式完全一致，
+	// 区别仅在于使用 keyId 指定的已注册私钥，而不是 InitStreamFile 设置的全局私钥。
+	// keyId 未注册时返回 ERR_PRIVATE_KEY_NOT_SET（验证函数返回0）
+
+	PDUDLL_API int StreamEncryptFileWithKey(const char* keyId, const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback = nullptr);
+
+	PDUDLL_API int StreamDecryptFileWithKey(const char* keyId, const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback = nullptr);
+
+	PDUDLL_API int ValidateEncryptedFileWithKey(const char* keyId, const char* filePath, const unsigned char* publicKey);
+
+	// 注意: 调用者需要使用 FreeEncryptedData 释放 outputData 内存
+	PDUDLL_API int StreamEncryptDataWithKey(const char* keyId, const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char** outputData, size_t* outputLength);
+
+	// 注意: 调用者需要使用 FreeDecryptedData 释放 outputData 内存
+	PDUDLL_API int StreamDecryptDataWithKey(const char* keyId, const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char** outputData, size_t* outputLength);
+
 	// ========== 自包含式加密/解密函数（无需预设私钥） ==========
 	
 	// 自包含式文件加密函数（自动生成2048位私钥）
@@ -92,6 +409,10 @@ extern "C" {
 	// 注意: 此函数会自动生成2048位私钥并存储在加密文件中
 	PDUDLL_API int SelfContainedEncryptFile(const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback = nullptr);
 
+	/// @brief 自包含式文件加密（指定加密引擎），其余参数与 SelfContainedEncryptFile 相同
+	/// @note 引擎0输出 SELFV1.0 格式，其它引擎输出带引擎标识的 SELFV1.1 格式
+	PDUDLL_API int SelfContainedEncryptFileEx(const char* filePath, const char* outputPath, const unsigned char* publicKey, const EncodeOptions* options, ProgressCallback progressCallback = nullptr);
+
 	// 自包含式文件解密函数（从文件中读取私钥）
 	// filePath: 输入加密文件路径
 	// outputPath: 输出文件路径
@@ -111,6 +432,10 @@ extern "C" {
 	// 注意: 调用者需要使用 FreeEncryptedData 释放 outputData 内存
 	PDUDLL_API int SelfContainedEncryptData(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char** outputData, size_t* outputLength);
 
+	/// @brief 自包含式数据加密（指定加密引擎），其余参数与 SelfContainedEncryptData 相同
+	/// @note 调用者需要使用 FreeEncryptedData 释放 outputData 内存
+	PDUDLL_API int SelfContainedEncryptDataEx(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, const EncodeOptions* options, unsigned char** outputData, size_t* outputLength);
+
 	// 自包含式数据解密函数（从数据中读取私钥）
 	// inputData: 输入加密数据指针
 	// inputLength: 输入数据长度
@@ -127,6 +452,243 @@ extern "C" {
 	// 返回值: 1表示有效，0表示无效
 	PDUDLL_API int ValidateSelfContainedFile(const char* filePath, const unsigned char* publicKey);
 
+	// ========== 加密文件解密到内存 ==========
+
+	/// @brief 把整个加密文件解密到一次分配的内存中，不产生临时文件（自动识别双密钥/自包含式格式）
+	/// @param options 明文缓冲区分配选项（可为空，为空时使用本库分配器）
+	/// @param outputData 输出明文缓冲区，outputLength 输出明文大小
+	/// @return 0表示成功，负数表示错误码；双密钥格式需要预先设置私钥
+	/// @note 按文件头计算明文大小后只分配一次，数据区直接读入该缓冲区并就地解密；解密失败时缓冲区被擦除并释放。
+	///       options 为空时使用 FreeDecryptedData 释放，DECRYPT_MEMORY_PAGE_ALIGNED 时使用 FreeDecryptedPages 释放。
+	///       本库分配的明文缓冲区（包括页对齐方式）计入内存预算，明文大于预算上限时立即返回 ERR_MEMORY_BUDGET_EXCEEDED(-10)；
+	///       调用者分配器分配的缓冲区不计入预算
+	PDUDLL_API int DecryptFileToMemory(const char* filePath, const unsigned char* publicKey, const DecryptMemoryOptions* options, unsigned char** outputData, size_t* outputLength);
+
+	/// @brief 释放 DECRYPT_MEMORY_PAGE_ALIGNED 方式分配的明文缓冲区
+	/// @param length DecryptFileToMemory 返回的明文大小
+	PDUDLL_API void FreeDecryptedPages(unsigned char* data, size_t length);
+
+	// ========== 加密文件句柄（一次校验，多次解密） ==========
+
+	/// @brief 打开加密文件：识别格式、校验文件头与校验和并组合密钥，结果缓存在句柄中（自动识别双密钥/自包含式格式）
+	/// @param handle 输出文件句柄，使用完毕后调用 CloseEncryptedFile
+	/// @return 0表示成功，负数表示错误码；双密钥格式需要预先设置私钥（之后更换全局私钥不影响已打开的句柄）
+	/// @note 句柄在关闭前保持文件打开；同一句柄可以从多个线程同时调用下面的函数
+	PDUDLL_API int OpenEncryptedFile(const char* filePath, const unsigned char* publicKey, EncryptedFileHandle** handle);
+
+	/// @brief 取得已打开加密文件的明文大小与加密引擎标识
+	/// @param plaintextLength 输出明文大小（可为空）
+	/// @param engineId 输出加密引擎标识（可为空）
+	PDUDLL_API int GetEncryptedFileInfo(EncryptedFileHandle* handle, unsigned long long* plaintextLength, int* engineId);
+
+	/// @brief 把整个加密文件解密到输出文件，不再重复解析文件头
+	/// @return 0表示成功，负数表示错误码；解密失败时删除输出文件
+	PDUDLL_API int EncryptedFileDecrypt(EncryptedFileHandle* handle, const char* outputPath, ProgressCallback progressCallback = nullptr);
+
+	/// @brief 解密明文偏移 offset 处的 length 字节到调用者缓冲区，只读取对应的密文
+	/// @param bytesRead 输出实际解密的字节数（超出明文末尾的部分不计入，offset 等于明文大小时为0）
+	/// @return 0表示成功，ERR_INVALID_PARAMETER(-7)表示 offset 超出明文大小
+	/// @note 带认证标签的引擎在句柄上第一次随机读取时先完整校验一遍认证标签，校验失败时返回 ERR_DECRYPTION_FAILED(-4)，
+	///       之后的随机读取不再校验（EncryptedFileDecrypt 成功后同样视为已校验）
+	PDUDLL_API int EncryptedFileDecryptRange(EncryptedFileHandle* handle, unsigned long long offset, unsigned char* output, size_t length, size_t* bytesRead);
+
+	/// @brief 关闭加密文件句柄，擦除缓存的组合密钥（handle 可为空）
+	PDUDLL_API void CloseEncryptedFile(EncryptedFileHandle* handle);
+
+	// ========== 自动识别格式的解密入口 ==========
+
+	/// @brief 解密双密钥格式或自包含式格式的加密文件，按魔数头识别格式
+	/// @param format 输出识别出的格式 ENCODE_FORMAT_*（可为空；识别出格式后即使解密失败也有效）
+	/// @return 0表示成功，负数表示错误码；ERR_INVALID_HEADER(-5)表示两种格式都不是，双密钥格式需要预先设置私钥
+	/// @note 输入文件只打开一次，识别格式后在同一个文件句柄上校验与解密；解密失败时删除输出文件
+	PDUDLL_API int DecryptFileAny(const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback = nullptr, int* format = nullptr);
+
+	/// @brief 解密双密钥格式或自包含式格式的字节数组，按魔数头识别格式
+	/// @param format 输出识别出的格式 ENCODE_FORMAT_*（可为空）
+	/// @return 0表示成功，负数表示错误码
+	/// @note 调用者需要使用 FreeDecryptedData 释放 outputData 内存
+	PDUDLL_API int DecryptDataAny(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char** outputData, size_t* outputLength, int* format = nullptr);
+
+	/// @brief 验证双密钥格式或自包含式格式的加密文件，按魔数头识别格式
+	/// @param format 输出识别出的格式 ENCODE_FORMAT_*（可为空）
+	/// @return 1表示有效，0表示无效（与 ValidateEncryptedFile / ValidateSelfContainedFile 的校验内容相同）
+	PDUDLL_API int ValidateAny(const char* filePath, const unsigned char* publicKey, int* format = nullptr);
+
+	// ========== 按需解密读取器（明文页 LRU 缓存） ==========
+
+	/// @brief 打开加密文件读取器：只解密被读取到的页，解密后的明文页保存在容量固定的 LRU 缓存中
+	/// @param options 页大小与缓存容量（可为空）
+	/// @param reader 输出读取器，使用完毕后调用 CloseEncryptedFileReader
+	/// @return 0表示成功，负数表示错误码（与 OpenEncryptedFile 相同）；页缓存计入内存预算
+	/// @note 设置了内存预算时，缓存容量不超过预算减去一个最小流式缓冲区（第一次读取校验认证标签时使用）；
+	///       预算连一页缓存都放不下时返回 ERR_MEMORY_BUDGET_EXCEEDED(-10)
+	PDUDLL_API int OpenEncryptedFileReader(const char* filePath, const unsigned char* publicKey, const EncryptedReaderOptions* options, EncryptedFileReader** reader);
+
+	/// @brief 类似 pread：读取明文偏移 offset 处的 length 字节，未缓存的页按需读取密文并解密
+	/// @param bytesRead 输出实际读取的字节数（到达明文末尾时小于 length，offset 不小于明文大小时为0）
+	/// @return 0表示成功，负数表示错误码
+	/// @note 可以从多个线程同时调用（读取在读取器内部串行执行）；带认证标签的引擎在第一次读取时先完整校验认证标签
+	PDUDLL_API int ReadEncryptedFileAt(EncryptedFileReader* reader, unsigned long long offset, void* buffer, size_t length, size_t* bytesRead);
+
+	/// @brief 取得读取器的明文大小与缓存统计
+	/// @param stats 输出统计，调用者设置 stats->cbSize = sizeof(EncryptedReaderStats)
+	PDUDLL_API int GetEncryptedFileReaderStats(EncryptedFileReader* reader, EncryptedReaderStats* stats);
+
+	/// @brief 关闭读取器，擦除缓存的明文页和组合密钥（reader 可为空）
+	PDUDLL_API void CloseEncryptedFileReader(EncryptedFileReader* reader);
+
+	// ========== 可轮询进度对象 ==========
+
+	/// @brief 创建进度对象（options 可为空）
+	/// @note 文件加解密（StreamEncryptFile/StreamDecryptFile/SelfContainedEncryptFile/SelfContainedDecryptFile 及其 Ex/Async 版本）
+	///       每处理一块只更新进度对象中的原子计数器，回调按选项限流，与原有的 ProgressCallback 互不影响
+	PDUDLL_API int CreateProgress(const EncodeProgressOptions* options, EncodeProgress** progress);
+
+	/// @brief 读取进度快照（可以从任何线程随时调用）
+	/// @param info 调用者设置 info->cbSize = sizeof(EncodeProgressInfo)
+	/// @note 同步调用在打开文件、检查文件头阶段失败时不更新进度对象（以返回值为准）；异步操作总会进入结束阶段
+	PDUDLL_API int QueryProgress(EncodeProgress* progress, EncodeProgressInfo* info);
+
+	/// @brief 释放进度对象（仍在使用它的异步操作完成后才真正释放；progress 可为空）
+	/// @note 绑定在线程上时先用 SetThreadProgress(NULL) 解除绑定
+	PDUDLL_API void DestroyProgress(EncodeProgress* progress);
+
+	/// @brief 把进度对象绑定到调用线程，之后该线程上的文件加解密以及从该线程提交的异步操作都更新它
+	/// @param progress 进度对象，为空表示解除绑定
+	/// @return 之前绑定的进度对象
+	PDUDLL_API EncodeProgress* SetThreadProgress(EncodeProgress* progress);
+
+	// ========== 异步文件加解密 ==========
+
+	// 以下函数复制参数后立即返回，文件在库的工作线程（进程线程池）上处理，完成时调用 completionCallback（可为空）。
+	// 结果与对应的同步函数相同；双密钥格式使用提交时的全局私钥。
+	// operation: 输出操作句柄，用于取消和等待，使用完毕后调用 CloseOperation（可以在操作完成前关闭）
+
+	PDUDLL_API int StreamEncryptFileAsync(const char* filePath, const char* outputPath, const unsigned char* publicKey, const EncodeOptions* options,
+		ProgressCallback progressCallback, CompletionCallback completionCallback, void* userData, EncodeOperation** operation);
+
+	PDUDLL_API int StreamDecryptFileAsync(const char* filePath, const char* outputPath, const unsigned char* publicKey,
+		ProgressCallback progressCallback, CompletionCallback completionCallback, void* userData, EncodeOperation** operation);
+
+	PDUDLL_API int SelfContainedEncryptFileAsync(const char* filePath, const char* outputPath, const unsigned char* publicKey, const EncodeOptions* options,
+		ProgressCallback progressCallback, CompletionCallback completionCallback, void* userData, EncodeOperation** operation);
+
+	PDUDLL_API int SelfContainedDecryptFileAsync(const char* filePath, const char* outputPath, const unsigned char* publicKey,
+		ProgressCallback progressCallback, CompletionCallback completionCallback, void* userData, EncodeOperation** operation);
+
+	/// @brief 请求取消异步操作：在下一个数据块边界停止，删除不完整的输出文件，结果为 ERR_OPERATION_CANCELLED(-12)
+	/// @note 只是发出请求，立即返回；操作已完成时没有效果
+	PDUDLL_API int CancelOperation(EncodeOperation* operation);
+
+	/// @brief 等待异步操作完成
+	/// @param timeoutMilliseconds 最长等待时间（0表示只查询，INFINITE 表示一直等待）
+	/// @return 操作结果；超时返回 ERR_OPERATION_PENDING(-13)
+	/// @note 结果发布后先唤醒等待者再调用完成回调，因此返回时完成回调可能仍在执行；
+	///       完成回调中可以等待（立即返回结果）或关闭同一个操作
+	PDUDLL_API int WaitOperation(EncodeOperation* operation, unsigned int timeoutMilliseconds);
+
+	/// @brief 释放操作句柄（不等待、不取消，未完成的操作继续执行；operation 可为空）
+	PDUDLL_API void CloseOperation(EncodeOperation* operation);
+
+	// ========== 解密结果缓存（反复解密相同的内嵌数据） ==========
+
+	/// @brief 设置解密结果缓存的上限字节数（默认0，即不缓存），缩小时按 LRU 顺序淘汰
+	/// @note 缓存项占用明文、密文副本与公钥的大小之和，计入内存预算；预算不足时其它申请会按 LRU 顺序淘汰缓存项
+	PDUDLL_API void SetDecryptedBlobCacheLimit(size_t maxBytes);
+
+	/// @brief 解密内存中的加密数据（自动识别双密钥/自包含式格式），结果按密文内容与密钥身份缓存
+	/// @param blob 输出明文引用，使用完毕后调用 ReleaseDecryptedBlob
+	/// @param data 输出明文指针（只读，在 blob 释放前有效），length 输出明文大小
+	/// @return 0表示成功，负数表示错误码（与 StreamDecryptData / SelfContainedDecryptData 相同）
+	/// @note 命中时只增加引用计数，不复制、不解密；双密钥格式的结果与当前全局私钥绑定，更换私钥后自动移出缓存。
+	///       被淘汰的明文在最后一个引用释放时擦除
+	PDUDLL_API int AcquireDecryptedBlob(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, DecryptedBlob** blob, const unsigned char** data, size_t* length);
+
+	/// @brief 释放 AcquireDecryptedBlob 取得的引用（blob 可为空）
+	PDUDLL_API void ReleaseDecryptedBlob(DecryptedBlob* blob);
+
+	/// @brief 清空解密结果缓存（仍被引用的明文在释放时擦除）
+	PDUDLL_API void ClearDecryptedBlobCache();
+
+	/// @brief 取得解密结果缓存的统计（各参数可为空）
+	PDUDLL_API void GetDecryptedBlobCacheStats(size_t* cachedBytes, size_t* blobCount, unsigned long long* hits, unsigned long long* misses);
+
+	// ========== 调用者缓冲区 / 原地加解密（不分配输出内存） ==========
+
+	/// @brief 计算双密钥格式加密后的数据大小
+	PDUDLL_API size_t EncryptedSizeFor(size_t inputLength);
+
+	/// @brief 计算自包含式格式加密后的数据大小
+	PDUDLL_API size_t SelfContainedEncryptedSizeFor(size_t inputLength);
+
+	/// @brief 根据加密数据头计算解密后的明文大小（自动识别双密钥/自包含式格式）
+	/// @param plaintextLength 输出明文大小
+	/// @return 0表示成功，ERR_INVALID_HEADER(-5)表示无法识别的格式
+	PDUDLL_API int DecryptedSizeOf(const unsigned char* inputData, size_t inputLength, size_t* plaintextLength);
+
+	// 以下 Into 函数与对应的 StreamEncryptData 等函数输出完全一致，区别在于写入调用者提供的缓冲区。
+	// output: 输出缓冲区（调用者分配，大小由上面的 SizeFor/SizeOf 函数给出）
+	// outputCapacity: 输出缓冲区容量，不足时返回 ERR_BUFFER_TOO_SMALL(-9)
+	// outputLength: 实际写入的字节数
+
+	PDUDLL_API int StreamEncryptDataInto(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char* output, size_t outputCapacity, size_t* outputLength);
+
+	PDUDLL_API int StreamDecryptDataInto(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char* output, size_t outputCapacity, size_t* outputLength);
+
+	PDUDLL_API int SelfContainedEncryptDataInto(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char* output, size_t outputCapacity, size_t* outputLength);
+
+	PDUDLL_API int SelfContainedDecryptDataInto(const unsigned char* inputData, size_t inputLength, const unsigned char* publicKey, unsigned char* output, size_t outputCapacity, size_t* outputLength);
+
+	// 原地加密：buffer 前 dataLength 字节为明文，加密结果覆盖写入 buffer
+	// bufferCapacity 至少为 EncryptedSizeFor(dataLength) / SelfContainedEncryptedSizeFor(dataLength)
+	// 失败时 buffer 中的明文保持不变
+	PDUDLL_API int StreamEncryptDataInPlace(unsigned char* buffer, size_t bufferCapacity, size_t dataLength, const unsigned char* publicKey, size_t* outputLength);
+
+	PDUDLL_API int SelfContainedEncryptDataInPlace(unsigned char* buffer, size_t bufferCapacity, size_t dataLength, const unsigned char* publicKey, size_t* outputLength);
+
+	// 原地解密：buffer 中为完整加密数据，明文覆盖写入 buffer 起始处
+	PDUDLL_API int StreamDecryptDataInPlace(unsigned char* buffer, size_t bufferLength, const unsigned char* publicKey, size_t* outputLength);
+
+	PDUDLL_API int SelfContainedDecryptDataInPlace(unsigned char* buffer, size_t bufferLength, const unsigned char* publicKey, size_t* outputLength);
+
+	// ========== 目录树并行加解密（可中断续做） ==========
+
+	/// @brief 加密目录树：在输出根目录下创建相同的目录结构，每个文件加密到同名路径
+	/// @param inputRoot 输入根目录
+	/// @param outputRoot 输出根目录（不存在时创建；与输入根目录相同或互相包含时返回 ERR_INVALID_PARAMETER）
+	/// @param options 选项（可为空，默认双密钥格式、引擎0）
+	/// @param progressCallback 每完成一个文件调用一次（输入文件路径，1.0），在库的工作线程上调用，可为空
+	/// @param stats 输出统计（可为空，调用者设置 cbSize）
+	/// @return 0表示全部成功；某些文件失败时返回第一个失败文件的错误码，其余文件照常处理
+	/// @note 调用线程遍历目录树，同时由线程池处理已找到的文件。每完成一个文件在清单中记录一行
+	///       （相对路径、大小与修改时间），再次调用时跳过清单中已完成且未修改的文件，中断的运行从停下的地方继续。
+	///       清单第一行记录方向、格式、引擎与密钥校验值，与本次调用不一致（如换了公钥或引擎）时清单作废、全部重做；
+	///       需要全部重做时也可删除清单文件。符号链接与挂载点目录不进入
+	PDUDLL_API int EncryptDirectory(const char* inputRoot, const char* outputRoot, const unsigned char* publicKey, const EncodeDirectoryOptions* options = nullptr,
+		ProgressCallback progressCallback = nullptr, EncodeDirectoryStats* stats = nullptr);
+
+	/// @brief 解密目录树（每个文件自动识别双密钥/自包含式格式），参数与清单规则同 EncryptDirectory
+	PDUDLL_API int DecryptDirectory(const char* inputRoot, const char* outputRoot, const unsigned char* publicKey, const EncodeDirectoryOptions* options = nullptr,
+		ProgressCallback progressCallback = nullptr, EncodeDirectoryStats* stats = nullptr);
+
+	// ========== 可续做的大文件加解密（检查点） ==========
+
+	// 以下函数处理过程中每隔256MB把输出文件落盘，并在输出文件旁记录检查点（outputPath + ".checkpoint"：
+	// 已落盘的字节数、文件头状态、输入文件的大小与修改时间、密钥校验值）。
+	// 失败、取消或进程中断时保留输出文件与检查点，之后用相同参数再次调用即从最后一个检查点继续；
+	// 检查点与本次参数不符（输入被修改、换了密钥或引擎）时从头开始。成功后删除检查点。
+	// 可随机访问的引擎（引擎0）直接从检查点位置继续；AES-GCM 需要重新读入已完成的部分以恢复认证状态，但不再写出
+
+	/// @brief 可续做的双密钥格式文件加密（输出与 StreamEncryptFileEx 相同）
+	/// @param options 选项（可为空，使用引擎0）
+	/// @return 0表示成功，负数表示错误码
+	PDUDLL_API int ResumeEncryptFile(const char* filePath, const char* outputPath, const unsigned char* publicKey, const EncodeOptions* options, ProgressCallback progressCallback = nullptr);
+
+	/// @brief 可续做的文件解密（自动识别双密钥/自包含式格式，输出与 DecryptFileAny 相同）
+	/// @return 0表示成功，负数表示错误码
+	/// @note 认证标签校验失败时删除输出文件与检查点，返回 ERR_DECRYPTION_FAILED(-4)
+	PDUDLL_API int ResumeDecryptFile(const char* filePath, const char* outputPath, const unsigned char* publicKey, ProgressCallback progressCallback = nullptr);
+
 	// ========== 私钥提取函数 ==========
 	
 	// 从自包含式加密文件中提取私钥
@@ -0,0 +1,739 @@
+#pragma once
+
+// 加密库的仅头文件 C++ 层（需要 C++17）
+// 与 encode.h 中的 C 接口共用同一套变换内核与文件头格式：C 接口中引擎0的字节数组函数即由本层实现，
+// 两者生成的数据可以互相解密。本层不依赖加密库的导出函数，C++ 调用方包含本头文件即可在编译期
+// 选择密钥格式、输出方式和变换内核，热路径全部内联且不分配内存。
+//
+//   encode::Encoder<encode::StreamKey> encoder;
+//   if (encoder.Init(privateKey, publicKey) == encode::STATUS_SUCCESS) {
+//       encoder.Encrypt(plain, cipherSpan, &cipherLength);    // 写入调用者提供的缓冲区
+//   }
+//
+// 输入参数为 ByteView，可由指针 + 长度或任意连续字节容器（std::vector、std::array、std::string、
+// C++20 的 std::span 等）隐式构造。
+
+#include <stddef.h>
+#include <string.h>
+#include <emmintrin.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#define ENCODE_MAX_KEY_LENGTH 0x3FFFFFFF   // 单个密钥的最大长度（组合后仍在 int 范围内）
+
+namespace encode {
+
+// ========== 状态码（与 C 接口的错误码一致） ==========
+
+enum Status {
+	STATUS_SUCCESS = 0,                    // 执行成功
+	STATUS_MEMORY_ALLOCATION_FAILED = -2,  // 内存分配失败
+	STATUS_DECRYPTION_FAILED = -4,         // 密钥不匹配或校验和错误
+	STATUS_INVALID_HEADER = -5,            // 数据头无效
+	STATUS_INVALID_PARAMETER = -7,         // 无效参数
+	STATUS_PRIVATE_KEY_NOT_SET = -8,       // 未初始化密钥（或自包含格式只初始化了解密）
+	STATUS_BUFFER_TOO_SMALL = -9           // 调用者提供的缓冲区不足
+};
+
+// ========== 字节区间 ==========
+
+namespace detail {
+
+// 连续字节容器：提供 data() 与 size()，元素为单字节
+template <class Container, class = void>
+struct IsByteContainer : std::false_type {};
+
+template <class Container>
+struct IsByteContainer<Container, std::void_t<decltype(std::declval<Container&>().data()), decltype(std::declval<Container&>().size())>>
+	: std::bool_constant<std::is_pointer<decltype(std::declval<Container&>().data())>::value &&
+		sizeof(*std::declval<Container&>().data()) == 1> {};
+
+} // namespace detail
+
+// 只读字节区间（不持有内存）
+class ByteView {
+public:
+	constexpr ByteView() noexcept : data_(nullptr), size_(0) {}
+	constexpr ByteView(const unsigned char* data, size_t size) noexcept : data_(data), size_(size) {}
+
+	// 以0结尾的字符串（如公钥），不含结尾的0
+	ByteView(const char* text) noexcept : data_((const unsigned char*)text), size_(text ? strlen(text) : 0) {}
+	ByteView(const unsigned char* text) noexcept : ByteView((const char*)text) {}
+
+	template <class Container, class = std::enable_if_t<detail::IsByteContainer<const Container>::value>>
+	ByteView(const Container& container) noexcept
+		: data_((const unsigned char*)container.data()), size_(container.size()) {}
+
+	constexpr const unsigned char* data() const noexcept { return data_; }
+	constexpr size_t size() const noexcept { return size_; }
+	constexpr bool empty() const noexcept { return size_ == 0; }
+
+private:
+	const unsigned char* data_;
+	size_t size_;
+};
+
+// 可写字节区间（不持有内存）
+class MutableByteView {
+public:
+	constexpr MutableByteView() noexcept : data_(nullptr), size_(0) {}
+	constexpr MutableByteView(unsigned char* data, size_t size) noexcept : data_(data), size_(size) {}
+
+	template <class Container, class = std::enable_if_t<detail::IsByteContainer<Container>::value &&
+		!std::is_const<std::remove_pointer_t<decltype(std::declval<Container&>().data())>>::value>>
+	MutableByteView(Container& container) noexcept
+		: data_((unsigned char*)container.data()), size_(container.size()) {}
+
+	constexpr unsigned char* data() const noexcept { return data_; }
+	constexpr size_t size() const noexcept { return size_; }
+	constexpr bool empty() const noexcept { return size_ == 0; }
+	constexpr operator ByteView() const noexcept { return ByteView(data_, size_); }
+
+private:
+	unsigned char* data_;
+	size_t size_;
+};
+
+// ========== 格式与校验算法 ==========
+
+namespace detail {
+
+// 擦除内存（不会被编译器优化掉）
+inline void SecureWipe(void* memory, size_t size) noexcept {
+	volatile unsigned char* p = (volatile unsigned char*)memory;
+	while (size--) {
+		*p++ = 0;
+	}
+}
+
+// CRC32校验和（与 CalculateCRC32 一致）
+inline unsigned int Crc32(const unsigned char* data, size_t length) noexcept {
+	static const unsigned int crc_table[256] = {
+		0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
+		0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
+		0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
+		0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+		0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9,
+		0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
+		0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C,
+		0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+		0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
+		0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
+		0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D, 0x76DC4190, 0x01DB7106,
+		0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+		0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D,
+		0x91646C97, 0xE6635C01, 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
+		0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
+		0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+		0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7,
+		0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
+		0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA,
+		0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+		0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
+		0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
+		0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683, 0xE3630B12, 0x94643B84,
+		0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+		0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB,
+		0x196C3671, 0x6E6B06E7, 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
+		0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
+		0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+		0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55,
+		0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
+		0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28,
+		0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+		0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
+		0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
+		0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242,
+		0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+		0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69,
+		0x616BFFD3, 0x166CCF45, 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
+		0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
+		0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+		0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693,
+		0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
+		0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
+	};
+
+	unsigned int crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < length; i++) {
+		crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return crc ^ 0xFFFFFFFF;
+}
+
+// 公钥哈希（与 CalculatePublicKeyHash 一致，长度为0时返回0）
+inline unsigned int PublicKeyHash(const unsigned char* publicKey, size_t keyLen) noexcept {
+	if (!publicKey || keyLen == 0) return 0;
+
+	unsigned int hash1 = Crc32(publicKey, keyLen);
+	unsigned int hash2 = 0;
+
+	for (size_t i = 0; i < keyLen; i++) {
+		hash2 = ((hash2 << 5) + hash2) + publicKey[i];
+		hash2 ^= (hash2 >> 11);
+		hash2 += (hash2 << 3);
+		hash2 ^= (hash2 >> 5);
+		hash2 += (hash2 << 2);
+		hash2 ^= (hash2 >> 15);
+		hash2 += (hash2 << 10);
+	}
+
+	return hash1 ^ hash2;
+}
+
+// 私钥哈希（与 CalculatePrivateKeyHash 一致）
+inline unsigned int PrivateKeyHash(const unsigned char* privateKey, int keyLength) noexcept {
+	if (!privateKey || keyLength <= 0) return 0;
+
+	unsigned int hash1 = Crc32(privateKey, keyLength);
+	unsigned int hash2 = 0;
+
+	for (int i = 0; i < keyLength; i++) {
+		hash2 = ((hash2 << 7) + hash2) + privateKey[i];
+		hash2 ^= (hash2 >> 13);
+		hash2 += (hash2 << 5);
+		hash2 ^= (hash2 >> 7);
+		hash2 += (hash2 << 3);
+		hash2 ^= (hash2 >> 17);
+		hash2 += (hash2 << 11);
+	}
+
+	return hash1 ^ hash2 ^ 0xABCDEF01;
+}
+
+// 交错组合私钥和公钥，写入 combinedKey（privateKeyLength + pubKeyLen 字节）
+inline void InterleaveKeys(unsigned char* combinedKey, const unsigned char* privateKey, int privateKeyLength, const unsigned char* publicKey, int pubKeyLen) noexcept {
+	int totalLen = privateKeyLength + pubKeyLen;
+
+	for (int i = 0; i < totalLen; i++) {
+		if (i % 2 == 0) {
+			// 偶数位置使用私钥
+			combinedKey[i] = privateKey[i / 2 % privateKeyLength];
+		}
+		else {
+			// 奇数位置使用公钥
+			combinedKey[i] = publicKey[i / 2 % pubKeyLen];
+		}
+		// 应用位运算增强混合效果
+		combinedKey[i] ^= (unsigned char)(i * 7 + 13);
+	}
+}
+
+} // namespace detail
+
+// ========== 变换内核（KernelPolicy） ==========
+
+// 内核要求组合密钥之后追加 KeyPadding 字节的循环重复（由 Encoder 在初始化时准备）
+
+// 逐字节内核：双层XOR + 半字节交换（自逆操作，加密与解密共用）
+// position: 本段数据在整个数据区中的起始偏移，密钥索引按全局位置计算
+// output 可以等于 input，也可以位于 input 之前
+struct ScalarKernel {
+	static constexpr size_t KeyPadding = 0;
+
+	static void Transform(unsigned char* output, const unsigned char* input, size_t length, const unsigned char* key, int keyLength, long long position) noexcept {
+		size_t keyIndex = (size_t)(position % keyLength);
+
+		for (size_t i = 0; i < length; i++) {
+			unsigned char keyByte = key[keyIndex];
+			unsigned char a2 = input[i] ^ keyByte;                             // 第一次XOR
+			unsigned char a3 = (unsigned char)((a2 << 4) | (a2 >> 4));         // 半字节交换
+			output[i] = a3 ^ keyByte;                                          // 第二次XOR
+
+			if (++keyIndex == (size_t)keyLength) {
+				keyIndex = 0;
+			}
+		}
+	}
+};
+
+// SSE2 内核：每次变换16字节，结果与逐字节内核一致
+struct Sse2Kernel {
+	static constexpr size_t KeyPadding = 16;
+
+	// 16字节并行变换
+	static __m128i TransformBlock(__m128i data, __m128i key) noexcept {
+		__m128i value = _mm_xor_si128(data, key);
+		__m128i high = _mm_and_si128(_mm_slli_epi16(value, 4), _mm_set1_epi8((char)0xF0));
+		__m128i low = _mm_and_si128(_mm_srli_epi16(value, 4), _mm_set1_epi8(0x0F));
+		return _mm_xor_si128(_mm_or_si128(high, low), key);
+	}
+
+	// extendedKey: 组合密钥后追加 KeyPadding 字节的循环重复，任意位置都可以直接加载16字节密钥流
+	static void Transform(unsigned char* output, const unsigned char* input, size_t length, const unsigned char* extendedKey, int keyLength, long long position) noexcept {
+		size_t keyIndex = (size_t)(position % keyLength);
+		size_t i = 0;
+
+		for (; i + KeyPadding <= length; i += KeyPadding) {
+			__m128i key = _mm_loadu_si128((const __m128i*)(extendedKey + keyIndex));
+			__m128i data = _mm_loadu_si128((const __m128i*)(input + i));
+			_mm_storeu_si128((__m128i*)(output + i), TransformBlock(data, key));
+
+			keyIndex += KeyPadding;
+			if (keyIndex >= (size_t)keyLength) {
+				keyIndex %= keyLength;
+			}
+		}
+
+		ScalarKernel::Transform(output + i, input + i, length - i, extendedKey, keyLength, keyIndex);
+	}
+};
+
+// ========== 密钥内存 ==========
+
+// 默认的密钥内存分配器：普通堆内存，释放前擦除
+// 自定义分配器提供同名的两个静态函数即可（加密库内部使用锁定的安全内存区）
+struct HeapKeyAllocator {
+	static unsigned char* Allocate(size_t size) noexcept {
+		return new (std::nothrow) unsigned char[size];
+	}
+
+	static void Free(unsigned char* memory, size_t size) noexcept {
+		detail::SecureWipe(memory, size);
+		delete[] memory;
+	}
+};
+
+// 持有所有权的密钥缓冲区：只能移动，析构时擦除并释放
+template <class Allocator>
+class KeyBuffer {
+public:
+	KeyBuffer() noexcept : data_(nullptr), size_(0) {}
+	KeyBuffer(KeyBuffer&& other) noexcept : data_(other.data_), size_(other.size_) {
+		other.data_ = nullptr;
+		other.size_ = 0;
+	}
+	KeyBuffer& operator=(KeyBuffer&& other) noexcept {
+		if (this != &other) {
+			Reset();
+			std::swap(data_, other.data_);
+			std::swap(size_, other.size_);
+		}
+		return *this;
+	}
+	KeyBuffer(const KeyBuffer&) = delete;
+	KeyBuffer& operator=(const KeyBuffer&) = delete;
+	~KeyBuffer() { Reset(); }
+
+	bool Allocate(size_t size) noexcept {
+		Reset();
+		data_ = Allocator::Allocate(size);
+		size_ = data_ ? size : 0;
+		return data_ != nullptr;
+	}
+
+	void Reset() noexcept {
+		if (data_) {
+			Allocator::Free(data_, size_);
+			data_ = nullptr;
+			size_ = 0;
+		}
+	}
+
+	unsigned char* data() const noexcept { return data_; }
+	size_t size() const noexcept { return size_; }
+
+private:
+	unsigned char* data_;
+	size_t size_;
+};
+
+// 一组已准备好的密钥材料
+template <class Allocator>
+struct KeyState {
+	KeyBuffer<Allocator> combinedKey;      // 组合密钥，其后为内核所需的循环填充
+	int combinedKeyLength = 0;
+	unsigned int checksum = 0;             // 组合密钥的CRC32（写在数据末尾）
+	unsigned int publicKeyHash = 0;
+	KeyBuffer<Allocator> privateKey;       // 自包含格式：写入数据头的私钥
+	KeyBuffer<Allocator> publicKey;        // 自包含格式：解密时与数据头中的私钥重新组合
+};
+
+namespace detail {
+
+// 组合密钥并追加内核所需的循环填充，同时计算校验和
+template <class Kernel, class Allocator>
+int BuildCombinedKey(KeyState<Allocator>& state, ByteView privateKey, ByteView publicKey) noexcept {
+	int privateKeyLength = (int)privateKey.size();
+	int pubKeyLen = (int)publicKey.size();
+	int totalLen = privateKeyLength + pubKeyLen;
+
+	if (!state.combinedKey.Allocate((size_t)totalLen + Kernel::KeyPadding)) {
+		return STATUS_MEMORY_ALLOCATION_FAILED;
+	}
+
+	unsigned char* key = state.combinedKey.data();
+	InterleaveKeys(key, privateKey.data(), privateKeyLength, publicKey.data(), pubKeyLen);
+	for (size_t i = 0; i < Kernel::KeyPadding; i++) {
+		key[totalLen + i] = key[i % totalLen];
+	}
+
+	state.combinedKeyLength = totalLen;
+	state.checksum = Crc32(key, totalLen);
+	return STATUS_SUCCESS;
+}
+
+// 复制一份密钥到 buffer
+template <class Allocator>
+bool CopyKey(KeyBuffer<Allocator>& buffer, ByteView key) noexcept {
+	if (!buffer.Allocate(key.size())) {
+		return false;
+	}
+	memcpy(buffer.data(), key.data(), key.size());
+	return true;
+}
+
+} // namespace detail
+
+// ========== 密钥格式（KeyPolicy） ==========
+
+// 双密钥格式（与 StreamEncryptData 系列一致）：
+// 魔数头 "ENCV1.0" + 组合密钥长度 + 公钥哈希 + 数据 + CRC32校验和
+// 私钥由调用方保存，加密和解密都需要同一对密钥
+struct StreamKey {
+	static constexpr size_t HeaderSize = 7 + sizeof(int) + sizeof(unsigned int);
+
+	template <class Kernel, class Allocator>
+	static int Init(KeyState<Allocator>& state, ByteView privateKey, ByteView publicKey) noexcept {
+		if (privateKey.empty() || publicKey.empty()) {
+			return STATUS_INVALID_PARAMETER;
+		}
+
+		state.publicKeyHash = detail::PublicKeyHash(publicKey.data(), publicKey.size());
+		return detail::BuildCombinedKey<Kernel>(state, privateKey, publicKey);
+	}
+
+	static bool MatchMagic(const unsigned char* header) noexcept {
+		return memcmp(header, "ENCV1.0", 7) == 0;
+	}
+
+	template <class Allocator>
+	static void WriteHeader(unsigned char* header, const KeyState<Allocator>& state) noexcept {
+		memcpy(header, "ENCV1.0", 7);
+		memcpy(header + 7, &state.combinedKeyLength, sizeof(int));
+		memcpy(header + 7 + sizeof(int), &state.publicKeyHash, sizeof(unsigned int));
+	}
+
+	// 校验数据头中的密钥信息，key 指向用于解密的密钥材料（直接使用 state，不需要临时密钥材料）
+	template <class Kernel, class Allocator>
+	static int OpenKey(const unsigned char* header, const KeyState<Allocator>& state, KeyState<Allocator>& /*scratch*/, const KeyState<Allocator>** key) noexcept {
+		int storedKeyLength;
+		unsigned int storedPublicKeyHash;
+		memcpy(&storedKeyLength, header + 7, sizeof(int));
+		memcpy(&storedPublicKeyHash, header + 7 + sizeof(int), sizeof(unsigned int));
+
+		if (!state.combinedKey.data()) {
+			return STATUS_PRIVATE_KEY_NOT_SET;
+		}
+		if (storedPublicKeyHash != state.publicKeyHash || storedKeyLength != state.combinedKeyLength) {
+			return STATUS_DECRYPTION_FAILED;
+		}
+
+		*key = &state;
+		return STATUS_SUCCESS;
+	}
+};
+
+// 自包含格式（与 SelfContainedEncryptData 系列一致）：
+// 魔数头 "SELFV1.0" + 组合密钥长度 + 公钥哈希 + 私钥长度 + 私钥（256字节）+ 私钥哈希 + 数据 + CRC32校验和
+// 加密时使用调用方提供的私钥并写入数据头；解密只需要公钥
+struct SelfContainedKey {
+	static constexpr size_t PrivateKeySize = 256;
+	static constexpr size_t HeaderSize = 8 + sizeof(int) + sizeof(unsigned int) + sizeof(int) + PrivateKeySize + sizeof(unsigned int);
+
+	// privateKey 为空时只能解密
+	template <class Kernel, class Allocator>
+	static int Init(KeyState<Allocator>& state, ByteView privateKey, ByteView publicKey) noexcept {
+		if (publicKey.empty() || (!privateKey.empty() && privateKey.size() != PrivateKeySize)) {
+			return STATUS_INVALID_PARAMETER;
+		}
+
+		if (!detail::CopyKey(state.publicKey, publicKey)) {
+			return STATUS_MEMORY_ALLOCATION_FAILED;
+		}
+		state.publicKeyHash = detail::PublicKeyHash(publicKey.data(), publicKey.size());
+
+		if (privateKey.empty()) {
+			return STATUS_SUCCESS;
+		}
+
+		if (!detail::CopyKey(state.privateKey, privateKey)) {
+			return STATUS_MEMORY_ALLOCATION_FAILED;
+		}
+		return detail::BuildCombinedKey<Kernel>(state, privateKey, publicKey);
+	}
+
+	static bool MatchMagic(const unsigned char* header) noexcept {
+		return memcmp(header, "SELFV1.0", 8) == 0;
+	}
+
+	template <class Allocator>
+	static void WriteHeader(unsigned char* header, const KeyState<Allocator>& state) noexcept {
+		int privateKeyLength = (int)PrivateKeySize;
+		unsigned int privateKeyHash = detail::PrivateKeyHash(state.privateKey.data(), privateKeyLength);
+
+		memcpy(header, "SELFV1.0", 8);
+		header += 8;
+		memcpy(header, &state.combinedKeyLength, sizeof(int));
+		header += sizeof(int);
+		memcpy(header, &state.publicKeyHash, sizeof(unsigned int));
+		header += sizeof(unsigned int);
+		memcpy(header, &privateKeyLength, sizeof(int));
+		header += sizeof(int);
+		memcpy(header, state.privateKey.data(), PrivateKeySize);
+		header += PrivateKeySize;
+		memcpy(header, &privateKeyHash, sizeof(unsigned int));
+	}
+
+	// 校验数据头并用其中的私钥与公钥重新组合密钥（写入 scratch）
+	// 原地解密会覆盖数据头，私钥在变换开始前已复制到 scratch 中
+	template <class Kernel, class Allocator>
+	static int OpenKey(const unsigned char* header, const KeyState<Allocator>& state, KeyState<Allocator>& scratch, const KeyState<Allocator>** key) noexcept {
+		int storedCombinedKeyLength;
+		unsigned int storedPublicKeyHash;
+		int privateKeyLength;
+		unsigned int storedPrivateKeyHash;
+		const unsigned char* privateKey = header + 8 + sizeof(int) + sizeof(unsigned int) + sizeof(int);
+
+		memcpy(&storedCombinedKeyLength, header + 8, sizeof(int));
+		memcpy(&storedPublicKeyHash, header + 8 + sizeof(int), sizeof(unsigned int));
+		memcpy(&privateKeyLength, header + 8 + sizeof(int) + sizeof(unsigned int), sizeof(int));
+		memcpy(&storedPrivateKeyHash, privateKey + PrivateKeySize, sizeof(unsigned int));
+
+		if (!state.publicKey.data()) {
+			return STATUS_PRIVATE_KEY_NOT_SET;
+		}
+		if (storedPublicKeyHash != state.publicKeyHash || privateKeyLength != (int)PrivateKeySize ||
+			storedPrivateKeyHash != detail::PrivateKeyHash(privateKey, privateKeyLength)) {
+			return STATUS_DECRYPTION_FAILED;
+		}
+
+		int result = detail::BuildCombinedKey<Kernel>(scratch, ByteView(privateKey, PrivateKeySize), ByteView(state.publicKey.data(), state.publicKey.size()));
+		if (result != STATUS_SUCCESS) {
+			return result;
+		}
+		if (storedCombinedKeyLength != scratch.combinedKeyLength) {
+			return STATUS_DECRYPTION_FAILED;
+		}
+
+		*key = &scratch;
+		return STATUS_SUCCESS;
+	}
+};
+
+// ========== 输出方式（IoPolicy） ==========
+
+// 持有所有权的字节缓冲区：只能移动，析构时擦除并释放
+class Buffer {
+public:
+	Buffer() noexcept : data_(nullptr), size_(0) {}
+	Buffer(Buffer&& other) noexcept : data_(other.data_), size_(other.size_) {
+		other.data_ = nullptr;
+		other.size_ = 0;
+	}
+	Buffer& operator=(Buffer&& other) noexcept {
+		if (this != &other) {
+			Reset();
+			std::swap(data_, other.data_);
+			std::swap(size_, other.size_);
+		}
+		return *this;
+	}
+	Buffer(const Buffer&) = delete;
+	Buffer& operator=(const Buffer&) = delete;
+	~Buffer() { Reset(); }
+
+	// 重新分配 size 字节（原有内容被擦除），失败时返回 false
+	bool Allocate(size_t size) noexcept {
+		Reset();
+		data_ = new (std::nothrow) unsigned char[size ? size : 1];
+		size_ = data_ ? size : 0;
+		return data_ != nullptr;
+	}
+
+	void Reset() noexcept {
+		if (data_) {
+			detail::SecureWipe(data_, size_);
+			delete[] data_;
+			data_ = nullptr;
+			size_ = 0;
+		}
+	}
+
+	unsigned char* data() const noexcept { return data_; }
+	size_t size() const noexcept { return size_; }
+	bool empty() const noexcept { return size_ == 0; }
+	operator ByteView() const noexcept { return ByteView(data_, size_); }
+	operator MutableByteView() const noexcept { return MutableByteView(data_, size_); }
+
+private:
+	unsigned char* data_;
+	size_t size_;
+};
+
+// 写入调用者提供的缓冲区，不分配内存；容量不足时返回 STATUS_BUFFER_TOO_SMALL
+struct CallerBufferIo {
+	static unsigned char* Acquire(MutableByteView output, size_t size, int* status) noexcept {
+		if (!output.data() || output.size() < size) {
+			*status = STATUS_BUFFER_TOO_SMALL;
+			return nullptr;
+		}
+		return output.data();
+	}
+};
+
+// 写入新分配的 Buffer（大小恰好等于输出长度），原有内容被释放
+struct OwnedBufferIo {
+	static unsigned char* Acquire(Buffer& output, size_t size, int* status) noexcept {
+		if (!output.Allocate(size)) {
+			*status = STATUS_MEMORY_ALLOCATION_FAILED;
+			return nullptr;
+		}
+		return output.data();
+	}
+};
+
+// ========== 加解密器 ==========
+
+// KeyPolicy: StreamKey / SelfContainedKey
+// IoPolicy: CallerBufferIo（output 为 MutableByteView 或可写字节容器）/ OwnedBufferIo（output 为 Buffer）
+// KernelPolicy: Sse2Kernel / ScalarKernel
+// KeyAllocator: 组合密钥等密钥材料的内存来源
+//
+// Init 只执行一次（分配并组合密钥、计算校验和），之后 Encrypt / Decrypt / Transform 不分配内存
+// （OwnedBufferIo 的输出和自包含格式解密时的组合密钥除外），可以从多个线程同时调用。
+// 对象只能移动，析构时擦除密钥材料。
+template <class KeyPolicy, class IoPolicy = CallerBufferIo, class KernelPolicy = Sse2Kernel, class KeyAllocator = HeapKeyAllocator>
+class Encoder {
+public:
+	typedef KeyState<KeyAllocator> State;
+
+	static constexpr size_t HeaderSize = KeyPolicy::HeaderSize;
+	static constexpr size_t Overhead = KeyPolicy::HeaderSize + sizeof(unsigned int);
+
+	Encoder() noexcept = default;
+	Encoder(Encoder&&) noexcept = default;
+	Encoder& operator=(Encoder&&) noexcept = default;
+
+	// 准备密钥材料；publicKey 通常为以0结尾的字符串
+	// 自包含格式的 privateKey 可以为空（只能解密）
+	int Init(ByteView privateKey, ByteView publicKey) noexcept {
+		state_ = State();
+		if (privateKey.size() > ENCODE_MAX_KEY_LENGTH || publicKey.size() > ENCODE_MAX_KEY_LENGTH) {
+			return STATUS_INVALID_PARAMETER;
+		}
+
+		int result = KeyPolicy::template Init<KernelPolicy>(state_, privateKey, publicKey);
+		if (result != STATUS_SUCCESS) {
+			state_ = State();
+		}
+		return result;
+	}
+
+	// 加密后的数据大小
+	static constexpr size_t EncryptedSize(size_t plaintextLength) noexcept {
+		return plaintextLength + Overhead;
+	}
+
+	// 加密 input 并写入 output（数据头 + 密文 + 校验和）
+	// CallerBufferIo 时 input 可以位于 output.data() + HeaderSize 处（原地加密）
+	template <class Output>
+	int Encrypt(ByteView input, Output&& output, size_t* outputLength) const noexcept {
+		if (!outputLength) {
+			return STATUS_INVALID_PARAMETER;
+		}
+		*outputLength = 0;
+
+		if (!input.data() || input.empty() || input.size() > (size_t)-1 - Overhead) {
+			return STATUS_INVALID_PARAMETER;
+		}
+		if (!state_.combinedKey.data()) {
+			return STATUS_PRIVATE_KEY_NOT_SET;
+		}
+
+		int result = STATUS_SUCCESS;
+		size_t outputSize = EncryptedSize(input.size());
+		unsigned char* out = IoPolicy::Acquire(output, outputSize, &result);
+		if (!out) {
+			return result;
+		}
+
+		KeyPolicy::WriteHeader(out, state_);
+		TransformWith(state_, out + HeaderSize, input.data(), input.size(), 0);
+		memcpy(out + HeaderSize + input.size(), &state_.checksum, sizeof(unsigned int));
+
+		*outputLength = outputSize;
+		return STATUS_SUCCESS;
+	}
+
+	// 校验并解密 input，明文写入 output
+	// CallerBufferIo 时 output 可以与 input 起始于同一位置（原地解密，明文移动到缓冲区起始处）
+	template <class Output>
+	int Decrypt(ByteView input, Output&& output, size_t* outputLength) const noexcept {
+		if (!outputLength) {
+			return STATUS_INVALID_PARAMETER;
+		}
+		*outputLength = 0;
+
+		if (!input.data() || input.empty()) {
+			return STATUS_INVALID_PARAMETER;
+		}
+		if (input.size() < Overhead || !KeyPolicy::MatchMagic(input.data())) {
+			return STATUS_INVALID_HEADER;
+		}
+
+		State scratch;
+		const State* key = nullptr;
+		int result = KeyPolicy::template OpenKey<KernelPolicy>(input.data(), state_, scratch, &key);
+		if (result != STATUS_SUCCESS) {
+			return result;
+		}
+
+		// 验证校验和（从末尾读取）
+		unsigned int storedChecksum;
+		memcpy(&storedChecksum, input.data() + input.size() - sizeof(unsigned int), sizeof(unsigned int));
+		if (storedChecksum != key->checksum) {
+			return STATUS_DECRYPTION_FAILED;
+		}
+
+		size_t dataSize = input.size() - Overhead;
+		unsigned char* out = IoPolicy::Acquire(output, dataSize, &result);
+		if (!out) {
+			return result;
+		}
+
+		TransformWith(*key, out, input.data() + HeaderSize, dataSize, 0);
+
+		*outputLength = dataSize;
+		return STATUS_SUCCESS;
+	}
+
+	// 按数据区偏移 position 直接变换（不含数据头与校验和，加密与解密相同），可按任意偏移调用
+	// 需在 Init 成功（IsReady 为真）后调用
+	void Transform(unsigned char* output, const unsigned char* input, size_t length, long long position) const noexcept {
+		TransformWith(state_, output, input, length, position);
+	}
+
+	// 写入数据头（HeaderSize 字节）；与 Transform、Checksum 配合实现分段或增量加密
+	void WriteHeader(unsigned char* header) const noexcept {
+		KeyPolicy::WriteHeader(header, state_);
+	}
+
+	bool IsReady() const noexcept { return state_.combinedKey.data() != nullptr; }
+	int CombinedKeyLength() const noexcept { return state_.combinedKeyLength; }
+	unsigned int PublicKeyHash() const noexcept { return state_.publicKeyHash; }
+	unsigned int Checksum() const noexcept { return state_.checksum; }           // 写在数据末尾的校验和
+
+	// 组合密钥及其后 KernelPolicy::KeyPadding 字节的循环填充，供多缓冲区等外部内核直接使用
+	const unsigned char* KeyMaterial() const noexcept { return state_.combinedKey.data(); }
+
+private:
+	static void TransformWith(const State& key, unsigned char* output, const unsigned char* input, size_t length, long long position) noexcept {
+		KernelPolicy::Transform(output, input, length, key.combinedKey.data(), key.combinedKeyLength, position);
+	}
+
+	State state_;
+};
+
+} // namespace encode
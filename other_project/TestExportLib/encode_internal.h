@@ -0,0 +1,57 @@
+#pragma once
+
+// 加密库内部接口（不导出），供 encode.cpp 与各加密引擎模块共用
+
+// ========== 加密引擎接口 ==========
+
+// 每个引擎用组合密钥初始化一个数据流状态，按数据区偏移顺序变换数据，结束时生成或校验尾部数据。
+// 引擎标识记录在加密文件头中（引擎0沿用 V1.0 文件头），解密时按文件头选择引擎。
+
+#define CIPHER_ENGINE_MAX_HEADER 32        // 引擎参数（写在文件头中）的最大字节数
+#define CIPHER_ENGINE_MAX_TRAILER 32       // 引擎尾部数据（写在CRC32校验和之前）的最大字节数
+
+struct CipherEngine {
+	int id;                                // 引擎标识（0-255，写入文件头）
+	const char* name;                      // 引擎名称
+	size_t contextSize;                    // 每个数据流的状态大小（由调用方从密钥材料安全内存区分配）
+	size_t headerSize;                     // 引擎参数大小（加密时由调用方预先填充随机数）
+	size_t trailerSize;                    // 尾部数据大小（如认证标签）
+
+	// 初始化数据流状态；engineHeader 为 headerSize 字节的引擎参数，encrypt 非0表示加密方向
+	// 返回0表示成功
+	int (*init)(void* context, const unsigned char* key, int keyLength, const unsigned char* engineHeader, int encrypt);
+
+	// 变换数据区偏移 position 处的 length 字节，必须按偏移顺序调用
+	// output 可以等于 input，也可以位于 input 之前
+	void (*transform)(void* context, unsigned char* output, const unsigned char* input, size_t length, __int64 position);
+
+	// 结束数据流：加密时写出 trailerSize 字节尾部数据，解密时校验尾部数据
+	// 返回0表示成功
+	int (*finalize)(void* context, unsigned char* trailer);
+
+	// 擦除并释放 init 中取得的资源（context 本身由调用方释放）
+	void (*cleanup)(void* context);
+
+	// 随机访问变换：可按任意偏移、从多个线程同时调用，不修改 context，也不参与尾部数据的计算
+	// 不支持随机访问的引擎为空
+	void (*transformAt)(void* context, unsigned char* output, const unsigned char* input, size_t length, __int64 position);
+
+	// 已知答案自检，首次查找引擎时运行一次，未通过的引擎视为未注册；返回0表示通过
+	// 无需自检的引擎为空
+	int (*selfTest)();
+
+	// 单个数据流的明文上限（0表示不限制）；调用方在写出任何数据前检查已知的数据量，
+	// 数据量事先未知或在处理中增长时由引擎自己拒绝超出的部分，finalize 返回失败
+	unsigned long long maxDataLength;
+};
+
+// 按引擎标识查找已注册的引擎，未注册或自检未通过时返回空
+const CipherEngine* FindCipherEngine(int engineId);
+
+// 各模块实现的引擎
+extern const CipherEngine g_aesGcmEngine;             // aes_gcm.cpp
+
+// ========== 模块生命周期 ==========
+
+// DLL 卸载时释放每线程状态使用的 FLS 槽位（dllmain.cpp 在 DLL_PROCESS_DETACH 时调用）
+void ReleaseFiberLocalSlots();